@@ -1,74 +1,367 @@
 #include <mpi.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-double calcProduct(double* m1,double* m2, int size, int idx){
-    int row = idx / size; 
-    int col = idx % size;
-    double val = 0;
-    for (int i = 0;i<size;i++){
-        val+= m1[size*row+i] * m2[size*i+col];
+#include "../common/counter_rng.h"
+
+#define ORDER        8    // order of the matrices multiplied when none is given
+#define MAX_PRINTED  16   // larger results are checked but not printed
+#define PANEL        64   // most columns of A / rows of B broadcast per SUMMA step
+#define TILE_ROWS    32   // rows of C updated per tile of the local multiply
+#define TILE_DEPTH   128  // rows of B per tile, TILE_DEPTH x TILE_COLUMNS doubles stay in L2
+#define TILE_COLUMNS 256  // columns of C and B per tile
+#define SAMPLES      8    // elements of C each process checks against a plain dot product
+#define REPEATS      3    // benchmark runs per order and rank count, the best one is reported
+#define MAX_ORDERS   16   // most orders of a benchmark
+
+// processes laid out as a grid, with the communicators of their grid row and grid column
+typedef struct
+{
+    MPI_Comm comm;
+    MPI_Comm rowComm;    // ranked by grid column
+    MPI_Comm columnComm; // ranked by grid row
+    int dims[2];
+    int row, column;
+} Grid;
+
+// first index given to part i when n indices are split as evenly as possible, the larger parts first
+static int blockStart(int n, int parts, int i)
+{
+    return i * (n / parts) + (i < n % parts ? i : n % parts);
+}
+
+// part which index k falls into
+static int blockOwner(int n, int parts, int k)
+{
+    int q = n / parts, r = n % parts;
+
+    return k < r * (q + 1) ? k / (q + 1) : r + (k - r * (q + 1)) / q;
+}
+
+// element (i, j) of matrix m (0 or 1) of order n, the same wherever it is computed
+static double element(unsigned long long seed, int n, int m, int i, int j)
+{
+    return counter_rng_below(seed, ((unsigned long long)m * n + i) * n + j, 100);
+}
+
+static void createGrid(MPI_Comm comm, Grid *grid)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // as square a grid as the process count allows, ranks laid out row by row
+    grid->comm = comm;
+    grid->dims[0] = grid->dims[1] = 0;
+    MPI_Dims_create(size, 2, grid->dims);
+    grid->row = rank / grid->dims[1];
+    grid->column = rank % grid->dims[1];
+    MPI_Comm_split(comm, grid->row, grid->column, &grid->rowComm);
+    MPI_Comm_split(comm, grid->column, grid->row, &grid->columnComm);
+}
+
+static void freeGrid(Grid *grid)
+{
+    MPI_Comm_free(&grid->rowComm);
+    MPI_Comm_free(&grid->columnComm);
+}
+
+// c += a * b, a being rows x depth, b depth x columns, tiled so that the tile of b in use stays in cache
+static void multiplyAdd(int rows, int columns, int depth, const double *restrict a, int lda, const double *restrict b,
+                        int ldb, double *restrict c, int ldc)
+{
+    for (int jj = 0; jj < columns; jj += TILE_COLUMNS)
+    {
+        int jEnd = jj + TILE_COLUMNS < columns ? jj + TILE_COLUMNS : columns;
+        for (int kk = 0; kk < depth; kk += TILE_DEPTH)
+        {
+            int kEnd = kk + TILE_DEPTH < depth ? kk + TILE_DEPTH : depth;
+            for (int ii = 0; ii < rows; ii += TILE_ROWS)
+            {
+                int iEnd = ii + TILE_ROWS < rows ? ii + TILE_ROWS : rows;
+                for (int i = ii; i < iEnd; i++)
+                    for (int k = kk; k < kEnd; k++)
+                    {
+                        double aik = a[i * lda + k];
+                        for (int j = jj; j < jEnd; j++)
+                            c[i * ldc + j] += aik * b[k * ldb + j];
+                    }
+            }
+        }
+    }
+}
+
+/*
+ * SUMMA: c = a * b for matrices of order n, each process holding the same block of rows by grid row and
+ * columns by grid column of all three, row-major. At every step the grid column owning the next columns of a
+ * broadcasts them along the grid rows, the grid row owning the same rows of b broadcasts them along the grid
+ * columns, and every process multiplies the two panels into its block of c. A step never crosses the boundary
+ * of a block, so orders that do not divide evenly over the grid need nothing special.
+ */
+static void summa(Grid *grid, int n, const double *a, const double *b, double *c)
+{
+    int rowStart = blockStart(n, grid->dims[0], grid->row);
+    int rows = blockStart(n, grid->dims[0], grid->row + 1) - rowStart;
+    int columnStart = blockStart(n, grid->dims[1], grid->column);
+    int columns = blockStart(n, grid->dims[1], grid->column + 1) - columnStart;
+
+    double *aPanel = malloc(sizeof(double) * (rows * PANEL > 0 ? rows * PANEL : 1));
+    double *bPanel = malloc(sizeof(double) * (PANEL * columns > 0 ? PANEL * columns : 1));
+    memset(c, 0, sizeof(double) * rows * columns);
+
+    int width;
+    for (int k = 0; k < n; k += width)
+    {
+        int aOwner = blockOwner(n, grid->dims[1], k);
+        int bOwner = blockOwner(n, grid->dims[0], k);
+        width = PANEL < n - k ? PANEL : n - k;
+        if (blockStart(n, grid->dims[1], aOwner + 1) - k < width)
+            width = blockStart(n, grid->dims[1], aOwner + 1) - k;
+        if (blockStart(n, grid->dims[0], bOwner + 1) - k < width)
+            width = blockStart(n, grid->dims[0], bOwner + 1) - k;
+
+        // the columns of a are packed, the rows of b are already contiguous and go out in place
+        if (grid->column == aOwner)
+            for (int i = 0; i < rows; i++)
+                memcpy(aPanel + i * width, a + i * columns + k - columnStart, sizeof(double) * width);
+        const double *bRows = grid->row == bOwner ? b + (k - rowStart) * columns : bPanel;
+        MPI_Bcast(aPanel, rows * width, MPI_DOUBLE, aOwner, grid->rowComm);
+        MPI_Bcast((double *)bRows, width * columns, MPI_DOUBLE, bOwner, grid->columnComm);
+
+        multiplyAdd(rows, columns, width, aPanel, width, bRows, columns, c, columns);
+    }
+
+    free(aPanel);
+    free(bPanel);
+}
+
+// fills the blocks of both matrices held by this process
+static void fillBlocks(Grid *grid, int n, unsigned long long seed, double *a, double *b)
+{
+    int rowStart = blockStart(n, grid->dims[0], grid->row);
+    int rows = blockStart(n, grid->dims[0], grid->row + 1) - rowStart;
+    int columnStart = blockStart(n, grid->dims[1], grid->column);
+    int columns = blockStart(n, grid->dims[1], grid->column + 1) - columnStart;
+
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < columns; j++)
+        {
+            a[i * columns + j] = element(seed, n, 0, rowStart + i, columnStart + j);
+            b[i * columns + j] = element(seed, n, 1, rowStart + i, columnStart + j);
+        }
+}
+
+// largest difference, over all processes, between sampled elements of c and their plain dot products
+static double checkSamples(Grid *grid, int n, unsigned long long seed, const double *c)
+{
+    int rowStart = blockStart(n, grid->dims[0], grid->row);
+    int rows = blockStart(n, grid->dims[0], grid->row + 1) - rowStart;
+    int columnStart = blockStart(n, grid->dims[1], grid->column);
+    int columns = blockStart(n, grid->dims[1], grid->column + 1) - columnStart;
+    double error = 0, maxError;
+
+    for (int s = 0; s < SAMPLES && rows * columns > 0; s++)
+    {
+        int i = counter_rng_below(~seed, 2 * s, rows);
+        int j = counter_rng_below(~seed, 2 * s + 1, columns);
+        double expected = 0;
+        for (int k = 0; k < n; k++)
+            expected += element(seed, n, 0, rowStart + i, k) * element(seed, n, 1, k, columnStart + j);
+        if (fabs(c[i * columns + j] - expected) > error)
+            error = fabs(c[i * columns + j] - expected);
     }
-    return val;
+    MPI_Reduce(&error, &maxError, 1, MPI_DOUBLE, MPI_MAX, 0, grid->comm);
+    return maxError;
+}
+
+// gathers the blocks of c into the whole matrix on rank 0 of the grid
+static void gatherResult(Grid *grid, int n, const double *c, double *result)
+{
+    int rank, size;
+    MPI_Comm_rank(grid->comm, &rank);
+    MPI_Comm_size(grid->comm, &size);
+    int rows = blockStart(n, grid->dims[0], grid->row + 1) - blockStart(n, grid->dims[0], grid->row);
+    int columns = blockStart(n, grid->dims[1], grid->column + 1) - blockStart(n, grid->dims[1], grid->column);
+
+    int *counts = NULL, *displacements = NULL;
+    double *blocks = NULL;
+    if (rank == 0)
+    {
+        counts = malloc(sizeof(int) * size);
+        displacements = malloc(sizeof(int) * size);
+        blocks = malloc(sizeof(double) * n * n);
+        for (int p = 0, offset = 0; p < size; p++)
+        {
+            int r = p / grid->dims[1], q = p % grid->dims[1];
+            counts[p] = (blockStart(n, grid->dims[0], r + 1) - blockStart(n, grid->dims[0], r)) *
+                        (blockStart(n, grid->dims[1], q + 1) - blockStart(n, grid->dims[1], q));
+            displacements[p] = offset;
+            offset += counts[p];
+        }
+    }
+    MPI_Gatherv(c, rows * columns, MPI_DOUBLE, blocks, counts, displacements, MPI_DOUBLE, 0, grid->comm);
+
+    if (rank == 0)
+    {
+        // each block arrives whole, its rows go back to their place in the matrix
+        for (int p = 0; p < size; p++)
+        {
+            int r = p / grid->dims[1], q = p % grid->dims[1];
+            int rowStart = blockStart(n, grid->dims[0], r);
+            int columnStart = blockStart(n, grid->dims[1], q);
+            int width = blockStart(n, grid->dims[1], q + 1) - columnStart;
+            for (int i = 0; i * width < counts[p]; i++)
+                memcpy(result + (rowStart + i) * n + columnStart, blocks + displacements[p] + i * width,
+                       sizeof(double) * width);
+        }
+        free(counts);
+        free(displacements);
+        free(blocks);
+    }
+}
+
+// multiplies two matrices of order n with all processes of the grid, returns the seconds taken by the slowest one
+static double multiply(Grid *grid, int n, unsigned long long seed, double **c)
+{
+    int rows = blockStart(n, grid->dims[0], grid->row + 1) - blockStart(n, grid->dims[0], grid->row);
+    int columns = blockStart(n, grid->dims[1], grid->column + 1) - blockStart(n, grid->dims[1], grid->column);
+    int count = rows * columns > 0 ? rows * columns : 1;
+    double *a = malloc(sizeof(double) * count);
+    double *b = malloc(sizeof(double) * count);
+    double seconds, slowest;
+
+    *c = malloc(sizeof(double) * count);
+    fillBlocks(grid, n, seed, a, b);
+
+    MPI_Barrier(grid->comm);
+    seconds = MPI_Wtime();
+    summa(grid, n, a, b, *c);
+    seconds = MPI_Wtime() - seconds;
+    MPI_Reduce(&seconds, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, grid->comm);
+
+    free(a);
+    free(b);
+    return slowest;
 }
 
+/*
+ * Benchmark: every order given is multiplied by 1, 2, 4, ... processes and by all of them, the best of REPEATS runs
+ * is reported in GFLOP/s (2 n^3 floating point operations per product).
+ */
+static void benchmark(int orderCount, int *orders)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (rank == 0)
+        printf("%6s %6s %8s %12s %10s %10s\n", "order", "ranks", "grid", "seconds", "GFLOP/s", "max error");
+    for (int o = 0; o < orderCount; o++)
+        for (int ranks = 1; ranks <= size; ranks = (ranks < size && 2 * ranks > size) ? size : 2 * ranks)
+        {
+            // the processes left out wait for the next run
+            MPI_Comm comm;
+            MPI_Comm_split(MPI_COMM_WORLD, rank < ranks ? 0 : MPI_UNDEFINED, rank, &comm);
+            if (comm != MPI_COMM_NULL)
+            {
+                Grid grid;
+                double best = 0, error = 0, *c;
+                createGrid(comm, &grid);
+                for (int r = 0; r < REPEATS; r++)
+                {
+                    double seconds = multiply(&grid, orders[o], RNG_DEFAULT_SEED, &c);
+                    if (r == 0 || seconds < best)
+                        best = seconds;
+                    if (r == REPEATS - 1)
+                        error = checkSamples(&grid, orders[o], RNG_DEFAULT_SEED, c);
+                    free(c);
+                }
+                if (rank == 0)
+                    printf("%6d %6d %4dx%-3d %12.6f %10.3f %10.2g\n", orders[o], ranks, grid.dims[0], grid.dims[1], best,
+                           2.0 * orders[o] * orders[o] * orders[o] / best * 1e-9, error);
+                freeGrid(&grid);
+                MPI_Comm_free(&comm);
+            }
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+}
 
+/*
+ * usage: matrix [seed [order]]     multiplies two random matrices, printing the result when it is small
+ *        matrix -b [order ...]     benchmark, 256 512 1000 by default
+ */
 int main(int argc, char *argv[])
 {
     int rank, size;
     int matrixSize;
-    double* matrix1; 
-    double* matrix2;
-    double* resultMatrix;
+    unsigned long long seed;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    srand((unsigned int)time(NULL));
-    matrixSize = 8;
-    matrix1 = malloc(sizeof(double) * matrixSize * matrixSize);
-    matrix2 = malloc(sizeof(double) * matrixSize * matrixSize);
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        int orders[MAX_ORDERS] = {256, 512, 1000}, orderCount = 3;
+        if (argc > 2)
+            for (orderCount = 0; orderCount < MAX_ORDERS && orderCount + 2 < argc; orderCount++)
+                if ((orders[orderCount] = atoi(argv[orderCount + 2])) <= 0)
+                {
+                    if (rank == 0)
+                        fprintf(stderr, "usage: %s [seed [order]] | -b [order ...]\n", argv[0]);
+                    MPI_Finalize();
+                    return EXIT_FAILURE;
+                }
+        benchmark(orderCount, orders);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
 
-    if (rank == 0)
+    // the matrices are reproducible from the seed given as first argument, rank 0 picks it otherwise
+    seed = argc > 1 ? strtoull(argv[1], NULL, 0) : (unsigned long long)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    matrixSize = argc > 2 ? atoi(argv[2]) : ORDER;
+    if (matrixSize <= 0)
     {
-        resultMatrix = malloc(sizeof(double) * matrixSize * matrixSize);
-        
-        for (int i = 0;i<matrixSize*matrixSize;i++){
-            matrix1[i] = rand()%100;
-            matrix2[i] = rand()%100;
-        }
+        if (rank == 0)
+            fprintf(stderr, "usage: %s [seed [order]] | -b [order ...]\n", argv[0]);
+        MPI_Finalize();
+        return EXIT_FAILURE;
     }
-    //init m1
-    MPI_Bcast(matrix1,matrixSize*matrixSize,MPI_DOUBLE,0,MPI_COMM_WORLD);
-    //init m2
-    MPI_Bcast(matrix2,matrixSize*matrixSize,MPI_DOUBLE,0,MPI_COMM_WORLD);
-
-
-
-
-    int count = (matrixSize* matrixSize) /size;
-    int floor =  count * rank;
-    int ceiling =  count * (rank+1);
-    double* localResults = malloc(sizeof(double) * count);
-    for (int i = floor;i<ceiling;i++){
-        localResults[i-floor] = calcProduct(matrix1,matrix2,matrixSize,i);
-    } 
-    MPI_Gather(localResults,count,MPI_DOUBLE,resultMatrix,count,MPI_DOUBLE,0,MPI_COMM_WORLD);
-    
-    if (rank==0){
-        printf("Here be the results:\n");
-        for (int i=0;i<matrixSize;i++){
-            for (int j=0;j<matrixSize;j++)
-                printf("%10.2f ",resultMatrix[i*matrixSize+j]);
-        printf("\n");
+
+    Grid grid;
+    double *localResults;
+    createGrid(MPI_COMM_WORLD, &grid);
+    if (rank == 0)
+        printf("Seed: %llu\n", seed);
+    double seconds = multiply(&grid, matrixSize, seed, &localResults);
+    double error = checkSamples(&grid, matrixSize, seed, localResults);
+
+    if (matrixSize <= MAX_PRINTED)
+    {
+        double *resultMatrix = rank == 0 ? malloc(sizeof(double) * matrixSize * matrixSize) : NULL;
+        gatherResult(&grid, matrixSize, localResults, resultMatrix);
+        if (rank == 0)
+        {
+            printf("Here be the results:\n");
+            for (int i = 0; i < matrixSize; i++)
+            {
+                for (int j = 0; j < matrixSize; j++)
+                    printf("%10.2f ", resultMatrix[i * matrixSize + j]);
+                printf("\n");
+            }
+            free(resultMatrix);
         }
-        free(resultMatrix);
     }
+    if (rank == 0)
+        printf("Order %d on a %dx%d grid: %.6f s, max error of the sampled elements %g\n", matrixSize, grid.dims[0],
+               grid.dims[1], seconds, error);
+
     free(localResults);
-    free(matrix1);
-    free(matrix2);
+    freeGrid(&grid);
     MPI_Finalize();
     return EXIT_SUCCESS;
 }
@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "../common/counter_rng.h"
+
 int main(int argc, char *argv[])
 {
     int rank, size;
@@ -19,16 +21,17 @@ int main(int argc, char *argv[])
 
     int rcount = size*size;
 
-    srand((unsigned int)time(NULL));
+    // the data is reproducible from the seed given as first argument
+    unsigned long long seed = argc > 1 ? strtoull(argv[1], NULL, 0) : (unsigned long long)time(NULL);
 
     
     if (rank == 0)
     {
         data = malloc(sizeof(int) * rcount);
         for (int i = 0; i < rcount; i++)
-            data[i] = rand();
+            data[i] = counter_rng_u32(seed, i) >> 1;
 
-        printf("generated data:\n");
+        printf("generated data (seed %llu):\n", seed);
 
         for (int i = 0; i < size; i++){
         for (int j = 0; j < size; j++)
@@ -0,0 +1,220 @@
+/**
+ * @file latency.c (implementation file)
+ *
+ * @brief Problem name: multithreaded word count
+ *
+ * Latency histograms of the task FIFO: how long getTask() waits for a task and how long the FIFO lock is held.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifdef LATENCY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "latency.h"
+
+/** @brief Bits of the linear part of a bucket, 2^LATENCY_SUB_BITS buckets per power of two. */
+#define LATENCY_SUB_BITS 5
+
+/** @brief Number of linear buckets per power of two. */
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+
+/** @brief Number of buckets, enough for any latency up to 2^63 ns. */
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * (64 - LATENCY_SUB_BITS))
+
+/**
+ * @brief Struct containing the histograms of a thread.
+ *
+ * "counts" - number of latencies in each bucket, for each kind.
+ * "max" - largest latency recorded, for each kind.
+ * "sum" - sum of the latencies recorded, for each kind.
+ * "putCount" - number of calls of putTask().
+ * "putFullCount" - number of calls of putTask() that found the FIFO full.
+ * "next" - histograms of the thread which recorded before this one.
+ */
+typedef struct Histograms
+{
+    long long counts[LATENCY_KINDS][LATENCY_BUCKETS];
+    long long max[LATENCY_KINDS];
+    long long sum[LATENCY_KINDS];
+    long long putCount;
+    long long putFullCount;
+    struct Histograms *next;
+} Histograms;
+
+/** @brief Names of the kinds of latency, as printed. */
+static const char *kindNames[LATENCY_KINDS] = {"getTask() wait", "FIFO lock hold"};
+
+/** @brief Histograms of the calling thread, NULL until it records. */
+static __thread Histograms *own;
+
+/** @brief Histograms of all threads. */
+static Histograms *all;
+
+/** @brief Locking flag which warrants mutual exclusion while accessing the list of histograms. */
+static pthread_mutex_t allAccess = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Gets the histograms of the calling thread, allocating them the first time.
+ *
+ * @return histograms of the calling thread
+ */
+static Histograms *ownHistograms()
+{
+    if (own == NULL)
+    {
+        if ((own = calloc(1, sizeof(Histograms))) == NULL)
+        {
+            perror("Error on allocating latency histograms");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&allAccess);
+        own->next = all;
+        all = own;
+        pthread_mutex_unlock(&allAccess);
+    }
+    return own;
+}
+
+/**
+ * @brief Gets the bucket of a latency.
+ *
+ * Latencies below 2 * LATENCY_SUB_BUCKETS have a bucket each, the ones above share buckets
+ * 1 / LATENCY_SUB_BUCKETS of their power of two wide.
+ *
+ * @param value latency
+ * @return index of the bucket
+ */
+static int bucketOf(long long value)
+{
+    unsigned long long v = value < 0 ? 0 : (unsigned long long)value;
+
+    if (v < 2 * LATENCY_SUB_BUCKETS)
+        return (int)v;
+
+    int shift = 63 - __builtin_clzll(v) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + (int)(v >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/**
+ * @brief Gets the largest latency of a bucket.
+ *
+ * @param bucket index of the bucket
+ * @return largest latency falling into it
+ */
+static long long bucketTop(int bucket)
+{
+    if (bucket < 2 * LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    long long first = (long long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    return first + (1LL << shift) - 1;
+}
+
+long long latencyClock()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void recordLatency(LatencyKind kind, long long nanoseconds)
+{
+    Histograms *h = ownHistograms();
+
+    h->counts[kind][bucketOf(nanoseconds)]++;
+    h->sum[kind] += nanoseconds;
+    if (nanoseconds > h->max[kind])
+        h->max[kind] = nanoseconds;
+}
+
+void recordPut(bool full)
+{
+    Histograms *h = ownHistograms();
+
+    h->putCount++;
+    if (full)
+        h->putFullCount++;
+}
+
+/**
+ * @brief Gets a percentile of a merged histogram.
+ *
+ * @param counts number of latencies in each bucket
+ * @param total number of latencies
+ * @param max largest latency
+ * @param percentile percentile wanted, from 0 to 100
+ * @return largest latency of the bucket the percentile falls into
+ */
+static long long valueAt(long long *counts, long long total, long long max, double percentile)
+{
+    long long wanted = (long long)(percentile / 100.0 * total + 0.5);
+    long long seen = 0;
+
+    if (wanted < 1)
+        wanted = 1;
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+        if ((seen += counts[b]) >= wanted)
+            return bucketTop(b) < max ? bucketTop(b) : max;
+    return max;
+}
+
+void printLatency()
+{
+    static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    long long counts[LATENCY_BUCKETS];
+    long long putCount = 0, putFullCount = 0;
+
+    pthread_mutex_lock(&allAccess);
+
+    printf("\n%-16s %10s %12s %12s %12s %12s %12s %12s\n", "Latency (ns)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int k = 0; k < LATENCY_KINDS; k++)
+    {
+        long long total = 0, sum = 0, max = 0;
+
+        memset(counts, 0, sizeof(counts));
+        for (Histograms *h = all; h != NULL; h = h->next)
+        {
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+            {
+                counts[b] += h->counts[k][b];
+                total += h->counts[k][b];
+            }
+            sum += h->sum[k];
+            if (h->max[k] > max)
+                max = h->max[k];
+        }
+
+        printf("%-16s %10lld %12.0f", kindNames[k], total, total == 0 ? 0.0 : (double)sum / total);
+        for (int p = 0; p < (int)(sizeof(percentiles) / sizeof(percentiles[0])); p++)
+            printf(" %12lld", total == 0 ? 0 : valueAt(counts, total, max, percentiles[p]));
+        printf(" %12lld\n", max);
+    }
+
+    for (Histograms *h = all; h != NULL; h = h->next)
+    {
+        putCount += h->putCount;
+        putFullCount += h->putFullCount;
+    }
+    printf("putTask() found the FIFO full in %lld of %lld calls\n", putFullCount, putCount);
+
+    own = NULL;
+    while (all != NULL)
+    {
+        Histograms *next = all->next;
+        free(all);
+        all = next;
+    }
+
+    pthread_mutex_unlock(&allAccess);
+}
+
+#endif
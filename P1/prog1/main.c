@@ -19,6 +19,7 @@
 
 #include "worker.h"
 #include "sharedRegion.h"
+#include "latency.h"
 
 /**
  * @brief Struct containing the command line argument values.
@@ -187,6 +188,8 @@ int main(int argc, char **args)
         printf("%-30s %15d %21d %21d\n", fileNames[i], results[i].wordCount, results[i].vowelStartCount, results[i].consonantEndCount);
     }
 
+    LATENCY_REPORT();
+
     freeSharedRegion();
     free(cmdArgs.fileNames);
 
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 
 #include "sharedRegion.h"
+#include "latency.h"
 
 /** @brief Number of files to be processed. */
 int totalFileCount;
@@ -219,11 +220,14 @@ Task getTask()
 
     if ((status = pthread_mutex_lock(&fifoAccess)) != 0)
         throwThreadError(status, "Error on getTask() lock");
+    LATENCY_STAMP(locked);
 
     // trying to lock readerCountAccess doesn't work here, even if readerCount is stored in a tmp variable at the start of the func
     while ((ii == ri && !full) && readerCount > 0)
         if ((status = pthread_cond_wait(&fifoEmpty, &fifoAccess)) != 0)
             throwThreadError(status, "Error on getTask() fifoEmpty wait");
+    LATENCY_STAMP(waited);
+    LATENCY_BETWEEN(LATENCY_GET_WAIT, locked, waited);
 
     // if not empty
     if (!(ii == ri && !full))
@@ -237,6 +241,7 @@ Task getTask()
         val.fileIndex = -1;
     }
 
+    LATENCY_SINCE(LATENCY_HOLD, waited);
     if ((status = pthread_mutex_unlock(&fifoAccess)) != 0)
         throwThreadError(status, "Error on getTask() unlock");
 
@@ -256,6 +261,8 @@ bool putTask(Task task)
 
     if ((status = pthread_mutex_lock(&fifoAccess)) != 0)
         throwThreadError(status, "Error on putTask() lock");
+    LATENCY_STAMP(locked);
+    LATENCY_PUT(full);
 
     if (full)
     {
@@ -271,6 +278,7 @@ bool putTask(Task task)
             throwThreadError(status, "Error on putTask() fifoEmpty signal");
     }
 
+    LATENCY_SINCE(LATENCY_HOLD, locked);
     if ((status = pthread_mutex_unlock(&fifoAccess)) != 0)
         throwThreadError(status, "Error on putTask() unlock");
 
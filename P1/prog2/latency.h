@@ -0,0 +1,77 @@
+/**
+ * @file latency.h (interface file)
+ *
+ * @brief Problem name: multithreaded determinant calculation
+ *
+ * Latency histograms of the task FIFO: how long getTask() waits for a task and how long the FIFO lock is held.
+ *
+ * Only compiled in with -DLATENCY, otherwise every macro expands to nothing.
+ * Each thread records into histograms of its own, allocated the first time it records, with buckets growing
+ * logarithmically and split linearly in LATENCY_SUB_BUCKETS (HDR style, about 3% of precision from a nanosecond up).
+ * The histograms of all threads are merged and printed as percentiles at the end of the run.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#ifdef LATENCY
+
+#include <stdbool.h>
+
+/** @brief What is measured. */
+typedef enum LatencyKind
+{
+    LATENCY_GET_WAIT, // time getTask() waits for the FIFO not to be empty
+    LATENCY_HOLD,     // time the FIFO lock is held, not counting the waits
+    LATENCY_KINDS
+} LatencyKind;
+
+/**
+ * @brief Gets the current time.
+ *
+ * @return nanoseconds since an arbitrary origin
+ */
+extern long long latencyClock();
+
+/**
+ * @brief Records a latency in the histogram of the calling thread.
+ *
+ * @param kind what was measured
+ * @param nanoseconds latency
+ */
+extern void recordLatency(LatencyKind kind, long long nanoseconds);
+
+/**
+ * @brief Records whether putTask() found room in the FIFO.
+ *
+ * @param full if the FIFO was full
+ */
+extern void recordPut(bool full);
+
+/**
+ * @brief Merges the histograms of all threads and prints their percentiles.
+ *
+ * Must be called once every thread has stopped recording.
+ */
+extern void printLatency();
+
+#define LATENCY_STAMP(name) long long name = latencyClock()
+#define LATENCY_BETWEEN(kind, from, to) recordLatency(kind, (to) - (from))
+#define LATENCY_SINCE(kind, from) recordLatency(kind, latencyClock() - (from))
+#define LATENCY_PUT(full) recordPut(full)
+#define LATENCY_REPORT() printLatency()
+
+#else
+
+#define LATENCY_STAMP(name)
+#define LATENCY_BETWEEN(kind, from, to)
+#define LATENCY_SINCE(kind, from)
+#define LATENCY_PUT(full)
+#define LATENCY_REPORT()
+
+#endif
+
+#endif
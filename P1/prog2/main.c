@@ -19,6 +19,7 @@
 
 #include "worker.h"
 #include "sharedRegion.h"
+#include "latency.h"
 
 /**
  * @brief Struct containing the command line argument values.
@@ -190,6 +191,8 @@ int main(int argc, char **args)
         }
     }
 
+    LATENCY_REPORT();
+
     freeSharedRegion();
     free(cmdArgs.fileNames);
 
@@ -0,0 +1,39 @@
+/**
+ * @file backoff.c (implementation file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * Exponential backoff of the loops that poll for messages and send completions.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <time.h>
+
+#include "backoff.h"
+
+/** @brief Longest time a polling loop sleeps while nothing happens, in nanoseconds. */
+long maxBackoff = DEFAULT_MAX_BACKOFF;
+
+/**
+ * @brief Gets the time to sleep after another round where nothing happened.
+ *
+ * @param backoff time slept the last round, in nanoseconds
+ * @return twice that time, at most maxBackoff
+ */
+long nextBackoff(long backoff)
+{
+    return backoff * 2 > maxBackoff ? maxBackoff : backoff * 2;
+}
+
+/**
+ * @brief Sleeps for a while.
+ *
+ * @param nanoseconds time to sleep
+ */
+void backOff(long nanoseconds)
+{
+    struct timespec wait = {.tv_sec = nanoseconds / 1000000000L, .tv_nsec = nanoseconds % 1000000000L};
+    nanosleep(&wait, NULL);
+}
@@ -0,0 +1,44 @@
+/**
+ * @file backoff.h (interface file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * Exponential backoff of the loops that poll for messages and send completions.
+ *
+ * Completions are polled on purpose: MPI has no completion event a thread could wait on alongside its other
+ * sources of work, and a thread blocked in MPI_Wait or MPI_Waitsome busy-polls inside Open MPI, burning a core
+ * for as long as the request is pending. Polling loops instead sleep for a time that starts at MIN_BACKOFF,
+ * doubles while nothing happens, and is capped at maxBackoff, so a completion is noticed at most that late.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef BACKOFF_H_
+#define BACKOFF_H_
+
+/** @brief Shortest time a polling loop sleeps while nothing happens, in nanoseconds. */
+#define MIN_BACKOFF 1000
+
+/** @brief Default for maxBackoff, in nanoseconds. */
+#define DEFAULT_MAX_BACKOFF 1000000
+
+/** @brief Longest time a polling loop sleeps while nothing happens, in nanoseconds. */
+extern long maxBackoff;
+
+/**
+ * @brief Gets the time to sleep after another round where nothing happened.
+ *
+ * @param backoff time slept the last round, in nanoseconds
+ * @return twice that time, at most maxBackoff
+ */
+extern long nextBackoff(long backoff);
+
+/**
+ * @brief Sleeps for a while.
+ *
+ * @param nanoseconds time to sleep
+ */
+extern void backOff(long nanoseconds);
+
+#endif
@@ -0,0 +1,262 @@
+/**
+ * @file compression.c (implementation file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * LZ77 compression of text chunks, so that less of them has to go through the network.
+ *
+ * A compressed chunk starts with its raw size as an int, followed by sequences of a token byte,
+ * literals, a 2 byte offset and extra length bytes, in the same layout as an LZ4 block.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "compression.h"
+
+/** @brief Number of bits of the hash of 4 bytes, the match table has 2^HASH_BITS entries. */
+#define HASH_BITS 12
+
+/** @brief Shortest match worth encoding. */
+#define MIN_MATCH 4
+
+/** @brief Farthest back a match can be, offsets take 2 bytes. */
+#define MAX_OFFSET 65535
+
+/**
+ * @brief Hashes the 4 bytes at a position.
+ *
+ * @param bytes position of the bytes
+ * @return index into the match table
+ */
+static int hash4(const unsigned char *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief Writes the part of a length that did not fit in its token nibble.
+ *
+ * @param length length minus 15
+ * @param compressed compressed array
+ * @param written number of bytes written so far, advanced
+ * @param capacity size of the compressed array
+ * @return if it fit
+ */
+static int writeExtraLength(int length, unsigned char *compressed, int *written, int capacity)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (*written >= capacity)
+            return 0;
+        compressed[(*written)++] = 255;
+    }
+    if (*written >= capacity)
+        return 0;
+    compressed[(*written)++] = length;
+    return 1;
+}
+
+/**
+ * @brief Writes a sequence of literals optionally followed by a match.
+ *
+ * @param literals first literal
+ * @param literalCount number of literals
+ * @param offset distance back to the match, 0 if there is none
+ * @param matchLength length of the match
+ * @param compressed compressed array
+ * @param written number of bytes written so far, advanced
+ * @param capacity size of the compressed array
+ * @return if it fit
+ */
+static int writeSequence(const unsigned char *literals, int literalCount, int offset, int matchLength,
+                         unsigned char *compressed, int *written, int capacity)
+{
+    if (*written >= capacity)
+        return 0;
+
+    int token = *written;
+    (*written)++;
+    compressed[token] = (literalCount < 15 ? literalCount : 15) << 4;
+    if (literalCount >= 15 && !writeExtraLength(literalCount - 15, compressed, written, capacity))
+        return 0;
+
+    if (*written + literalCount > capacity)
+        return 0;
+    memcpy(compressed + *written, literals, literalCount);
+    *written += literalCount;
+
+    // the last sequence has no match
+    if (offset == 0)
+        return 1;
+
+    if (*written + 2 > capacity)
+        return 0;
+    compressed[(*written)++] = offset & 0xff;
+    compressed[(*written)++] = offset >> 8;
+
+    matchLength -= MIN_MATCH;
+    compressed[token] |= matchLength < 15 ? matchLength : 15;
+    if (matchLength >= 15 && !writeExtraLength(matchLength - 15, compressed, written, capacity))
+        return 0;
+    return 1;
+}
+
+/**
+ * @brief Compresses a chunk.
+ *
+ * @param size number of bytes in the chunk
+ * @param bytes array with the bytes of the chunk
+ * @param capacity number of bytes that can be written into the compressed array
+ * @param compressed array to write the compressed chunk into
+ * @return number of bytes of the compressed chunk, -1 if it would not fit into capacity
+ */
+int compressChunk(int size, const char *bytes, int capacity, char *compressed)
+{
+    const unsigned char *in = (const unsigned char *)bytes;
+    unsigned char *out = (unsigned char *)compressed;
+
+    if (capacity < (int)sizeof(int))
+        return -1;
+    memcpy(out, &size, sizeof(int));
+    int written = sizeof(int);
+
+    // last position each hash was seen at
+    int table[1 << HASH_BITS];
+    for (int i = 0; i < 1 << HASH_BITS; i++)
+        table[i] = -1;
+
+    int anchor = 0; // first byte not written yet
+    int position = 0;
+    while (position + MIN_MATCH <= size)
+    {
+        int hash = hash4(in + position);
+        int candidate = table[hash];
+        table[hash] = position;
+
+        if (candidate < 0 || position - candidate > MAX_OFFSET || memcmp(in + candidate, in + position, MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        // extend the match as far as it goes
+        int length = MIN_MATCH;
+        while (position + length < size && in[candidate + length] == in[position + length])
+            length++;
+
+        if (!writeSequence(in + anchor, position - anchor, position - candidate, length, out, &written, capacity))
+            return -1;
+        position += length;
+        anchor = position;
+    }
+
+    if (!writeSequence(in + anchor, size - anchor, 0, 0, out, &written, capacity))
+        return -1;
+    return written;
+}
+
+/**
+ * @brief Gets the raw size of a compressed chunk.
+ *
+ * @param compressed array with the compressed chunk
+ * @return number of bytes of the chunk once decompressed
+ */
+int rawChunkSize(const char *compressed)
+{
+    int size;
+    memcpy(&size, compressed, sizeof(int));
+    return size;
+}
+
+/**
+ * @brief Reads the part of a length that did not fit in its token nibble.
+ *
+ * @param compressed compressed array
+ * @param read number of bytes read so far, advanced
+ * @param size size of the compressed array
+ * @return extra length, -1 if the array ends before it does
+ */
+static int readExtraLength(const unsigned char *compressed, int *read, int size)
+{
+    int length = 0;
+    int byte;
+    do
+    {
+        if (*read >= size)
+            return -1;
+        byte = compressed[(*read)++];
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+/**
+ * @brief Decompresses a chunk.
+ *
+ * @param size number of bytes of the compressed chunk
+ * @param compressed array with the compressed chunk
+ * @param bytes array to write the chunk into, with room for rawChunkSize() bytes
+ * @return number of bytes of the chunk, -1 if the compressed chunk is corrupt
+ */
+int decompressChunk(int size, const char *compressed, char *bytes)
+{
+    const unsigned char *in = (const unsigned char *)compressed;
+    unsigned char *out = (unsigned char *)bytes;
+
+    if (size < (int)sizeof(int))
+        return -1;
+    int rawSize = rawChunkSize(compressed);
+    int read = sizeof(int);
+    int written = 0;
+
+    while (read < size)
+    {
+        int token = in[read++];
+
+        int literalCount = token >> 4;
+        if (literalCount == 15)
+        {
+            int extra = readExtraLength(in, &read, size);
+            if (extra < 0)
+                return -1;
+            literalCount += extra;
+        }
+        if (read + literalCount > size || written + literalCount > rawSize)
+            return -1;
+        memcpy(out + written, in + read, literalCount);
+        read += literalCount;
+        written += literalCount;
+
+        // the last sequence has no match
+        if (read == size)
+            break;
+
+        if (read + 2 > size)
+            return -1;
+        int offset = in[read] | in[read + 1] << 8;
+        read += 2;
+
+        int matchLength = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            int extra = readExtraLength(in, &read, size);
+            if (extra < 0)
+                return -1;
+            matchLength += extra;
+        }
+        if (offset == 0 || offset > written || written + matchLength > rawSize)
+            return -1;
+
+        // byte by byte, a match may overlap what it copies
+        for (int i = 0; i < matchLength; i++, written++)
+            out[written] = out[written - offset];
+    }
+
+    return written == rawSize ? written : -1;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+/**
+ * @file compression.h (interface file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * LZ77 compression of text chunks, so that less of them has to go through the network.
+ *
+ * A compressed chunk starts with its raw size as an int, followed by sequences of a token byte,
+ * literals, a 2 byte offset and extra length bytes, in the same layout as an LZ4 block.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+/**
+ * @brief Compresses a chunk.
+ *
+ * @param size number of bytes in the chunk
+ * @param bytes array with the bytes of the chunk
+ * @param capacity number of bytes that can be written into the compressed array
+ * @param compressed array to write the compressed chunk into
+ * @return number of bytes of the compressed chunk, -1 if it would not fit into capacity
+ */
+extern int compressChunk(int size, const char *bytes, int capacity, char *compressed);
+
+/**
+ * @brief Gets the raw size of a compressed chunk.
+ *
+ * @param compressed array with the compressed chunk
+ * @return number of bytes of the chunk once decompressed
+ */
+extern int rawChunkSize(const char *compressed);
+
+/**
+ * @brief Decompresses a chunk.
+ *
+ * @param size number of bytes of the compressed chunk
+ * @param compressed array with the compressed chunk
+ * @param bytes array to write the chunk into, with room for rawChunkSize() bytes
+ * @return number of bytes of the chunk, -1 if the compressed chunk is corrupt
+ */
+extern int decompressChunk(int size, const char *compressed, char *bytes);
+
+#endif
\ No newline at end of file
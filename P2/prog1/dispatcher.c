@@ -9,7 +9,6 @@
  * @author Diogo Bento, nmec: 93391
  */
 
-#include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,10 +16,17 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "dispatcher.h"
 #include "utfUtils.h"
 #include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "trace.h"
+#include "backoff.h"
+#include "compression.h"
+#include "transport.h"
 
 /** @brief The initial max number of bytes of the text chunk in a task. */
 static const int MAX_BYTES_READ = 1500;
@@ -133,8 +139,114 @@ static Task readBytes(FILE *file)
     return task;
 }
 
+/** @brief Smallest chunk worth compressing, in bytes. */
+static const int MIN_COMPRESSED_BYTES = 256;
+
+/** @brief Smallest fraction of a chunk compression has to save to be kept on. */
+static const double MIN_COMPRESSION_SAVING = 0.05;
+
+/** @brief While compression does not pay off, one in this many chunks is still compressed to keep measuring it. */
+static const int COMPRESSION_PROBE_INTERVAL = 32;
+
+/** @brief Weight of the latest chunk in the compression averages. */
+static const double COMPRESSION_SMOOTHING = 0.1;
+
+/** @brief Average compressed over raw size, 0 until a chunk has been compressed. */
+static double compressionRatio;
+
+/** @brief Average compression speed, in bytes per second. */
+static double compressionSpeed;
+
+/** @brief Chunks not compressed since compression was last measured. */
+static int skippedChunks;
+
+/** @brief Statistics of the chunks compressed by the reader. */
+static CompressionStats compressionStats;
+
+/**
+ * @brief Checks if compressing chunks pays off.
+ *
+ * The reader and the sender run side by side, so compression pays off when it saves enough bytes
+ * and the reader can compress faster than the link can send.
+ *
+ * @return if the next chunk should be compressed
+ */
+static bool compressionPaysOff()
+{
+    // nothing measured yet
+    if (compressionRatio == 0)
+        return true;
+    return compressionRatio < 1 - MIN_COMPRESSION_SAVING && compressionSpeed > linkBandwidth;
+}
+
 /**
- * @brief Thread that reads file contents into local buffers so they can be sent to workers in a round-robin fashion.
+ * @brief Compresses a task in place if it is large enough and compression pays off.
+ *
+ * @param task task to be compressed
+ */
+static void compressTask(Task *task)
+{
+    if (task->byteCount < MIN_COMPRESSED_BYTES)
+        return;
+
+    // keep measuring now and then, the text may compress better further on
+    if (!compressionPaysOff() && ++skippedChunks < COMPRESSION_PROBE_INTERVAL)
+        return;
+    skippedChunks = 0;
+
+    // only worth it if smaller than the chunk
+    char *compressed = malloc(task->byteCount);
+    long start = monotonicTime();
+    int size = compressChunk(task->byteCount, task->bytes, task->byteCount - 1, compressed);
+    long elapsed = monotonicTime() - start;
+
+    double ratio = size < 0 ? 1 : (double)size / task->byteCount;
+    double speed = task->byteCount * 1000000000.0 / (elapsed > 0 ? elapsed : 1);
+    if (compressionRatio == 0)
+    {
+        compressionRatio = ratio;
+        compressionSpeed = speed;
+    }
+    else
+    {
+        compressionRatio += COMPRESSION_SMOOTHING * (ratio - compressionRatio);
+        compressionSpeed += COMPRESSION_SMOOTHING * (speed - compressionSpeed);
+    }
+
+    if (size < 0)
+    {
+        free(compressed);
+        return;
+    }
+
+    compressionStats.chunkCount++;
+    compressionStats.rawBytes += task->byteCount;
+    compressionStats.compressedBytes += size;
+
+    free(task->bytes);
+    task->bytes = compressed;
+    task->byteCount = size;
+    task->compressed = true;
+}
+
+/**
+ * @brief Gets the statistics of the chunks compressed by the reader.
+ *
+ * Only meaningful after dispatchFileTasksIntoSender() has finished.
+ *
+ * @return CompressionStats struct with the compression statistics
+ */
+CompressionStats getCompressionStats()
+{
+    return compressionStats;
+}
+
+/**
+ * @brief Thread that reads file contents into local buffers so they can be sent to workers.
+ *
+ * Each chunk goes to the worker expected to finish it first, rank 0 compute threads included,
+ * taking its size in bytes as its cost.
+ * Chunks for workers off the node of rank 0 are compressed while that pays off against the link bandwidth.
  *
  * Will block when pushing chunks if it builds a significant lead over sender.
  *
@@ -142,15 +254,17 @@ static Task readBytes(FILE *file)
  */
 void *dispatchFileTasksIntoSender()
 {
-    int nextDispatch = 1;
+    TRACE_THREAD("reader");
+
+    compressionRatio = 0;
+    skippedChunks = 0;
+    compressionStats = (CompressionStats){0};
+
     for (int fIdx = 0; fIdx < totalFileCount; fIdx++)
     {
         char *filename = files[fIdx];
         FILE *file = fopen(filename, "rb");
 
-        // init result struct
-        initResult();
-
         // if file is a dud
         if (file == NULL)
             continue;
@@ -160,7 +274,9 @@ void *dispatchFileTasksIntoSender()
         while (true)
         {
             // get chunk
+            TRACE_BEGIN("read");
             task = readBytes(file);
+            TRACE_END("read");
 
             // exit if no chunk
             if (task.byteCount == 0)
@@ -169,148 +285,236 @@ void *dispatchFileTasksIntoSender()
                 break;
             }
 
-            // inform shared region that an extra chunk was read
-            incrementChunks(fIdx);
+            // word counting cost grows with the chunk size
+            task.fileIndex = fIdx;
+            task.compressed = false;
+            task.cost = task.byteCount;
+            int worker = pickWorker();
 
-            // send task into respective queue, this may block
-            pushTaskToSender(nextDispatch - 1, task);
+            // only chunks that go through the network are worth compressing
+            if (linkBandwidth > 0 && worker < processCount - 1 && !sharesNodeWithDispatcher(worker + 1))
+            {
+                TRACE_BEGIN("compress");
+                compressTask(&task);
+                TRACE_END("compress");
+            }
 
-            // advance dispatch number, wraps back to 1 after processCount
-            nextDispatch++;
-            if (nextDispatch >= processCount)
-                nextDispatch = 1;
+            // send task into the queue of the worker expected to finish it first, this may block
+            TRACE_BEGIN("push");
+            pushTaskToSender(worker, task);
+            TRACE_END("push");
         }
     }
 
-    // inform shared region that all files have been read
-    finishedReading();
-
     // send signal to stop workers
     Task stop = {.byteCount = -1};
-    for (int i = 0; i < processCount - 1; i++)
+    for (int i = 0; i < workerCount; i++)
         pushTaskToSender(i, stop);
 
     pthread_exit((int *)EXIT_SUCCESS);
 }
 
+/** @brief Dispatch statistics gathered by the sender, read once it has finished. */
+static DispatchStats dispatchStats;
+
+/**
+ * @brief Sends a task toward a remote worker in a non-blocking manner.
+ *
+ * Workers on the node of rank 0 get the task through their next shared window slot when it fits.
+ *
+ * @param worker index of the worker queue, rank minus 1
+ * @param task task to be sent, must stay allocated until the request completes
+ * @param nextSlot next shared window slot of the worker
+ * @param descriptor buffer for the slot descriptor, must stay allocated until the request completes
+ * @param request request handler of the send
+ */
+static void sendTask(int worker, Task *task, int *nextSlot, int descriptor[3], TransportRequest *request)
+{
+    int rank = worker + 1;
+    int taskBytes = task->byteCount;
+
+    if (fitsNodeMemory(rank, taskBytes))
+    {
+        // write task into the next slot of the worker and only send where it is
+        memcpy(nodeSlot(rank, *nextSlot), task->bytes, taskBytes);
+        syncNodeMemory();
+        descriptor[0] = *nextSlot;
+        descriptor[1] = task->byteCount;
+        descriptor[2] = task->fileIndex;
+        *nextSlot = (*nextSlot + 1) % NODE_SLOTS_PER_WORKER;
+
+        // synchronous, completion means the worker is done with the slot written before this one
+        transportIssend(descriptor, 3, TRANSPORT_INT, rank, SHARED_TASK_TAG, request);
+    }
+    else if (sharesNodeWithDispatcher(rank))
+        // too big for a slot, still synchronous so that the slot rotation holds
+        transportIssend(task->bytes, task->byteCount, TRANSPORT_CHAR, rank, CHUNK_TAG(task->fileIndex, task->compressed), request);
+    else
+        // its size is implied by the message, its file and whether it is compressed by the tag
+        transportIsend(task->bytes, task->byteCount, TRANSPORT_CHAR, rank, CHUNK_TAG(task->fileIndex, task->compressed), request);
+}
+
 /**
  * @brief Thread that emits chunks toward workers in a non-blocking manner.
  *
+ * Works as a progress engine: reaps completed sends with transportTestsome(), hands a new task to every idle worker,
+ * and when neither happens sleeps on the task queue notifier, for good if no sends are pending,
+ * or for an exponentially growing time otherwise.
+ *
+ * New tasks wake the sender right away, completed sends are polled for as backoff.h explains.
+ *
  * @return pointer to the identification of this thread
  */
 void *emitTasksToWorkers()
 {
+    int remoteCount = processCount - 1;
+
     // curently employed entities
-    bool working[processCount - 1];
-    int currentlyWorking = processCount - 1;
+    bool working[remoteCount];
+    int currentlyWorking = remoteCount;
+
+    // request handler objects, last chunk sent to each worker
+    TransportRequest requests[remoteCount];
+    Task tasks[remoteCount];
 
-    // request handler objects, last chunk received
-    int requests[processCount - 1];
-    Task tasks[processCount - 1];
+    // next shared window slot of each worker, descriptors of the last task written into one
+    int nextSlot[remoteCount];
+    int descriptors[remoteCount][3];
 
     // init data for this function
-    for (int i = 0; i < processCount - 1; i++)
+    for (int i = 0; i < remoteCount; i++)
     {
-        requests[i] = MPI_REQUEST_NULL;
+        requests[i] = TRANSPORT_REQUEST_NULL;
         tasks[i].byteCount = 0;
         working[i] = true;
+        nextSlot[i] = 0;
     }
 
-    // used to signal workers that no more tasks are coming
-    int killSignal = 0;
+    dispatchStats.taskCount = 0;
+    dispatchStats.totalLatency = 0;
+    dispatchStats.maxLatency = 0;
 
-    // only ever used to receive waitAny result
-    int lastFinish;
+    long backoff = MIN_BACKOFF;
 
-    int testStatus;
+    TRACE_THREAD("sender");
 
-    while (true)
+    while (currentlyWorking > 0)
     {
-        for (int i = 0; i < processCount - 1; i++)
+        bool progress = false;
+
+        // reap completed sends, these workers are ready for more
+        if (transportTestsome(remoteCount, requests) > 0)
+            progress = true;
+
+        // consume pending notifications, queues are checked right after
+        awaitFurtherTasks(0);
+
+        int pendingSends = 0;
+        for (int i = 0; i < remoteCount; i++)
         {
-            MPI_Test(requests + i, &testStatus, MPI_STATUS_IGNORE);
+            if (!transportRequestIsNull(requests + i))
+            {
+                pendingSends++;
+                continue;
+            }
+
+            // worker is either dead or still has its last task pending
+            if (!working[i])
+                continue;
+
+            // clear out last task
+            if (tasks[i].byteCount > 0)
+            {
+                free(tasks[i].bytes);
+                tasks[i].byteCount = 0;
+            }
+
+            // try to get a new task
+            if (!getTask(i, tasks + i))
+            {
+                // task get failed, we use this to avoid free in future loops
+                tasks[i].byteCount = 0;
+                continue;
+            }
+
+            progress = true;
+            pendingSends++;
 
-            // if worker is ready
-            if (working[i] && testStatus)
+            // if is a kill request
+            if (tasks[i].byteCount == -1)
             {
-                // clear out last task
-                if (tasks[i].byteCount > 0)
-                    free(tasks[i].bytes);
-
-                // try to get a new task
-                if (!getTask(i, tasks + i))
-                {
-                    // task get failed, we use this to avoid free in future loops
-                    tasks[i].byteCount = 0;
-                }
-                else
-                {
-                    // if is a kill request
-                    if (tasks[i].byteCount == -1)
-                    {
-                        // signal worker to stop and mark this worker as dead
-                        currentlyWorking--;
-                        MPI_Isend(&killSignal, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                        working[i] = false;
-                        continue;
-                    }
-
-                    // send this task to worker in a non-blocking manner
-                    MPI_Isend(&tasks[i].byteCount, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                    MPI_Request_free(requests + i);
-                    MPI_Isend(tasks[i].bytes, tasks[i].byteCount, MPI_CHAR, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                }
+                // signal worker to stop and mark this worker as dead, telling it how many file totals to reduce
+                currentlyWorking--;
+                transportIsend(&totalFileCount, 1, TRANSPORT_INT, i + 1, KILL_TAG, requests + i);
+                working[i] = false;
+                continue;
             }
+
+            double latency = (monotonicTime() - tasks[i].queuedAt) / 1000000000.0;
+            dispatchStats.taskCount++;
+            dispatchStats.totalLatency += latency;
+            if (latency > dispatchStats.maxLatency)
+                dispatchStats.maxLatency = latency;
+
+            TRACE_BEGIN("send");
+            sendTask(i, tasks + i, nextSlot + i, descriptors[i], requests + i);
+            TRACE_END("send");
         }
-        if (currentlyWorking > 0)
+
+        if (progress)
+            backoff = MIN_BACKOFF;
+        else if (pendingSends == 0)
         {
-            // wait for any chunks to be available and for a worker to be available
-            awaitFurtherTasks();
-            MPI_Waitany(processCount - 1, requests, &lastFinish, MPI_STATUS_IGNORE);
+            // every live worker is idle with nothing queued, only a new task can change that
+            TRACE_BEGIN("wait");
+            awaitFurtherTasks(-1);
+            TRACE_END("wait");
         }
         else
-            break;
+        {
+            // sends are in flight, sleep a little unless a task shows up meanwhile
+            TRACE_BEGIN("wait");
+            awaitFurtherTasks(backoff);
+            TRACE_END("wait");
+            backoff = nextBackoff(backoff);
+        }
     }
 
     // wait for all the kill messages to have been sent
-    for (int i = 0; i < processCount - 1; i++)
-        MPI_Wait(&requests[i], MPI_STATUS_IGNORE);
+    transportWaitall(remoteCount, requests);
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    dispatchStats.senderCpuTime = cpu.tv_sec + cpu.tv_nsec / 1000000000.0;
 
     pthread_exit((int *)EXIT_SUCCESS);
 }
 
 /**
- * @brief Thread that merges file chunks read by workers into their results structure.
+ * @brief Gets the statistics gathered by the sender.
  *
- * @return pointer to the identification of this thread
+ * Only meaningful after emitTasksToWorkers() has finished.
+ *
+ * @return DispatchStats struct with the sender statistics
  */
-void *mergeChunks()
+DispatchStats getDispatchStats()
 {
-    int nextReceive = 1;
-    int readArr[3]; // move data here
+    return dispatchStats;
+}
 
-    // for each file
-    for (int i = 0; i < totalFileCount; i++)
-    {
-        // blocks until this results object has been initialized
-        Result *res = getResultToUpdate(i);
+/**
+ * @brief Reduces the totals of every worker into the results, along with every worker.
+ *
+ * Must be called after every other dispatcher thread has finished.
+ */
+void reduceResults()
+{
+    TRACE_THREAD("main");
 
-        int currentChunk = 0;
-        // while file has chunks
-        while (hasMoreChunks(i, currentChunk++))
-        {
-            // get word count, start vowel count, end consonant count
-            MPI_Recv(readArr, 3, MPI_INT, nextReceive, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            (*res).wordCount += readArr[0];
-            (*res).vowelStartCount += readArr[1];
-            (*res).consonantEndCount += readArr[2];
-
-            // advance receive number, wraps back to 1 after processCount
-            nextReceive++;
-            if (nextReceive >= processCount)
-                nextReceive = 1;
-        }
-    }
+    TRACE_BEGIN("reduce");
 
-    pthread_exit((int *)EXIT_SUCCESS);
-}
\ No newline at end of file
+    // rank 0 compute threads already merged theirs, a result is three ints
+    transportReduceSum((int *)getResults(), 3 * totalFileCount);
+
+    TRACE_END("reduce");
+}
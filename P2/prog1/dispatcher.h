@@ -13,7 +13,11 @@
 #define DISPATCHER_H_
 
 /**
- * @brief Thread that reads file contents into local buffers so they can be sent to workers in a round-robin fashion.
+ * @brief Thread that reads file contents into local buffers so they can be sent to workers.
+ *
+ * Each chunk goes to the worker expected to finish it first, rank 0 compute threads included,
+ * taking its size in bytes as its cost.
+ * Chunks for workers off the node of rank 0 are compressed while that pays off against the link bandwidth.
  *
  * Will block when pushing chunks if it builds a significant lead over sender.
  *
@@ -21,18 +25,70 @@
  */
 extern void *dispatchFileTasksIntoSender();
 
+/**
+ * @brief Statistics of the chunks compressed by the reader.
+ *
+ * @param chunkCount number of chunks sent compressed
+ * @param rawBytes size of those chunks before compression
+ * @param compressedBytes size of those chunks after compression
+ */
+typedef struct CompressionStats
+{
+    int chunkCount;
+    long rawBytes;
+    long compressedBytes;
+} CompressionStats;
+
+/**
+ * @brief Gets the statistics of the chunks compressed by the reader.
+ *
+ * Only meaningful after dispatchFileTasksIntoSender() has finished.
+ *
+ * @return CompressionStats struct with the compression statistics
+ */
+extern CompressionStats getCompressionStats();
+
+/**
+ * @brief Statistics gathered by the sender.
+ *
+ * @param taskCount number of tasks sent to remote workers
+ * @param totalLatency sum of the time, in seconds, tasks waited in a queue before being sent
+ * @param maxLatency longest time, in seconds, a task waited in a queue before being sent
+ * @param senderCpuTime CPU time, in seconds, used by the sender thread
+ */
+typedef struct DispatchStats
+{
+    int taskCount;
+    double totalLatency;
+    double maxLatency;
+    double senderCpuTime;
+} DispatchStats;
+
 /**
  * @brief Thread that emits chunks toward workers in a non-blocking manner.
- * 
+ *
+ * Works as a progress engine: reaps completed sends with MPI_Testsome, hands a new task to every idle worker,
+ * and when neither happens sleeps on the task queue notifier, for good if no sends are pending,
+ * or for an exponentially growing time otherwise.
+ *
  * @return pointer to the identification of this thread
  */
 extern void *emitTasksToWorkers();
 
 /**
- * @brief Thread that merges file chunks read by workers into their results structure.
+ * @brief Gets the statistics gathered by the sender.
  *
- * @return pointer to the identification of this thread
+ * Only meaningful after emitTasksToWorkers() has finished.
+ *
+ * @return DispatchStats struct with the sender statistics
+ */
+extern DispatchStats getDispatchStats();
+
+/**
+ * @brief Reduces the totals of every worker into the results, along with every worker.
+ *
+ * Must be called after every other dispatcher thread has finished.
  */
-extern void *mergeChunks();
+extern void reduceResults();
 
 #endif
\ No newline at end of file
@@ -15,10 +15,19 @@
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/resource.h>
 
 #include "worker.h"
 #include "dispatcher.h"
 #include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "trace.h"
+#include "backoff.h"
+#include "transport.h"
+
+/** @brief Size in bytes of each task slot in the memory shared with workers on the same node. */
+static const int NODE_SLOT_BYTES = 1 << 14;
 
 /**
  * @brief Struct containing the command line argument values.
@@ -26,12 +35,20 @@
  * @param status if the file was called correctly
  * @param fileCount count of the files given
  * @param fileNames array of file names given
+ * @param localWorkerCount count of the compute threads to be created on rank 0
+ * @param linkBandwidth bandwidth of the link out of rank 0, in MB/s, 0 to never compress chunks
+ * @param simulatedRanks ranks run as threads of this process, 0 if ranks are real processes
+ * @param maxBackoff longest sleep of the loops polling for messages, in microseconds
  */
 typedef struct CMDArgs
 {
     int status;
     int fileCount;
     char **fileNames;
+    int localWorkerCount;
+    double linkBandwidth;
+    int simulatedRanks;
+    double maxBackoff;
 } CMDArgs;
 
 /**
@@ -44,8 +61,12 @@ static void printUsage(char *cmdName)
     fprintf(stderr, "\nSynopsis: %s OPTIONS [filenames]\n"
                     "  OPTIONS:\n"
                     "  -h      --- print this help\n"
-                    "  -f      --- file names, space separated\n",
-            cmdName);
+                    "  -f      --- file names, space separated\n"
+                    "  -w      --- compute thread count on the dispatcher process (default: 1)\n"
+                    "  -z      --- compress chunks for a dispatcher link of this many MB/s (default: 0, never)\n"
+                    "  -s      --- ranks simulated as threads of a single process, to benchmark dispatch (default: 0, none)\n"
+                    "  -p      --- longest sleep while polling for messages, in us (default: %ld)\n",
+            cmdName, (long)DEFAULT_MAX_BACKOFF / 1000);
 }
 
 /**
@@ -58,6 +79,10 @@ static void printUsage(char *cmdName)
 CMDArgs parseCMD(int argc, char *args[])
 {
     CMDArgs cmdArgs;
+    cmdArgs.localWorkerCount = 1;
+    cmdArgs.linkBandwidth = 0;
+    cmdArgs.simulatedRanks = 0;
+    cmdArgs.maxBackoff = DEFAULT_MAX_BACKOFF / 1000;
     cmdArgs.status = EXIT_FAILURE;
     int opt;
     opterr = 0;
@@ -72,7 +97,7 @@ CMDArgs parseCMD(int argc, char *args[])
     }
     do
     {
-        switch ((opt = getopt(argc, args, "f:w:h")))
+        switch ((opt = getopt(argc, args, "f:w:z:s:p:h")))
         {
         case 'f':                // file name
             if (filestart != -1) // duplicate -f
@@ -91,6 +116,50 @@ CMDArgs parseCMD(int argc, char *args[])
             cmdArgs.fileNames = (char **)malloc(sizeof(char **) * filespan);
             memcpy(cmdArgs.fileNames, &args[filestart], (sizeof(char *) * filespan));
             break;
+        case 'w': // compute threads on rank 0
+            cmdArgs.localWorkerCount = atoi(optarg);
+            if (cmdArgs.localWorkerCount < 0)
+            {
+                fprintf(stderr, "%s: negative compute thread count\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'z': // link bandwidth of rank 0
+            cmdArgs.linkBandwidth = atof(optarg);
+            if (cmdArgs.linkBandwidth < 0)
+            {
+                fprintf(stderr, "%s: negative link bandwidth\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 's': // ranks simulated in-process
+            cmdArgs.simulatedRanks = atoi(optarg);
+            if (cmdArgs.simulatedRanks < 0)
+            {
+                fprintf(stderr, "%s: negative simulated rank count\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'p': // backoff cap
+            cmdArgs.maxBackoff = atof(optarg);
+            if (cmdArgs.maxBackoff < 0.001)
+            {
+                fprintf(stderr, "%s: backoff below a nanosecond\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
         case 'h': // help
             printUsage(basename(args[0]));
             if (!(filestart == -1 || filespan == 0))
@@ -132,13 +201,85 @@ static void printResults(char **fileNames, int fileCount)
     }
 }
 
+/**
+ * @brief Gets the CPU time used by all threads of this process.
+ *
+ * @return user plus system time, in seconds
+ */
+static double processCpuTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+/**
+ * @brief Prints how much CPU rank 0 used and how long tasks waited to be sent.
+ *
+ * @param elapsed wall clock time of the run, in seconds
+ * @param cpu CPU time used by rank 0 during the run, in seconds
+ */
+static void printDispatchReport(double elapsed, double cpu)
+{
+    printf("Dispatcher CPU time = %.6f s (%.1f%% of elapsed time)\n", cpu, 100 * cpu / elapsed);
+
+    // no sender without remote workers
+    if (processCount < 2)
+        return;
+
+    DispatchStats stats = getDispatchStats();
+    printf("Sender CPU time = %.6f s (%.1f%% of elapsed time)\n", stats.senderCpuTime, 100 * stats.senderCpuTime / elapsed);
+    if (stats.taskCount > 0)
+        printf("Dispatch latency = %.3f us average, %.3f us max over %d tasks\n",
+               1e6 * stats.totalLatency / stats.taskCount, 1e6 * stats.maxLatency, stats.taskCount);
+
+    CompressionStats compression = getCompressionStats();
+    if (linkBandwidth > 0)
+        printf("Compression = %d chunks, %ld bytes into %ld (%.1f%%)\n", compression.chunkCount, compression.rawBytes,
+               compression.compressedBytes, compression.rawBytes > 0 ? 100.0 * compression.compressedBytes / compression.rawBytes : 100.0);
+
+    if (threadTransport())
+    {
+        TransportStats transport = getTransportStats();
+        printf("Transport = %ld messages, %ld bytes, longest mailbox %d messages at rank %d\n", transport.messageCount,
+               transport.byteCount, transport.maxQueueDepth, transport.maxQueueRank);
+    }
+}
+
+/**
+ * @brief Tells every worker that there is nothing left to process.
+ *
+ * @param size total process count
+ */
+static void stopWorkers(int size)
+{
+    for (int i = 1; i < size; i++)
+        transportSend(NULL, 0, TRANSPORT_CHAR, i, KILL_TAG);
+}
+
+/**
+ * @brief Simulated rank thread, runs a worker over the in-process transport.
+ *
+ * @param par pointer to the rank simulated by this thread
+ * @return pointer to the identification of this thread
+ */
+static void *whileSimulatedRankWorks(void *par)
+{
+    enterRank(*((int *)par));
+    whileTasksWorkAndSendResult();
+
+    pthread_exit((int *)EXIT_SUCCESS);
+}
+
 /**
  * @brief Main thread.
  *
  * Determines whether process is a worker or dispatcher and performs associated tasks
  * Dispatchers are multi-threaded and output results
- * Dispatcher threads include a file reader, a sending component, and a results merger
+ * Dispatcher threads include a file reader, a sending component, and compute threads
+ * Once they finish, the totals of every process are reduced into the dispatcher
  * Worker performs tasks until it receives an exit signal
+ * A single process runs everything on its compute threads, or simulates every worker rank with a thread
  *
  * @param argc argument count
  * @param args argument array
@@ -160,30 +301,76 @@ int main(int argc, char **args)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (size < 2)
-    {
-        printf("There is a 2 process minimum\n");
-        MPI_Finalize();
-        exit(EXIT_FAILURE);
-    }
+    initNodeMemory(NODE_SLOT_BYTES);
+    TRACE_INIT();
 
     if (rank == 0) // dispatcher
     {
         CMDArgs cmdArgs = parseCMD(argc, args);
+        if (cmdArgs.status == EXIT_SUCCESS && cmdArgs.simulatedRanks > 0 && size > 1)
+        {
+            fprintf(stderr, "%s: -s needs a single process\n", basename(args[0]));
+            free(cmdArgs.fileNames);
+            cmdArgs.status = EXIT_FAILURE;
+        }
+        if (cmdArgs.status == EXIT_SUCCESS && cmdArgs.simulatedRanks > 1)
+        {
+            startThreadTransport(cmdArgs.simulatedRanks);
+            size = cmdArgs.simulatedRanks;
+        }
+        if (cmdArgs.status == EXIT_SUCCESS && size == 1 && cmdArgs.localWorkerCount == 0)
+        {
+            fprintf(stderr, "%s: a single process needs at least one compute thread\n", basename(args[0]));
+            free(cmdArgs.fileNames);
+            cmdArgs.status = EXIT_FAILURE;
+        }
+
+        // the file of a chunk is told by its tag
+        int *tagUpperBound, flag;
+        MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tagUpperBound, &flag);
+        if (cmdArgs.status == EXIT_SUCCESS && CHUNK_TAG(cmdArgs.fileCount - 1, 1) > *tagUpperBound)
+        {
+            fprintf(stderr, "%s: too many files, at most %d are supported\n", basename(args[0]), CHUNK_FILE(*tagUpperBound) + 1);
+            free(cmdArgs.fileNames);
+            cmdArgs.status = EXIT_FAILURE;
+        }
         if (cmdArgs.status == EXIT_FAILURE)
         {
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal to workers that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal to workers that there's nothing left to process
+            stopWorkers(size);
+            TRACE_WRITE();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
         struct timespec start, finish;              // time measurement
         clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
+        double startCpu = processCpuTime();
 
-        initSharedRegion(cmdArgs.fileCount, cmdArgs.fileNames, size, 10);
+        initSharedRegion(cmdArgs.fileCount, cmdArgs.fileNames, size, cmdArgs.localWorkerCount, 10, cmdArgs.linkBandwidth * 1000000);
+
+        // create simulated ranks, every one of them but rank 0 is a worker
+        pthread_t simulatedRanks[threadTransport() ? size : 1];
+        int simulatedIds[threadTransport() ? size : 1];
+        for (int r = 1; threadTransport() && r < size; r++)
+        {
+            simulatedIds[r] = r;
+            if (pthread_create(&simulatedRanks[r], NULL, whileSimulatedRankWorks, &simulatedIds[r]) != 0)
+            {
+                perror("Error on creating simulated rank");
+
+                // signal that there's nothing left to process
+                stopWorkers(size);
+
+                free(cmdArgs.fileNames);
+                freeSharedRegion();
+                TRACE_WRITE();
+                freeNodeMemory();
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+            }
+        }
 
         // create reader thread
         pthread_t reader;
@@ -191,60 +378,69 @@ int main(int argc, char **args)
         {
             perror("Error on creating dispatcher");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
 
             free(cmdArgs.fileNames);
             freeSharedRegion();
+            TRACE_WRITE();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
-        // create sender thread
+        // create sender thread, only needed if there are remote workers
+        maxBackoff = (long)(cmdArgs.maxBackoff * 1000);
         pthread_t sender;
-        if (pthread_create(&sender, NULL, emitTasksToWorkers, NULL) != 0)
+        if (size > 1 && pthread_create(&sender, NULL, emitTasksToWorkers, NULL) != 0)
         {
             perror("Error on creating sender");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
 
             free(cmdArgs.fileNames);
             freeSharedRegion();
+            TRACE_WRITE();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
-        // create merger thread
-        pthread_t merger;
-        if (pthread_create(&merger, NULL, mergeChunks, NULL) != 0)
+        // create compute threads
+        pthread_t localWorkers[cmdArgs.localWorkerCount];
+        int localIds[cmdArgs.localWorkerCount];
+        for (int i = 0; i < cmdArgs.localWorkerCount; i++)
         {
-            perror("Error on creating merger");
+            localIds[i] = i;
+            if (pthread_create(&localWorkers[i], NULL, whileLocalTasksWorkAndSendResult, &localIds[i]) != 0)
+            {
+                perror("Error on creating compute thread");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
                 // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-            
-            free(cmdArgs.fileNames);
-            freeSharedRegion();
-            MPI_Finalize();
-            exit(EXIT_FAILURE);
+                stopWorkers(size);
+
+                free(cmdArgs.fileNames);
+                freeSharedRegion();
+                TRACE_WRITE();
+                freeNodeMemory();
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+            }
         }
 
-        // wait for merger
-        if (pthread_join(merger, NULL) != 0)
+        // wait for compute threads
+        for (int i = 0; i < cmdArgs.localWorkerCount; i++)
         {
-            perror("Error on waiting for merger thread");
-            exit(EXIT_FAILURE);
+            if (pthread_join(localWorkers[i], NULL) != 0)
+            {
+                perror("Error on waiting for compute thread");
+                exit(EXIT_FAILURE);
+            }
         }
 
         // wait for sender
-        if (pthread_join(sender, NULL) != 0)
+        if (size > 1 && pthread_join(sender, NULL) != 0)
         {
             perror("Error on waiting for sender thread");
             exit(EXIT_FAILURE);
@@ -257,18 +453,39 @@ int main(int argc, char **args)
             exit(EXIT_FAILURE);
         }
 
+        // wait for simulated ranks
+        for (int r = 1; threadTransport() && r < size; r++)
+        {
+            if (pthread_join(simulatedRanks[r], NULL) != 0)
+            {
+                perror("Error on waiting for simulated rank");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // gather the totals of every worker
+        reduceResults();
+
         clock_gettime(CLOCK_MONOTONIC_RAW, &finish); // end time measurement
+        double elapsed = (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+        double cpu = processCpuTime() - startCpu;
         printResults(cmdArgs.fileNames, cmdArgs.fileCount);
-        printf("\nElapsed time = %.6f s\n", (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
+        printf("\nElapsed time = %.6f s\n", elapsed);
+        printDispatchReport(elapsed, cpu);
 
         free(cmdArgs.fileNames);
         freeSharedRegion();
+        freeTransport();
     }
     else // worker
     {
         whileTasksWorkAndSendResult();
     }
 
+    // every rank hands its timeline to rank 0
+    TRACE_WRITE();
+
+    freeNodeMemory();
     MPI_Finalize();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
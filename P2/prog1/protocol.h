@@ -0,0 +1,41 @@
+/**
+ * @file protocol.h (interface file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * Message tags used between the dispatcher and the workers.
+ *
+ * Every task travels in a single message, workers learn its size through MPI_Mprobe and MPI_Get_count.
+ * Workers on the node of rank 0 may instead get a descriptor of a task written into the shared window.
+ * No results travel per task, workers keep totals per file and reduce them into rank 0 after the kill message.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+/** @brief Tag of a message telling a worker that no more tasks are coming, with the number of files to reduce totals of. */
+#define KILL_TAG 1
+
+/** @brief Tag of a message with the slot of the shared window where a task was written, its size and file index. */
+#define SHARED_TASK_TAG 3
+
+/**
+ * @brief Tag of a message carrying a task toward a worker, a chunk of file n uses TASK_TAG + 2n, or TASK_TAG + 2n + 1 if compressed.
+ *
+ * Kept well above every other tag since it starts a range.
+ */
+#define TASK_TAG 100
+
+/** @brief Tag of a chunk of a file, compressed or not. */
+#define CHUNK_TAG(fileIndex, compressed) (TASK_TAG + 2 * (fileIndex) + (compressed))
+
+/** @brief Index of the file of a chunk tag. */
+#define CHUNK_FILE(tag) (((tag) - TASK_TAG) / 2)
+
+/** @brief If a chunk tag is of a compressed chunk. */
+#define CHUNK_COMPRESSED(tag) (((tag) - TASK_TAG) % 2)
+
+#endif
@@ -3,17 +3,24 @@
  *
  * @brief Problem name: multiprocess word count with multithreaded dispatcher
  *
- * Shared region acessed by reader, sender, and merger at the same time.
+ * Shared region acessed by reader, sender, and compute threads at the same time.
  *
  * @author Pedro Casimiro, nmec: 93179
  * @author Diogo Bento, nmec: 93391
  */
 
+#define _GNU_SOURCE // ppoll
+
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "sharedRegion.h"
 
@@ -26,8 +33,14 @@ char **files;
 /** @brief Total process count. Includes rank 0. */
 int processCount;
 
-/** @brief Index of last initialized results object. */
-static int lastInitializedResult;
+/** @brief Number of compute threads running on rank 0. */
+int localWorkerCount;
+
+/** @brief Number of task queues, remote workers (rank minus 1) followed by rank 0 compute threads. */
+int workerCount;
+
+/** @brief Bandwidth of the link out of rank 0, in bytes per second, 0 to never compress chunks. */
+double linkBandwidth;
 
 /** @brief Array of the results for each file. */
 static Result *results;
@@ -47,26 +60,26 @@ static int *ri;
 /** @brief Flags signaling the task FIFOs are full. */
 static bool *full;
 
-/** @brief Synchronization point when a new result object is initialized. */
-static pthread_cond_t resultInitialized;
-
-/** @brief Synchronization point when a chunk count is increased. */
-static pthread_cond_t chunksIncreased;
-
 /** @brief Locking flag which warrants mutual exclusion while accessing the results array. */
 static pthread_mutex_t resultsAccess = PTHREAD_MUTEX_INITIALIZER;
 
 /** @brief Locking flags which warrant mutual exclusion while accessing the task FIFOs. */
 static pthread_mutex_t *fifoAccess;
 
-/** @brief Locking flag to allow wait in awaitFurtherTasks. */
-static pthread_mutex_t awaitAccess = PTHREAD_MUTEX_INITIALIZER;
-
 /** @brief Synchronization points when the task FIFOs are full. */
 static pthread_cond_t *fifoFull;
 
-/** @brief Synchronization point when a new task is pushed. */
-static pthread_cond_t newTask;
+/** @brief Synchronization points when the task FIFOs are empty. */
+static pthread_cond_t *fifoEmpty;
+
+/** @brief Event file descriptor notified whenever a task is pushed for a remote worker. */
+static int newTaskEvent;
+
+/** @brief Cost of the tasks waiting in each queue. */
+static double *queuedCost;
+
+/** @brief Locking flag which warrants mutual exclusion while accessing the worker loads. */
+static pthread_mutex_t loadAccess = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief Throws error and stops thread that threw.
@@ -89,36 +102,44 @@ static void throwThreadError(int error, char *string)
  * @param _totalFileCount number of files to be processed
  * @param _files array with the file names of all files
  * @param _processCount total process count
+ * @param _localWorkerCount number of compute threads running on rank 0
  * @param _fifoSize number of tasks that can be queued up for each worker
+ * @param _linkBandwidth bandwidth of the link out of rank 0, in bytes per second, 0 to never compress chunks
  */
-void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _fifoSize)
+void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _localWorkerCount, int _fifoSize,
+                      double _linkBandwidth)
 {
     totalFileCount = _totalFileCount;
     files = _files;
     processCount = _processCount;
+    localWorkerCount = _localWorkerCount;
+    workerCount = processCount - 1 + localWorkerCount;
     fifoSize = _fifoSize;
-    lastInitializedResult = -1;
+    linkBandwidth = _linkBandwidth;
 
-    results = malloc(sizeof(Result) * totalFileCount);
+    // every file starts with no words, totals are only added at the end
+    results = calloc(totalFileCount, sizeof(Result));
 
-    pthread_cond_init(&resultInitialized, NULL);
-    pthread_cond_init(&chunksIncreased, NULL);
-    pthread_cond_init(&newTask, NULL);
+    newTaskEvent = eventfd(0, EFD_NONBLOCK);
 
     // create a FIFO per worker
-    ii = malloc(sizeof(int) * (processCount - 1));
-    ri = malloc(sizeof(int) * (processCount - 1));
-    full = malloc(sizeof(bool) * (processCount - 1));
-    fifoAccess = malloc(sizeof(pthread_mutex_t) * (processCount - 1));
-    fifoFull = malloc(sizeof(pthread_cond_t) * (processCount - 1));
-    taskFIFO = malloc(sizeof(Task *) * (processCount - 1));
-    for (int i = 0; i < (processCount - 1); i++)
+    ii = malloc(sizeof(int) * workerCount);
+    ri = malloc(sizeof(int) * workerCount);
+    full = malloc(sizeof(bool) * workerCount);
+    fifoAccess = malloc(sizeof(pthread_mutex_t) * workerCount);
+    fifoFull = malloc(sizeof(pthread_cond_t) * workerCount);
+    fifoEmpty = malloc(sizeof(pthread_cond_t) * workerCount);
+    taskFIFO = malloc(sizeof(Task *) * workerCount);
+    queuedCost = malloc(sizeof(double) * workerCount);
+    for (int i = 0; i < workerCount; i++)
     {
+        queuedCost[i] = 0;
         ii[i] = 0;
         ri[i] = 0;
         full[i] = false;
         pthread_mutex_init(&fifoAccess[i], NULL);
         pthread_cond_init(&fifoFull[i], NULL);
+        pthread_cond_init(&fifoEmpty[i], NULL);
         taskFIFO[i] = malloc(sizeof(Task) * fifoSize);
     }
 }
@@ -131,169 +152,137 @@ void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _p
 void freeSharedRegion()
 {
     free(results);
-    for (int i = 0; i < processCount - 1; i++)
-    {
+    for (int i = 0; i < workerCount; i++)
         free(taskFIFO[i]);
-    }
     free(taskFIFO);
     free(ii);
     free(ri);
     free(full);
     free(fifoAccess);
     free(fifoFull);
+    free(fifoEmpty);
+    close(newTaskEvent);
+    free(queuedCost);
 }
 
 /**
- * @brief Initializes the result of the next file.
- */
-void initResult()
-{
-
-    int status;
-
-    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on initResult() lock");
-
-    results[++lastInitializedResult].chunks = 0;
-    results[lastInitializedResult].consonantEndCount = 0;
-    results[lastInitializedResult].vowelStartCount = 0;
-    results[lastInitializedResult].wordCount = 0;
-
-    if ((status = pthread_cond_signal(&resultInitialized)) != 0)
-        throwThreadError(status, "Error on initResult() resultInitialized signal");
-
-    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on initResult() unlock");
-}
-
-/**
- * @brief Used when dispatcher has finished reading so that hasMoreChunks() can handle the last file.
+ * @brief Adds the totals a thread gathered over all files into the results.
+ *
+ * @param totals results of the thread, one per file
  */
-void finishedReading()
+void mergeResults(Result *totals)
 {
     int status;
 
-    lastInitializedResult++;
-
     if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on finishedReading() lock");
+        throwThreadError(status, "Error on mergeResults() lock");
 
-    if ((status = pthread_cond_signal(&chunksIncreased)) != 0)
-        throwThreadError(status, "Error on finishedReading() chunksIncreased signal");
+    for (int i = 0; i < totalFileCount; i++)
+    {
+        results[i].vowelStartCount += totals[i].vowelStartCount;
+        results[i].consonantEndCount += totals[i].consonantEndCount;
+        results[i].wordCount += totals[i].wordCount;
+    }
 
     if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on finishedReading() lock");
+        throwThreadError(status, "Error on mergeResults() unlock");
 }
 
 /**
- * @brief Increment the chunks read by 1.
+ * @brief Gets the results of all files.
  *
- * @param fileIndex index of the file
+ * @return Result struct array with all the results
  */
-void incrementChunks(int fileIndex)
+Result *getResults()
 {
+    Result *val;
     int status;
 
     if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on incrementChunks() lock");
-
-    results[fileIndex].chunks++;
+        throwThreadError(status, "Error on getResults() lock");
 
-    if ((status = pthread_cond_signal(&chunksIncreased)) != 0)
-        throwThreadError(status, "Error on incrementChunks() chunksIncreased signal");
+    val = results;
 
     if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on incrementChunks() lock");
+        throwThreadError(status, "Error on getResults() unlock");
+
+    return val;
 }
 
 /**
- * @brief Allows merger to get a result object, will block until result at index has been initialized.
+ * @brief Gets the current time of the monotonic clock.
  *
- * @param fileIndex index of the file
+ * @return time in nanoseconds
  */
-Result *getResultToUpdate(int fileIndex)
+long monotonicTime()
 {
-    if (fileIndex >= totalFileCount)
-        return NULL;
-
-    int status;
-
-    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on getResultToUpdate() lock");
-
-    // wait for result initialization
-    while (fileIndex > lastInitializedResult)
-        if ((status = pthread_cond_wait(&resultInitialized, &resultsAccess)) != 0)
-            throwThreadError(status, "Error on getResultToUpdate() resultInitialized wait");
-
-    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on getResultToUpdate() unlock");
-    return &results[fileIndex];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
 }
 
 /**
- * @brief Will wait until there are more chunks to be used in the file or all chunks have already been used.
+ * @brief Picks the worker with the least work queued.
+ *
+ * Workers report nothing back until the end, so the queued cost is dropped as soon as a task leaves its queue.
+ * All workers are taken to be equally fast, so the cost of the task itself would not change the pick.
  *
- * @param fileIndex index of the file
- * @param currentChunk last chunk to be used
- * @return if there are more chunks of the file to be used
+ * @return index of the worker queue
  */
-bool hasMoreChunks(int fileIndex, int currentChunk)
+int pickWorker()
 {
-    bool val;
     int status;
 
-    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on hasMoreChunks() lock");
-
-    // wait until there are chunks left in the current fileIndex
-    // or it has been confirmed that no more chunks will be read
-    while (fileIndex >= lastInitializedResult && currentChunk >= results[fileIndex].chunks)
-        if ((status = pthread_cond_wait(&chunksIncreased, &resultsAccess)) != 0)
-            throwThreadError(status, "Error on hasMoreChunks() chunksIncreased wait");
+    if ((status = pthread_mutex_lock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on pickWorker() lock");
 
-    // if false, all chunks of current file index have been used
-    val = currentChunk < results[fileIndex].chunks;
+    // least queued cost, ties go to the lowest index
+    int best = 0;
+    for (int i = 1; i < workerCount; i++)
+        if (queuedCost[i] < queuedCost[best])
+            best = i;
 
-    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on hasMoreChunks() lock");
+    if ((status = pthread_mutex_unlock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on pickWorker() unlock");
 
-    return val;
+    return best;
 }
 
 /**
- * @brief Gets the results of all files.
+ * @brief Adds to the cost queued for a worker.
  *
- * @return Result struct array with all the results
+ * @param worker index of the worker queue
+ * @param cost cost to add, negative when a task leaves the queue
  */
-Result *getResults()
+static void addQueuedCost(int worker, double cost)
 {
-    Result *val;
     int status;
 
-    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on getResults() lock");
-
-    val = results;
+    if ((status = pthread_mutex_lock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on addQueuedCost() lock");
 
-    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
-        throwThreadError(status, "Error on getResults() unlock");
+    queuedCost[worker] += cost;
 
-    return val;
+    if ((status = pthread_mutex_unlock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on addQueuedCost() unlock");
 }
 
 /**
  * @brief Pushes a chunk to a given worker's queue.
  *
- * Notifies anyone inside awaitFurtherTasks.
+ * Counts its cost as queued for that worker and notifies anyone inside awaitFurtherTasks.
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task task that worker must perform
  */
 void pushTaskToSender(int worker, Task task)
 {
     int status;
 
+    // counted before the task is visible, it could leave the queue before this function returns
+    if (task.byteCount != -1)
+        addQueuedCost(worker, task.cost);
+
     if ((status = pthread_mutex_lock(&fifoAccess[worker])) != 0)
         throwThreadError(status, "Error on pushTaskToSender() fifoAccess lock");
 
@@ -301,28 +290,28 @@ void pushTaskToSender(int worker, Task task)
         if ((status = pthread_cond_wait(&fifoFull[worker], &fifoAccess[worker])) != 0)
             throwThreadError(status, "Error on pushTaskToSender() fifoFull wait");
 
+    task.queuedAt = monotonicTime();
+
     taskFIFO[worker][ii[worker]] = task;
     ii[worker] = (ii[worker] + 1) % fifoSize;
     full[worker] = (ii[worker] == ri[worker]);
 
+    if ((status = pthread_cond_signal(&fifoEmpty[worker])) != 0)
+        throwThreadError(status, "Error on pushTaskToSender() fifoEmpty signal");
+
     if ((status = pthread_mutex_unlock(&fifoAccess[worker])) != 0)
         throwThreadError(status, "Error on pushTaskToSender() fifoAccess unlock");
 
-    // notify that there's new content
-    if ((status = pthread_mutex_lock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() awaitAccess lock");
-
-    if ((status = pthread_cond_signal(&newTask)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() newTask signal");
-
-    if ((status = pthread_mutex_unlock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() awaitAccess unlock");
+    // notify the sender that there's new content, compute threads of rank 0 were already signaled
+    uint64_t one = 1;
+    if (worker < processCount - 1 && write(newTaskEvent, &one, sizeof(one)) != sizeof(one))
+        throwThreadError(errno, "Error on pushTaskToSender() newTaskEvent write");
 }
 
 /**
  * @brief Get a task for a given worker
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task a task meant for the worker
  * @return if getTask was successful (fifo was not empty)
  */
@@ -337,8 +326,9 @@ bool getTask(int worker, Task *task)
     // if not empty
     if (!(ii[worker] == ri[worker] && !full[worker]))
     {
-        (*task).byteCount = taskFIFO[worker][ri[worker]].byteCount;
-        (*task).bytes = taskFIFO[worker][ri[worker]].bytes;
+        *task = taskFIFO[worker][ri[worker]];
+        if (task->byteCount != -1)
+            addQueuedCost(worker, -task->cost);
 
         ri[worker] = (ri[worker] + 1) % fifoSize;
         full[worker] = false;
@@ -358,39 +348,58 @@ bool getTask(int worker, Task *task)
 }
 
 /**
- * @brief Block until there are pending tasks.
+ * @brief Get a task for a given worker, blocking until one is available.
+ *
+ * Used by the compute threads of rank 0, which have no sender between them and their queue.
+ *
+ * @param worker index of the worker queue
+ * @return a task meant for the worker
  */
-void awaitFurtherTasks()
+Task awaitTask(int worker)
 {
-    bool isEmpty = true;
+    Task task;
     int status;
-    if ((status = pthread_mutex_lock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on awaitFurtherInfo() awaitAccess lock");
 
-    for (int i = 0; i < processCount - 1; i++)
-    {
-        if ((status = pthread_mutex_lock(&fifoAccess[i])) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess lock");
-
-        // if not empty
-        if (!(ii[i] == ri[i] && !full[i]))
-        {
-            isEmpty = false;
-            if ((status = pthread_mutex_unlock(&fifoAccess[i])) != 0)
-                throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess (is not empty) unlock");
-            break;
-        }
-
-        if ((status = pthread_mutex_unlock(&fifoAccess[i])) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess unlock");
-    }
+    if ((status = pthread_mutex_lock(&fifoAccess[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() lock");
 
-    if (isEmpty)
-    {
-        if ((status = pthread_cond_wait(&newTask, &awaitAccess)) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() newTask wait");
-    }
+    // wait while empty
+    while (ii[worker] == ri[worker] && !full[worker])
+        if ((status = pthread_cond_wait(&fifoEmpty[worker], &fifoAccess[worker])) != 0)
+            throwThreadError(status, "Error on awaitTask() fifoEmpty wait");
+
+    task = taskFIFO[worker][ri[worker]];
+    if (task.byteCount != -1)
+        addQueuedCost(worker, -task.cost);
+    ri[worker] = (ri[worker] + 1) % fifoSize;
+    full[worker] = false;
+
+    if ((status = pthread_cond_signal(&fifoFull[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() fifoFull signal");
+
+    if ((status = pthread_mutex_unlock(&fifoAccess[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() unlock");
 
-    if ((status = pthread_mutex_unlock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on awaitFurtherInfo() awaitAccess unlock");
-}
\ No newline at end of file
+    return task;
+}
+
+/**
+ * @brief Block until a task is pushed for a remote worker or a timeout expires.
+ *
+ * Consumes every notification received so far, so queues must be checked after calling it.
+ *
+ * @param timeout longest wait in nanoseconds, 0 to only consume notifications, negative to wait indefinitely
+ * @return if any task was pushed for a remote worker since the last call
+ */
+bool awaitFurtherTasks(long timeout)
+{
+    struct pollfd event = {.fd = newTaskEvent, .events = POLLIN};
+    struct timespec wait = {.tv_sec = timeout / 1000000000L, .tv_nsec = timeout % 1000000000L};
+
+    if (timeout != 0 && ppoll(&event, 1, timeout < 0 ? NULL : &wait, NULL) < 0 && errno != EINTR)
+        throwThreadError(errno, "Error on awaitFurtherTasks() newTaskEvent poll");
+
+    // reading resets the counter, fails with EAGAIN if nothing was pushed
+    uint64_t pushed;
+    return read(newTaskEvent, &pushed, sizeof(pushed)) == sizeof(pushed);
+}
@@ -17,14 +17,14 @@
 /**
  * @brief Struct containing the results calculated from a file.
  *
- * @param chunks the number of chunks read from the file
+ * Laid out as three ints so that an array of them can be reduced as is.
+ *
  * @param vowelStartCount number of words that start with a vowel in the file
  * @param consonantEndCount number of words that end with a consonant in the file
  * @param wordCount number of words in the file
  */
 typedef struct Result
 {
-    int chunks;
     int vowelStartCount;
     int consonantEndCount;
     int wordCount;
@@ -35,11 +35,19 @@ typedef struct Result
  *
  * @param byteCount number of bytes read from the file
  * @param bytes array with the bytes read from the file
+ * @param fileIndex index of the file the bytes were read from
+ * @param compressed if the bytes hold the chunk compressed
+ * @param cost estimated cost of the task, its number of bytes
+ * @param queuedAt monotonic time, in nanoseconds, at which the task was pushed into a queue
  */
 typedef struct Task
 {
     int byteCount;
     char *bytes;
+    int fileIndex;
+    bool compressed;
+    double cost;
+    long queuedAt;
 } Task;
 
 /** @brief Number of files to be processed. */
@@ -51,6 +59,15 @@ extern char **files;
 /** @brief Total process count. Includes rank 0. */
 extern int processCount;
 
+/** @brief Number of compute threads running on rank 0. */
+extern int localWorkerCount;
+
+/** @brief Number of task queues, remote workers (rank minus 1) followed by rank 0 compute threads. */
+extern int workerCount;
+
+/** @brief Bandwidth of the link out of rank 0, in bytes per second, 0 to never compress chunks. */
+extern double linkBandwidth;
+
 /**
  * @brief Initializes the shared region.
  *
@@ -59,9 +76,12 @@ extern int processCount;
  * @param _totalFileCount number of files to be processed
  * @param _files array with the file names of all files
  * @param _processCount total process count
+ * @param _localWorkerCount number of compute threads running on rank 0
  * @param _fifoSize number of tasks that can be queued up for each worker
+ * @param _linkBandwidth bandwidth of the link out of rank 0, in bytes per second, 0 to never compress chunks
  */
-extern void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _fifoSize);
+extern void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _localWorkerCount, int _fifoSize,
+                             double _linkBandwidth);
 
 /**
  * @brief Frees all memory allocated during initialization of the shared region or the results.
@@ -71,51 +91,42 @@ extern void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount],
 extern void freeSharedRegion();
 
 /**
- * @brief Initializes the result of the next file.
- */
-extern void initResult();
-
-/**
- * @brief Used when dispatcher has finished reading so that hasMoreChunks() can handle the last file.
- */
-extern void finishedReading();
-
-/**
- * @brief Increment the chunks read by 1.
+ * @brief Adds the totals a thread gathered over all files into the results.
  *
- * @param fileIndex index of the file
+ * @param totals results of the thread, one per file
  */
-extern void incrementChunks(int fileIndex);
+extern void mergeResults(Result *totals);
 
 /**
- * @brief Allows merger to get a result object, will block until result at index has been initialized.
+ * @brief Gets the results of all files.
  *
- * @param fileIndex index of the file
+ * @return Result struct array with all the results
  */
-extern Result *getResultToUpdate(int fileIndex);
+extern Result *getResults();
 
 /**
- * @brief Will wait until there are more chunks to be used in the file or all chunks have already been used.
+ * @brief Gets the current time of the monotonic clock.
  *
- * @param fileIndex index of the file
- * @param currentChunk last chunk to be used
- * @return if there are more chunks of the file to be used
+ * @return time in nanoseconds
  */
-extern bool hasMoreChunks(int fileIndex, int currentChunk);
+extern long monotonicTime();
 
 /**
- * @brief Gets the results of all files.
+ * @brief Picks the worker with the least work queued.
  *
- * @return Result struct array with all the results
+ * Workers report nothing back until the end, so the queued cost is dropped as soon as a task leaves its queue.
+ * All workers are taken to be equally fast, so the cost of the task itself would not change the pick.
+ *
+ * @return index of the worker queue
  */
-extern Result *getResults();
+extern int pickWorker();
 
 /**
  * @brief Pushes a chunk to a given worker's queue.
  *
- * Notifies anyone inside awaitFurtherTasks.
+ * Counts its cost as queued for that worker and notifies anyone inside awaitFurtherTasks.
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task task that worker must perform
  */
 extern void pushTaskToSender(int worker, Task task);
@@ -123,15 +134,30 @@ extern void pushTaskToSender(int worker, Task task);
 /**
  * @brief Get a task for a given worker
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task a task meant for the worker
  * @return if getTask was successful (fifo was not empty)
  */
 extern bool getTask(int worker, Task *task);
 
 /**
- * @brief Block until there are pending tasks.
+ * @brief Get a task for a given worker, blocking until one is available.
+ *
+ * Used by the compute threads of rank 0, which have no sender between them and their queue.
+ *
+ * @param worker index of the worker queue
+ * @return a task meant for the worker
+ */
+extern Task awaitTask(int worker);
+
+/**
+ * @brief Block until a task is pushed for a remote worker or a timeout expires.
+ *
+ * Consumes every notification received so far, so queues must be checked after calling it.
+ *
+ * @param timeout longest wait in nanoseconds, 0 to only consume notifications, negative to wait indefinitely
+ * @return if any task was pushed for a remote worker since the last call
  */
-extern void awaitFurtherTasks();
+extern bool awaitFurtherTasks(long timeout);
 
 #endif
\ No newline at end of file
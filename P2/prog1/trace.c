@@ -0,0 +1,323 @@
+/**
+ * @file trace.c (implementation file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * Timeline of every rank and thread, written as a Chrome trace that chrome://tracing or Perfetto can load.
+ *
+ * Only compiled in with -DTRACE, otherwise every macro expands to nothing.
+ * Each thread records begin and end events into a buffer of its own, allocated when the thread names itself,
+ * before its first span, and the buffers of all ranks are gathered by rank 0 at shutdown.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifdef TRACE
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "trace.h"
+
+/** @brief Max number of threads of a rank that can record events, the events of later ones are dropped. */
+#define MAX_TRACE_THREADS 64
+
+/** @brief Number of events each thread can record, later ones are dropped. */
+#define TRACE_CAPACITY (1 << 16)
+
+/**
+ * @brief Struct relative to a single event.
+ *
+ * @param name name of the span
+ * @param phase 'B' for its begin, 'E' for its end
+ * @param time monotonic time, in nanoseconds, at which it happened
+ */
+typedef struct TraceEvent
+{
+    const char *name;
+    char phase;
+    long time;
+} TraceEvent;
+
+/**
+ * @brief Struct containing the events of a thread.
+ *
+ * @param name name of the thread
+ * @param count number of events recorded
+ * @param dropped number of events that did not fit
+ * @param events array of TRACE_CAPACITY events, NULL if it could not be allocated
+ */
+typedef struct TraceBuffer
+{
+    const char *name;
+    int count;
+    int dropped;
+    TraceEvent *events;
+} TraceBuffer;
+
+/** @brief Buffers of all threads that recorded events. */
+static TraceBuffer buffers[MAX_TRACE_THREADS];
+
+/** @brief Number of buffers taken, threads claim theirs without locking. */
+static atomic_int bufferCount;
+
+/** @brief Buffer of the calling thread, NULL until it records. */
+static _Thread_local TraceBuffer *threadBuffer;
+
+/** @brief If the calling thread found no buffer left, so that it only tries to claim one once. */
+static _Thread_local bool threadUnbuffered;
+
+/** @brief Number of threads that found no buffer left. */
+static atomic_int unbufferedThreads;
+
+/** @brief Number of events of the threads without a buffer, all dropped. */
+static atomic_long unbufferedEvents;
+
+/** @brief Monotonic time, in nanoseconds, at which all timelines start. */
+static long traceStart;
+
+/** @brief Rank of this process. */
+static int traceRank;
+
+/**
+ * @brief Gets the current time of the monotonic clock.
+ *
+ * @return time in nanoseconds
+ */
+static long traceTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * @brief Gets the buffer of the calling thread, claiming and allocating one the first time.
+ *
+ * Threads name themselves before their first span, so the allocation is not counted in any of them.
+ *
+ * @return buffer of the thread, NULL if there are none left
+ */
+static TraceBuffer *getThreadBuffer()
+{
+    if (threadBuffer == NULL && !threadUnbuffered)
+    {
+        int index = atomic_fetch_add(&bufferCount, 1);
+        if (index >= MAX_TRACE_THREADS)
+        {
+            threadUnbuffered = true;
+            atomic_fetch_add(&unbufferedThreads, 1);
+            return NULL;
+        }
+
+        threadBuffer = &buffers[index];
+        threadBuffer->name = "thread";
+        threadBuffer->count = 0;
+        threadBuffer->dropped = 0;
+        threadBuffer->events = malloc(sizeof(TraceEvent) * TRACE_CAPACITY);
+    }
+    return threadBuffer;
+}
+
+/**
+ * @brief Records an event on the calling thread.
+ *
+ * @param name name of the span
+ * @param phase 'B' for its begin, 'E' for its end
+ */
+static void record(const char *name, char phase)
+{
+    long time = traceTime();
+    TraceBuffer *buffer = getThreadBuffer();
+    if (buffer == NULL)
+    {
+        atomic_fetch_add(&unbufferedEvents, 1);
+        return;
+    }
+
+    // without events, the buffer still counts how many were dropped
+    if (buffer->events == NULL || buffer->count == TRACE_CAPACITY)
+    {
+        buffer->dropped++;
+        return;
+    }
+    buffer->events[buffer->count++] = (TraceEvent){.name = name, .phase = phase, .time = time};
+}
+
+/**
+ * @brief Starts the timeline of this rank.
+ *
+ * Collective, ranks synchronize so that their timelines share an origin.
+ */
+void initTrace()
+{
+    MPI_Comm_rank(MPI_COMM_WORLD, &traceRank);
+    atomic_store(&bufferCount, 0);
+    atomic_store(&unbufferedThreads, 0);
+    atomic_store(&unbufferedEvents, 0);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    traceStart = traceTime();
+}
+
+/**
+ * @brief Names the calling thread in the timeline and allocates its buffer.
+ *
+ * @param name name of the thread, must outlive the trace
+ */
+void traceThread(const char *name)
+{
+    TraceBuffer *buffer = getThreadBuffer();
+    if (buffer != NULL)
+        buffer->name = name;
+}
+
+/**
+ * @brief Records the start of a span on the calling thread.
+ *
+ * @param name name of the span, must outlive the trace
+ */
+void traceBegin(const char *name)
+{
+    record(name, 'B');
+}
+
+/**
+ * @brief Records the end of the innermost open span on the calling thread.
+ *
+ * @param name name of the span, must outlive the trace
+ */
+void traceEnd(const char *name)
+{
+    record(name, 'E');
+}
+
+/**
+ * @brief Appends formatted text to a growable string.
+ *
+ * @param text string to append to, reallocated as needed
+ * @param length length of the string
+ * @param capacity allocated size of the string
+ * @param format printf format of the text
+ */
+static void append(char **text, int *length, int *capacity, const char *format, ...)
+{
+    va_list args;
+
+    while (true)
+    {
+        va_start(args, format);
+        int written = vsnprintf(*text + *length, *capacity - *length, format, args);
+        va_end(args);
+
+        if (written < *capacity - *length)
+        {
+            *length += written;
+            return;
+        }
+        *capacity = 2 * *capacity + written;
+        *text = realloc(*text, *capacity);
+    }
+}
+
+/**
+ * @brief Gathers the timelines of all ranks into rank 0, which writes them to a file.
+ *
+ * Collective, must be called once every thread has stopped recording.
+ *
+ * @param fileName name of the trace file
+ */
+void writeTrace(const char *fileName)
+{
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // events of this rank as JSON objects, each followed by a comma
+    int length = 0, capacity = 1 << 16;
+    char *text = malloc(capacity);
+    text[0] = '\0';
+
+    append(&text, &length, &capacity, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}},\n",
+           traceRank, traceRank);
+
+    int threads = atomic_load(&bufferCount);
+    if (threads > MAX_TRACE_THREADS)
+        threads = MAX_TRACE_THREADS;
+    int fullThreads = 0, unallocatedThreads = 0;
+    long fullEvents = 0, unallocatedEvents = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        TraceBuffer *buffer = &buffers[t];
+        append(&text, &length, &capacity, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+               traceRank, t, buffer->name);
+        if (buffer->events == NULL)
+        {
+            unallocatedThreads++;
+            unallocatedEvents += buffer->dropped;
+        }
+        else if (buffer->dropped > 0)
+        {
+            fullThreads++;
+            fullEvents += buffer->dropped;
+        }
+
+        for (int e = 0; e < buffer->count; e++)
+            append(&text, &length, &capacity, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+                   buffer->events[e].name, buffer->events[e].phase, (buffer->events[e].time - traceStart) / 1000.0, traceRank, t);
+        free(buffer->events);
+    }
+
+    // spans of these threads may have lost their begin or their end
+    if (fullThreads > 0)
+        fprintf(stderr, "Trace of rank %d: %d threads filled their %d events and dropped %ld more\n", traceRank, fullThreads,
+                TRACE_CAPACITY, fullEvents);
+    if (unallocatedThreads > 0)
+        fprintf(stderr, "Trace of rank %d: %d threads could not allocate their buffer and dropped all their %ld events\n",
+                traceRank, unallocatedThreads, unallocatedEvents);
+    if (atomic_load(&unbufferedThreads) > 0)
+        fprintf(stderr, "Trace of rank %d: %d threads past the first %d had no buffer and dropped all their %ld events\n",
+                traceRank, atomic_load(&unbufferedThreads), MAX_TRACE_THREADS, atomic_load(&unbufferedEvents));
+
+    // rank 0 collects the text of every rank in order
+    int lengths[size], displacements[size];
+    MPI_Gather(&length, 1, MPI_INT, lengths, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    char *all = NULL;
+    int total = 0;
+    if (traceRank == 0)
+    {
+        for (int r = 0; r < size; r++)
+        {
+            displacements[r] = total;
+            total += lengths[r];
+        }
+        all = malloc(total + 1);
+    }
+    MPI_Gatherv(text, length, MPI_CHAR, all, lengths, displacements, MPI_CHAR, 0, MPI_COMM_WORLD);
+    free(text);
+
+    if (traceRank == 0)
+    {
+        FILE *file = fopen(fileName, "w");
+        if (file == NULL)
+            perror("Error on opening the trace file");
+        else
+        {
+            // every rank wrote at least its name, drop the comma after the last object
+            fprintf(file, "{\"traceEvents\":[\n");
+            fwrite(all, 1, total - 2, file);
+            fprintf(file, "\n]}\n");
+            fclose(file);
+        }
+        free(all);
+    }
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * @file trace.h (interface file)
+ *
+ * @brief Problem name: multiprocess word count with multithreaded dispatcher
+ *
+ * Timeline of every rank and thread, written as a Chrome trace that chrome://tracing or Perfetto can load.
+ *
+ * Only compiled in with -DTRACE, otherwise every macro expands to nothing.
+ * Each thread records begin and end events into a buffer of its own, allocated when the thread names itself,
+ * before its first span, and the buffers of all ranks are gathered by rank 0 at shutdown.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifdef TRACE
+
+/**
+ * @brief Starts the timeline of this rank.
+ *
+ * Collective, ranks synchronize so that their timelines share an origin.
+ */
+extern void initTrace();
+
+/**
+ * @brief Names the calling thread in the timeline and allocates its buffer.
+ *
+ * Must come before the first span of the thread, so that the allocation is not counted in it.
+ *
+ * @param name name of the thread, must outlive the trace
+ */
+extern void traceThread(const char *name);
+
+/**
+ * @brief Records the start of a span on the calling thread.
+ *
+ * @param name name of the span, must outlive the trace
+ */
+extern void traceBegin(const char *name);
+
+/**
+ * @brief Records the end of the innermost open span on the calling thread.
+ *
+ * @param name name of the span, must outlive the trace
+ */
+extern void traceEnd(const char *name);
+
+/**
+ * @brief Gathers the timelines of all ranks into rank 0, which writes them to a file.
+ *
+ * Collective, must be called once every thread has stopped recording.
+ *
+ * @param fileName name of the trace file
+ */
+extern void writeTrace(const char *fileName);
+
+#define TRACE_INIT() initTrace()
+#define TRACE_THREAD(name) traceThread(name)
+#define TRACE_BEGIN(name) traceBegin(name)
+#define TRACE_END(name) traceEnd(name)
+#define TRACE_WRITE() writeTrace(TRACE_FILE)
+
+/** @brief Name of the trace file written by rank 0. */
+#ifndef TRACE_FILE
+#define TRACE_FILE "trace.json"
+#endif
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_THREAD(name)
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_WRITE()
+
+#endif
+
+#endif
\ No newline at end of file
@@ -15,10 +15,16 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "worker.h"
 #include "utfUtils.h"
-#include "sharedRegion.h" // only used for the structs
+#include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "trace.h"
+#include "compression.h"
+#include "transport.h"
 
 /**
  * @brief Reads an UTF-8 character from a byte array.
@@ -107,60 +113,201 @@ static Result parseTask(int byteCount, char *bytes)
     return result;
 }
 
+/**
+ * @brief Adds the result of a chunk to the totals of its file.
+ *
+ * @param totals totals per file, grown to fit the file index
+ * @param capacity number of files the totals fit
+ * @param fileIndex index of the file the chunk was read from
+ * @param result result of the chunk
+ */
+static void addToTotals(Result **totals, int *capacity, int fileIndex, Result result)
+{
+    if (fileIndex >= *capacity)
+    {
+        // files never seen start with no words
+        int grown = 2 * fileIndex + 1;
+        *totals = realloc(*totals, sizeof(Result) * grown);
+        memset(*totals + *capacity, 0, sizeof(Result) * (grown - *capacity));
+        *capacity = grown;
+    }
+
+    (*totals)[fileIndex].wordCount += result.wordCount;
+    (*totals)[fileIndex].vowelStartCount += result.vowelStartCount;
+    (*totals)[fileIndex].consonantEndCount += result.consonantEndCount;
+}
+
 /**
  * @brief Worker process loop.
  *
- * Receives tasks via send and returns results from tasks.
+ * Receives tasks via send and keeps the totals of every file, reduced into rank 0 once told to stop.
  */
 void whileTasksWorkAndSendResult()
 {
     int chunkSize;      // chunk size, in bytes
-    char *chunk;        // task
+    char *chunk = NULL; // task
     int currentMax = 0; // how many bytes have been allocated for chunks
+    int wireSize;       // size of the received message, in bytes
+    char *wire = NULL;  // compressed chunk
+    int wireMax = 0;    // how many bytes have been allocated for compressed chunks
     Result result;      // result of the task processing
-    int sendArray[3];
+    int descriptor[3];  // slot, size and file index of a chunk in the shared window
+
+    Result *totals = NULL; // totals of every file a chunk was received from
+    int totalsCapacity = 0;
+    int fileCount = 0; // files to reduce totals of, as told by the kill message
+
+    int rank = transportRank();
+
+    TransportMessage message; // handle to the probed message
+    TransportStatus status;   // tag and size of the probed message
+
+    TRACE_THREAD("worker");
 
-    MPI_Request req = MPI_REQUEST_NULL;
     while (true)
     {
-        // receive next task chunk size
-        MPI_Recv(&chunkSize, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        // wait for the next message, its size is only known once it arrives
+        TRACE_BEGIN("wait");
+        transportMprobe(0, TRANSPORT_ANY_TAG, &message, &status);
+        TRACE_END("wait");
 
         // signal to stop working
-        if (chunkSize < 1)
+        if (status.tag == KILL_TAG)
         {
-            // wait for last response to be read before shutdown
-            MPI_Wait(&req, MPI_STATUS_IGNORE);
+            // empty if rank 0 gave up before reading anything
+            chunkSize = transportGetCount(&status, TRANSPORT_INT);
+            transportMrecv(&fileCount, chunkSize, TRANSPORT_INT, &message);
             break;
         }
 
-        // if our current chunk buffer isnt large enough
-        if (chunkSize > currentMax)
+        if (status.tag == SHARED_TASK_TAG)
         {
-            // if matrix has not been allocated yet
-            if (currentMax == 0)
-                chunk = malloc(sizeof(char) * chunkSize);
+            // chunk was written into one of our slots of the shared window, read it in place
+            transportMrecv(descriptor, 3, TRANSPORT_INT, &message);
+            syncNodeMemory();
+            TRACE_BEGIN("compute");
+            result = parseTask(descriptor[1], nodeSlot(rank, descriptor[0]));
+            TRACE_END("compute");
+            addToTotals(&totals, &totalsCapacity, descriptor[2], result);
+        }
+        else
+        {
+            wireSize = transportGetCount(&status, TRANSPORT_CHAR);
+
+            // compressed chunks are received apart and decompressed into the chunk buffer
+            if (CHUNK_COMPRESSED(status.tag))
+            {
+                if (wireSize > wireMax)
+                {
+                    if (wireMax > 0)
+                        free(wire);
+                    wire = malloc(sizeof(char) * wireSize);
+
+                    wireMax = wireSize;
+                }
+
+                TRACE_BEGIN("receive");
+                transportMrecv(wire, wireSize, TRANSPORT_CHAR, &message);
+                TRACE_END("receive");
+                chunkSize = rawChunkSize(wire);
+            }
             else
-                chunk = realloc(chunk, sizeof(char) * chunkSize);
+                chunkSize = wireSize;
 
-            currentMax = chunkSize;
-        }
+            // if our current chunk buffer isnt large enough
+            if (chunkSize > currentMax)
+            {
+                // old contents are about to be overwritten, no need to realloc them
+                if (currentMax > 0)
+                    free(chunk);
+                chunk = malloc(sizeof(char) * chunkSize);
 
-        // receive chunk
-        MPI_Recv(chunk, chunkSize, MPI_CHAR, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        result = parseTask(chunkSize, chunk);
+                currentMax = chunkSize;
+            }
 
-        // wait for last send to cleared
-        if (req != MPI_REQUEST_NULL)
-            MPI_Wait(&req, MPI_STATUS_IGNORE);
+            if (CHUNK_COMPRESSED(status.tag))
+            {
+                TRACE_BEGIN("decompress");
+                int decompressed = decompressChunk(wireSize, wire, chunk);
+                TRACE_END("decompress");
+                if (decompressed < 0)
+                {
+                    // its counts would be missing from the totals, no result beats a wrong one
+                    fprintf(stderr, "Corrupt compressed chunk received by rank %d\n", rank);
+                    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                }
+            }
+            else
+            {
+                // receive chunk
+                TRACE_BEGIN("receive");
+                transportMrecv(chunk, chunkSize, TRANSPORT_CHAR, &message);
+                TRACE_END("receive");
+            }
 
-        // send back result
-        sendArray[0] = result.wordCount;
-        sendArray[1] = result.vowelStartCount;
-        sendArray[2] = result.consonantEndCount;
-        MPI_Isend(sendArray, 3, MPI_INT, 0, 0, MPI_COMM_WORLD, &req);
+            TRACE_BEGIN("compute");
+            result = parseTask(chunkSize, chunk);
+            TRACE_END("compute");
+            addToTotals(&totals, &totalsCapacity, CHUNK_FILE(status.tag), result);
+        }
     }
 
     if (currentMax > 0)
         free(chunk);
+    if (wireMax > 0)
+        free(wire);
+
+    // every file must have totals, even those no chunk came from
+    if (fileCount > 0)
+    {
+        addToTotals(&totals, &totalsCapacity, fileCount - 1, (Result){0});
+
+        TRACE_BEGIN("reduce");
+        transportReduceSum((int *)totals, 3 * fileCount);
+        TRACE_END("reduce");
+    }
+    free(totals);
+}
+
+/**
+ * @brief Rank 0 compute thread loop.
+ *
+ * Takes tasks straight from its queue in the shared region and keeps the totals of every file,
+ * merged into the results once told to stop.
+ *
+ * @param par pointer to the index of this thread among the rank 0 compute threads
+ * @return pointer to the identification of this thread
+ */
+void *whileLocalTasksWorkAndSendResult(void *par)
+{
+    int localId = *((int *)par);
+    Task task;
+    Result result;
+
+    // every file starts with no words
+    Result *totals = calloc(totalFileCount, sizeof(Result));
+    int totalsCapacity = totalFileCount;
+
+    TRACE_THREAD("compute thread");
+
+    while (true)
+    {
+        TRACE_BEGIN("wait");
+        task = awaitTask(processCount - 1 + localId);
+        TRACE_END("wait");
+        if (task.byteCount == -1)
+            break;
+
+        TRACE_BEGIN("compute");
+        result = parseTask(task.byteCount, task.bytes);
+        TRACE_END("compute");
+        free(task.bytes);
+
+        addToTotals(&totals, &totalsCapacity, task.fileIndex, result);
+    }
+
+    mergeResults(totals);
+    free(totals);
+
+    pthread_exit((int *)EXIT_SUCCESS);
 }
\ No newline at end of file
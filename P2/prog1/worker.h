@@ -15,8 +15,19 @@
 /**
  * @brief Worker process loop.
  *
- * Receives tasks via send and returns results from tasks.
+ * Receives tasks via send and keeps the totals of every file, reduced into rank 0 once told to stop.
  */
 extern void whileTasksWorkAndSendResult();
 
+/**
+ * @brief Rank 0 compute thread loop.
+ *
+ * Takes tasks straight from its queue in the shared region and keeps the totals of every file,
+ * merged into the results once told to stop.
+ *
+ * @param par pointer to the index of this thread among the rank 0 compute threads
+ * @return pointer to the identification of this thread
+ */
+extern void *whileLocalTasksWorkAndSendResult(void *par);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,276 @@
+/**
+ * @file aggregator.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Contains implementation of the aggregator process of a node.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "aggregator.h"
+#include "worker.h"
+#include "hierarchy.h"
+#include "protocol.h"
+#include "trace.h"
+#include "backoff.h"
+
+/** @brief Most batches held at once, so that the next one arrives while the last is handed out. */
+#define HELD_BATCHES 2
+
+/** @brief Most tasks each worker of the node is handed at once, so that it never waits for the next one. */
+#define TASKS_PER_WORKER 2
+
+/**
+ * @brief Struct relative to a batch received from rank 0.
+ *
+ * @param buffer batch as received, task count and orders followed by the matrices
+ * @param capacity number of doubles allocated for the buffer, only ever grown
+ * @param count number of tasks in the batch
+ * @param offsets position of each matrix in the buffer
+ * @param results determinant of each matrix
+ * @param handedOut number of tasks handed out to workers
+ * @param done number of results received
+ * @param sent if the results were sent to rank 0
+ */
+typedef struct Batch
+{
+    double *buffer;
+    int capacity;
+    int count;
+    long *offsets;
+    double *results;
+    int handedOut;
+    int done;
+    bool sent;
+} Batch;
+
+/**
+ * @brief Struct relative to a task handed out to a worker.
+ *
+ * @param batch index of the batch it belongs to
+ * @param task index of the task in its batch
+ */
+typedef struct HandedTask
+{
+    int batch;
+    int task;
+} HandedTask;
+
+/**
+ * @brief Receives a batch into a held batch, growing its buffer if needed.
+ *
+ * @param batch held batch to be overwritten
+ * @param message handle to the probed batch
+ * @param status status of the probed batch
+ */
+static void receiveBatch(Batch *batch, MPI_Message *message, MPI_Status *status)
+{
+    int size;
+    MPI_Get_count(status, MPI_DOUBLE, &size);
+
+    // old contents were sent already, no need to realloc them
+    if (size > batch->capacity)
+    {
+        if (batch->capacity > 0)
+            MPI_Free_mem(batch->buffer);
+        MPI_Alloc_mem(sizeof(double) * size, MPI_INFO_NULL, &batch->buffer);
+        batch->capacity = size;
+    }
+
+    TRACE_BEGIN("receive");
+    MPI_Mrecv(batch->buffer, size, MPI_DOUBLE, message, MPI_STATUS_IGNORE);
+    TRACE_END("receive");
+
+    // matrices follow the header one after the other
+    batch->count = (int)batch->buffer[0];
+    long offset = 1 + batch->count;
+    for (int t = 0; t < batch->count; t++)
+    {
+        int order = (int)batch->buffer[1 + t];
+        batch->offsets[t] = offset;
+        offset += (long)order * order;
+    }
+
+    batch->handedOut = 0;
+    batch->done = 0;
+    batch->sent = false;
+}
+
+/**
+ * @brief Aggregator process loop.
+ *
+ * Receives batches of tasks from rank 0, hands their tasks out to the workers of its node,
+ * and sends the results of each batch back in a single message, in the order batches came in.
+ * Once stopped, stops its workers and helps compute the matrices left for all processes together.
+ */
+void whileBatchesHandOutAndReduce()
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // workers of this node
+    int workers[size];
+    int nodeWorkerCount = 0;
+    for (int r = 0; r < size; r++)
+        if (r != rank && parentRank(r) == rank)
+            workers[nodeWorkerCount++] = r;
+
+    Batch batches[HELD_BATCHES];
+    int oldest = 0;    // index of the oldest held batch
+    int heldCount = 0; // number of held batches
+    for (int b = 0; b < HELD_BATCHES; b++)
+    {
+        batches[b].capacity = 0;
+        batches[b].offsets = malloc(sizeof(long) * batchSize);
+        batches[b].results = malloc(sizeof(double) * batchSize);
+    }
+
+    // send and result requests of the tasks handed to each worker, then the result send of each batch
+    int taskRequestCount = 2 * nodeWorkerCount * TASKS_PER_WORKER;
+    MPI_Request requests[taskRequestCount + HELD_BATCHES];
+    for (int i = 0; i < taskRequestCount + HELD_BATCHES; i++)
+        requests[i] = MPI_REQUEST_NULL;
+    int completed[taskRequestCount + HELD_BATCHES];
+    int completedCount;
+
+    // tasks handed to each worker, oldest first
+    HandedTask handed[nodeWorkerCount][TASKS_PER_WORKER];
+    int handedHead[nodeWorkerCount];
+    int handedCount[nodeWorkerCount];
+    for (int w = 0; w < nodeWorkerCount; w++)
+    {
+        handedHead[w] = 0;
+        handedCount[w] = 0;
+    }
+
+    bool stopping = false;
+    int distributedCount = 0; // matrices left for all processes once tasks run out
+    long backoff = MIN_BACKOFF;
+
+    TRACE_THREAD("aggregator");
+
+    while (!stopping || heldCount > 0)
+    {
+        bool progress = false;
+
+        // take the next batch if there is room for it
+        if (!stopping && heldCount < HELD_BATCHES)
+        {
+            int arrived;
+            MPI_Message message;
+            MPI_Status status;
+            MPI_Improbe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &arrived, &message, &status);
+            if (arrived && status.MPI_TAG == KILL_TAG)
+            {
+                // empty if rank 0 gave up before reading anything
+                int count;
+                MPI_Get_count(&status, MPI_INT, &count);
+                MPI_Mrecv(&distributedCount, count, MPI_INT, &message, MPI_STATUS_IGNORE);
+                stopping = true;
+                progress = true;
+            }
+            else if (arrived)
+            {
+                receiveBatch(&batches[(oldest + heldCount) % HELD_BATCHES], &message, &status);
+                heldCount++;
+                progress = true;
+            }
+        }
+
+        // reap completed sends and results
+        MPI_Testsome(taskRequestCount + HELD_BATCHES, requests, &completedCount, completed, MPI_STATUSES_IGNORE);
+        if (completedCount != MPI_UNDEFINED && completedCount > 0)
+            progress = true;
+
+        for (int w = 0; w < nodeWorkerCount; w++)
+        {
+            // results of a worker come back in the order it was handed tasks
+            while (handedCount[w] > 0)
+            {
+                int slot = w * TASKS_PER_WORKER + handedHead[w];
+                if (requests[2 * slot] != MPI_REQUEST_NULL || requests[2 * slot + 1] != MPI_REQUEST_NULL)
+                    break;
+                batches[handed[w][handedHead[w]].batch].done++;
+                handedHead[w] = (handedHead[w] + 1) % TASKS_PER_WORKER;
+                handedCount[w]--;
+            }
+
+            // hand out the next tasks, oldest batch first
+            while (handedCount[w] < TASKS_PER_WORKER)
+            {
+                int b = 0;
+                while (b < heldCount && batches[(oldest + b) % HELD_BATCHES].handedOut == batches[(oldest + b) % HELD_BATCHES].count)
+                    b++;
+                if (b == heldCount)
+                    break;
+
+                Batch *batch = &batches[(oldest + b) % HELD_BATCHES];
+                int task = batch->handedOut++;
+                int order = (int)batch->buffer[1 + task];
+
+                int next = (handedHead[w] + handedCount[w]) % TASKS_PER_WORKER;
+                int slot = w * TASKS_PER_WORKER + next;
+                handed[w][next] = (HandedTask){.batch = (oldest + b) % HELD_BATCHES, .task = task};
+                handedCount[w]++;
+
+                MPI_Isend(batch->buffer + batch->offsets[task], order * order, MPI_DOUBLE, workers[w], TASK_TAG, MPI_COMM_WORLD,
+                          &requests[2 * slot]);
+                MPI_Irecv(&batch->results[task], 1, MPI_DOUBLE, workers[w], RESULT_TAG, MPI_COMM_WORLD, &requests[2 * slot + 1]);
+                progress = true;
+            }
+        }
+
+        // results go back a whole batch at a time, in the order batches came in
+        while (heldCount > 0)
+        {
+            Batch *batch = &batches[oldest];
+            MPI_Request *request = &requests[taskRequestCount + oldest];
+            if (!batch->sent && batch->done == batch->count)
+            {
+                TRACE_BEGIN("send");
+                MPI_Isend(batch->results, batch->count, MPI_DOUBLE, 0, RESULT_TAG, MPI_COMM_WORLD, request);
+                TRACE_END("send");
+                batch->sent = true;
+                progress = true;
+            }
+            if (!batch->sent || *request != MPI_REQUEST_NULL)
+                break;
+
+            // results are out, the batch can be overwritten
+            oldest = (oldest + 1) % HELD_BATCHES;
+            heldCount--;
+        }
+
+        if (progress)
+            backoff = MIN_BACKOFF;
+        else
+        {
+            TRACE_BEGIN("wait");
+            backOff(backoff);
+            TRACE_END("wait");
+            backoff = nextBackoff(backoff);
+        }
+    }
+
+    // stop the workers of the node, telling them how many matrices to compute with everyone
+    for (int w = 0; w < nodeWorkerCount; w++)
+        MPI_Send(&distributedCount, 1, MPI_INT, workers[w], KILL_TAG, MPI_COMM_WORLD);
+
+    for (int b = 0; b < HELD_BATCHES; b++)
+    {
+        if (batches[b].capacity > 0)
+            MPI_Free_mem(batches[b].buffer);
+        free(batches[b].offsets);
+        free(batches[b].results);
+    }
+
+    whileDistributedTasksWork(distributedCount);
+}
@@ -0,0 +1,24 @@
+/**
+ * @file aggregator.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Contains implementation of the aggregator process of a node.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+/**
+ * @brief Aggregator process loop.
+ *
+ * Receives batches of tasks from rank 0, hands their tasks out to the workers of its node,
+ * and sends the results of each batch back in a single message, in the order batches came in.
+ * Once stopped, stops its workers and helps compute the matrices left for all processes together.
+ */
+extern void whileBatchesHandOutAndReduce();
+
+#endif
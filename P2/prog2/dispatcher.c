@@ -16,24 +16,61 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "dispatcher.h"
 #include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "distributedLU.h"
+#include "matrixPool.h"
+#include "hierarchy.h"
+#include "transport.h"
+#include "trace.h"
+#include "backoff.h"
 
 /**
- * @brief Thread that reads file contents into local buffers so they can be sent to workers in a round-robin fashion.
+ * @brief Orders tasks from the most to the least expensive, keeping file order among equals.
  *
- * Will block when pushing chunks if it builds a significant lead over sender.
+ * @param a first task
+ * @param b second task
+ * @return negative if a goes first, positive if b goes first
+ */
+static int compareTaskCost(const void *a, const void *b)
+{
+    const Task *taskA = a, *taskB = b;
+
+    if (taskA->cost != taskB->cost)
+        return taskA->cost > taskB->cost ? -1 : 1;
+    if (taskA->fileIndex != taskB->fileIndex)
+        return taskA->fileIndex - taskB->fileIndex;
+    return taskA->matrixIndex - taskB->matrixIndex;
+}
+
+/** @brief Largest size of the ring matrices are read into, in bytes. */
+static const long MATRIX_POOL_BYTES = 64L * 1024 * 1024;
+
+/**
+ * @brief Thread that reads file contents into the matrix pool so they can be sent to workers.
+ *
+ * Headers of all files are read first so that matrices can be dispatched largest first (LPT),
+ * each to the worker expected to finish it first, rank 0 compute threads included.
+ * Will block when pushing chunks if it builds a significant lead over sender,
+ * or when reading if the matrices not yet sent or computed fill up the pool.
  *
  * @return pointer to the identification of this thread
  */
 void *dispatchFileTasksIntoSender()
 {
-    int nextDispatch = 1;
+    TRACE_THREAD("reader");
+
+    // every matrix of every file, without its contents
+    Task *tasks = NULL;
+    int taskCount = 0;
+
     for (int fIdx = 0; fIdx < totalFileCount; fIdx++)
     {
-        char *filename = files[fIdx];
-        FILE *file = fopen(filename, "rb");
+        FILE *file = fopen(files[fIdx], "rb");
 
         // if file is a dud
         if (file == NULL)
@@ -49,146 +86,410 @@ void *dispatchFileTasksIntoSender()
         // order of the matrices in the file
         int order;
         fread(&order, 4, 1, file);
+        fclose(file);
+
+        // matrices this large are left for all processes to compute together at the end
+        if (distributedOrder > 0 && order >= distributedOrder)
+        {
+            for (int i = 0; i < count; i++)
+                deferDistributedTask(fIdx, i, order);
+            initResult(count);
+            continue;
+        }
 
         // init result struct
         initResult(count);
 
+        // gaussian elimination cost grows with the cube of the order
+        tasks = realloc(tasks, sizeof(Task) * (taskCount + count));
         for (int i = 0; i < count; i++)
-        {
-            // read matrix from file
-            Task task = {.order = order, .matrix = malloc(sizeof(double) * order * order)};
-            fread(task.matrix, 8, order * order, file);
+            tasks[taskCount++] = (Task){.order = order, .matrix = NULL, .fileIndex = fIdx, .matrixIndex = i,
+                                        .cost = (double)order * order * order};
+    }
 
-            // send task into respective queue, this may block
-            pushTaskToSender(nextDispatch - 1, task);
+    qsort(tasks, taskCount, sizeof(Task), compareTaskCost);
 
-            // advance dispatch number, wraps back to 1 after processCount
-            nextDispatch++;
-            if (nextDispatch >= processCount)
-                nextDispatch = 1;
+    // room for every matrix at once if they take less than the largest pool, the first one is the largest
+    long totalBytes = 0;
+    for (int i = 0; i < taskCount; i++)
+        totalBytes += sizeof(double) * (long)tasks[i].order * tasks[i].order;
+    if (taskCount > 0)
+        initMatrixPool(totalBytes < MATRIX_POOL_BYTES ? totalBytes : MATRIX_POOL_BYTES, tasks[0].order);
+
+    // equal orders come from the same file, so each file is still read in one go
+    FILE *file = NULL;
+    int openIndex = -1;
+    for (int i = 0; i < taskCount; i++)
+    {
+        Task task = tasks[i];
+        if (task.fileIndex != openIndex)
+        {
+            if (file != NULL)
+                fclose(file);
+            file = fopen(files[task.fileIndex], "rb");
+            openIndex = task.fileIndex;
         }
+
+        // read matrix from file, skipping the header and the matrices before it
+        TRACE_BEGIN("read");
+        task.matrix = acquireMatrix(task.order);
+        fseek(file, 8 + sizeof(double) * task.order * task.order * task.matrixIndex, SEEK_SET);
+        fread(task.matrix, 8, task.order * task.order, file);
+        TRACE_END("read");
+
+        // send task into the queue of the worker expected to finish it first, this may block
+        TRACE_BEGIN("push");
+        pushTaskToSender(pickWorker(task.cost), task);
+        TRACE_END("push");
     }
+    if (file != NULL)
+        fclose(file);
+    free(tasks);
 
-    // send signal to stop workers
+    // send signal to stop workers, those fed by an aggregator are stopped by it
     Task stop = {.order = -1, .matrix = NULL};
-    for (int i = 0; i < processCount - 1; i++)
-        pushTaskToSender(i, stop);
+    for (int i = 0; i < workerCount; i++)
+        if (i >= processCount - 1 || parentRank(i + 1) == 0)
+            pushTaskToSender(i, stop);
 
     pthread_exit((int *)EXIT_SUCCESS);
 }
 
+/** @brief Dispatch statistics gathered by the sender, read once it has finished. */
+static DispatchStats dispatchStats;
+
+/**
+ * @brief Sends a task toward a remote worker in a non-blocking manner.
+ *
+ * Workers on the node of rank 0 get the task through their next shared window slot when it fits.
+ *
+ * @param worker index of the worker queue, rank minus 1
+ * @param task task to be sent, its matrix must stay in the pool until the request completes
+ * @param nextSlot next shared window slot of the worker
+ * @param descriptor buffer for the slot descriptor, must stay allocated until the request completes
+ * @param request request handler of the send
+ */
+static void sendTask(int worker, Task *task, int *nextSlot, int descriptor[2], TransportRequest *request)
+{
+    int rank = worker + 1;
+    int taskBytes = (int)sizeof(double) * task->order * task->order;
+
+    if (fitsNodeMemory(rank, taskBytes))
+    {
+        // write task into the next slot of the worker and only send where it is
+        memcpy(nodeSlot(rank, *nextSlot), task->matrix, taskBytes);
+        syncNodeMemory();
+        descriptor[0] = *nextSlot;
+        descriptor[1] = task->order;
+        *nextSlot = (*nextSlot + 1) % NODE_SLOTS_PER_WORKER;
+
+        // synchronous, completion means the worker is done with the slot written before this one
+        transportIssend(descriptor, 2, TRANSPORT_INT, rank, SHARED_TASK_TAG, request);
+    }
+    else if (sharesNodeWithDispatcher(rank))
+        // too big for a slot, still synchronous so that the slot rotation holds
+        transportIssend(task->matrix, task->order * task->order, TRANSPORT_DOUBLE, rank, TASK_TAG, request);
+    else
+        // its order is implied by the message, workers receive it as plain doubles
+        transportIsend(task->matrix, task->order * task->order, TRANSPORT_DOUBLE, rank, TASK_TAG, request);
+}
+
+/**
+ * @brief Sends a batch of tasks toward an aggregator in a non-blocking manner.
+ *
+ * The header and every matrix are sent as a single message of doubles, straight from where they are through MPI.
+ *
+ * @param worker index of the worker queue, rank minus 1
+ * @param batch tasks to be sent, their matrices must stay in the pool until the request completes
+ * @param count number of tasks in the batch
+ * @param header buffer for the task count and orders, must stay allocated until the request completes
+ * @param request request handler of the send
+ */
+static void sendBatch(int worker, Task *batch, int count, double *header, TransportRequest *request)
+{
+    void *blocks[count + 1];
+    int blockLengths[count + 1];
+
+    header[0] = count;
+    blocks[0] = header;
+    blockLengths[0] = count + 1;
+    for (int t = 0; t < count; t++)
+    {
+        header[t + 1] = batch[t].order;
+        blocks[t + 1] = batch[t].matrix;
+        blockLengths[t + 1] = batch[t].order * batch[t].order;
+    }
+
+    transportIsendBlocks(count + 1, blocks, blockLengths, TRANSPORT_DOUBLE, worker + 1, BATCH_TAG, request);
+}
+
 /**
  * @brief Thread that emits chunks toward workers in a non-blocking manner.
  *
+ * Works as a progress engine: reaps completed sends with transportTestsome(), hands a new task to every idle worker,
+ * or a batch of every task queued to an idle aggregator, and when neither happens sleeps on the task queue notifier,
+ * for good if no sends are pending, or for an exponentially growing time otherwise.
+ *
+ * New tasks wake the sender right away, completed sends are polled for as backoff.h explains.
+ *
  * @return pointer to the identification of this thread
  */
 void *emitTasksToWorkers()
 {
+    int remoteCount = processCount - 1;
+
     // curently employed entities
-    bool working[processCount - 1];
-    int currentlyWorking = processCount - 1;
+    bool working[remoteCount];
+    int currentlyWorking = remoteCount;
 
-    // request handler objects, last chunk received
-    int requests[processCount - 1];
-    Task tasks[processCount - 1];
+    // request handler objects, last matrices sent to each worker, whether a worker's queue ended in a kill request
+    TransportRequest requests[remoteCount];
+    Task *batches[remoteCount];
+    int batchCounts[remoteCount];
+    bool stopping[remoteCount];
+
+    // most tasks taken at once for each worker, headers of the last batch sent to each aggregator
+    int batchLimits[remoteCount];
+    double *headers[remoteCount];
+
+    // next shared window slot of each worker, descriptors of the last task written into one
+    int nextSlot[remoteCount];
+    int descriptors[remoteCount][2];
+
+    // matrices left for all processes, known by the time workers are stopped
+    DistributedTask *distributedTasks;
+    int distributedCount;
 
     // init data for this function
-    for (int i = 0; i < processCount - 1; i++)
+    for (int i = 0; i < remoteCount; i++)
     {
-        requests[i] = MPI_REQUEST_NULL;
-        tasks[i].order = 0;
-        working[i] = true;
+        requests[i] = TRANSPORT_REQUEST_NULL;
+        working[i] = parentRank(i + 1) == 0;
+        if (!working[i])
+            currentlyWorking--;
+        stopping[i] = false;
+        nextSlot[i] = 0;
+
+        batchLimits[i] = isAggregator(i + 1) ? batchSize : 1;
+        batches[i] = malloc(sizeof(Task) * batchLimits[i]);
+        batchCounts[i] = 0;
+        headers[i] = isAggregator(i + 1) ? malloc(sizeof(double) * (batchSize + 1)) : NULL;
     }
 
-    // used to signal workers that no more tasks are coming
-    int killSignal = 0;
+    dispatchStats.taskCount = 0;
+    dispatchStats.totalLatency = 0;
+    dispatchStats.maxLatency = 0;
 
-    // only ever used to receive waitAny result
-    int lastFinish;
+    long backoff = MIN_BACKOFF;
 
-    int testStatus;
+    TRACE_THREAD("sender");
 
-    while (true)
+    while (currentlyWorking > 0)
     {
-        for (int i = 0; i < processCount - 1; i++)
+        bool progress = false;
+
+        // reap completed sends, these workers are ready for more
+        if (transportTestsome(remoteCount, requests) > 0)
+            progress = true;
+
+        // consume pending notifications, queues are checked right after
+        awaitFurtherTasks(0);
+
+        int pendingSends = 0;
+        for (int i = 0; i < remoteCount; i++)
         {
-            MPI_Test(requests + i, &testStatus, MPI_STATUS_IGNORE);
+            if (!transportRequestIsNull(requests + i))
+            {
+                pendingSends++;
+                continue;
+            }
+
+            // worker is either dead or still has its last task pending
+            if (!working[i])
+                continue;
 
-            // if worker is ready
-            if (working[i] && testStatus)
+            // give the matrices of the last tasks back to the pool
+            for (int t = 0; t < batchCounts[i]; t++)
+                releaseMatrix(batches[i][t].matrix);
+            batchCounts[i] = 0;
+
+            // take every task queued, up to what the worker takes at once, a kill request being the last one
+            Task task;
+            while (!stopping[i] && batchCounts[i] < batchLimits[i] && getTask(i, &task))
             {
-                // clear out last task
-                if (tasks[i].order > 0)
-                    free(tasks[i].matrix);
-
-                // try to get a new task
-                if (!getTask(i, tasks + i))
-                {
-                    // task get failed, we use this to avoid free in future loops
-                    tasks[i].order = 0;
-                }
+                if (task.order == -1)
+                    stopping[i] = true;
                 else
-                {
-                    // if is a kill request
-                    if (tasks[i].order == -1)
-                    {
-                        // signal worker to stop and mark this worker as dead
-                        currentlyWorking--;
-                        MPI_Isend(&killSignal, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                        working[i] = false;
-                        continue;
-                    }
-                    // send this task to worker in a non-blocking manner
-                    MPI_Isend(&tasks[i].order, 1, MPI_INT, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                    MPI_Request_free(requests + i);
-                    MPI_Isend(tasks[i].matrix, tasks[i].order * tasks[i].order, MPI_DOUBLE, i + 1, 0, MPI_COMM_WORLD, requests + i);
-                }
+                    batches[i][batchCounts[i]++] = task;
+            }
+
+            // nothing queued yet
+            if (batchCounts[i] == 0 && !stopping[i])
+                continue;
+
+            progress = true;
+            pendingSends++;
+
+            // kill request once every task before it was sent
+            if (batchCounts[i] == 0)
+            {
+                // signal worker to stop and mark this worker as dead, telling it how many matrices to compute with everyone
+                currentlyWorking--;
+                distributedCount = getDistributedTasks(&distributedTasks);
+                transportIsend(&distributedCount, 1, TRANSPORT_INT, i + 1, KILL_TAG, requests + i);
+                working[i] = false;
+                continue;
             }
+
+            long now = monotonicTime();
+            for (int t = 0; t < batchCounts[i]; t++)
+            {
+                double latency = (now - batches[i][t].queuedAt) / 1000000000.0;
+                dispatchStats.taskCount++;
+                dispatchStats.totalLatency += latency;
+                if (latency > dispatchStats.maxLatency)
+                    dispatchStats.maxLatency = latency;
+            }
+
+            TRACE_BEGIN("send");
+            if (headers[i] != NULL)
+                sendBatch(i, batches[i], batchCounts[i], headers[i], requests + i);
+            else
+                sendTask(i, batches[i], nextSlot + i, descriptors[i], requests + i);
+            TRACE_END("send");
         }
-        if (currentlyWorking > 0)
+
+        if (progress)
+            backoff = MIN_BACKOFF;
+        else if (pendingSends == 0)
         {
-            // wait for any chunks to be available and for a worker to be available
-            awaitFurtherTasks();
-            MPI_Waitany(processCount - 1, requests, &lastFinish, MPI_STATUS_IGNORE);
+            // every live worker is idle with nothing queued, only a new task can change that
+            TRACE_BEGIN("wait");
+            awaitFurtherTasks(-1);
+            TRACE_END("wait");
         }
         else
-            break;
+        {
+            // sends are in flight, sleep a little unless a task shows up meanwhile
+            TRACE_BEGIN("wait");
+            awaitFurtherTasks(backoff);
+            TRACE_END("wait");
+            backoff = nextBackoff(backoff);
+        }
     }
 
     // wait for all the kill messages to have been sent
-    for (int i = 0; i < processCount - 1; i++)
-        MPI_Wait(&requests[i], MPI_STATUS_IGNORE);
+    transportWaitall(remoteCount, requests);
+    for (int i = 0; i < remoteCount; i++)
+    {
+        free(batches[i]);
+        free(headers[i]);
+    }
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    dispatchStats.senderCpuTime = cpu.tv_sec + cpu.tv_nsec / 1000000000.0;
 
     pthread_exit((int *)EXIT_SUCCESS);
 }
 
+/**
+ * @brief Gets the statistics gathered by the sender.
+ *
+ * Only meaningful after emitTasksToWorkers() has finished.
+ *
+ * @return DispatchStats struct with the sender statistics
+ */
+DispatchStats getDispatchStats()
+{
+    return dispatchStats;
+}
+
+/**
+ * @brief Gets the worker queue a result came from.
+ *
+ * @param status status of the received result
+ * @return index of the worker queue
+ */
+static int resultWorker(TransportStatus *status)
+{
+    // rank 0 compute threads tell themselves apart by tag
+    if (status->source == 0)
+        return processCount - 1 + status->tag - LOCAL_RESULT_TAG;
+    return status->source - 1;
+}
+
 /**
  * @brief Thread that merges file chunks read by workers into their results structure.
  *
+ * Results are taken as they arrive from any worker and matched to the oldest task handed to it,
+ * those of a batch all at once and in the order its tasks were sent.
+ *
  * @return pointer to the identification of this thread
  */
 void *mergeChunks()
 {
-    int nextReceive = 1;
-
-    // for each file
+    // blocks until every results object has been initialized
+    int remaining = 0;
     for (int i = 0; i < totalFileCount; i++)
+        remaining += getResultToUpdate(i)->matrixCount;
+
+    // no worker gets the matrices left for all processes
+    DistributedTask *distributedTasks;
+    remaining -= getDistributedTasks(&distributedTasks);
+
+    TRACE_THREAD("merger");
+
+    // a single determinant unless it comes from an aggregator
+    double determinants[batchSize > 1 ? batchSize : 1];
+    int count;
+    TransportMessage message;
+    TransportStatus status;
+    while (remaining > 0)
     {
-        // blocks until this results object has been initialized
-        Result *res = getResultToUpdate(i);
+        // get determinants
+        TRACE_BEGIN("receive");
+        transportMprobe(TRANSPORT_ANY_SOURCE, TRANSPORT_ANY_TAG, &message, &status);
+        count = transportGetCount(&status, TRANSPORT_DOUBLE);
+        transportMrecv(determinants, count, TRANSPORT_DOUBLE, &message);
+        TRACE_END("receive");
 
-        // for each determinant
-        for (int k = 0; k < (*res).matrixCount; k++)
+        for (int i = 0; i < count; i++)
         {
-            // get determinant
-            MPI_Recv((*res).determinants + k, 1, MPI_DOUBLE, nextReceive, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            // advance receive number, wraps back to 1 after processCount
-            nextReceive++;
-            if (nextReceive >= processCount)
-                nextReceive = 1;
+            Assignment assignment = completeTask(resultWorker(&status));
+            getResultToUpdate(assignment.fileIndex)->determinants[assignment.matrixIndex] = determinants[i];
         }
+        remaining -= count;
     }
 
     pthread_exit((int *)EXIT_SUCCESS);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Computes the matrices left for all processes together, along with every worker.
+ *
+ * Each matrix is announced through broadcasts that workers wait for once they are stopped.
+ * Must be called after every other dispatcher thread has finished.
+ */
+void computeDistributedTasks()
+{
+    DistributedTask *distributedTasks;
+    int distributedCount = getDistributedTasks(&distributedTasks);
+
+    TRACE_THREAD("main");
+
+    for (int i = 0; i < distributedCount; i++)
+    {
+        DistributedTask task = distributedTasks[i];
+        char *fileName = files[task.fileIndex];
+
+        // file name length, matrix index, order
+        int header[3] = {strlen(fileName) + 1, task.matrixIndex, task.order};
+        MPI_Bcast(header, 3, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(fileName, header[0], MPI_CHAR, 0, MPI_COMM_WORLD);
+
+        TRACE_BEGIN("distributed LU");
+        getResultToUpdate(task.fileIndex)->determinants[task.matrixIndex] = distributedDeterminant(fileName, task.matrixIndex, task.order);
+        TRACE_END("distributed LU");
+    }
+}
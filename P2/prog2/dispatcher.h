@@ -13,26 +13,67 @@
 #define DISPATCHER_H_
 
 /**
- * @brief Thread that reads file contents into local buffers so they can be sent to workers in a round-robin fashion.
+ * @brief Thread that reads file contents into local buffers so they can be sent to workers.
  *
+ * Headers of all files are read first so that matrices can be dispatched largest first (LPT),
+ * each to the worker expected to finish it first, rank 0 compute threads included.
  * Will block when pushing chunks if it builds a significant lead over sender.
  *
  * @return pointer to the identification of this thread
  */
 extern void *dispatchFileTasksIntoSender();
 
+/**
+ * @brief Statistics gathered by the sender.
+ *
+ * @param taskCount number of tasks sent to remote workers
+ * @param totalLatency sum of the time, in seconds, tasks waited in a queue before being sent
+ * @param maxLatency longest time, in seconds, a task waited in a queue before being sent
+ * @param senderCpuTime CPU time, in seconds, used by the sender thread
+ */
+typedef struct DispatchStats
+{
+    int taskCount;
+    double totalLatency;
+    double maxLatency;
+    double senderCpuTime;
+} DispatchStats;
+
 /**
  * @brief Thread that emits chunks toward workers in a non-blocking manner.
  *
+ * Works as a progress engine: reaps completed sends with MPI_Testsome, hands a new task to every idle worker,
+ * and when neither happens sleeps on the task queue notifier, for good if no sends are pending,
+ * or for an exponentially growing time otherwise.
+ *
  * @return pointer to the identification of this thread
  */
 extern void *emitTasksToWorkers();
 
+/**
+ * @brief Gets the statistics gathered by the sender.
+ *
+ * Only meaningful after emitTasksToWorkers() has finished.
+ *
+ * @return DispatchStats struct with the sender statistics
+ */
+extern DispatchStats getDispatchStats();
+
 /**
  * @brief Thread that merges file chunks read by workers into their results structure.
  *
+ * Results are taken as they arrive from any worker and matched to the oldest task handed to it.
+ *
  * @return pointer to the identification of this thread
  */
 extern void *mergeChunks();
 
+/**
+ * @brief Computes the matrices left for all processes together, along with every worker.
+ *
+ * Each matrix is announced through broadcasts that workers wait for once they are stopped.
+ * Must be called after every other dispatcher thread has finished.
+ */
+extern void computeDistributedTasks();
+
 #endif
\ No newline at end of file
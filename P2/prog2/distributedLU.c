@@ -0,0 +1,278 @@
+/**
+ * @file distributedLU.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Determinant of a single matrix computed by all processes together.
+ *
+ * The matrix is dealt out 2D block-cyclically over a grid of every process and reduced through
+ * a right-looking LU factorization with partial pivoting, so no process ever holds all of it.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "distributedLU.h"
+
+/** @brief Order of the square blocks dealt out to the process grid. */
+#define BLOCK_ORDER 64
+
+/**
+ * @brief Struct matching MPI_DOUBLE_INT, used to find the pivot with MPI_MAXLOC.
+ *
+ * @param value absolute value of the candidate
+ * @param row global row of the candidate
+ */
+typedef struct Pivot
+{
+    double value;
+    int row;
+} Pivot;
+
+/**
+ * @brief Counts the rows (or columns) below a global index that a process of the grid holds.
+ *
+ * @param globalCount global index, the matrix order gives the total held
+ * @param gridIndex row (or column) of the process in the grid
+ * @param gridCount number of rows (or columns) of the grid
+ * @return number of local rows (or columns)
+ */
+static int localCount(int globalCount, int gridIndex, int gridCount)
+{
+    int blocks = globalCount / BLOCK_ORDER;
+    int count = blocks / gridCount * BLOCK_ORDER;
+    int extraBlocks = blocks % gridCount;
+
+    // whole leftover blocks go to the first processes, the partial one to the next
+    if (gridIndex < extraBlocks)
+        count += BLOCK_ORDER;
+    else if (gridIndex == extraBlocks)
+        count += globalCount % BLOCK_ORDER;
+    return count;
+}
+
+/**
+ * @brief Gets the grid row (or column) of the process that holds a global row (or column).
+ *
+ * @param globalIndex global row (or column)
+ * @param gridCount number of rows (or columns) of the grid
+ * @return row (or column) of the process in the grid
+ */
+static int owner(int globalIndex, int gridCount)
+{
+    return globalIndex / BLOCK_ORDER % gridCount;
+}
+
+/**
+ * @brief Gets the local index of a global row (or column) within the process that holds it.
+ *
+ * @param globalIndex global row (or column)
+ * @param gridCount number of rows (or columns) of the grid
+ * @return local row (or column)
+ */
+static int localIndex(int globalIndex, int gridCount)
+{
+    return globalIndex / (BLOCK_ORDER * gridCount) * BLOCK_ORDER + globalIndex % BLOCK_ORDER;
+}
+
+/**
+ * @brief Gets the global index of a local row (or column).
+ *
+ * @param localIndex local row (or column)
+ * @param gridIndex row (or column) of the process in the grid
+ * @param gridCount number of rows (or columns) of the grid
+ * @return global row (or column)
+ */
+static int globalIndex(int localIndex, int gridIndex, int gridCount)
+{
+    return (localIndex / BLOCK_ORDER * gridCount + gridIndex) * BLOCK_ORDER + localIndex % BLOCK_ORDER;
+}
+
+/**
+ * @brief Reads the blocks of a matrix held by this process, in row-major order.
+ *
+ * @param fileName name of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order order of the matrix
+ * @param dims number of rows and columns of the grid
+ * @param block buffer for the local rows times local columns elements
+ * @param elementCount number of elements held by this process
+ */
+static void readBlocks(char *fileName, int matrixIndex, int order, int dims[2], double *block, int elementCount)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // view of the matrix that only shows the blocks of this process
+    int sizes[2] = {order, order};
+    int distributions[2] = {MPI_DISTRIBUTE_CYCLIC, MPI_DISTRIBUTE_CYCLIC};
+    int blockOrders[2] = {BLOCK_ORDER, BLOCK_ORDER};
+    MPI_Datatype view;
+    MPI_Type_create_darray(size, rank, 2, sizes, distributions, blockOrders, dims, MPI_ORDER_C, MPI_DOUBLE, &view);
+    MPI_Type_commit(&view);
+
+    // skip the header and the matrices before this one
+    MPI_Offset displacement = 8 + (MPI_Offset)sizeof(double) * order * order * matrixIndex;
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Error on opening %s for a distributed determinant\n", fileName);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    MPI_File_set_view(file, displacement, MPI_DOUBLE, view, "native", MPI_INFO_NULL);
+    MPI_File_read_all(file, block, elementCount, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+
+    MPI_Type_free(&view);
+}
+
+/**
+ * @brief Calculates the determinant of a matrix with all processes of MPI_COMM_WORLD.
+ *
+ * Collective, every process must call it with the same arguments.
+ * Each process reads its own blocks straight from the file, which must be reachable by all of them.
+ *
+ * @param fileName name of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order order of the matrix
+ * @return determinant of the matrix, only meaningful on rank 0
+ */
+double distributedDeterminant(char *fileName, int matrixIndex, int order)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // as square a grid as the process count allows, ranks laid out row by row
+    int dims[2] = {0, 0};
+    MPI_Dims_create(size, 2, dims);
+    int gridRow = rank / dims[1];
+    int gridColumn = rank % dims[1];
+
+    // processes in the same grid row, ranked by column, and in the same grid column, ranked by row
+    MPI_Comm rowComm, columnComm;
+    MPI_Comm_split(MPI_COMM_WORLD, gridRow, gridColumn, &rowComm);
+    MPI_Comm_split(MPI_COMM_WORLD, gridColumn, gridRow, &columnComm);
+
+    int rows = localCount(order, gridRow, dims[0]);
+    int columns = localCount(order, gridColumn, dims[1]);
+    double *block = malloc(sizeof(double) * (rows * columns > 0 ? rows * columns : 1));
+    readBlocks(fileName, matrixIndex, order, dims, block, rows * columns);
+
+    // pivot row from column k onward, and multipliers of the rows below it
+    double *pivotRow = malloc(sizeof(double) * (columns + 1));
+    double *multipliers = malloc(sizeof(double) * (rows + 1));
+
+    double product = 1; // product of the diagonal elements held by this process
+    int swaps = 0;      // row swaps, every process counts all of them
+    bool singular = false;
+
+    for (int k = 0; k < order; k++)
+    {
+        int rowOwner = owner(k, dims[0]);
+        int columnOwner = owner(k, dims[1]);
+
+        // first local row at or below k, first local column at or after k, and after k
+        int firstRow = localCount(k, gridRow, dims[0]);
+        int firstColumn = localCount(k, gridColumn, dims[1]);
+        int nextColumn = localCount(k + 1, gridColumn, dims[1]);
+
+        // largest element of column k at or below the diagonal, searched by the process column that holds it
+        Pivot pivot = {.value = -1, .row = order};
+        if (gridColumn == columnOwner)
+        {
+            int column = localIndex(k, dims[1]);
+            for (int i = firstRow; i < rows; i++)
+                if (fabs(block[i * columns + column]) > pivot.value)
+                {
+                    pivot.value = fabs(block[i * columns + column]);
+                    pivot.row = globalIndex(i, gridRow, dims[0]);
+                }
+            MPI_Allreduce(MPI_IN_PLACE, &pivot, 1, MPI_DOUBLE_INT, MPI_MAXLOC, columnComm);
+        }
+        MPI_Bcast(&pivot, 1, MPI_DOUBLE_INT, columnOwner, rowComm);
+
+        // every process knows the column is all zeros
+        if (pivot.value == 0)
+        {
+            singular = true;
+            break;
+        }
+
+        // swap rows k and pivot.row from column k onward, each process column swapping its own part
+        if (pivot.row != k)
+        {
+            swaps++;
+            int pivotOwner = owner(pivot.row, dims[0]);
+            int pivotLocal = localIndex(pivot.row, dims[0]);
+            int kLocal = localIndex(k, dims[0]);
+            int count = columns - firstColumn;
+
+            if (gridRow == rowOwner && gridRow == pivotOwner)
+            {
+                for (int j = firstColumn; j < columns; j++)
+                {
+                    double temp = block[kLocal * columns + j];
+                    block[kLocal * columns + j] = block[pivotLocal * columns + j];
+                    block[pivotLocal * columns + j] = temp;
+                }
+            }
+            else if (gridRow == rowOwner)
+                MPI_Sendrecv_replace(block + kLocal * columns + firstColumn, count, MPI_DOUBLE, pivotOwner, 0, pivotOwner, 0,
+                                     columnComm, MPI_STATUS_IGNORE);
+            else if (gridRow == pivotOwner)
+                MPI_Sendrecv_replace(block + pivotLocal * columns + firstColumn, count, MPI_DOUBLE, rowOwner, 0, rowOwner, 0,
+                                     columnComm, MPI_STATUS_IGNORE);
+        }
+
+        // pivot row goes down every process column, the one holding column k gets the pivot first
+        if (gridRow == rowOwner)
+            for (int j = firstColumn; j < columns; j++)
+                pivotRow[j - firstColumn] = block[localIndex(k, dims[0]) * columns + j];
+        MPI_Bcast(pivotRow, columns - firstColumn, MPI_DOUBLE, rowOwner, columnComm);
+
+        // multipliers of the rows below k go along every process row
+        int nextRow = localCount(k + 1, gridRow, dims[0]);
+        if (gridColumn == columnOwner)
+        {
+            int column = localIndex(k, dims[1]);
+            for (int i = nextRow; i < rows; i++)
+                multipliers[i - nextRow] = block[i * columns + column] / pivotRow[0];
+
+            // diagonal element of the triangular matrix
+            if (gridRow == rowOwner)
+                product *= pivotRow[0];
+        }
+        MPI_Bcast(multipliers, rows - nextRow, MPI_DOUBLE, columnOwner, rowComm);
+
+        // eliminate column k from the trailing matrix
+        for (int i = nextRow; i < rows; i++)
+        {
+            double term = multipliers[i - nextRow];
+            double *row = block + i * columns;
+            for (int j = nextColumn; j < columns; j++)
+                row[j] -= term * pivotRow[j - firstColumn];
+        }
+    }
+
+    double determinant;
+    MPI_Reduce(&product, &determinant, 1, MPI_DOUBLE, MPI_PROD, 0, MPI_COMM_WORLD);
+
+    free(block);
+    free(pivotRow);
+    free(multipliers);
+    MPI_Comm_free(&rowComm);
+    MPI_Comm_free(&columnComm);
+
+    if (singular)
+        return 0;
+    return swaps % 2 == 0 ? determinant : -determinant;
+}
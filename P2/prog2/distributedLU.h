@@ -0,0 +1,31 @@
+/**
+ * @file distributedLU.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Determinant of a single matrix computed by all processes together.
+ *
+ * The matrix is dealt out 2D block-cyclically over a grid of every process and reduced through
+ * a right-looking LU factorization with partial pivoting, so no process ever holds all of it.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef DISTRIBUTED_LU_H_
+#define DISTRIBUTED_LU_H_
+
+/**
+ * @brief Calculates the determinant of a matrix with all processes of MPI_COMM_WORLD.
+ *
+ * Collective, every process must call it with the same arguments.
+ * Each process reads its own blocks straight from the file, which must be reachable by all of them.
+ *
+ * @param fileName name of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order order of the matrix
+ * @return determinant of the matrix, only meaningful on rank 0
+ */
+extern double distributedDeterminant(char *fileName, int matrixIndex, int order);
+
+#endif
\ No newline at end of file
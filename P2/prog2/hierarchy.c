@@ -0,0 +1,97 @@
+/**
+ * @file hierarchy.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Two-level dispatch, where rank 0 hands batches of tasks to one aggregator rank per node
+ * instead of feeding every worker of that node on its own.
+ *
+ * The aggregator of a node is its lowest rank, and its workers are the other ranks of the node.
+ * Workers on the node of rank 0, and nodes with a single rank, are still fed by rank 0 directly.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hierarchy.h"
+
+/** @brief Most tasks rank 0 hands an aggregator at once, 0 if tasks are not dispatched through aggregators. */
+int batchSize;
+
+/** @brief Lowest rank of the node of each rank. */
+static int *nodeLeaders = NULL;
+
+/** @brief Number of ranks on the node of each rank. */
+static int *nodeSizes = NULL;
+
+/**
+ * @brief Finds the aggregator of every node.
+ *
+ * Collective over MPI_COMM_WORLD, every rank must call it with the same batch size.
+ *
+ * @param _batchSize most tasks rank 0 hands an aggregator at once, 0 to feed every worker from rank 0
+ */
+void initHierarchy(int _batchSize)
+{
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    batchSize = _batchSize;
+    if (batchSize <= 0)
+        return;
+
+    MPI_Comm nodeComm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+
+    int leader, nodeSize;
+    MPI_Allreduce(&rank, &leader, 1, MPI_INT, MPI_MIN, nodeComm);
+    MPI_Comm_size(nodeComm, &nodeSize);
+    MPI_Comm_free(&nodeComm);
+
+    // every rank needs to know the node of every other one
+    nodeLeaders = malloc(sizeof(int) * size);
+    nodeSizes = malloc(sizeof(int) * size);
+    MPI_Allgather(&leader, 1, MPI_INT, nodeLeaders, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allgather(&nodeSize, 1, MPI_INT, nodeSizes, 1, MPI_INT, MPI_COMM_WORLD);
+}
+
+/**
+ * @brief Frees the memory used to describe the hierarchy.
+ */
+void freeHierarchy()
+{
+    free(nodeLeaders);
+    free(nodeSizes);
+    nodeLeaders = NULL;
+    nodeSizes = NULL;
+}
+
+/**
+ * @brief Checks if a rank gets batches from rank 0 and hands their tasks to the workers of its node.
+ *
+ * @param rank rank to be checked
+ * @return if the rank is an aggregator
+ */
+bool isAggregator(int rank)
+{
+    // rank 0 feeds its own node, a node without workers needs no aggregator
+    return nodeLeaders != NULL && nodeLeaders[rank] == rank && nodeLeaders[rank] != nodeLeaders[0] && nodeSizes[rank] > 1;
+}
+
+/**
+ * @brief Gets the rank that hands tasks to a worker and takes back its results.
+ *
+ * @param rank rank of the worker
+ * @return rank 0 or the aggregator of its node
+ */
+int parentRank(int rank)
+{
+    if (nodeLeaders != NULL && nodeLeaders[rank] != rank && isAggregator(nodeLeaders[rank]))
+        return nodeLeaders[rank];
+    return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file hierarchy.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Two-level dispatch, where rank 0 hands batches of tasks to one aggregator rank per node
+ * instead of feeding every worker of that node on its own.
+ *
+ * The aggregator of a node is its lowest rank, and its workers are the other ranks of the node.
+ * Workers on the node of rank 0, and nodes with a single rank, are still fed by rank 0 directly.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef HIERARCHY_H_
+#define HIERARCHY_H_
+
+#include <stdbool.h>
+
+/** @brief Most tasks rank 0 hands an aggregator at once, 0 if tasks are not dispatched through aggregators. */
+extern int batchSize;
+
+/**
+ * @brief Finds the aggregator of every node.
+ *
+ * Collective over MPI_COMM_WORLD, every rank must call it with the same batch size.
+ *
+ * @param _batchSize most tasks rank 0 hands an aggregator at once, 0 to feed every worker from rank 0
+ */
+extern void initHierarchy(int _batchSize);
+
+/**
+ * @brief Frees the memory used to describe the hierarchy.
+ */
+extern void freeHierarchy();
+
+/**
+ * @brief Checks if a rank gets batches from rank 0 and hands their tasks to the workers of its node.
+ *
+ * @param rank rank to be checked
+ * @return if the rank is an aggregator
+ */
+extern bool isAggregator(int rank);
+
+/**
+ * @brief Gets the rank that hands tasks to a worker and takes back its results.
+ *
+ * @param rank rank of the worker
+ * @return rank 0 or the aggregator of its node
+ */
+extern int parentRank(int rank);
+
+#endif
@@ -16,10 +16,22 @@
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/resource.h>
 
 #include "worker.h"
+#include "aggregator.h"
 #include "dispatcher.h"
 #include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "matrixPool.h"
+#include "hierarchy.h"
+#include "transport.h"
+#include "trace.h"
+#include "backoff.h"
+
+/** @brief Size in bytes of each task slot in the memory shared with workers on the same node. */
+static const int NODE_SLOT_BYTES = 1 << 20;
 
 /**
  * @brief Struct containing the command line argument values.
@@ -27,12 +39,22 @@
  * @param status if the file was called correctly
  * @param fileCount count of the files given
  * @param fileNames array of file names given
+ * @param localWorkerCount count of the compute threads to be created on rank 0
+ * @param distributedOrder smallest order of the matrices computed by all processes together, 0 if none are
+ * @param batchSize most tasks handed to the aggregator of a node at once, 0 if there are no aggregators
+ * @param simulatedRanks ranks run as threads of this process, 0 if ranks are real processes
+ * @param maxBackoff longest sleep of the loops polling for messages, in microseconds
  */
 typedef struct CMDArgs
 {
     int status;
     int fileCount;
     char **fileNames;
+    int localWorkerCount;
+    int distributedOrder;
+    int batchSize;
+    int simulatedRanks;
+    double maxBackoff;
 } CMDArgs;
 
 /**
@@ -45,8 +67,13 @@ static void printUsage(char *cmdName)
     fprintf(stderr, "\nSynopsis: %s OPTIONS [filenames]\n"
                     "  OPTIONS:\n"
                     "  -h      --- print this help\n"
-                    "  -f      --- file names, space separated\n",
-            cmdName);
+                    "  -f      --- file names, space separated\n"
+                    "  -w      --- compute thread count on the dispatcher process (default: 1)\n"
+                    "  -d      --- smallest matrix order computed by all processes together (default: 0, none)\n"
+                    "  -a      --- tasks handed at once to one aggregator process per node (default: 0, no aggregators)\n"
+                    "  -s      --- ranks simulated as threads of a single process, to benchmark dispatch (default: 0, none)\n"
+                    "  -p      --- longest sleep while polling for messages, in us (default: %ld)\n",
+            cmdName, (long)DEFAULT_MAX_BACKOFF / 1000);
 }
 
 /**
@@ -58,7 +85,12 @@ static void printUsage(char *cmdName)
  */
 CMDArgs parseCMD(int argc, char *args[])
 {
-    CMDArgs cmdArgs;
+    CMDArgs cmdArgs = {.status = EXIT_FAILURE};
+    cmdArgs.localWorkerCount = 1;
+    cmdArgs.distributedOrder = 0;
+    cmdArgs.batchSize = 0;
+    cmdArgs.simulatedRanks = 0;
+    cmdArgs.maxBackoff = DEFAULT_MAX_BACKOFF / 1000;
     cmdArgs.status = EXIT_FAILURE;
     int opt;
     opterr = 0;
@@ -73,7 +105,7 @@ CMDArgs parseCMD(int argc, char *args[])
     }
     do
     {
-        switch ((opt = getopt(argc, args, "f:w:h")))
+        switch ((opt = getopt(argc, args, "f:w:d:a:s:p:h")))
         {
         case 'f':                // file name
             if (filestart != -1) // duplicate -f
@@ -92,6 +124,61 @@ CMDArgs parseCMD(int argc, char *args[])
             cmdArgs.fileNames = (char **)malloc(sizeof(char **) * filespan);
             memcpy(cmdArgs.fileNames, &args[filestart], (sizeof(char *) * filespan));
             break;
+        case 'w': // compute threads on rank 0
+            cmdArgs.localWorkerCount = atoi(optarg);
+            if (cmdArgs.localWorkerCount < 0)
+            {
+                fprintf(stderr, "%s: negative compute thread count\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'd': // order of the matrices computed by all processes
+            cmdArgs.distributedOrder = atoi(optarg);
+            if (cmdArgs.distributedOrder < 0)
+            {
+                fprintf(stderr, "%s: negative distributed matrix order\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'a': // batch size of the aggregators
+            cmdArgs.batchSize = atoi(optarg);
+            if (cmdArgs.batchSize < 0)
+            {
+                fprintf(stderr, "%s: negative batch size\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 's': // ranks simulated in process
+            cmdArgs.simulatedRanks = atoi(optarg);
+            if (cmdArgs.simulatedRanks < 0)
+            {
+                fprintf(stderr, "%s: negative simulated rank count\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'p': // backoff cap
+            cmdArgs.maxBackoff = atof(optarg);
+            if (cmdArgs.maxBackoff < 0.001)
+            {
+                fprintf(stderr, "%s: backoff below a nanosecond\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
         case 'h': // help
             printUsage(basename(args[0]));
             if (!(filestart == -1 || filespan == 0))
@@ -136,13 +223,82 @@ static void printResults(char **fileNames, int fileCount)
     }
 }
 
+/**
+ * @brief Gets the CPU time used by all threads of this process.
+ *
+ * @return user plus system time, in seconds
+ */
+static double processCpuTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+/**
+ * @brief Prints how much CPU rank 0 used and how long tasks waited to be sent.
+ *
+ * @param elapsed wall clock time of the run, in seconds
+ * @param cpu CPU time used by rank 0 during the run, in seconds
+ */
+static void printDispatchReport(double elapsed, double cpu)
+{
+    printf("Dispatcher CPU time = %.6f s (%.1f%% of elapsed time)\n", cpu, 100 * cpu / elapsed);
+
+    // no sender without remote workers
+    if (processCount < 2)
+        return;
+
+    DispatchStats stats = getDispatchStats();
+    printf("Sender CPU time = %.6f s (%.1f%% of elapsed time)\n", stats.senderCpuTime, 100 * stats.senderCpuTime / elapsed);
+    if (stats.taskCount > 0)
+        printf("Dispatch latency = %.3f us average, %.3f us max over %d tasks\n",
+               1e6 * stats.totalLatency / stats.taskCount, 1e6 * stats.maxLatency, stats.taskCount);
+
+    if (threadTransport())
+    {
+        TransportStats transport = getTransportStats();
+        printf("Transport = %ld messages, %ld bytes, longest mailbox %d messages at rank %d\n", transport.messageCount,
+               transport.byteCount, transport.maxQueueDepth, transport.maxQueueRank);
+    }
+}
+
+/**
+ * @brief Tells every process rank 0 hands tasks to that there are none left, the others are told by their aggregator.
+ *
+ * @param size total process count
+ */
+static void stopWorkers(int size)
+{
+    for (int i = 1; i < size; i++)
+        if (parentRank(i) == 0)
+            transportSend(NULL, 0, TRANSPORT_CHAR, i, KILL_TAG);
+}
+
+/**
+ * @brief Simulated rank thread, runs a worker over the in-process transport.
+ *
+ * @param par pointer to the rank simulated by this thread
+ * @return pointer to the identification of this thread
+ */
+static void *whileSimulatedRankWorks(void *par)
+{
+    enterRank(*((int *)par));
+    whileTasksWorkAndSendResult();
+
+    pthread_exit((int *)EXIT_SUCCESS);
+}
+
 /**
  * @brief Main thread.
  *
  * Determines whether process is a worker or dispatcher and performs associated tasks
  * Dispatchers are multi-threaded and output results
- * Dispatcher threads include a file reader, a sending component, and a results merger
+ * Dispatcher threads include a file reader, a sending component, a results merger, and compute threads
+ * Aggregators hand the tasks of the batches they get to the workers of their node
  * Worker performs tasks until it receives an exit signal
+ * Then all processes compute together the matrices too large for one of them
+ * A single process runs everything on its compute threads, or simulates every worker rank with a thread
  *
  * @param argc argument count
  * @param args argument array
@@ -164,30 +320,93 @@ int main(int argc, char **args)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (size < 2)
+    initNodeMemory(NODE_SLOT_BYTES);
+    TRACE_INIT();
+
+    CMDArgs cmdArgs = {.status = EXIT_FAILURE};
+    int batchSize = 0;
+    if (rank == 0)
     {
-        printf("There is a 2 process minimum\n");
-        MPI_Finalize();
-        exit(EXIT_FAILURE);
+        cmdArgs = parseCMD(argc, args);
+        if (cmdArgs.status == EXIT_SUCCESS && cmdArgs.simulatedRanks > 0 &&
+            (size > 1 || cmdArgs.batchSize > 0 || cmdArgs.distributedOrder > 0))
+        {
+            // hierarchy and distributed matrices rely on collectives over real processes
+            fprintf(stderr, "%s: -s needs a single process and no -a or -d\n", basename(args[0]));
+            free(cmdArgs.fileNames);
+            cmdArgs.status = EXIT_FAILURE;
+        }
+        if (cmdArgs.status == EXIT_SUCCESS && cmdArgs.simulatedRanks > 1)
+        {
+            startThreadTransport(cmdArgs.simulatedRanks);
+            size = cmdArgs.simulatedRanks;
+        }
+        if (cmdArgs.status == EXIT_SUCCESS && size == 1 && cmdArgs.localWorkerCount == 0)
+        {
+            fprintf(stderr, "%s: a single process needs at least one compute thread\n", basename(args[0]));
+            free(cmdArgs.fileNames);
+            cmdArgs.status = EXIT_FAILURE;
+        }
+        if (cmdArgs.status == EXIT_SUCCESS)
+        {
+            batchSize = cmdArgs.batchSize;
+            maxBackoff = (long)(cmdArgs.maxBackoff * 1000);
+        }
     }
 
+    // every rank needs to know who hands it tasks and how long it may sleep, only rank 0 parsed the command line
+    MPI_Bcast(&batchSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&maxBackoff, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    initHierarchy(batchSize);
+
     if (rank == 0) // dispatcher
     {
-        CMDArgs cmdArgs = parseCMD(argc, args);
         if (cmdArgs.status == EXIT_FAILURE)
         {
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal to workers that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
+            TRACE_WRITE();
+            freeHierarchy();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
         struct timespec start, finish;              // time measurement
         clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
+        double startCpu = processCpuTime();
+
+        // room for a whole batch to be queued while the last one is handed out
+        initSharedRegion(cmdArgs.fileCount, cmdArgs.fileNames, size, cmdArgs.localWorkerCount, batchSize > 5 ? 2 * batchSize : 10,
+                         cmdArgs.distributedOrder);
 
-        initSharedRegion(cmdArgs.fileCount, cmdArgs.fileNames, size, 10);
+        // workers fed by an aggregator only ever get tasks from it
+        for (int i = 1; i < size; i++)
+            if (parentRank(i) != 0)
+                excludeWorker(i - 1);
+
+        // create simulated ranks, every one of them but rank 0 is a worker
+        pthread_t simulatedRanks[threadTransport() ? size : 1];
+        int simulatedIds[threadTransport() ? size : 1];
+        for (int r = 1; threadTransport() && r < size; r++)
+        {
+            simulatedIds[r] = r;
+            if (pthread_create(&simulatedRanks[r], NULL, whileSimulatedRankWorks, &simulatedIds[r]) != 0)
+            {
+                perror("Error on creating simulated rank");
+
+                // signal that there's nothing left to process
+                stopWorkers(size);
+
+                free(cmdArgs.fileNames);
+                freeSharedRegion();
+                TRACE_WRITE();
+                freeHierarchy();
+                freeNodeMemory();
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+            }
+        }
 
         // create reader thread
         pthread_t reader;
@@ -195,47 +414,73 @@ int main(int argc, char **args)
         {
             perror("Error on creating dispatcher");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
 
             free(cmdArgs.fileNames);
             freeSharedRegion();
+            TRACE_WRITE();
+            freeHierarchy();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
-        // create sender thread
+        // create sender thread, only needed if there are remote workers
         pthread_t sender;
-        if (pthread_create(&sender, NULL, emitTasksToWorkers, NULL) != 0)
+        if (size > 1 && pthread_create(&sender, NULL, emitTasksToWorkers, NULL) != 0)
         {
             perror("Error on creating sender");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
 
             free(cmdArgs.fileNames);
             freeSharedRegion();
+            TRACE_WRITE();
+            freeHierarchy();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
 
+        // create compute threads
+        pthread_t localWorkers[cmdArgs.localWorkerCount];
+        int localIds[cmdArgs.localWorkerCount];
+        for (int i = 0; i < cmdArgs.localWorkerCount; i++)
+        {
+            localIds[i] = i;
+            if (pthread_create(&localWorkers[i], NULL, whileLocalTasksWorkAndSendResult, &localIds[i]) != 0)
+            {
+                perror("Error on creating compute thread");
+
+                // signal that there's nothing left to process
+                stopWorkers(size);
+
+                free(cmdArgs.fileNames);
+                freeSharedRegion();
+                TRACE_WRITE();
+                freeHierarchy();
+                freeNodeMemory();
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+            }
+        }
+
         // create merger thread
         pthread_t merger;
         if (pthread_create(&merger, NULL, mergeChunks, NULL) != 0)
         {
             perror("Error on creating merger");
 
-            int stop = 0;
-            for (int i = 1; i < size; i++)
-                // signal that there's nothing left to process
-                MPI_Send(&stop, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
+            // signal that there's nothing left to process
+            stopWorkers(size);
             
             free(cmdArgs.fileNames);
             freeSharedRegion();
+            TRACE_WRITE();
+            freeHierarchy();
+            freeNodeMemory();
             MPI_Finalize();
             exit(EXIT_FAILURE);
         }
@@ -247,8 +492,18 @@ int main(int argc, char **args)
             exit(EXIT_FAILURE);
         }
 
+        // wait for compute threads
+        for (int i = 0; i < cmdArgs.localWorkerCount; i++)
+        {
+            if (pthread_join(localWorkers[i], NULL) != 0)
+            {
+                perror("Error on waiting for compute thread");
+                exit(EXIT_FAILURE);
+            }
+        }
+
         // wait for sender
-        if (pthread_join(sender, NULL) != 0)
+        if (size > 1 && pthread_join(sender, NULL) != 0)
         {
             perror("Error on waiting for sender thread");
             exit(EXIT_FAILURE);
@@ -261,18 +516,45 @@ int main(int argc, char **args)
             exit(EXIT_FAILURE);
         }
 
+        // wait for simulated ranks
+        for (int r = 1; threadTransport() && r < size; r++)
+        {
+            if (pthread_join(simulatedRanks[r], NULL) != 0)
+            {
+                perror("Error on waiting for simulated rank");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // matrices too large for one worker, computed along with every worker
+        computeDistributedTasks();
+
         clock_gettime(CLOCK_MONOTONIC_RAW, &finish); // end time measurement
+        double elapsed = (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+        double cpu = processCpuTime() - startCpu;
         printResults(cmdArgs.fileNames, cmdArgs.fileCount);
-        printf("\nElapsed time = %.6f s\n", (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
+        printf("\nElapsed time = %.6f s\n", elapsed);
+        printDispatchReport(elapsed, cpu);
 
         free(cmdArgs.fileNames);
         freeSharedRegion();
+        freeMatrixPool();
+        freeTransport();
+    }
+    else if (isAggregator(rank))
+    {
+        whileBatchesHandOutAndReduce();
     }
     else // worker
     {
         whileTasksWorkAndSendResult();
     }
 
+    // every rank hands its timeline to rank 0
+    TRACE_WRITE();
+
+    freeHierarchy();
+    freeNodeMemory();
     MPI_Finalize();
     exit(EXIT_SUCCESS);
 }
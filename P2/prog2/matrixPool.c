@@ -0,0 +1,198 @@
+/**
+ * @file matrixPool.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Pool of send buffers the reader reads matrices into, allocated once through MPI so it can be registered.
+ *
+ * Buffers are carved in order out of a single ring and returned in any order, the ring only
+ * advances past the oldest buffer once it is returned. The reader blocks while the ring is full.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "matrixPool.h"
+
+/** @brief Alignment of every buffer in the ring, in bytes, also the size of the header before it. */
+#define POOL_ALIGNMENT 64
+
+/**
+ * @brief Struct placed right before every buffer in the ring.
+ *
+ * Blocks that pad the end of the ring when a buffer does not fit there are released from the start.
+ *
+ * @param size bytes taken by the block, header included
+ * @param released if the buffer was given back
+ */
+typedef struct BlockHeader
+{
+    long size;
+    bool released;
+} BlockHeader;
+
+/** @brief Ring the matrices are read into. */
+static char *ring;
+
+/** @brief Size of the ring in bytes, a multiple of POOL_ALIGNMENT. */
+static long capacity;
+
+/** @brief Offset of the next block to be taken. */
+static long head;
+
+/** @brief Offset of the oldest block not yet released. */
+static long tail;
+
+/** @brief Bytes taken between tail and head. */
+static long used;
+
+/** @brief Locking flag which warrants mutual exclusion while accessing the ring. */
+static pthread_mutex_t poolAccess = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Synchronization point when the oldest block is released. */
+static pthread_cond_t blockReleased = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Throws error and stops thread that threw.
+ *
+ * @param error error code
+ * @param string error description
+ */
+static void throwThreadError(int error, char *string)
+{
+    errno = error;
+    perror(string);
+    pthread_exit((int *)EXIT_FAILURE);
+}
+
+/**
+ * @brief Gets the bytes a block holding a matrix takes in the ring.
+ *
+ * @param order order of the matrix
+ * @return size of the block, header included
+ */
+static long blockSize(int order)
+{
+    long bytes = sizeof(double) * (long)order * order;
+    return POOL_ALIGNMENT + (bytes + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+}
+
+/**
+ * @brief Allocates the ring the matrices are read into.
+ *
+ * Must be called before any matrix is acquired.
+ *
+ * @param _capacity size of the ring in bytes, at most the sum of the matrices it will hold
+ * @param largestOrder order of the largest matrix it will hold, always given room for
+ */
+void initMatrixPool(long _capacity, int largestOrder)
+{
+    capacity = (_capacity + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+    if (capacity < blockSize(largestOrder))
+        capacity = blockSize(largestOrder);
+
+    MPI_Alloc_mem(capacity, MPI_INFO_NULL, &ring);
+    head = 0;
+    tail = 0;
+    used = 0;
+}
+
+/**
+ * @brief Frees the ring.
+ *
+ * Should be called after every matrix has been released.
+ */
+void freeMatrixPool()
+{
+    if (ring != NULL)
+        MPI_Free_mem(ring);
+    ring = NULL;
+}
+
+/**
+ * @brief Takes a buffer for a matrix out of the ring, blocking until there is room for it.
+ *
+ * @param order order of the matrix
+ * @return buffer of order*order doubles
+ */
+double *acquireMatrix(int order)
+{
+    long size = blockSize(order);
+    int status;
+
+    if ((status = pthread_mutex_lock(&poolAccess)) != 0)
+        throwThreadError(status, "Error on acquireMatrix() lock");
+
+    while (true)
+    {
+        // an empty ring starts over, so that any matrix fits
+        if (used == 0)
+            head = tail = 0;
+
+        if (used < capacity && head >= tail)
+        {
+            // free space runs from head to the end, then from the start to tail
+            long room = capacity - head;
+            if (size <= room)
+                break;
+
+            // pad the end so the block goes at the start, padding is released once tail reaches it
+            *(BlockHeader *)(ring + head) = (BlockHeader){.size = room, .released = true};
+            used += room;
+            head = 0;
+        }
+        if (head < tail && size <= tail - head)
+            break;
+
+        if ((status = pthread_cond_wait(&blockReleased, &poolAccess)) != 0)
+            throwThreadError(status, "Error on acquireMatrix() blockReleased wait");
+    }
+
+    BlockHeader *header = (BlockHeader *)(ring + head);
+    *header = (BlockHeader){.size = size, .released = false};
+    head = (head + size) % capacity;
+    used += size;
+
+    if ((status = pthread_mutex_unlock(&poolAccess)) != 0)
+        throwThreadError(status, "Error on acquireMatrix() unlock");
+
+    return (double *)((char *)header + POOL_ALIGNMENT);
+}
+
+/**
+ * @brief Gives a buffer back to the ring.
+ *
+ * @param matrix buffer taken by acquireMatrix(), no longer used by anyone
+ */
+void releaseMatrix(double *matrix)
+{
+    int status;
+
+    if ((status = pthread_mutex_lock(&poolAccess)) != 0)
+        throwThreadError(status, "Error on releaseMatrix() lock");
+
+    ((BlockHeader *)((char *)matrix - POOL_ALIGNMENT))->released = true;
+
+    // move past every released block at the tail, padding included
+    bool advanced = false;
+    while (used > 0 && ((BlockHeader *)(ring + tail))->released)
+    {
+        long size = ((BlockHeader *)(ring + tail))->size;
+        tail = (tail + size) % capacity;
+        used -= size;
+        advanced = true;
+    }
+
+    if (advanced && (status = pthread_cond_signal(&blockReleased)) != 0)
+        throwThreadError(status, "Error on releaseMatrix() blockReleased signal");
+
+    if ((status = pthread_mutex_unlock(&poolAccess)) != 0)
+        throwThreadError(status, "Error on releaseMatrix() unlock");
+}
@@ -0,0 +1,52 @@
+/**
+ * @file matrixPool.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Pool of send buffers the reader reads matrices into, allocated once through MPI so it can be registered.
+ *
+ * Buffers are carved in order out of a single ring and returned in any order, the ring only
+ * advances past the oldest buffer once it is returned. The reader blocks while the ring is full.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef MATRIX_POOL_H_
+#define MATRIX_POOL_H_
+
+#include <mpi.h>
+
+/**
+ * @brief Allocates the ring the matrices are read into.
+ *
+ * Must be called before any matrix is acquired.
+ *
+ * @param capacity size of the ring in bytes, at most the sum of the matrices it will hold
+ * @param largestOrder order of the largest matrix it will hold, always given room for
+ */
+extern void initMatrixPool(long capacity, int largestOrder);
+
+/**
+ * @brief Frees the ring.
+ *
+ * Should be called after every matrix has been released.
+ */
+extern void freeMatrixPool();
+
+/**
+ * @brief Takes a buffer for a matrix out of the ring, blocking until there is room for it.
+ *
+ * @param order order of the matrix
+ * @return buffer of order*order doubles
+ */
+extern double *acquireMatrix(int order);
+
+/**
+ * @brief Gives a buffer back to the ring.
+ *
+ * @param matrix buffer taken by acquireMatrix(), no longer used by anyone
+ */
+extern void releaseMatrix(double *matrix);
+
+#endif
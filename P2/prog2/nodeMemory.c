@@ -0,0 +1,151 @@
+/**
+ * @file nodeMemory.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Shared memory window between rank 0 and the workers running on the same node.
+ *
+ * Rank 0 writes a task into one of the two slots a co-located worker owns and only sends it a descriptor.
+ * Workers on other nodes keep receiving their tasks as regular messages.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "nodeMemory.h"
+
+/** @brief Ranks running on the same node as this one. */
+static MPI_Comm nodeComm = MPI_COMM_NULL;
+
+/** @brief Shared window, only created on the node of rank 0. */
+static MPI_Win nodeWin = MPI_WIN_NULL;
+
+/** @brief Start of the slots of rank 0 in this process' address space. */
+static char *nodeBase = NULL;
+
+/** @brief Size in bytes of each task slot. */
+static int slotBytes;
+
+/** @brief Rank of each process in nodeComm, MPI_UNDEFINED if it is not on the node of rank 0. */
+static int *nodeRanks = NULL;
+
+/**
+ * @brief Creates the shared window between rank 0 and the workers on its node.
+ *
+ * Collective over MPI_COMM_WORLD, must be called by every rank before any task is exchanged.
+ *
+ * @param _slotBytes size in bytes of each task slot
+ */
+void initNodeMemory(int _slotBytes)
+{
+    int rank, size, nodeSize;
+
+    slotBytes = _slotBytes;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // ordering by world rank makes rank 0 the first rank of its node
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+    MPI_Comm_size(nodeComm, &nodeSize);
+
+    // translate every world rank into nodeComm
+    MPI_Group worldGroup, nodeGroup;
+    MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+    MPI_Comm_group(nodeComm, &nodeGroup);
+    int worldRanks[size];
+    for (int i = 0; i < size; i++)
+        worldRanks[i] = i;
+    nodeRanks = malloc(sizeof(int) * size);
+    MPI_Group_translate_ranks(worldGroup, size, worldRanks, nodeGroup, nodeRanks);
+    MPI_Group_free(&worldGroup);
+    MPI_Group_free(&nodeGroup);
+
+    // only the node of rank 0 shares memory with it, and only if it has workers
+    if (nodeRanks[0] == MPI_UNDEFINED || nodeSize < 2)
+        return;
+
+    MPI_Aint windowBytes = 0;
+    if (rank == 0)
+        windowBytes = (MPI_Aint)(nodeSize - 1) * NODE_SLOTS_PER_WORKER * slotBytes;
+
+    MPI_Win_allocate_shared(windowBytes, 1, MPI_INFO_NULL, nodeComm, &nodeBase, &nodeWin);
+
+    // workers find out where the slots of rank 0 were mapped in their address space
+    if (rank != 0)
+    {
+        MPI_Aint queriedBytes;
+        int dispUnit;
+        MPI_Win_shared_query(nodeWin, 0, &queriedBytes, &dispUnit, &nodeBase);
+    }
+
+    // window stays open for the whole run, synchronization is done with syncNodeMemory() and messages
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, nodeWin);
+}
+
+/**
+ * @brief Frees the shared window.
+ *
+ * Collective over MPI_COMM_WORLD, must be called by every rank after the last task was handled.
+ */
+void freeNodeMemory()
+{
+    if (nodeWin != MPI_WIN_NULL)
+    {
+        MPI_Win_unlock_all(nodeWin);
+        MPI_Win_free(&nodeWin);
+    }
+    MPI_Comm_free(&nodeComm);
+    free(nodeRanks);
+}
+
+/**
+ * @brief Checks if a worker runs on the same node as rank 0.
+ *
+ * @param rank rank of the worker
+ * @return if the worker shares the node with rank 0
+ */
+bool sharesNodeWithDispatcher(int rank)
+{
+    return nodeWin != MPI_WIN_NULL && nodeRanks[rank] != MPI_UNDEFINED;
+}
+
+/**
+ * @brief Checks if a task of a given size can be handed to a worker through the shared window.
+ *
+ * @param rank rank of the worker
+ * @param bytes size of the task in bytes
+ * @return if the worker shares the node with rank 0 and the task fits in a slot
+ */
+bool fitsNodeMemory(int rank, int bytes)
+{
+    return sharesNodeWithDispatcher(rank) && bytes <= slotBytes;
+}
+
+/**
+ * @brief Gets the address of a task slot of a co-located worker.
+ *
+ * @param rank rank of the worker owning the slot
+ * @param slot index of the slot, lower than NODE_SLOTS_PER_WORKER
+ * @return address of the slot in the shared window
+ */
+void *nodeSlot(int rank, int slot)
+{
+    // rank 0 is the first rank of the node and owns no slots
+    return nodeBase + ((size_t)(nodeRanks[rank] - 1) * NODE_SLOTS_PER_WORKER + slot) * slotBytes;
+}
+
+/**
+ * @brief Synchronizes the private and public copies of the shared window.
+ *
+ * Called by rank 0 after writing a slot and by workers before reading one.
+ */
+void syncNodeMemory()
+{
+    MPI_Win_sync(nodeWin);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file nodeMemory.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Shared memory window between rank 0 and the workers running on the same node.
+ *
+ * Rank 0 writes a task into one of the two slots a co-located worker owns and only sends it a descriptor.
+ * Workers on other nodes keep receiving their tasks as regular messages.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef NODE_MEMORY_H_
+#define NODE_MEMORY_H_
+
+#include <stdbool.h>
+
+/** @brief Number of task slots every co-located worker owns, used alternately. */
+#define NODE_SLOTS_PER_WORKER 2
+
+/**
+ * @brief Creates the shared window between rank 0 and the workers on its node.
+ *
+ * Collective over MPI_COMM_WORLD, must be called by every rank before any task is exchanged.
+ *
+ * @param _slotBytes size in bytes of each task slot
+ */
+extern void initNodeMemory(int _slotBytes);
+
+/**
+ * @brief Frees the shared window.
+ *
+ * Collective over MPI_COMM_WORLD, must be called by every rank after the last task was handled.
+ */
+extern void freeNodeMemory();
+
+/**
+ * @brief Checks if a task of a given size can be handed to a worker through the shared window.
+ *
+ * @param rank rank of the worker
+ * @param bytes size of the task in bytes
+ * @return if the worker shares the node with rank 0 and the task fits in a slot
+ */
+extern bool fitsNodeMemory(int rank, int bytes);
+
+/**
+ * @brief Checks if a worker runs on the same node as rank 0.
+ *
+ * @param rank rank of the worker
+ * @return if the worker shares the node with rank 0
+ */
+extern bool sharesNodeWithDispatcher(int rank);
+
+/**
+ * @brief Gets the address of a task slot of a co-located worker.
+ *
+ * @param rank rank of the worker owning the slot
+ * @param slot index of the slot, lower than NODE_SLOTS_PER_WORKER
+ * @return address of the slot in the shared window
+ */
+extern void *nodeSlot(int rank, int slot);
+
+/**
+ * @brief Synchronizes the private and public copies of the shared window.
+ *
+ * Called by rank 0 after writing a slot and by workers before reading one.
+ */
+extern void syncNodeMemory();
+
+#endif
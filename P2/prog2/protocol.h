@@ -0,0 +1,44 @@
+/**
+ * @file protocol.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Message tags used between the dispatcher and the workers.
+ *
+ * Every task travels in a single message, workers learn its size through MPI_Mprobe and MPI_Get_count.
+ * Workers on the node of rank 0 may instead get a descriptor of a task written into the shared window.
+ * Aggregators get batches of tasks in a single message and answer with the results of a whole batch,
+ * the workers of their node deal with them exactly as with rank 0.
+ * The kill message carries how many matrices are left for all processes to compute together,
+ * each announced afterwards by a broadcast of its file name length, matrix index and order, then of its file name.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+/** @brief Tag of a message carrying a task toward a worker. */
+#define TASK_TAG 0
+
+/** @brief Tag of a message telling a worker that no more tasks are coming, with the count of matrices computed by everyone. */
+#define KILL_TAG 1
+
+/** @brief Tag of a message carrying the result of a task, or of a whole batch, back to the dispatcher. */
+#define RESULT_TAG 2
+
+/** @brief Tag of a message with the slot of the shared window where a task was written, and the task size. */
+#define SHARED_TASK_TAG 3
+
+/** @brief Tag of a message carrying a batch of tasks toward an aggregator, as doubles: task count, order of each task, then each matrix. */
+#define BATCH_TAG 4
+
+/**
+ * @brief Tag of the results rank 0 compute threads send to their own rank, thread n uses LOCAL_RESULT_TAG + n.
+ *
+ * Kept well above every other tag since it starts a range.
+ */
+#define LOCAL_RESULT_TAG 100
+
+#endif
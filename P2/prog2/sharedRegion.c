@@ -9,11 +9,18 @@
  * @author Diogo Bento, nmec: 93391
  */
 
+#define _GNU_SOURCE // ppoll
+
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "sharedRegion.h"
 
@@ -26,12 +33,27 @@ char **files;
 /** @brief Total process count. Includes rank 0. */
 int processCount;
 
+/** @brief Number of compute threads running on rank 0. */
+int localWorkerCount;
+
+/** @brief Number of task queues, remote workers (rank minus 1) followed by rank 0 compute threads. */
+int workerCount;
+
+/** @brief Smallest order of the matrices computed by all processes together, 0 if none are. */
+int distributedOrder;
+
 /** @brief Index of last initialized results object. */
 static int lastInitializedResult;
 
 /** @brief Array of the results for each file. */
 static Result *results;
 
+/** @brief Matrices set aside to be computed by all processes together. */
+static DistributedTask *distributedTasks;
+
+/** @brief Number of matrices set aside to be computed by all processes together. */
+static int distributedCount;
+
 /** @brief Max number of items the task FIFOs can contain. */
 static int fifoSize;
 
@@ -56,14 +78,41 @@ static pthread_mutex_t resultsAccess = PTHREAD_MUTEX_INITIALIZER;
 /** @brief Locking flags which warrant mutual exclusion while accessing the task FIFOs. */
 static pthread_mutex_t *fifoAccess;
 
-/** @brief Locking flag to allow wait in awaitFurtherTasks. */
-static pthread_mutex_t awaitAccess = PTHREAD_MUTEX_INITIALIZER;
-
 /** @brief Synchronization points when the task FIFOs are full. */
 static pthread_cond_t *fifoFull;
 
-/** @brief Synchronization point when a new task is pushed. */
-static pthread_cond_t newTask;
+/** @brief Synchronization points when the task FIFOs are empty. */
+static pthread_cond_t *fifoEmpty;
+
+/** @brief Event file descriptor notified whenever a task is pushed for a remote worker. */
+static int newTaskEvent;
+
+/** @brief Cost of the tasks handed to each worker whose results were not merged yet. */
+static double *outstandingCost;
+
+/** @brief Cost of the tasks each worker has completed. */
+static double *completedCost;
+
+/** @brief Monotonic time, in nanoseconds, at which each worker got its first task. */
+static long *startedAt;
+
+/** @brief Flags signaling workers that are never handed tasks by rank 0. */
+static bool *excluded;
+
+/** @brief Rings with the assignments awaiting a result. 1 per worker. */
+static Assignment **pending;
+
+/** @brief Retrieval pointers to the assignment rings. */
+static int *pendingHead;
+
+/** @brief Number of assignments in each ring. */
+static int *pendingCount;
+
+/** @brief Capacity of each assignment ring, doubled when it fills up. */
+static int *pendingCapacity;
+
+/** @brief Locking flag which warrants mutual exclusion while accessing the worker loads. */
+static pthread_mutex_t loadAccess = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief Throws error and stops thread that threw.
@@ -86,35 +135,62 @@ static void throwThreadError(int error, char *string)
  * @param _totalFileCount number of files to be processed
  * @param _files array with the file names of all files
  * @param _processCount total process count
+ * @param _localWorkerCount number of compute threads running on rank 0
  * @param _fifoSize number of tasks that can be queued up for each worker
+ * @param _distributedOrder smallest order of the matrices computed by all processes together, 0 if none are
  */
-void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _fifoSize)
+void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _localWorkerCount, int _fifoSize,
+                      int _distributedOrder)
 {
     totalFileCount = _totalFileCount;
     files = _files;
     processCount = _processCount;
+    localWorkerCount = _localWorkerCount;
+    workerCount = processCount - 1 + localWorkerCount;
     fifoSize = _fifoSize;
     lastInitializedResult = -1;
+    distributedOrder = _distributedOrder;
+    distributedTasks = NULL;
+    distributedCount = 0;
 
     results = malloc(sizeof(Result) * totalFileCount);
 
     pthread_cond_init(&resultInitialized, NULL);
-    pthread_cond_init(&newTask, NULL);
+    newTaskEvent = eventfd(0, EFD_NONBLOCK);
 
     // create a FIFO per worker
-    ii = malloc(sizeof(int) * (processCount - 1));
-    ri = malloc(sizeof(int) * (processCount - 1));
-    full = malloc(sizeof(bool) * (processCount - 1));
-    fifoAccess = malloc(sizeof(pthread_mutex_t) * (processCount - 1));
-    fifoFull = malloc(sizeof(pthread_cond_t) * (processCount - 1));
-    taskFIFO = malloc(sizeof(Task *) * (processCount - 1));
-    for (int i = 0; i < (processCount - 1); i++)
+    ii = malloc(sizeof(int) * workerCount);
+    ri = malloc(sizeof(int) * workerCount);
+    full = malloc(sizeof(bool) * workerCount);
+    fifoAccess = malloc(sizeof(pthread_mutex_t) * workerCount);
+    fifoFull = malloc(sizeof(pthread_cond_t) * workerCount);
+    fifoEmpty = malloc(sizeof(pthread_cond_t) * workerCount);
+    taskFIFO = malloc(sizeof(Task *) * workerCount);
+    outstandingCost = malloc(sizeof(double) * workerCount);
+    completedCost = malloc(sizeof(double) * workerCount);
+    startedAt = malloc(sizeof(long) * workerCount);
+    excluded = malloc(sizeof(bool) * workerCount);
+    pending = malloc(sizeof(Assignment *) * workerCount);
+    pendingHead = malloc(sizeof(int) * workerCount);
+    pendingCount = malloc(sizeof(int) * workerCount);
+    pendingCapacity = malloc(sizeof(int) * workerCount);
+    for (int i = 0; i < workerCount; i++)
     {
+        outstandingCost[i] = 0;
+        completedCost[i] = 0;
+        startedAt[i] = 0;
+        excluded[i] = false;
+        pendingHead[i] = 0;
+        pendingCount[i] = 0;
+        pendingCapacity[i] = 2 * fifoSize;
+        pending[i] = malloc(sizeof(Assignment) * pendingCapacity[i]);
+
         ii[i] = 0;
         ri[i] = 0;
         full[i] = false;
         pthread_mutex_init(&fifoAccess[i], NULL);
         pthread_cond_init(&fifoFull[i], NULL);
+        pthread_cond_init(&fifoEmpty[i], NULL);
         taskFIFO[i] = malloc(sizeof(Task) * fifoSize);
     }
 }
@@ -130,9 +206,11 @@ void freeSharedRegion()
         if (results[i].matrixCount >= 0)
             free(results[i].determinants);
     free(results);
-    for (int i = 0; i < processCount - 1; i++)
+    free(distributedTasks);
+    for (int i = 0; i < workerCount; i++)
     {
         free(taskFIFO[i]);
+        free(pending[i]);
     }
     free(taskFIFO);
     free(ii);
@@ -140,6 +218,16 @@ void freeSharedRegion()
     free(full);
     free(fifoAccess);
     free(fifoFull);
+    free(fifoEmpty);
+    close(newTaskEvent);
+    free(outstandingCost);
+    free(completedCost);
+    free(startedAt);
+    free(excluded);
+    free(pending);
+    free(pendingHead);
+    free(pendingCount);
+    free(pendingCapacity);
 }
 
 /**
@@ -166,6 +254,51 @@ void initResult(int matrixCount)
         throwThreadError(status, "Error on initResult() unlock");
 }
 
+/**
+ * @brief Sets a matrix aside to be computed by all processes together once workers run out of tasks.
+ *
+ * Must be called before the result of its file is initialized.
+ *
+ * @param fileIndex index of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order size of matrix
+ */
+void deferDistributedTask(int fileIndex, int matrixIndex, int order)
+{
+    int status;
+
+    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
+        throwThreadError(status, "Error on deferDistributedTask() lock");
+
+    distributedTasks = realloc(distributedTasks, sizeof(DistributedTask) * (distributedCount + 1));
+    distributedTasks[distributedCount++] = (DistributedTask){.fileIndex = fileIndex, .matrixIndex = matrixIndex, .order = order};
+
+    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
+        throwThreadError(status, "Error on deferDistributedTask() unlock");
+}
+
+/**
+ * @brief Gets the matrices set aside to be computed by all processes together.
+ *
+ * @param tasks set to the array of the matrices
+ * @return number of matrices set aside
+ */
+int getDistributedTasks(DistributedTask **tasks)
+{
+    int status, count;
+
+    if ((status = pthread_mutex_lock(&resultsAccess)) != 0)
+        throwThreadError(status, "Error on getDistributedTasks() lock");
+
+    *tasks = distributedTasks;
+    count = distributedCount;
+
+    if ((status = pthread_mutex_unlock(&resultsAccess)) != 0)
+        throwThreadError(status, "Error on getDistributedTasks() unlock");
+
+    return count;
+}
+
 /**
  * @brief Allows merger to get a result object, will block until result at index has been initialized.
  *
@@ -211,18 +344,164 @@ Result *getResults()
     return val;
 }
 
+/**
+ * @brief Gets the current time of the monotonic clock.
+ *
+ * @return time in nanoseconds
+ */
+long monotonicTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * @brief Picks the worker expected to finish a task first.
+ *
+ * The estimate is the cost a worker still has to get through plus the new task, over the throughput it showed so far.
+ * Workers that have not completed a task yet are assumed to run at the average throughput.
+ *
+ * @param cost estimated cost of the task
+ * @return index of the worker queue
+ */
+int pickWorker(double cost)
+{
+    int status;
+    long now = monotonicTime();
+
+    if ((status = pthread_mutex_lock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on pickWorker() lock");
+
+    // throughput of every worker with completed tasks, in cost per nanosecond
+    double throughput[workerCount];
+    double throughputSum = 0;
+    int measured = 0;
+    for (int i = 0; i < workerCount; i++)
+    {
+        throughput[i] = 0;
+        if (completedCost[i] > 0 && now > startedAt[i])
+        {
+            throughput[i] = completedCost[i] / (now - startedAt[i]);
+            throughputSum += throughput[i];
+            measured++;
+        }
+    }
+    double averageThroughput = measured > 0 ? throughputSum / measured : 1;
+
+    // lowest estimated finish time, ties go to the lowest index
+    int best = -1;
+    double bestFinish = 0;
+    for (int i = 0; i < workerCount; i++)
+    {
+        if (excluded[i])
+            continue;
+
+        double finish = (outstandingCost[i] + cost) / (throughput[i] > 0 ? throughput[i] : averageThroughput);
+        if (best == -1 || finish < bestFinish)
+        {
+            best = i;
+            bestFinish = finish;
+        }
+    }
+
+    if ((status = pthread_mutex_unlock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on pickWorker() unlock");
+
+    return best;
+}
+
+/**
+ * @brief Keeps a worker from ever being picked, for remote workers fed by the aggregator of their node.
+ *
+ * Must be called before the first task is pushed.
+ *
+ * @param worker index of the worker queue
+ */
+void excludeWorker(int worker)
+{
+    excluded[worker] = true;
+}
+
+/**
+ * @brief Records a task as handed to a worker, growing its assignment ring if needed.
+ *
+ * @param worker index of the worker queue
+ * @param assignment where the result of the task belongs
+ */
+static void recordAssignment(int worker, Assignment assignment)
+{
+    int status;
+
+    if ((status = pthread_mutex_lock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on recordAssignment() lock");
+
+    if (pendingCount[worker] == pendingCapacity[worker])
+    {
+        // unroll the ring into a bigger one
+        Assignment *grown = malloc(sizeof(Assignment) * pendingCapacity[worker] * 2);
+        for (int i = 0; i < pendingCount[worker]; i++)
+            grown[i] = pending[worker][(pendingHead[worker] + i) % pendingCapacity[worker]];
+        free(pending[worker]);
+        pending[worker] = grown;
+        pendingHead[worker] = 0;
+        pendingCapacity[worker] *= 2;
+    }
+
+    pending[worker][(pendingHead[worker] + pendingCount[worker]) % pendingCapacity[worker]] = assignment;
+    pendingCount[worker]++;
+    outstandingCost[worker] += assignment.cost;
+    if (startedAt[worker] == 0)
+        startedAt[worker] = monotonicTime();
+
+    if ((status = pthread_mutex_unlock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on recordAssignment() unlock");
+}
+
+/**
+ * @brief Marks the oldest task handed to a worker as completed.
+ *
+ * Workers return results in the order they got tasks, so this identifies the result just received from it.
+ *
+ * @param worker index of the worker queue
+ * @return Assignment struct with where the result belongs
+ */
+Assignment completeTask(int worker)
+{
+    Assignment assignment;
+    int status;
+
+    if ((status = pthread_mutex_lock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on completeTask() lock");
+
+    assignment = pending[worker][pendingHead[worker]];
+    pendingHead[worker] = (pendingHead[worker] + 1) % pendingCapacity[worker];
+    pendingCount[worker]--;
+    outstandingCost[worker] -= assignment.cost;
+    completedCost[worker] += assignment.cost;
+
+    if ((status = pthread_mutex_unlock(&loadAccess)) != 0)
+        throwThreadError(status, "Error on completeTask() unlock");
+
+    return assignment;
+}
+
 /**
  * @brief Pushes a chunk to a given worker's queue.
  *
- * Notifies anyone inside awaitFurtherTasks.
+ * Records it as an assignment of that worker and notifies anyone inside awaitFurtherTasks.
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task task that worker must perform
  */
 void pushTaskToSender(int worker, Task task)
 {
     int status;
 
+    // recorded before the task is visible, its result could come back before this function returns
+    if (task.order != -1)
+        recordAssignment(worker, (Assignment){.fileIndex = task.fileIndex, .matrixIndex = task.matrixIndex, .cost = task.cost});
+
     if ((status = pthread_mutex_lock(&fifoAccess[worker])) != 0)
         throwThreadError(status, "Error on pushTaskToSender() fifoAccess lock");
 
@@ -230,28 +509,28 @@ void pushTaskToSender(int worker, Task task)
         if ((status = pthread_cond_wait(&fifoFull[worker], &fifoAccess[worker])) != 0)
             throwThreadError(status, "Error on pushTaskToSender() fifoFull wait");
 
+    task.queuedAt = monotonicTime();
+
     taskFIFO[worker][ii[worker]] = task;
     ii[worker] = (ii[worker] + 1) % fifoSize;
     full[worker] = (ii[worker] == ri[worker]);
 
+    if ((status = pthread_cond_signal(&fifoEmpty[worker])) != 0)
+        throwThreadError(status, "Error on pushTaskToSender() fifoEmpty signal");
+
     if ((status = pthread_mutex_unlock(&fifoAccess[worker])) != 0)
         throwThreadError(status, "Error on pushTaskToSender() fifoAccess unlock");
 
-    // notify that there's new content
-    if ((status = pthread_mutex_lock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() awaitAccess lock");
-
-    if ((status = pthread_cond_signal(&newTask)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() newTask signal");
-
-    if ((status = pthread_mutex_unlock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on pushTaskToSender() awaitAccess unlock");
+    // notify the sender that there's new content, compute threads of rank 0 were already signaled
+    uint64_t one = 1;
+    if (worker < processCount - 1 && write(newTaskEvent, &one, sizeof(one)) != sizeof(one))
+        throwThreadError(errno, "Error on pushTaskToSender() newTaskEvent write");
 }
 
 /**
  * @brief Get a task for a given worker
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task a task meant for the worker
  * @return if getTask was successful (fifo was not empty)
  */
@@ -266,8 +545,7 @@ bool getTask(int worker, Task *task)
     // if not empty
     if (!(ii[worker] == ri[worker] && !full[worker]))
     {
-        (*task).order = taskFIFO[worker][ri[worker]].order;
-        (*task).matrix = taskFIFO[worker][ri[worker]].matrix;
+        *task = taskFIFO[worker][ri[worker]];
 
         ri[worker] = (ri[worker] + 1) % fifoSize;
         full[worker] = false;
@@ -287,39 +565,56 @@ bool getTask(int worker, Task *task)
 }
 
 /**
- * @brief Block until there are pending tasks.
+ * @brief Get a task for a given worker, blocking until one is available.
+ *
+ * Used by the compute threads of rank 0, which have no sender between them and their queue.
+ *
+ * @param worker index of the worker queue
+ * @return a task meant for the worker
  */
-void awaitFurtherTasks()
+Task awaitTask(int worker)
 {
-    bool isEmpty = true;
+    Task task;
     int status;
-    if ((status = pthread_mutex_lock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on awaitFurtherInfo() awaitAccess lock");
 
-    for (int i = 0; i < processCount - 1; i++)
-    {
-        if ((status = pthread_mutex_lock(&fifoAccess[i])) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess lock");
+    if ((status = pthread_mutex_lock(&fifoAccess[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() lock");
 
-        // if not empty
-        if (!(ii[i] == ri[i] && !full[i]))
-        {
-            isEmpty = false;
-            if ((status = pthread_mutex_unlock(&fifoAccess[i])) != 0)
-                throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess (is not empty) unlock");
-            break;
-        }
+    // wait while empty
+    while (ii[worker] == ri[worker] && !full[worker])
+        if ((status = pthread_cond_wait(&fifoEmpty[worker], &fifoAccess[worker])) != 0)
+            throwThreadError(status, "Error on awaitTask() fifoEmpty wait");
 
-        if ((status = pthread_mutex_unlock(&fifoAccess[i])) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() fifoAccess unlock");
-    }
+    task = taskFIFO[worker][ri[worker]];
+    ri[worker] = (ri[worker] + 1) % fifoSize;
+    full[worker] = false;
 
-    if (isEmpty)
-    {
-        if ((status = pthread_cond_wait(&newTask, &awaitAccess)) != 0)
-            throwThreadError(status, "Error on awaitFurtherInfo() newTask wait");
-    }
+    if ((status = pthread_cond_signal(&fifoFull[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() fifoFull signal");
+
+    if ((status = pthread_mutex_unlock(&fifoAccess[worker])) != 0)
+        throwThreadError(status, "Error on awaitTask() unlock");
+
+    return task;
+}
+
+/**
+ * @brief Block until a task is pushed for a remote worker or a timeout expires.
+ *
+ * Consumes every notification received so far, so queues must be checked after calling it.
+ *
+ * @param timeout longest wait in nanoseconds, 0 to only consume notifications, negative to wait indefinitely
+ * @return if any task was pushed for a remote worker since the last call
+ */
+bool awaitFurtherTasks(long timeout)
+{
+    struct pollfd event = {.fd = newTaskEvent, .events = POLLIN};
+    struct timespec wait = {.tv_sec = timeout / 1000000000L, .tv_nsec = timeout % 1000000000L};
+
+    if (timeout != 0 && ppoll(&event, 1, timeout < 0 ? NULL : &wait, NULL) < 0 && errno != EINTR)
+        throwThreadError(errno, "Error on awaitFurtherTasks() newTaskEvent poll");
 
-    if ((status = pthread_mutex_unlock(&awaitAccess)) != 0)
-        throwThreadError(status, "Error on awaitFurtherInfo() awaitAccess unlock");
+    // reading resets the counter, fails with EAGAIN if nothing was pushed
+    uint64_t pushed;
+    return read(newTaskEvent, &pushed, sizeof(pushed)) == sizeof(pushed);
 }
@@ -31,13 +31,49 @@ typedef struct Result
  *
  * @param order size of matrix
  * @param matrix pointer to matrix array of size order*order
+ * @param fileIndex index of the file the matrix was read from
+ * @param matrixIndex index of the matrix in its file
+ * @param cost estimated cost of the task, the cube of its order
+ * @param queuedAt monotonic time, in nanoseconds, at which the task was pushed into a queue
  */
 typedef struct Task
 {
     int order;
     double *matrix;
+    int fileIndex;
+    int matrixIndex;
+    double cost;
+    long queuedAt;
 } Task;
 
+/**
+ * @brief Struct identifying where the result of a task handed to a worker belongs.
+ *
+ * @param fileIndex index of the file the matrix was read from
+ * @param matrixIndex index of the matrix in its file
+ * @param cost estimated cost of the task
+ */
+typedef struct Assignment
+{
+    int fileIndex;
+    int matrixIndex;
+    double cost;
+} Assignment;
+
+/**
+ * @brief Struct relative to a matrix computed by all processes together.
+ *
+ * @param fileIndex index of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order size of matrix
+ */
+typedef struct DistributedTask
+{
+    int fileIndex;
+    int matrixIndex;
+    int order;
+} DistributedTask;
+
 /** @brief Number of files to be processed. */
 extern int totalFileCount;
 
@@ -47,6 +83,15 @@ extern char **files;
 /** @brief Total process count. Includes rank 0. */
 extern int processCount;
 
+/** @brief Number of compute threads running on rank 0. */
+extern int localWorkerCount;
+
+/** @brief Number of task queues, remote workers (rank minus 1) followed by rank 0 compute threads. */
+extern int workerCount;
+
+/** @brief Smallest order of the matrices computed by all processes together, 0 if none are. */
+extern int distributedOrder;
+
 /**
  * @brief Initializes the shared region.
  *
@@ -55,9 +100,12 @@ extern int processCount;
  * @param _totalFileCount number of files to be processed
  * @param _files array with the file names of all files
  * @param _processCount total process count
+ * @param _localWorkerCount number of compute threads running on rank 0
  * @param _fifoSize number of tasks that can be queued up for each worker
+ * @param _distributedOrder smallest order of the matrices computed by all processes together, 0 if none are
  */
-extern void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _fifoSize);
+extern void initSharedRegion(int _totalFileCount, char *_files[_totalFileCount], int _processCount, int _localWorkerCount, int _fifoSize,
+                             int _distributedOrder);
 
 /**
  * @brief Frees all memory allocated during initialization of the shared region or the results.
@@ -73,6 +121,25 @@ extern void freeSharedRegion();
  */
 extern void initResult(int matrixCount);
 
+/**
+ * @brief Sets a matrix aside to be computed by all processes together once workers run out of tasks.
+ *
+ * Must be called before the result of its file is initialized.
+ *
+ * @param fileIndex index of the file the matrix is in
+ * @param matrixIndex index of the matrix in its file
+ * @param order size of matrix
+ */
+extern void deferDistributedTask(int fileIndex, int matrixIndex, int order);
+
+/**
+ * @brief Gets the matrices set aside to be computed by all processes together.
+ *
+ * @param tasks set to the array of the matrices
+ * @return number of matrices set aside
+ */
+extern int getDistributedTasks(DistributedTask **tasks);
+
 /**
  * @brief Allows merger to get a result object, will block until result at index has been initialized.
  *
@@ -87,12 +154,49 @@ extern Result *getResultToUpdate(int fileIndex);
  */
 extern Result *getResults();
 
+/**
+ * @brief Gets the current time of the monotonic clock.
+ *
+ * @return time in nanoseconds
+ */
+extern long monotonicTime();
+
+/**
+ * @brief Picks the worker expected to finish a task first.
+ *
+ * The estimate is the cost a worker still has to get through plus the new task, over the throughput it showed so far.
+ * Workers that have not completed a task yet are assumed to run at the average throughput.
+ *
+ * @param cost estimated cost of the task
+ * @return index of the worker queue
+ */
+extern int pickWorker(double cost);
+
+/**
+ * @brief Keeps a worker from ever being picked, for remote workers fed by the aggregator of their node.
+ *
+ * Must be called before the first task is pushed.
+ *
+ * @param worker index of the worker queue
+ */
+extern void excludeWorker(int worker);
+
+/**
+ * @brief Marks the oldest task handed to a worker as completed.
+ *
+ * Workers return results in the order they got tasks, so this identifies the result just received from it.
+ *
+ * @param worker index of the worker queue
+ * @return Assignment struct with where the result belongs
+ */
+extern Assignment completeTask(int worker);
+
 /**
  * @brief Pushes a chunk to a given worker's queue.
  *
- * Notifies anyone inside awaitFurtherTasks.
+ * Records it as an assignment of that worker and notifies anyone inside awaitFurtherTasks.
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task task that worker must perform
  */
 extern void pushTaskToSender(int worker, Task task);
@@ -100,15 +204,30 @@ extern void pushTaskToSender(int worker, Task task);
 /**
  * @brief Get a task for a given worker
  *
- * @param worker worker rank minus 1
+ * @param worker index of the worker queue
  * @param task a task meant for the worker
  * @return if getTask was successful (fifo was not empty)
  */
 extern bool getTask(int worker, Task *task);
 
 /**
- * @brief Block until there are pending tasks.
+ * @brief Get a task for a given worker, blocking until one is available.
+ *
+ * Used by the compute threads of rank 0, which have no sender between them and their queue.
+ *
+ * @param worker index of the worker queue
+ * @return a task meant for the worker
+ */
+extern Task awaitTask(int worker);
+
+/**
+ * @brief Block until a task is pushed for a remote worker or a timeout expires.
+ *
+ * Consumes every notification received so far, so queues must be checked after calling it.
+ *
+ * @param timeout longest wait in nanoseconds, 0 to only consume notifications, negative to wait indefinitely
+ * @return if any task was pushed for a remote worker since the last call
  */
-extern void awaitFurtherTasks();
+extern bool awaitFurtherTasks(long timeout);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,779 @@
+/**
+ * @file transport.c (implementation file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Point-to-point messages exchanged by the dispatcher, its compute threads and the workers, and sums reduced into rank 0.
+ *
+ * By default they go through MPI. The in-process backend instead runs every rank as a thread of a single process,
+ * each rank owning a lock-free mailbox that any thread pushes into and only the rank takes from,
+ * so the dispatcher protocol can be measured at hundreds of ranks without a real launch.
+ * Sends of the in-process backend complete once the message has been received.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "transport.h"
+#include "backoff.h"
+
+/**
+ * @brief Struct relative to a message of the in-process backend.
+ *
+ * @param next next message pushed into the same mailbox
+ * @param pendingNext next message taken out of the mailbox but not yet probed
+ * @param source rank that sent it
+ * @param tag tag it was sent with
+ * @param bytes size of its data
+ * @param detached if nobody waits for it to be received, so the receiver frees it
+ * @param received if it was received, the sender frees it then
+ * @param data contents of the message
+ */
+struct Mail
+{
+    _Atomic(Mail *) next;
+    Mail *pendingNext;
+    int source;
+    int tag;
+    int bytes;
+    bool detached;
+    atomic_bool received;
+    char data[];
+};
+
+/**
+ * @brief Struct relative to the mailbox of a rank of the in-process backend.
+ *
+ * Any thread pushes into it without locking, only the owning rank takes messages out of it.
+ *
+ * @param head last message pushed
+ * @param tail next message to be taken out
+ * @param stub placeholder that keeps the queue from ever being empty
+ * @param pendingFirst oldest message taken out but not yet probed
+ * @param pendingLast newest message taken out but not yet probed
+ * @param pendingCount number of messages taken out but not yet probed
+ * @param sleeping if the owner is blocked waiting for a message
+ * @param event event file descriptor the owner blocks on
+ * @param messageCount number of messages received
+ * @param byteCount number of bytes received
+ * @param maxDepth most messages ever waiting to be probed
+ */
+typedef struct Mailbox
+{
+    _Atomic(Mail *) head;
+    Mail *tail;
+    Mail *stub;
+    Mail *pendingFirst;
+    Mail *pendingLast;
+    int pendingCount;
+    atomic_bool sleeping;
+    int event;
+    long messageCount;
+    long byteCount;
+    int maxDepth;
+} Mailbox;
+
+/** @brief Tag of the messages of a reduction in the in-process backend, below the tags MPI allows so none clashes. */
+#define REDUCE_TAG (-2)
+
+/** @brief If every rank is a thread of this process. */
+static bool threaded = false;
+
+/** @brief Number of ranks simulated by the in-process backend. */
+static int rankCount;
+
+/** @brief Mailbox of every rank simulated by the in-process backend. */
+static Mailbox *mailboxes;
+
+/** @brief Rank simulated by the calling thread. */
+static _Thread_local int threadRank = 0;
+
+/** @brief Lengths of the arrays of doubles a datatype was committed for. */
+static int *typeLengths = NULL;
+
+/** @brief Datatypes committed, one per length. */
+static MPI_Datatype *types = NULL;
+
+/** @brief Number of datatypes committed. */
+static int typeCount = 0;
+
+/** @brief Locking flag which warrants mutual exclusion while accessing the datatypes. */
+static pthread_mutex_t typesAccess = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Gets the size of an element.
+ *
+ * @param type type of the element
+ * @return size in bytes
+ */
+static int typeSize(TransportType type)
+{
+    switch (type)
+    {
+    case TRANSPORT_INT:
+        return sizeof(int);
+    case TRANSPORT_DOUBLE:
+        return sizeof(double);
+    default:
+        return sizeof(char);
+    }
+}
+
+/**
+ * @brief Gets the MPI datatype of an element.
+ *
+ * @param type type of the element
+ * @return MPI datatype
+ */
+static MPI_Datatype mpiType(TransportType type)
+{
+    switch (type)
+    {
+    case TRANSPORT_INT:
+        return MPI_INT;
+    case TRANSPORT_DOUBLE:
+        return MPI_DOUBLE;
+    default:
+        return MPI_CHAR;
+    }
+}
+
+/**
+ * @brief Describes an array to MPI, arrays of doubles as a single element of a contiguous datatype.
+ *
+ * @param count number of elements
+ * @param type type of the elements
+ * @param mpiCount set to the number of MPI elements
+ * @param datatype set to the MPI datatype
+ */
+static void describe(int count, TransportType type, int *mpiCount, MPI_Datatype *datatype)
+{
+    *mpiCount = count;
+    *datatype = mpiType(type);
+    if (type != TRANSPORT_DOUBLE || count < 2)
+        return;
+
+    pthread_mutex_lock(&typesAccess);
+
+    // few distinct lengths, usually one per matrix order
+    int i = 0;
+    while (i < typeCount && typeLengths[i] != count)
+        i++;
+    if (i == typeCount)
+    {
+        typeLengths = realloc(typeLengths, sizeof(int) * (typeCount + 1));
+        types = realloc(types, sizeof(MPI_Datatype) * (typeCount + 1));
+        typeLengths[typeCount] = count;
+        MPI_Type_contiguous(count, MPI_DOUBLE, &types[typeCount]);
+        MPI_Type_commit(&types[typeCount]);
+        typeCount++;
+    }
+    *mpiCount = 1;
+    *datatype = types[i];
+
+    pthread_mutex_unlock(&typesAccess);
+}
+
+/**
+ * @brief Switches to the in-process backend, where every rank is a thread of this process.
+ *
+ * Must be called by a process that is alone in MPI_COMM_WORLD, before any message is exchanged.
+ * The calling thread and every thread that does not enter a rank act as rank 0.
+ *
+ * @param _rankCount number of ranks to be simulated
+ */
+void startThreadTransport(int _rankCount)
+{
+    rankCount = _rankCount;
+    mailboxes = malloc(sizeof(Mailbox) * rankCount);
+    for (int r = 0; r < rankCount; r++)
+    {
+        Mailbox *box = &mailboxes[r];
+        box->stub = malloc(sizeof(Mail));
+        atomic_init(&box->stub->next, NULL);
+        atomic_init(&box->head, box->stub);
+        box->tail = box->stub;
+        box->pendingFirst = NULL;
+        box->pendingLast = NULL;
+        box->pendingCount = 0;
+        atomic_init(&box->sleeping, false);
+        box->event = eventfd(0, 0);
+        box->messageCount = 0;
+        box->byteCount = 0;
+        box->maxDepth = 0;
+    }
+    threaded = true;
+}
+
+/**
+ * @brief Frees the datatypes committed for arrays of doubles and the mailboxes of the in-process backend.
+ *
+ * Should be called once every rank has stopped exchanging messages.
+ */
+void freeTransport()
+{
+    for (int i = 0; i < typeCount; i++)
+        MPI_Type_free(&types[i]);
+    free(typeLengths);
+    free(types);
+    typeLengths = NULL;
+    types = NULL;
+    typeCount = 0;
+
+    if (!threaded)
+        return;
+    for (int r = 0; r < rankCount; r++)
+    {
+        free(mailboxes[r].stub);
+        close(mailboxes[r].event);
+    }
+    free(mailboxes);
+}
+
+/**
+ * @brief Makes the calling thread act as a given rank of the in-process backend.
+ *
+ * @param rank rank simulated by the thread
+ */
+void enterRank(int rank)
+{
+    threadRank = rank;
+}
+
+/**
+ * @brief Gets the rank of the caller.
+ *
+ * @return rank in MPI_COMM_WORLD, or the rank simulated by the calling thread
+ */
+int transportRank()
+{
+    if (threaded)
+        return threadRank;
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+/**
+ * @brief Pushes a message into a mailbox, from any thread.
+ *
+ * @param box mailbox of the receiver
+ * @param mail message to be pushed
+ */
+static void pushMail(Mailbox *box, Mail *mail)
+{
+    atomic_store(&mail->next, NULL);
+    Mail *previous = atomic_exchange(&box->head, mail);
+    atomic_store(&previous->next, mail);
+}
+
+/**
+ * @brief Takes the oldest message out of a mailbox, only from its owner.
+ *
+ * @param box mailbox of the caller
+ * @return message, NULL if there are none or the last one is still being pushed
+ */
+static Mail *popMail(Mailbox *box)
+{
+    Mail *tail = box->tail;
+    Mail *next = atomic_load(&tail->next);
+
+    // skip the placeholder
+    if (tail == box->stub)
+    {
+        if (next == NULL)
+            return NULL;
+        box->tail = next;
+        tail = next;
+        next = atomic_load(&next->next);
+    }
+
+    if (next != NULL)
+    {
+        box->tail = next;
+        return tail;
+    }
+
+    // tail is the last message, put the placeholder behind it so it can be taken out
+    if (tail != atomic_load(&box->head))
+        return NULL;
+    pushMail(box, box->stub);
+    next = atomic_load(&tail->next);
+    if (next != NULL)
+    {
+        box->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Copies a message into the mailbox of a rank, waking it if it is blocked.
+ *
+ * @param blockCount number of buffers the message is gathered from
+ * @param blocks buffers the message is gathered from
+ * @param bytes size of each buffer
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param detached if nobody waits for it to be received
+ * @return message posted
+ */
+static Mail *postMail(int blockCount, const void *blocks[blockCount], const int bytes[blockCount], int destination, int tag, bool detached)
+{
+    int total = 0;
+    for (int b = 0; b < blockCount; b++)
+        total += bytes[b];
+
+    Mail *mail = malloc(sizeof(Mail) + total);
+    mail->source = threadRank;
+    mail->tag = tag;
+    mail->bytes = total;
+    mail->detached = detached;
+    atomic_init(&mail->received, false);
+    for (int b = 0, offset = 0; b < blockCount; offset += bytes[b], b++)
+        memcpy(mail->data + offset, blocks[b], bytes[b]);
+
+    Mailbox *box = &mailboxes[destination];
+    pushMail(box, mail);
+
+    uint64_t one = 1;
+    if (atomic_exchange(&box->sleeping, false) && write(box->event, &one, sizeof(one)) != sizeof(one))
+        perror("Error on postMail() event write");
+
+    // a detached message may be gone already
+    return detached ? NULL : mail;
+}
+
+/**
+ * @brief Moves every message pushed so far into the list of messages waiting to be probed.
+ *
+ * @param box mailbox of the caller
+ */
+static void drainMailbox(Mailbox *box)
+{
+    Mail *mail;
+    while ((mail = popMail(box)) != NULL)
+    {
+        mail->pendingNext = NULL;
+        if (box->pendingLast == NULL)
+            box->pendingFirst = mail;
+        else
+            box->pendingLast->pendingNext = mail;
+        box->pendingLast = mail;
+        box->pendingCount++;
+    }
+    if (box->pendingCount > box->maxDepth)
+        box->maxDepth = box->pendingCount;
+}
+
+/**
+ * @brief Takes the oldest matching message out of the list of messages waiting to be probed.
+ *
+ * @param box mailbox of the caller
+ * @param source rank the message must come from, or TRANSPORT_ANY_SOURCE
+ * @param tag tag the message must have, or TRANSPORT_ANY_TAG
+ * @return message, NULL if none matches
+ */
+static Mail *takeMatch(Mailbox *box, int source, int tag)
+{
+    Mail *previous = NULL;
+    for (Mail *mail = box->pendingFirst; mail != NULL; previous = mail, mail = mail->pendingNext)
+    {
+        // like in MPI, any tag only matches the tags of point-to-point messages
+        if ((source != TRANSPORT_ANY_SOURCE && mail->source != source) || (tag == TRANSPORT_ANY_TAG ? mail->tag < 0 : mail->tag != tag))
+            continue;
+
+        if (previous == NULL)
+            box->pendingFirst = mail->pendingNext;
+        else
+            previous->pendingNext = mail->pendingNext;
+        if (box->pendingLast == mail)
+            box->pendingLast = previous;
+        box->pendingCount--;
+        return mail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sends a message, returning once its buffer can be reused.
+ *
+ * @param buffer elements to be sent
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ */
+void transportSend(const void *buffer, int count, TransportType type, int destination, int tag)
+{
+    if (threaded)
+    {
+        int bytes = count * typeSize(type);
+        postMail(1, &buffer, &bytes, destination, tag, true);
+        return;
+    }
+
+    int mpiCount;
+    MPI_Datatype datatype;
+    describe(count, type, &mpiCount, &datatype);
+    MPI_Send(buffer, mpiCount, datatype, destination, tag, MPI_COMM_WORLD);
+}
+
+/**
+ * @brief Starts sending a message.
+ *
+ * Arrays of doubles are sent through MPI as a single element of a contiguous datatype, committed once per length.
+ *
+ * @param buffer elements to be sent, must stay allocated until the request completes
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+void transportIsend(const void *buffer, int count, TransportType type, int destination, int tag, TransportRequest *request)
+{
+    *request = TRANSPORT_REQUEST_NULL;
+    if (threaded)
+    {
+        int bytes = count * typeSize(type);
+        request->mail = postMail(1, &buffer, &bytes, destination, tag, false);
+        return;
+    }
+
+    int mpiCount;
+    MPI_Datatype datatype;
+    describe(count, type, &mpiCount, &datatype);
+    MPI_Isend(buffer, mpiCount, datatype, destination, tag, MPI_COMM_WORLD, &request->mpi);
+}
+
+/**
+ * @brief Starts sending a message that only completes once it has been received.
+ *
+ * @param buffer elements to be sent, must stay allocated until the request completes
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+void transportIssend(const void *buffer, int count, TransportType type, int destination, int tag, TransportRequest *request)
+{
+    // every send of the in-process backend is synchronous
+    if (threaded)
+    {
+        transportIsend(buffer, count, type, destination, tag, request);
+        return;
+    }
+
+    *request = TRANSPORT_REQUEST_NULL;
+    int mpiCount;
+    MPI_Datatype datatype;
+    describe(count, type, &mpiCount, &datatype);
+    MPI_Issend(buffer, mpiCount, datatype, destination, tag, MPI_COMM_WORLD, &request->mpi);
+}
+
+/**
+ * @brief Starts sending a message gathered from several buffers, received as a single array.
+ *
+ * Described to MPI with an hindexed datatype over the buffers, so nothing is copied.
+ *
+ * @param blockCount number of buffers
+ * @param blocks buffers to be sent, must stay allocated until the request completes
+ * @param counts number of elements of each buffer
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+void transportIsendBlocks(int blockCount, void *blocks[blockCount], int counts[blockCount], TransportType type, int destination, int tag,
+                          TransportRequest *request)
+{
+    *request = TRANSPORT_REQUEST_NULL;
+    if (threaded)
+    {
+        int bytes[blockCount];
+        for (int b = 0; b < blockCount; b++)
+            bytes[b] = counts[b] * typeSize(type);
+        request->mail = postMail(blockCount, (const void **)blocks, bytes, destination, tag, false);
+        return;
+    }
+
+    MPI_Aint displacements[blockCount];
+    for (int b = 0; b < blockCount; b++)
+        MPI_Get_address(blocks[b], &displacements[b]);
+
+    // freed right away, MPI keeps it until the send is done
+    MPI_Datatype blocksType;
+    MPI_Type_create_hindexed(blockCount, counts, displacements, mpiType(type), &blocksType);
+    MPI_Type_commit(&blocksType);
+    MPI_Isend(MPI_BOTTOM, 1, blocksType, destination, tag, MPI_COMM_WORLD, &request->mpi);
+    MPI_Type_free(&blocksType);
+}
+
+/**
+ * @brief Blocks until a matching message arrives, taking it out of reach of any other probe.
+ *
+ * @param source rank the message must come from, or TRANSPORT_ANY_SOURCE
+ * @param tag tag the message must have, or TRANSPORT_ANY_TAG
+ * @param message handle to receive the message through
+ * @param status envelope of the message
+ */
+void transportMprobe(int source, int tag, TransportMessage *message, TransportStatus *status)
+{
+    if (!threaded)
+    {
+        MPI_Mprobe(source == TRANSPORT_ANY_SOURCE ? MPI_ANY_SOURCE : source, tag == TRANSPORT_ANY_TAG ? MPI_ANY_TAG : tag, MPI_COMM_WORLD,
+                   &message->mpi, &status->mpi);
+        message->mail = NULL;
+        status->source = status->mpi.MPI_SOURCE;
+        status->tag = status->mpi.MPI_TAG;
+        return;
+    }
+
+    Mailbox *box = &mailboxes[threadRank];
+    Mail *mail;
+    while (true)
+    {
+        drainMailbox(box);
+        if ((mail = takeMatch(box, source, tag)) != NULL)
+            break;
+
+        // check again once senders know they have to wake us, a message may have arrived meanwhile
+        atomic_store(&box->sleeping, true);
+        drainMailbox(box);
+        if ((mail = takeMatch(box, source, tag)) != NULL)
+        {
+            atomic_store(&box->sleeping, false);
+            break;
+        }
+
+        uint64_t posted;
+        if (read(box->event, &posted, sizeof(posted)) != sizeof(posted) && errno != EINTR)
+            perror("Error on transportMprobe() event read");
+        atomic_store(&box->sleeping, false);
+    }
+
+    message->mail = mail;
+    status->source = mail->source;
+    status->tag = mail->tag;
+    status->bytes = mail->bytes;
+}
+
+/**
+ * @brief Gets the number of elements of a probed message.
+ *
+ * @param status envelope of the message
+ * @param type type of the elements
+ * @return number of elements
+ */
+int transportGetCount(TransportStatus *status, TransportType type)
+{
+    if (threaded)
+        return status->bytes / typeSize(type);
+
+    int count;
+    MPI_Get_count(&status->mpi, mpiType(type), &count);
+    return count;
+}
+
+/**
+ * @brief Receives a probed message.
+ *
+ * @param buffer buffer for the elements
+ * @param count number of elements, as given by transportGetCount()
+ * @param type type of the elements
+ * @param message handle of the message
+ */
+void transportMrecv(void *buffer, int count, TransportType type, TransportMessage *message)
+{
+    if (!threaded)
+    {
+        MPI_Mrecv(buffer, count, mpiType(type), &message->mpi, MPI_STATUS_IGNORE);
+        return;
+    }
+
+    Mail *mail = message->mail;
+    Mailbox *box = &mailboxes[threadRank];
+    int bytes = count * typeSize(type);
+    memcpy(buffer, mail->data, bytes < mail->bytes ? bytes : mail->bytes);
+    box->messageCount++;
+    box->byteCount += mail->bytes;
+
+    // the sender may free it as soon as it is marked
+    if (mail->detached)
+        free(mail);
+    else
+        atomic_store(&mail->received, true);
+}
+
+/**
+ * @brief Checks if a request belongs to no send in progress.
+ *
+ * @param request request to be checked
+ * @return if it is null
+ */
+bool transportRequestIsNull(TransportRequest *request)
+{
+    return request->mpi == MPI_REQUEST_NULL && request->mail == NULL;
+}
+
+/**
+ * @brief Completes a send of the in-process backend if it was received.
+ *
+ * @param request request of the send
+ * @return if it completed now
+ */
+static bool testMail(TransportRequest *request)
+{
+    if (request->mail == NULL || !atomic_load(&request->mail->received))
+        return false;
+    free(request->mail);
+    request->mail = NULL;
+    return true;
+}
+
+/**
+ * @brief Completes every send that has finished, setting their requests to null.
+ *
+ * @param count number of requests
+ * @param requests requests to be checked, null ones are skipped
+ * @return number of sends that finished
+ */
+int transportTestsome(int count, TransportRequest requests[count])
+{
+    int completedCount = 0;
+    if (threaded)
+    {
+        for (int i = 0; i < count; i++)
+            if (testMail(&requests[i]))
+                completedCount++;
+        return completedCount;
+    }
+
+    MPI_Request mpiRequests[count];
+    int completed[count];
+    for (int i = 0; i < count; i++)
+        mpiRequests[i] = requests[i].mpi;
+    MPI_Testsome(count, mpiRequests, &completedCount, completed, MPI_STATUSES_IGNORE);
+    for (int i = 0; i < count; i++)
+        requests[i].mpi = mpiRequests[i];
+    return completedCount == MPI_UNDEFINED ? 0 : completedCount;
+}
+
+/**
+ * @brief Blocks until a send finishes, setting its request to null.
+ *
+ * @param request request of the send, may be null
+ */
+void transportWait(TransportRequest *request)
+{
+    if (!threaded)
+    {
+        MPI_Wait(&request->mpi, MPI_STATUS_IGNORE);
+        return;
+    }
+
+    long backoff = MIN_BACKOFF;
+    while (request->mail != NULL && !testMail(request))
+    {
+        backOff(backoff);
+        backoff = nextBackoff(backoff);
+    }
+}
+
+/**
+ * @brief Blocks until every send finishes, setting their requests to null.
+ *
+ * @param count number of requests
+ * @param requests requests of the sends, may be null
+ */
+void transportWaitall(int count, TransportRequest requests[count])
+{
+    for (int i = 0; i < count; i++)
+        transportWait(&requests[i]);
+}
+
+/**
+ * @brief Sums arrays of ints of every rank into rank 0.
+ *
+ * Collective, every rank calls it with the same count. In the in-process backend every other rank sends its array
+ * to rank 0, which adds them up.
+ *
+ * @param values elements of the caller, replaced by the sums on rank 0
+ * @param count number of elements
+ */
+void transportReduceSum(int *values, int count)
+{
+    int rank = transportRank();
+
+    if (!threaded)
+    {
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : values, values, count, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        return;
+    }
+
+    if (rank != 0)
+    {
+        transportSend(values, count, TRANSPORT_INT, 0, REDUCE_TAG);
+        return;
+    }
+
+    int *received = malloc(sizeof(int) * count);
+    TransportMessage message;
+    TransportStatus status;
+    for (int r = 1; r < rankCount; r++)
+    {
+        transportMprobe(r, REDUCE_TAG, &message, &status);
+        transportMrecv(received, count, TRANSPORT_INT, &message);
+        for (int i = 0; i < count; i++)
+            values[i] += received[i];
+    }
+    free(received);
+}
+
+/**
+ * @brief Checks if every rank is a thread of this process.
+ *
+ * @return if the in-process backend is in use
+ */
+bool threadTransport()
+{
+    return threaded;
+}
+
+/**
+ * @brief Gets the statistics of the in-process backend.
+ *
+ * Only meaningful once every rank has stopped exchanging messages.
+ *
+ * @return TransportStats struct with the statistics
+ */
+TransportStats getTransportStats()
+{
+    TransportStats stats = {.messageCount = 0, .byteCount = 0, .maxQueueDepth = 0, .maxQueueRank = 0};
+    for (int r = 0; threaded && r < rankCount; r++)
+    {
+        stats.messageCount += mailboxes[r].messageCount;
+        stats.byteCount += mailboxes[r].byteCount;
+        if (mailboxes[r].maxDepth > stats.maxQueueDepth)
+        {
+            stats.maxQueueDepth = mailboxes[r].maxDepth;
+            stats.maxQueueRank = r;
+        }
+    }
+    return stats;
+}
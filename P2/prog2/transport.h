@@ -0,0 +1,270 @@
+/**
+ * @file transport.h (interface file)
+ *
+ * @brief Problem name: multiprocess determinant calculation with multithreaded dispatcher
+ *
+ * Point-to-point messages exchanged by the dispatcher, its compute threads and the workers, and sums reduced into rank 0.
+ *
+ * By default they go through MPI. The in-process backend instead runs every rank as a thread of a single process,
+ * each rank owning a lock-free mailbox that any thread pushes into and only the rank takes from,
+ * so the dispatcher protocol can be measured at hundreds of ranks without a real launch.
+ * Sends of the in-process backend complete once the message has been received.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <mpi.h>
+#include <stdbool.h>
+
+/** @brief Matches a message from any rank. */
+#define TRANSPORT_ANY_SOURCE (-1)
+
+/** @brief Matches a message with any tag. */
+#define TRANSPORT_ANY_TAG (-1)
+
+/** @brief Type of the elements of a message. */
+typedef enum TransportType
+{
+    TRANSPORT_CHAR,
+    TRANSPORT_INT,
+    TRANSPORT_DOUBLE
+} TransportType;
+
+/** @brief Message of the in-process backend. */
+typedef struct Mail Mail;
+
+/**
+ * @brief Struct relative to a send in progress.
+ *
+ * @param mpi request of the MPI backend
+ * @param mail message of the in-process backend, NULL once the send completed
+ */
+typedef struct TransportRequest
+{
+    MPI_Request mpi;
+    Mail *mail;
+} TransportRequest;
+
+/** @brief Request of no send, or of one that completed. */
+#define TRANSPORT_REQUEST_NULL ((TransportRequest){.mpi = MPI_REQUEST_NULL, .mail = NULL})
+
+/**
+ * @brief Struct relative to a probed message, only received through it.
+ *
+ * @param mpi message of the MPI backend
+ * @param mail message of the in-process backend
+ */
+typedef struct TransportMessage
+{
+    MPI_Message mpi;
+    Mail *mail;
+} TransportMessage;
+
+/**
+ * @brief Struct relative to the envelope of a probed message.
+ *
+ * @param source rank that sent it
+ * @param tag tag it was sent with
+ * @param mpi status of the MPI backend
+ * @param bytes size of the message in the in-process backend
+ */
+typedef struct TransportStatus
+{
+    int source;
+    int tag;
+    MPI_Status mpi;
+    int bytes;
+} TransportStatus;
+
+/**
+ * @brief Statistics of the in-process backend.
+ *
+ * @param messageCount number of messages received
+ * @param byteCount number of bytes received
+ * @param maxQueueDepth most messages waiting to be received by a single rank
+ * @param maxQueueRank rank that had them waiting
+ */
+typedef struct TransportStats
+{
+    long messageCount;
+    long byteCount;
+    int maxQueueDepth;
+    int maxQueueRank;
+} TransportStats;
+
+/**
+ * @brief Switches to the in-process backend, where every rank is a thread of this process.
+ *
+ * Must be called by a process that is alone in MPI_COMM_WORLD, before any message is exchanged.
+ * The calling thread and every thread that does not enter a rank act as rank 0.
+ *
+ * @param rankCount number of ranks to be simulated
+ */
+extern void startThreadTransport(int rankCount);
+
+/**
+ * @brief Frees the datatypes committed for arrays of doubles and the mailboxes of the in-process backend.
+ *
+ * Should be called once every rank has stopped exchanging messages.
+ */
+extern void freeTransport();
+
+/**
+ * @brief Makes the calling thread act as a given rank of the in-process backend.
+ *
+ * @param rank rank simulated by the thread
+ */
+extern void enterRank(int rank);
+
+/**
+ * @brief Gets the rank of the caller.
+ *
+ * @return rank in MPI_COMM_WORLD, or the rank simulated by the calling thread
+ */
+extern int transportRank();
+
+/**
+ * @brief Sends a message, returning once its buffer can be reused.
+ *
+ * @param buffer elements to be sent
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ */
+extern void transportSend(const void *buffer, int count, TransportType type, int destination, int tag);
+
+/**
+ * @brief Starts sending a message.
+ *
+ * Arrays of doubles are sent through MPI as a single element of a contiguous datatype, committed once per length.
+ *
+ * @param buffer elements to be sent, must stay allocated until the request completes
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+extern void transportIsend(const void *buffer, int count, TransportType type, int destination, int tag, TransportRequest *request);
+
+/**
+ * @brief Starts sending a message that only completes once it has been received.
+ *
+ * @param buffer elements to be sent, must stay allocated until the request completes
+ * @param count number of elements
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+extern void transportIssend(const void *buffer, int count, TransportType type, int destination, int tag, TransportRequest *request);
+
+/**
+ * @brief Starts sending a message gathered from several buffers, received as a single array.
+ *
+ * Described to MPI with an hindexed datatype over the buffers, so nothing is copied.
+ *
+ * @param blockCount number of buffers
+ * @param blocks buffers to be sent, must stay allocated until the request completes
+ * @param counts number of elements of each buffer
+ * @param type type of the elements
+ * @param destination rank to send to
+ * @param tag tag of the message
+ * @param request request of the send
+ */
+extern void transportIsendBlocks(int blockCount, void *blocks[blockCount], int counts[blockCount], TransportType type, int destination, int tag,
+                                 TransportRequest *request);
+
+/**
+ * @brief Blocks until a matching message arrives, taking it out of reach of any other probe.
+ *
+ * @param source rank the message must come from, or TRANSPORT_ANY_SOURCE
+ * @param tag tag the message must have, or TRANSPORT_ANY_TAG
+ * @param message handle to receive the message through
+ * @param status envelope of the message
+ */
+extern void transportMprobe(int source, int tag, TransportMessage *message, TransportStatus *status);
+
+/**
+ * @brief Gets the number of elements of a probed message.
+ *
+ * @param status envelope of the message
+ * @param type type of the elements
+ * @return number of elements
+ */
+extern int transportGetCount(TransportStatus *status, TransportType type);
+
+/**
+ * @brief Receives a probed message.
+ *
+ * @param buffer buffer for the elements
+ * @param count number of elements, as given by transportGetCount()
+ * @param type type of the elements
+ * @param message handle of the message
+ */
+extern void transportMrecv(void *buffer, int count, TransportType type, TransportMessage *message);
+
+/**
+ * @brief Checks if a request belongs to no send in progress.
+ *
+ * @param request request to be checked
+ * @return if it is null
+ */
+extern bool transportRequestIsNull(TransportRequest *request);
+
+/**
+ * @brief Completes every send that has finished, setting their requests to null.
+ *
+ * @param count number of requests
+ * @param requests requests to be checked, null ones are skipped
+ * @return number of sends that finished
+ */
+extern int transportTestsome(int count, TransportRequest requests[count]);
+
+/**
+ * @brief Blocks until a send finishes, setting its request to null.
+ *
+ * @param request request of the send, may be null
+ */
+extern void transportWait(TransportRequest *request);
+
+/**
+ * @brief Blocks until every send finishes, setting their requests to null.
+ *
+ * @param count number of requests
+ * @param requests requests of the sends, may be null
+ */
+extern void transportWaitall(int count, TransportRequest requests[count]);
+
+/**
+ * @brief Sums arrays of ints of every rank into rank 0.
+ *
+ * Collective, every rank calls it with the same count.
+ *
+ * @param values elements of the caller, replaced by the sums on rank 0
+ * @param count number of elements
+ */
+extern void transportReduceSum(int *values, int count);
+
+/**
+ * @brief Checks if every rank is a thread of this process.
+ *
+ * @return if the in-process backend is in use
+ */
+extern bool threadTransport();
+
+/**
+ * @brief Gets the statistics of the in-process backend.
+ *
+ * Only meaningful once every rank has stopped exchanging messages.
+ *
+ * @return TransportStats struct with the statistics
+ */
+extern TransportStats getTransportStats();
+
+#endif
@@ -15,8 +15,18 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "worker.h"
+#include "sharedRegion.h"
+#include "protocol.h"
+#include "nodeMemory.h"
+#include "distributedLU.h"
+#include "matrixPool.h"
+#include "hierarchy.h"
+#include "transport.h"
+#include "trace.h"
 
 /**
  * @brief Calculates the determinant of a matrix through Gaussian elimination.
@@ -76,57 +86,163 @@ static double calculateDeterminant(int order, double *matrix)
     return determinant;
 }
 
+/**
+ * @brief Computes the matrices left for all processes together, as announced by rank 0.
+ *
+ * @param taskCount number of matrices left, as told by the kill message
+ */
+void whileDistributedTasksWork(int taskCount)
+{
+    int header[3]; // file name length, matrix index, order
+    char *fileName = NULL;
+
+    for (int i = 0; i < taskCount; i++)
+    {
+        MPI_Bcast(header, 3, MPI_INT, 0, MPI_COMM_WORLD);
+        fileName = realloc(fileName, header[0]);
+        MPI_Bcast(fileName, header[0], MPI_CHAR, 0, MPI_COMM_WORLD);
+
+        // result is only kept by rank 0
+        TRACE_BEGIN("distributed LU");
+        distributedDeterminant(fileName, header[1], header[2]);
+        TRACE_END("distributed LU");
+    }
+
+    free(fileName);
+}
+
 /**
  * @brief Worker process loop.
  *
- * Receives tasks via send and returns results from tasks.
+ * Receives tasks via send and returns results from tasks, to rank 0 or to the aggregator of its node.
+ * Once stopped, helps compute the matrices left for all processes together.
  */
 void whileTasksWorkAndSendResult()
 {
     int matrixOrder;
-    double *matrix;
+    int elementCount;   // number of doubles in the received matrix
+    double *matrix = NULL;
     int currentMax = 0; // how much memory we've allocated to the matrix
+    double determinant; // result of the task processing
+    double sendValue;   // buffer of the pending result send
+    int descriptor[2];  // slot and order of a matrix in the shared window
+    int distributedCount = 0; // matrices left for all processes once tasks run out
 
-    MPI_Request req = MPI_REQUEST_NULL;
+    int rank = transportRank();
+    int parent = parentRank(rank); // hands us tasks and takes back results
+
+    TransportMessage message; // handle to the probed message
+    TransportStatus status;   // tag and size of the probed message
+
+    TRACE_THREAD("worker");
+
+    TransportRequest req = TRANSPORT_REQUEST_NULL;
     while (true)
     {
-        // receive next task matrix size
-        MPI_Recv(&matrixOrder, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        // wait for the next message, its size is only known once it arrives
+        TRACE_BEGIN("wait");
+        transportMprobe(parent, TRANSPORT_ANY_TAG, &message, &status);
+        TRACE_END("wait");
 
         // signal to stop working
-        if (matrixOrder < 1)
+        if (status.tag == KILL_TAG)
         {
+            // empty if rank 0 gave up before reading anything
+            elementCount = transportGetCount(&status, TRANSPORT_INT);
+            transportMrecv(&distributedCount, elementCount, TRANSPORT_INT, &message);
+
             // wait for last response to be read before shutdown
-            MPI_Wait(&req, MPI_STATUS_IGNORE);
+            transportWait(&req);
             break;
         }
 
-        // our current matrix buffer isnt large enough
-        if (matrixOrder > currentMax)
+        if (status.tag == SHARED_TASK_TAG)
         {
-            // if matrix has not been allocated yet
-            if (currentMax == 0)
-                matrix = malloc(sizeof(double) * matrixOrder * matrixOrder);
-            else
-                matrix = realloc(matrix, sizeof(double) * matrixOrder * matrixOrder);
-
-            currentMax = matrixOrder;
+            // matrix was written into one of our slots of the shared window, reduce it in place
+            transportMrecv(descriptor, 2, TRANSPORT_INT, &message);
+            syncNodeMemory();
+            TRACE_BEGIN("compute");
+            determinant = calculateDeterminant(descriptor[1], nodeSlot(rank, descriptor[0]));
+            TRACE_END("compute");
         }
+        else
+        {
+            // matrices are square, so the order is the root of the element count
+            elementCount = transportGetCount(&status, TRANSPORT_DOUBLE);
+            matrixOrder = (int)lround(sqrt(elementCount));
 
-        // receive matrix
-        MPI_Recv(matrix, matrixOrder * matrixOrder, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            // our current matrix buffer isnt large enough
+            if (matrixOrder > currentMax)
+            {
+                // old contents are about to be overwritten, no need to realloc them
+                if (currentMax > 0)
+                    MPI_Free_mem(matrix);
+                MPI_Alloc_mem(sizeof(double) * matrixOrder * matrixOrder, MPI_INFO_NULL, &matrix);
 
-        // calculate result
-        double determinant = calculateDeterminant(matrixOrder, matrix);
+                currentMax = matrixOrder;
+            }
+
+            // receive matrix
+            TRACE_BEGIN("receive");
+            transportMrecv(matrix, elementCount, TRANSPORT_DOUBLE, &message);
+            TRACE_END("receive");
+
+            // calculate result
+            TRACE_BEGIN("compute");
+            determinant = calculateDeterminant(matrixOrder, matrix);
+            TRACE_END("compute");
+        }
 
         // wait for last send to cleared
-        if (req != MPI_REQUEST_NULL)
-            MPI_Wait(&req, MPI_STATUS_IGNORE);
+        TRACE_BEGIN("send");
+        if (!transportRequestIsNull(&req))
+            transportWait(&req);
 
         // send back result
-        MPI_Isend(&determinant, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, &req);
+        sendValue = determinant;
+        transportIsend(&sendValue, 1, TRANSPORT_DOUBLE, parent, RESULT_TAG, &req);
+        TRACE_END("send");
     }
 
     if (currentMax > 0)
-        free(matrix);
-}
\ No newline at end of file
+        MPI_Free_mem(matrix);
+
+    whileDistributedTasksWork(distributedCount);
+}
+
+/**
+ * @brief Rank 0 compute thread loop.
+ *
+ * Takes tasks straight from its queue in the shared region and sends results to its own rank,
+ * so that they are merged like those of remote workers.
+ *
+ * @param par pointer to the index of this thread among the rank 0 compute threads
+ * @return pointer to the identification of this thread
+ */
+void *whileLocalTasksWorkAndSendResult(void *par)
+{
+    int localId = *((int *)par);
+    Task task;
+    double determinant;
+
+    TRACE_THREAD("compute thread");
+
+    while (true)
+    {
+        TRACE_BEGIN("wait");
+        task = awaitTask(processCount - 1 + localId);
+        TRACE_END("wait");
+        if (task.order == -1)
+            break;
+
+        TRACE_BEGIN("compute");
+        determinant = calculateDeterminant(task.order, task.matrix);
+        TRACE_END("compute");
+        releaseMatrix(task.matrix);
+
+        // send result to own rank so the merger handles it like any other
+        transportSend(&determinant, 1, TRANSPORT_DOUBLE, 0, LOCAL_RESULT_TAG + localId);
+    }
+
+    pthread_exit((int *)EXIT_SUCCESS);
+}
@@ -15,8 +15,27 @@
 /**
  * @brief Worker process loop.
  *
- * Receives tasks via send and returns results from tasks.
+ * Receives tasks via send and returns results from tasks, to rank 0 or to the aggregator of its node.
+ * Once stopped, helps compute the matrices left for all processes together.
  */
 extern void whileTasksWorkAndSendResult();
 
+/**
+ * @brief Computes the matrices left for all processes together, as announced by rank 0.
+ *
+ * @param taskCount number of matrices left, as told by the kill message
+ */
+extern void whileDistributedTasksWork(int taskCount);
+
+/**
+ * @brief Rank 0 compute thread loop.
+ *
+ * Takes tasks straight from its queue in the shared region and sends results to its own rank,
+ * so that they are merged like those of remote workers.
+ *
+ * @param par pointer to the index of this thread among the rank 0 compute threads
+ * @return pointer to the identification of this thread
+ */
+extern void *whileLocalTasksWorkAndSendResult(void *par);
+
 #endif
\ No newline at end of file
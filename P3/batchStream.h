@@ -0,0 +1,200 @@
+/**
+ * @file batchStream.h (interface and implementation file)
+ *
+ * @brief Problem name: CUDA matrix multiplication along rows and columns
+ *
+ * Streams the matrices of a file in batches through two host buffers, an I/O thread
+ * reading the next batch into one while the other one is being computed.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef _BATCH_STREAM_H
+#define _BATCH_STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/**
+ * @brief Struct containing the state of the batches of a file being streamed.
+ *
+ * @param file file the matrices are read from, positioned at the first one
+ * @param order order of the matrices
+ * @param count number of matrices left to be read
+ * @param batchSize most matrices in a batch
+ * @param buffers host buffers batches are read into, each with room for batchSize matrices
+ * @param batchCounts number of matrices read into each buffer
+ * @param filled if a buffer holds a batch not yet handed out
+ * @param ended if the I/O thread has read its last batch
+ * @param current buffer handed out last, -1 if none is
+ * @param reader I/O thread
+ * @param access locking flag which warrants mutual exclusion while accessing the buffer states
+ * @param changed synchronization point when a buffer is filled or handed back
+ */
+typedef struct BatchStream
+{
+    FILE *file;
+    int order;
+    int count;
+    int batchSize;
+    double *buffers[2];
+    int batchCounts[2];
+    bool filled[2];
+    bool ended;
+    int current;
+    pthread_t reader;
+    pthread_mutex_t access;
+    pthread_cond_t changed;
+} BatchStream;
+
+/**
+ * @brief I/O thread that reads batches into whichever buffer is free, in turn.
+ *
+ * @param par pointer to the BatchStream being read
+ * @return NULL
+ */
+static void *readBatches(void *par)
+{
+    BatchStream *stream = (BatchStream *)par;
+    size_t matrixElements = (size_t)stream->order * stream->order;
+
+    for (int next = 0; stream->count > 0; next = 1 - next)
+    {
+        pthread_mutex_lock(&stream->access);
+        while (stream->filled[next])
+            pthread_cond_wait(&stream->changed, &stream->access);
+        pthread_mutex_unlock(&stream->access);
+
+        // read outside the lock, the buffer is ours until it is marked filled
+        int wanted = stream->count < stream->batchSize ? stream->count : stream->batchSize;
+        int read = fread(stream->buffers[next], sizeof(double) * matrixElements, wanted, stream->file);
+
+        // a truncated file ends the stream at its last whole matrix
+        stream->count = read < wanted ? 0 : stream->count - read;
+
+        pthread_mutex_lock(&stream->access);
+        stream->batchCounts[next] = read;
+        stream->filled[next] = read > 0;
+        stream->ended = stream->count == 0;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->access);
+    }
+
+    pthread_mutex_lock(&stream->access);
+    stream->ended = true;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->access);
+
+    return NULL;
+}
+
+/**
+ * @brief Gets how many matrices go in a batch, so that both buffers fit in the budget.
+ *
+ * @param order order of the matrices
+ * @param count number of matrices in the file
+ * @param budget most bytes taken by both buffers
+ * @return most matrices in a batch, a single one if not even two fit
+ */
+static int batchSizeFor(int order, int count, size_t budget)
+{
+    size_t fitting = budget / (2 * sizeof(double) * (size_t)order * order);
+    return fitting < 1 ? 1 : fitting < (size_t)count ? (int)fitting : count;
+}
+
+/**
+ * @brief Starts streaming the matrices of a file.
+ *
+ * @param stream stream to be started
+ * @param file file the matrices are read from, positioned at the first one
+ * @param order order of the matrices
+ * @param count number of matrices in the file
+ * @param budget most bytes taken by both buffers
+ * @return most matrices in a batch
+ */
+static int startBatchStream(BatchStream *stream, FILE *file, int order, int count, size_t budget)
+{
+    size_t matrixBytes = sizeof(double) * (size_t)order * order;
+
+    stream->file = file;
+    stream->order = order;
+    stream->count = count;
+    stream->batchSize = batchSizeFor(order, count, budget);
+    for (int b = 0; b < 2; b++)
+    {
+        stream->buffers[b] = (double *)malloc(matrixBytes * stream->batchSize);
+        stream->batchCounts[b] = 0;
+        stream->filled[b] = false;
+    }
+    stream->ended = false;
+    stream->current = -1;
+    pthread_mutex_init(&stream->access, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+
+    if (pthread_create(&stream->reader, NULL, readBatches, stream) != 0)
+    {
+        perror("Error on creating I/O thread");
+        exit(1);
+    }
+    return stream->batchSize;
+}
+
+/**
+ * @brief Hands back the batch handed out last and waits for the next one.
+ *
+ * @param stream stream being read
+ * @param batchCount set to the number of matrices in the batch
+ * @return buffer with the batch, valid until the next call, NULL once there are no more
+ */
+static double *nextBatch(BatchStream *stream, int *batchCount)
+{
+    pthread_mutex_lock(&stream->access);
+
+    // batches are handed out in the order they were read
+    int next = 0;
+    if (stream->current != -1)
+    {
+        stream->filled[stream->current] = false;
+        pthread_cond_broadcast(&stream->changed);
+        next = 1 - stream->current;
+    }
+
+    while (!stream->filled[next] && !stream->ended)
+        pthread_cond_wait(&stream->changed, &stream->access);
+
+    double *batch = NULL;
+    *batchCount = 0;
+    if (stream->filled[next])
+    {
+        stream->current = next;
+        batch = stream->buffers[next];
+        *batchCount = stream->batchCounts[next];
+    }
+
+    pthread_mutex_unlock(&stream->access);
+    return batch;
+}
+
+/**
+ * @brief Waits for the I/O thread and frees both buffers.
+ *
+ * Must be called once nextBatch() returned NULL.
+ *
+ * @param stream stream to be stopped
+ */
+static void stopBatchStream(BatchStream *stream)
+{
+    if (pthread_join(stream->reader, NULL) != 0)
+    {
+        perror("Error on waiting for I/O thread");
+        exit(1);
+    }
+    free(stream->buffers[0]);
+    free(stream->buffers[1]);
+    pthread_mutex_destroy(&stream->access);
+    pthread_cond_destroy(&stream->changed);
+}
+
+#endif // _BATCH_STREAM_H
@@ -0,0 +1,348 @@
+/**
+ * @file bench.h (interface and implementation file)
+ *
+ * @brief Problem name: CUDA matrix multiplication along rows and columns
+ *
+ * Statistics of repeated timings of each phase of a run, reported as JSON along with
+ * the host and build they were taken on, and comparison of two such reports.
+ *
+ * @author Pedro Casimiro, nmec: 93179
+ * @author Diogo Bento, nmec: 93391
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+/** @brief Phases every repetition is split into, total being their sum. */
+enum Phase
+{
+    PHASE_LOAD,
+    PHASE_TRANSFER,
+    PHASE_COMPUTE,
+    PHASE_VERIFY,
+    PHASE_TOTAL,
+    PHASE_COUNT
+};
+
+/** @brief Names of the phases, as written to the reports. */
+static const char *PHASE_NAMES[PHASE_COUNT] = {"load", "transfer", "compute", "verify", "total"};
+
+/** @brief Default smallest relative change of a median reported as significant, in percent. */
+#define DEFAULT_THRESHOLD 5.0
+
+/** @brief Welch t statistic above which two sets of timings are told apart, about 95% confidence. */
+#define SIGNIFICANT_T 2.0
+
+/**
+ * @brief Struct containing the statistics of the timings of a phase.
+ *
+ * @param count number of timings
+ * @param min shortest timing
+ * @param median median timing
+ * @param p95 95th percentile timing
+ * @param mean mean timing
+ * @param stddev sample standard deviation of the timings
+ */
+typedef struct PhaseStats
+{
+    int count;
+    double min;
+    double median;
+    double p95;
+    double mean;
+    double stddev;
+} PhaseStats;
+
+/**
+ * @brief Gets the seconds elapsed since a point in time.
+ *
+ * @param start point in time, measured with CLOCK_MONOTONIC_RAW
+ * @return seconds elapsed
+ */
+static double secondsSince(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (now.tv_sec - start->tv_sec) / 1.0 + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/**
+ * @brief Orders timings from the shortest to the longest.
+ *
+ * @param a first timing
+ * @param b second timing
+ * @return negative if a goes first, positive if b goes first
+ */
+static int compareSeconds(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Computes the statistics of the timings of a phase.
+ *
+ * @param samples timings of every repetition, left untouched
+ * @param count number of repetitions
+ * @return PhaseStats struct with the statistics
+ */
+static PhaseStats summarize(double *samples, int count)
+{
+    PhaseStats stats = {count, 0, 0, 0, 0, 0};
+    if (count == 0)
+        return stats;
+
+    double *sorted = (double *)malloc(sizeof(double) * count);
+    memcpy(sorted, samples, sizeof(double) * count);
+    qsort(sorted, count, sizeof(double), compareSeconds);
+
+    stats.min = sorted[0];
+    stats.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    // nearest rank
+    stats.p95 = sorted[(int)ceil(0.95 * count) - 1];
+
+    for (int i = 0; i < count; i++)
+        stats.mean += samples[i];
+    stats.mean /= count;
+    for (int i = 0; i < count && count > 1; i++)
+        stats.stddev += (samples[i] - stats.mean) * (samples[i] - stats.mean);
+    stats.stddev = count > 1 ? sqrt(stats.stddev / (count - 1)) : 0;
+
+    free(sorted);
+    return stats;
+}
+
+/**
+ * @brief Writes a string as a JSON string literal.
+ *
+ * @param out stream to write to
+ * @param string string to be written
+ */
+static void printJSONString(FILE *out, const char *string)
+{
+    fputc('"', out);
+    for (; *string; string++)
+    {
+        if (*string == '"' || *string == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*string >= ' ')
+            fputc(*string, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Gets the model name of the CPU.
+ *
+ * @param model buffer for the name
+ * @param size size of the buffer
+ */
+static void cpuModel(char *model, int size)
+{
+    snprintf(model, size, "unknown");
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo == NULL)
+        return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), cpuinfo) != NULL)
+    {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon != NULL)
+        {
+            snprintf(model, size, "%s", colon + 2);
+            model[strcspn(model, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose(cpuinfo);
+}
+
+/**
+ * @brief Prints the statistics of every phase as a JSON report, along with the host, build and configuration.
+ *
+ * @param out stream to write to
+ * @param program name of the program
+ * @param backend what determinants were computed on, "gpu" or "cpu"
+ * @param device name of the device, or NULL on CPU
+ * @param threadCount number of CPU threads computing determinants, 0 on GPU
+ * @param memoryBudget host memory for matrices read ahead, in MiB
+ * @param fileNames names of the files processed
+ * @param fileCount number of files processed
+ * @param repetitions number of repetitions timed
+ * @param samples timings of every repetition, per phase
+ * @param differences number of determinants that did not match the single threaded CPU ones
+ */
+static void printBenchReport(FILE *out, const char *program, const char *backend, const char *device, int threadCount, int memoryBudget,
+                             char **fileNames, int fileCount, int repetitions, double *samples[PHASE_COUNT], int differences)
+{
+    char hostName[256] = "unknown";
+    gethostname(hostName, sizeof(hostName));
+    struct utsname system;
+    uname(&system);
+    char model[256];
+    cpuModel(model, sizeof(model));
+
+    fprintf(out, "{\n  \"program\": ");
+    printJSONString(out, program);
+    fprintf(out, ",\n  \"backend\": ");
+    printJSONString(out, backend);
+
+    fprintf(out, ",\n  \"host\": {\"name\": ");
+    printJSONString(out, hostName);
+    fprintf(out, ", \"system\": \"%s %s %s\", \"cpu\": ", system.sysname, system.release, system.machine);
+    printJSONString(out, model);
+    fprintf(out, ", \"cores\": %ld, \"device\": ", sysconf(_SC_NPROCESSORS_ONLN));
+    if (device != NULL)
+        printJSONString(out, device);
+    else
+        fprintf(out, "null");
+
+    fprintf(out, "},\n  \"build\": {\"compiler\": ");
+#ifdef __VERSION__
+    printJSONString(out, __VERSION__);
+#else
+    fprintf(out, "null");
+#endif
+#ifdef __CUDACC_VER_MAJOR__
+    fprintf(out, ", \"cuda\": \"%d.%d\"", __CUDACC_VER_MAJOR__, __CUDACC_VER_MINOR__);
+#else
+    fprintf(out, ", \"cuda\": null");
+#endif
+    fprintf(out, ", \"date\": \"%s %s\"},\n", __DATE__, __TIME__);
+
+    fprintf(out, "  \"config\": {\"repetitions\": %d, \"threads\": %d, \"memoryBudgetMiB\": %d, \"files\": [", repetitions, threadCount,
+            memoryBudget);
+    for (int i = 0; i < fileCount; i++)
+    {
+        fprintf(out, i ? ", " : "");
+        printJSONString(out, fileNames[i]);
+    }
+    fprintf(out, "]},\n  \"differences\": %d,\n  \"phases\": {\n", differences);
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        PhaseStats stats = summarize(samples[p], repetitions);
+        fprintf(out, "    \"%s\": {\"count\": %d, \"min\": %.9f, \"median\": %.9f, \"p95\": %.9f, \"mean\": %.9f, \"stddev\": %.9f, \"samples\": [",
+                PHASE_NAMES[p], stats.count, stats.min, stats.median, stats.p95, stats.mean, stats.stddev);
+        for (int r = 0; r < repetitions; r++)
+            fprintf(out, "%s%.9f", r ? ", " : "", samples[p][r]);
+        fprintf(out, "]}%s\n", p < PHASE_COUNT - 1 ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+}
+
+/**
+ * @brief Reads a whole report into memory.
+ *
+ * @param fileName name of the report
+ * @return contents of the report, NULL if it could not be read
+ */
+static char *readReport(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = (char *)malloc(size + 1);
+    text[fread(text, 1, size, file)] = '\0';
+    fclose(file);
+    return text;
+}
+
+/**
+ * @brief Reads the statistics of a phase out of a report written by printBenchReport().
+ *
+ * @param report contents of the report
+ * @param phase phase to be read
+ * @param stats set to the statistics read
+ * @return if the phase was found
+ */
+static bool readPhaseStats(const char *report, int phase, PhaseStats *stats)
+{
+    const char *phases = strstr(report, "\"phases\"");
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\": {", PHASE_NAMES[phase]);
+    const char *object = phases != NULL ? strstr(phases, key) : NULL;
+    if (object == NULL)
+        return false;
+
+    // fields are searched for within the object only
+    const char *end = strchr(object, '}');
+    const char *names[] = {"\"count\": ", "\"min\": ", "\"median\": ", "\"p95\": ", "\"mean\": ", "\"stddev\": "};
+    double values[6];
+    for (int f = 0; f < 6; f++)
+    {
+        const char *field = strstr(object, names[f]);
+        if (field == NULL || field > end)
+            return false;
+        values[f] = strtod(field + strlen(names[f]), NULL);
+    }
+
+    *stats = (PhaseStats){(int)values[0], values[1], values[2], values[3], values[4], values[5]};
+    return true;
+}
+
+/**
+ * @brief Prints how the median of every phase changed between two reports.
+ *
+ * A change is significant when it is larger than the threshold and the Welch t statistic of both sets of timings
+ * tells them apart.
+ *
+ * @param oldName name of the baseline report
+ * @param newName name of the report compared with it
+ * @param threshold smallest relative change reported as significant, in percent
+ * @return EXIT_FAILURE if a phase got significantly slower or a report could not be read, EXIT_SUCCESS otherwise
+ */
+static int compareBenchReports(const char *oldName, const char *newName, double threshold)
+{
+    char *oldReport = readReport(oldName);
+    char *newReport = readReport(newName);
+    if (oldReport == NULL || newReport == NULL)
+    {
+        fprintf(stderr, "Could not read %s\n", oldReport == NULL ? oldName : newName);
+        free(oldReport);
+        free(newReport);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    printf("%-10s %14s %14s %9s %8s\n", "Phase", "Old median", "New median", "Change", "t");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        PhaseStats before, after;
+        if (!readPhaseStats(oldReport, p, &before) || !readPhaseStats(newReport, p, &after))
+        {
+            printf("%-10s missing\n", PHASE_NAMES[p]);
+            continue;
+        }
+
+        double change = before.median > 0 ? 100 * (after.median - before.median) / before.median : 0;
+        double error = sqrt(before.stddev * before.stddev / before.count + after.stddev * after.stddev / after.count);
+        double t = error > 0 ? (after.mean - before.mean) / error : 0;
+        bool significant = fabs(change) > threshold && (error == 0 || fabs(t) > SIGNIFICANT_T);
+
+        printf("%-10s %14.6f %14.6f %+8.1f%% %8.2f%s\n", PHASE_NAMES[p], before.median, after.median, change, t,
+               significant ? (change > 0 ? "  slower" : "  faster") : "");
+        if (significant && change > 0)
+            status = EXIT_FAILURE;
+    }
+
+    free(oldReport);
+    free(newReport);
+    return status;
+}
+
+#endif // _BENCH_H
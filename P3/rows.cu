@@ -9,13 +9,20 @@
  */
 
 #include "common.h"
+#include "batchStream.h"
+#include "bench.h"
 #include <cuda_runtime.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+
+/** @brief Default host memory for matrices read ahead, in MiB, both batch buffers included. */
+#define DEFAULT_MEMORY_BUDGET 256
 
 /**
  * @brief Struct containing the command line argument values.
@@ -23,12 +30,24 @@
  * @param status if the file was called correctly
  * @param fileCount count of the files given
  * @param fileNames array of file names given
+ * @param onCPU if determinants are computed by CPU threads instead of the device
+ * @param threadCount number of CPU threads, every core if 0
+ * @param memoryBudget most host memory taken by matrices read ahead, in MiB
+ * @param benchRepetitions number of timed repetitions of a benchmark, 0 for a single run
+ * @param compareNames names of the reports to be compared, NULL if none are
+ * @param threshold smallest relative change reported as significant by a comparison, in percent
  */
 typedef struct CMDArgs
 {
     int status;
     int fileCount;
     char **fileNames;
+    bool onCPU;
+    int threadCount;
+    int memoryBudget;
+    int benchRepetitions;
+    char *compareNames[2];
+    double threshold;
 } CMDArgs;
 
 /**
@@ -53,7 +72,13 @@ static void printUsage(char *cmdName)
     fprintf(stderr, "\nSynopsis: %s OPTIONS [filenames]\n"
                     "  OPTIONS:\n"
                     "  -h      --- print this help\n"
-                    "  -f      --- file names, space separated\n",
+                    "  -f      --- file names, space separated\n"
+                    "  -c      --- compute on CPU threads instead of the device\n"
+                    "  -w      --- CPU thread count (default: 0, every core)\n"
+                    "  -m      --- host memory for matrices read ahead, in MiB (default: 256)\n"
+                    "  --bench N                --- time N repetitions of every phase and print them as JSON\n"
+                    "  --compare OLD.json NEW.json --- compare two benchmark reports\n"
+                    "  --threshold PCT          --- smallest change of a median reported by --compare (default: 5)\n",
             cmdName);
 }
 
@@ -68,6 +93,16 @@ CMDArgs parseCMD(int argc, char *args[])
 {
     CMDArgs cmdArgs;
     cmdArgs.status = EXIT_FAILURE;
+    cmdArgs.onCPU = false;
+    cmdArgs.threadCount = 0;
+    cmdArgs.memoryBudget = DEFAULT_MEMORY_BUDGET;
+    cmdArgs.benchRepetitions = 0;
+    cmdArgs.compareNames[0] = cmdArgs.compareNames[1] = NULL;
+    cmdArgs.threshold = DEFAULT_THRESHOLD;
+    struct option longOptions[] = {{"bench", required_argument, NULL, 'b'},
+                                   {"compare", required_argument, NULL, 'C'},
+                                   {"threshold", required_argument, NULL, 'T'},
+                                   {NULL, 0, NULL, 0}};
     int opt;
     opterr = 0;
     int filestart = -1;
@@ -81,7 +116,7 @@ CMDArgs parseCMD(int argc, char *args[])
     }
     do
     {
-        switch ((opt = getopt(argc, args, "f:w:h")))
+        switch ((opt = getopt_long(argc, args, "f:w:m:ch", longOptions, NULL)))
         {
         case 'f':                // file name
             if (filestart != -1) // duplicate -f
@@ -100,6 +135,57 @@ CMDArgs parseCMD(int argc, char *args[])
             cmdArgs.fileNames = (char **)malloc(sizeof(char **) * filespan);
             memcpy(cmdArgs.fileNames, &args[filestart], (sizeof(char *) * filespan));
             break;
+        case 'c': // CPU backend
+            cmdArgs.onCPU = true;
+            break;
+        case 'w': // CPU threads
+            cmdArgs.threadCount = atoi(optarg);
+            if (cmdArgs.threadCount < 0)
+            {
+                fprintf(stderr, "%s: negative thread count\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'm': // memory budget
+            cmdArgs.memoryBudget = atoi(optarg);
+            if (cmdArgs.memoryBudget <= 0)
+            {
+                fprintf(stderr, "%s: memory budget must be positive\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'b': // benchmark
+            cmdArgs.benchRepetitions = atoi(optarg);
+            if (cmdArgs.benchRepetitions <= 0)
+            {
+                fprintf(stderr, "%s: repetition count must be positive\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            break;
+        case 'C': // reports to compare, the second one follows the first
+            if (optind >= argc || args[optind][0] == '-')
+            {
+                fprintf(stderr, "%s: --compare needs two reports\n", basename(args[0]));
+                printUsage(basename(args[0]));
+                if (!(filestart == -1 || filespan == 0))
+                    free(cmdArgs.fileNames);
+                return cmdArgs;
+            }
+            cmdArgs.compareNames[0] = optarg;
+            cmdArgs.compareNames[1] = args[optind++];
+            break;
+        case 'T': // significance threshold
+            cmdArgs.threshold = atof(optarg);
+            break;
         case 'h': // help
             printUsage(basename(args[0]));
             if (!(filestart == -1 || filespan == 0))
@@ -115,6 +201,15 @@ CMDArgs parseCMD(int argc, char *args[])
             break;
         }
     } while (opt != -1);
+    if (cmdArgs.compareNames[0] != NULL) // only reports are needed
+    {
+        if (!(filestart == -1 || filespan == 0))
+            free(cmdArgs.fileNames);
+        cmdArgs.fileCount = 0;
+        cmdArgs.fileNames = NULL;
+        cmdArgs.status = EXIT_SUCCESS;
+        return cmdArgs;
+    }
     if (filestart == -1 || filespan == 0) // no files
     {
         fprintf(stderr, "%s: file name is missing\n", basename(args[0]));
@@ -199,6 +294,142 @@ static double calculateDeterminantOnCPU(int order, double *matrix)
     return determinant;
 }
 
+/** @brief Fewest rows each thread of a group reduces, smaller matrices get fewer threads each. */
+static const int MIN_ROWS_PER_THREAD = 16;
+
+/**
+ * @brief Struct containing the state of a group of CPU threads reducing one matrix at a time.
+ *
+ * @param barrier synchronization point of the group between elimination steps
+ * @param determinant determinant of the matrix being reduced
+ * @param singular if no pivot was found for the current step
+ */
+typedef struct CPUGroup
+{
+    pthread_barrier_t barrier;
+    double determinant;
+    bool singular;
+} CPUGroup;
+
+/**
+ * @brief Struct containing what a CPU thread needs to compute its share of the determinants of a file.
+ *
+ * @param matrices pointer containing all matrices
+ * @param determinants pointer containing determinant slots
+ * @param count number of matrices
+ * @param order size of matrices
+ * @param groupCount number of thread groups, each takes every groupCount-th matrix
+ * @param groupSize number of threads in each group
+ * @param groupIndex index of the group of this thread
+ * @param member index of this thread in its group
+ * @param group state of the group of this thread
+ */
+typedef struct CPUThreadArgs
+{
+    double *matrices;
+    double *determinants;
+    int count;
+    int order;
+    int groupCount;
+    int groupSize;
+    int groupIndex;
+    int member;
+    CPUGroup *group;
+} CPUThreadArgs;
+
+/**
+ * @brief Reduces a matrix along rows with a group of threads, each taking every groupSize-th row below the pivot.
+ *
+ * Mirrors calculateDeterminantsOnGPU, the group standing for a block and its threads for the threads of the block.
+ *
+ * @param args arguments of the calling thread
+ * @param matrix 1D representation of the matrix, reduced in place
+ */
+static void reduceOnCPUGroup(CPUThreadArgs *args, double *matrix)
+{
+    int order = args->order;
+    CPUGroup *group = args->group;
+    bool synchronized = args->groupSize > 1;
+
+    if (args->member == 0)
+    {
+        group->determinant = 1;
+        group->singular = false;
+    }
+
+    for (int i = 0; i < order; i++)
+    {
+        double *iterrow = matrix + i * order;
+
+        // first thread of the group puts a non zero pivot in place
+        if (args->member == 0)
+        {
+            if (iterrow[i] == 0)
+            {
+                int foundJ = 0;
+                for (int j = i + 1; j < order; j++)
+                    if (matrix[j * order + i] != 0)
+                    { // scan for row
+                        foundJ = j;
+                        break;
+                    }
+                if (!foundJ)
+                    group->singular = true;
+                else
+                {
+                    group->determinant *= -1;
+                    double tempRow[order]; // swap row
+                    memcpy(tempRow, iterrow, sizeof(double) * order);
+                    memcpy(iterrow, matrix + foundJ * order, sizeof(double) * order);
+                    memcpy(matrix + foundJ * order, tempRow, sizeof(double) * order);
+                }
+            }
+            group->determinant = group->singular ? 0 : group->determinant * iterrow[i];
+        }
+
+        if (synchronized)
+            pthread_barrier_wait(&group->barrier); // SYNC POINT: PIVOT IS IN PLACE
+        if (group->singular)
+            break;
+
+        // REDUCE ALONG ROW
+        for (int k = i + 1 + args->member; k < order; k += args->groupSize)
+        {
+            double *threadrow = matrix + k * order;
+            double hold = threadrow[i] / iterrow[i];
+            for (int j = i + 1; j < order; j++)
+                threadrow[j] -= hold * iterrow[j];
+        }
+
+        if (synchronized)
+            pthread_barrier_wait(&group->barrier); // SYNC POINT: REDUCE IS DONE
+    }
+
+    // the first thread moves on to the next matrix only once everyone is done with this one
+    if (synchronized)
+        pthread_barrier_wait(&group->barrier);
+}
+
+/**
+ * @brief CPU thread that computes the determinants of every matrix handed to its group.
+ *
+ * @param par pointer to the CPUThreadArgs of this thread
+ * @return NULL
+ */
+static void *calculateDeterminantsOnCPU(void *par)
+{
+    CPUThreadArgs *args = (CPUThreadArgs *)par;
+
+    for (int m = args->groupIndex; m < args->count; m += args->groupCount)
+    {
+        reduceOnCPUGroup(args, args->matrices + (size_t)m * args->order * args->order);
+        if (args->member == 0)
+            args->determinants[m] = args->group->determinant;
+    }
+
+    return NULL;
+}
+
 /**
  * @brief Function responsible for computing determinants on GPU
  *
@@ -289,10 +520,13 @@ __global__ void calculateDeterminantsOnGPU(double *matrix, double *determinants,
 /**
  * @brief Parses file contents and calculates determinants on GPU
  *
+ * Matrices are streamed in batches that fit the memory budget, the next batch being read while one is computed.
+ *
  * @param fileName Name of file to handle
  * @param resultSlot Results object to write to
+ * @param budget Most host memory taken by matrices read ahead, in bytes
  */
-static void parseFile(char *fileName, Result *resultSlot)
+static void parseFile(char *fileName, Result *resultSlot, size_t budget)
 {
     FILE *file = fopen(fileName, "rb");
     // if file is a dud
@@ -309,43 +543,44 @@ static void parseFile(char *fileName, Result *resultSlot)
     int order;
     fread(&order, 4, 1, file);
 
-    if ((size_t)order * (size_t)order * (size_t)count + (size_t)count > (size_t)5e9)
-    {
-        printf("File %s is bigger than we can handle, it will be ignored\n", fileName);
-        fclose(file);
-        (*resultSlot).matrixCount = 0;
-        return;
-    }
-
     // initialize results object
     (*resultSlot).matrixCount = count;
-    (*resultSlot).determinants = (double *)malloc(sizeof(double) * count);
+    (*resultSlot).determinants = (double *)calloc(count, sizeof(double));
     double *determinantsOnGPU;
     CHECK(cudaMalloc((void **)&determinantsOnGPU, sizeof(double) * count));
 
-    int memsize = order * order * count * sizeof(double);
+    // the device holds one batch at a time
+    BatchStream stream;
+    int batchSize = startBatchStream(&stream, file, order, count, budget);
+    size_t memsize = (size_t)order * order * batchSize * sizeof(double);
 
     double *matrixOnGPU;
-    double *matrix = (double *)malloc(memsize);
     CHECK(cudaMalloc((void **)&matrixOnGPU, memsize));
 
     dim3 block(order, 1);
-    dim3 grid(count);
 
-    fread(matrix, 8, memsize, file);
-    CHECK(cudaMemcpy(matrixOnGPU, matrix, memsize, cudaMemcpyHostToDevice));
-    calculateDeterminantsOnGPU<<<grid, block>>>(matrixOnGPU, determinantsOnGPU, order);
-    CHECK(cudaDeviceSynchronize());
-    CHECK(cudaGetLastError());
+    int done = 0; // matrices computed so far
+    int batchCount;
+    double *batch;
+    while ((batch = nextBatch(&stream, &batchCount)) != NULL)
+    {
+        dim3 grid(batchCount);
+
+        CHECK(cudaMemcpy(matrixOnGPU, batch, (size_t)order * order * batchCount * sizeof(double), cudaMemcpyHostToDevice));
+        calculateDeterminantsOnGPU<<<grid, block>>>(matrixOnGPU, determinantsOnGPU + done, order);
+        CHECK(cudaDeviceSynchronize());
+        CHECK(cudaGetLastError());
+        done += batchCount;
+    }
+    stopBatchStream(&stream);
 
     // copy results out of device
-    CHECK(cudaMemcpy((*resultSlot).determinants, determinantsOnGPU, count * sizeof(double), cudaMemcpyDeviceToHost));
+    CHECK(cudaMemcpy((*resultSlot).determinants, determinantsOnGPU, done * sizeof(double), cudaMemcpyDeviceToHost));
 
     // free memory
     CHECK(cudaFree(determinantsOnGPU));
     CHECK(cudaFree(matrixOnGPU));
     fclose(file);
-    free(matrix);
 }
 
 /**
@@ -386,6 +621,120 @@ static void parseFileOnCPU(char *fileName, Result *resultSlot)
     free(matrix);
 }
 
+/**
+ * @brief Calculates the determinants of a batch of matrices on CPU threads
+ *
+ * Matrices are dealt to groups of threads like they are to blocks on GPU, one thread per group
+ * unless there are fewer matrices than threads, in which case the threads of a group share a matrix.
+ *
+ * @param matrices pointer containing all matrices of the batch
+ * @param determinants pointer containing determinant slots of the batch
+ * @param count number of matrices in the batch
+ * @param order size of matrices
+ * @param threadCount Number of threads to compute with
+ */
+static void calculateBatchOnCPUThreads(double *matrices, double *determinants, int count, int order, int threadCount)
+{
+    // threads beyond what a matrix can keep busy are left out
+    int groupCount = count < threadCount ? count : threadCount;
+    int groupSize = threadCount / groupCount;
+    if (groupSize > order / MIN_ROWS_PER_THREAD)
+        groupSize = order / MIN_ROWS_PER_THREAD > 1 ? order / MIN_ROWS_PER_THREAD : 1;
+
+    CPUGroup *groups = (CPUGroup *)malloc(sizeof(CPUGroup) * groupCount);
+    CPUThreadArgs *args = (CPUThreadArgs *)malloc(sizeof(CPUThreadArgs) * groupCount * groupSize);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * groupCount * groupSize);
+    for (int g = 0; g < groupCount; g++)
+    {
+        if (groupSize > 1)
+            pthread_barrier_init(&groups[g].barrier, NULL, groupSize);
+        for (int member = 0; member < groupSize; member++)
+        {
+            CPUThreadArgs *arg = args + g * groupSize + member;
+            arg->matrices = matrices;
+            arg->determinants = determinants;
+            arg->count = count;
+            arg->order = order;
+            arg->groupCount = groupCount;
+            arg->groupSize = groupSize;
+            arg->groupIndex = g;
+            arg->member = member;
+            arg->group = groups + g;
+            if (pthread_create(threads + g * groupSize + member, NULL, calculateDeterminantsOnCPU, arg) != 0)
+            {
+                perror("Error on creating CPU thread");
+                exit(1);
+            }
+        }
+    }
+
+    for (int t = 0; t < groupCount * groupSize; t++)
+    {
+        if (pthread_join(threads[t], NULL) != 0)
+        {
+            perror("Error on waiting for CPU thread");
+            exit(1);
+        }
+    }
+
+    // free memory
+    for (int g = 0; g < groupCount; g++)
+    {
+        if (groupSize > 1)
+            pthread_barrier_destroy(&groups[g].barrier);
+    }
+    free(groups);
+    free(args);
+    free(threads);
+}
+
+/**
+ * @brief Parses file contents and calculates determinants on CPU threads
+ *
+ * Matrices are streamed in batches that fit the memory budget, the next batch being read while one is computed.
+ *
+ * @param fileName Name of file to handle
+ * @param resultSlot Results object to write to
+ * @param threadCount Number of threads to compute with
+ * @param budget Most host memory taken by matrices read ahead, in bytes
+ */
+static void parseFileOnCPUThreads(char *fileName, Result *resultSlot, int threadCount, size_t budget)
+{
+    FILE *file = fopen(fileName, "rb");
+    // if file is a dud
+    if (file == NULL)
+    {
+        (*resultSlot).matrixCount = 0;
+        return;
+    }
+    // number of matrices in the file
+    int count;
+    fread(&count, 4, 1, file);
+
+    // order of the matrices in the file
+    int order;
+    fread(&order, 4, 1, file);
+
+    // initialize results object
+    (*resultSlot).matrixCount = count;
+    (*resultSlot).determinants = (double *)calloc(count, sizeof(double));
+
+    BatchStream stream;
+    startBatchStream(&stream, file, order, count, budget);
+
+    int done = 0; // matrices computed so far
+    int batchCount;
+    double *batch;
+    while ((batch = nextBatch(&stream, &batchCount)) != NULL)
+    {
+        calculateBatchOnCPUThreads(batch, (*resultSlot).determinants + done, batchCount, order, threadCount);
+        done += batchCount;
+    }
+    stopBatchStream(&stream);
+
+    fclose(file);
+}
+
 /**
  * @brief Count number of different elements between 2 arrays
  *
@@ -414,6 +763,142 @@ static int countDifferent(double *arr1, double *arr2, int len, double tolerance)
     return c;
 }
 
+/**
+ * @brief Times the phases of computing the determinants of a file once, adding them to the timings of each phase
+ *
+ * Unlike parseFile(), batches are read, moved and computed one after the other so that every phase is timed apart.
+ * On CPU, moving a batch is copying it into the buffer it is reduced in.
+ *
+ * @param fileName Name of file to handle
+ * @param onCPU If determinants are computed by CPU threads instead of the device
+ * @param threadCount Number of CPU threads
+ * @param budget Most host memory taken by matrices read ahead, in bytes
+ * @param phases Timings of each phase, added to
+ * @return Number of determinants that do not match the single threaded CPU ones
+ */
+static int benchFile(char *fileName, bool onCPU, int threadCount, size_t budget, double phases[PHASE_COUNT])
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    FILE *file = fopen(fileName, "rb");
+    // if file is a dud
+    if (file == NULL)
+        return 0;
+    int count, order;
+    fread(&count, 4, 1, file);
+    fread(&order, 4, 1, file);
+
+    size_t matrixElements = (size_t)order * order;
+    int batchSize = batchSizeFor(order, count, budget);
+    double *batch = (double *)malloc(sizeof(double) * matrixElements * batchSize);
+    double *determinants = (double *)calloc(count, sizeof(double));
+
+    double *work = NULL, *matrixOnGPU = NULL, *determinantsOnGPU = NULL;
+    if (onCPU)
+        work = (double *)malloc(sizeof(double) * matrixElements * batchSize);
+    else
+    {
+        CHECK(cudaMalloc((void **)&matrixOnGPU, sizeof(double) * matrixElements * batchSize));
+        CHECK(cudaMalloc((void **)&determinantsOnGPU, sizeof(double) * count));
+    }
+    phases[PHASE_LOAD] += secondsSince(&start);
+
+    int done = 0; // matrices computed so far
+    while (done < count)
+    {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        int batchCount = fread(batch, sizeof(double) * matrixElements, count - done < batchSize ? count - done : batchSize, file);
+        phases[PHASE_LOAD] += secondsSince(&start);
+        if (batchCount == 0)
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        if (onCPU)
+            memcpy(work, batch, sizeof(double) * matrixElements * batchCount);
+        else
+            CHECK(cudaMemcpy(matrixOnGPU, batch, sizeof(double) * matrixElements * batchCount, cudaMemcpyHostToDevice));
+        phases[PHASE_TRANSFER] += secondsSince(&start);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        if (onCPU)
+            calculateBatchOnCPUThreads(work, determinants + done, batchCount, order, threadCount);
+        else
+        {
+            dim3 block(order, 1);
+            dim3 grid(batchCount);
+            calculateDeterminantsOnGPU<<<grid, block>>>(matrixOnGPU, determinantsOnGPU + done, order);
+            CHECK(cudaDeviceSynchronize());
+            CHECK(cudaGetLastError());
+        }
+        phases[PHASE_COMPUTE] += secondsSince(&start);
+        done += batchCount;
+    }
+    fclose(file);
+
+    if (!onCPU)
+    {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        CHECK(cudaMemcpy(determinants, determinantsOnGPU, done * sizeof(double), cudaMemcpyDeviceToHost));
+        phases[PHASE_TRANSFER] += secondsSince(&start);
+        CHECK(cudaFree(matrixOnGPU));
+        CHECK(cudaFree(determinantsOnGPU));
+    }
+
+    // single threaded CPU results are the reference
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    Result reference;
+    parseFileOnCPU(fileName, &reference);
+    int differences = countDifferent(determinants, reference.determinants, done, 5e-7);
+    phases[PHASE_VERIFY] += secondsSince(&start);
+
+    if (reference.matrixCount)
+        free(reference.determinants);
+    free(determinants);
+    free(batch);
+    free(work);
+    return differences;
+}
+
+/**
+ * @brief Times every phase over all files a number of times and prints their statistics as JSON
+ *
+ * A first repetition warms up caches and the device and is not timed.
+ *
+ * @param cmdArgs Command line argument values
+ * @param device Name of the device, NULL on CPU
+ * @param threadCount Number of CPU threads
+ * @return EXIT_FAILURE if any determinant did not match the single threaded CPU ones, EXIT_SUCCESS otherwise
+ */
+static int runBenchmark(CMDArgs *cmdArgs, const char *device, int threadCount)
+{
+    int repetitions = cmdArgs->benchRepetitions;
+    double *samples[PHASE_COUNT];
+    for (int p = 0; p < PHASE_COUNT; p++)
+        samples[p] = (double *)malloc(sizeof(double) * repetitions);
+
+    int differences = 0;
+    for (int r = -1; r < repetitions; r++)
+    {
+        double phases[PHASE_COUNT] = {0};
+        differences = 0;
+        for (int i = 0; i < cmdArgs->fileCount; i++)
+            differences += benchFile(cmdArgs->fileNames[i], cmdArgs->onCPU, threadCount, (size_t)cmdArgs->memoryBudget << 20, phases);
+        for (int p = 0; p < PHASE_TOTAL; p++)
+            phases[PHASE_TOTAL] += phases[p];
+
+        for (int p = 0; r >= 0 && p < PHASE_COUNT; p++)
+            samples[p][r] = phases[p];
+    }
+
+    printBenchReport(stdout, "rows", cmdArgs->onCPU ? "cpu" : "gpu", device, cmdArgs->onCPU ? threadCount : 0, cmdArgs->memoryBudget,
+                     cmdArgs->fileNames, cmdArgs->fileCount, repetitions, samples, differences);
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+        free(samples[p]);
+    return differences ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
     struct timespec start, finish; // time measurement
@@ -422,24 +907,56 @@ int main(int argc, char **argv)
     if (cmdArgs.status == EXIT_FAILURE)
         return EXIT_FAILURE;
 
+    if (cmdArgs.compareNames[0] != NULL)
+        return compareBenchReports(cmdArgs.compareNames[0], cmdArgs.compareNames[1], cmdArgs.threshold);
+
+    int threadCount = cmdArgs.threadCount > 0 ? cmdArgs.threadCount : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
     // set up device
-    int dev = 0;
     cudaDeviceProp deviceProp;
-    CHECK(cudaGetDeviceProperties(&deviceProp, dev));
-    printf("Using Device %d: %s\n", dev, deviceProp.name);
-    CHECK(cudaSetDevice(dev));
+    if (!cmdArgs.onCPU)
+    {
+        int dev = 0;
+        CHECK(cudaGetDeviceProperties(&deviceProp, dev));
+        if (cmdArgs.benchRepetitions == 0) // reports are JSON only
+            printf("Using Device %d: %s\n", dev, deviceProp.name);
+        CHECK(cudaSetDevice(dev));
+    }
 
-    Result *results = (Result *)malloc(sizeof(Result) * cmdArgs.fileCount);
+    if (cmdArgs.benchRepetitions > 0)
+    {
+        int status = runBenchmark(&cmdArgs, cmdArgs.onCPU ? NULL : deviceProp.name, threadCount);
+        free(cmdArgs.fileNames);
+        if (!cmdArgs.onCPU)
+            CHECK(cudaDeviceReset());
+        return status;
+    }
 
-    clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
+    Result *results = (Result *)malloc(sizeof(Result) * cmdArgs.fileCount);
 
-    for (int i = 0; i < cmdArgs.fileCount; i++)
+    if (cmdArgs.onCPU)
     {
-        parseFile(cmdArgs.fileNames[i], results + i);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
+        for (int i = 0; i < cmdArgs.fileCount; i++)
+        {
+            parseFileOnCPUThreads(cmdArgs.fileNames[i], results + i, threadCount, (size_t)cmdArgs.memoryBudget << 20);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &finish); // end time measurement
+        printResults(cmdArgs.fileNames, cmdArgs.fileCount, results);
+        printf("\nElapsed time on %d CPU threads = %.6f s\n", threadCount,
+               (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
+    }
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
+        for (int i = 0; i < cmdArgs.fileCount; i++)
+        {
+            parseFile(cmdArgs.fileNames[i], results + i, (size_t)cmdArgs.memoryBudget << 20);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &finish); // end time measurement
+        printResults(cmdArgs.fileNames, cmdArgs.fileCount, results);
+        printf("\nElapsed time on GPU = %.6f s\n", (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
     }
-    clock_gettime(CLOCK_MONOTONIC_RAW, &finish); // end time measurement
-    printResults(cmdArgs.fileNames, cmdArgs.fileCount, results);
-    printf("\nElapsed time on GPU = %.6f s\n", (finish.tv_sec - start.tv_sec) / 1.0 + (finish.tv_nsec - start.tv_nsec) / 1000000000.0);
 
     Result *resultsOnCPU = (Result *)malloc(sizeof(Result) * cmdArgs.fileCount);
     clock_gettime(CLOCK_MONOTONIC_RAW, &start); // begin time measurement
@@ -460,7 +977,7 @@ int main(int argc, char **argv)
             printf("Spotted %d different results at file %s\n", diff, cmdArgs.fileNames[i]);
     }
     if (!totaldiff)
-        printf("\nAll values are the same between CPU and GPU\n");
+        printf("\nAll values are the same between CPU and %s\n", cmdArgs.onCPU ? "CPU threads" : "GPU");
     free(cmdArgs.fileNames);
     for (int i = 0; i < cmdArgs.fileCount; i++)
     {
@@ -472,7 +989,8 @@ int main(int argc, char **argv)
     free(results);
     free(resultsOnCPU);
 
-    CHECK(cudaDeviceReset());
+    if (!cmdArgs.onCPU)
+        CHECK(cudaDeviceReset());
 
     return (0);
 }
@@ -0,0 +1,138 @@
+/**
+ *   Counter-based pseudo-random numbers
+ *
+ *   Number i of the stream of a seed is the SplitMix64 finalizer applied to seed + (i + 1) times the golden ratio, so
+ *   any number of the stream is computed without computing the ones before it. A buffer is thus filled by several
+ *   threads, each one computing its own range, and a seed gives the same buffer whatever the number of threads.
+ *
+ *   It is used by cryptCuda and cryptCudaStride for the sector numbers and by the matrix generators of MPI2.
+ */
+
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define RNG_DEFAULT_SEED  0xCCE2021ull
+#define RNG_GRAIN         16u                              // ranges given to threads are multiples of a cache line of words
+
+/* number counter of the stream of seed */
+
+static inline unsigned long long counter_rng (unsigned long long seed, unsigned long long counter)
+{
+  unsigned long long z;
+
+  z = seed + (counter + 1ull) * 0x9E3779B97F4A7C15ull;    // the Weyl sequence of SplitMix64
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline unsigned int counter_rng_u32 (unsigned long long seed, unsigned long long counter)
+{
+  return (unsigned int) (counter_rng (seed, counter) >> 32);
+}
+
+/* a number in [0, bound), without the bias of the remainder for small bounds */
+
+static inline unsigned int counter_rng_below (unsigned long long seed, unsigned long long counter, unsigned int bound)
+{
+  return (unsigned int) (((unsigned long long) counter_rng_u32 (seed, counter) * (unsigned long long) bound) >> 32);
+}
+
+/* a number in [0, 1) */
+
+static inline double counter_rng_double (unsigned long long seed, unsigned long long counter)
+{
+  return (double) (counter_rng (seed, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* fill the elements [first, last) of a buffer */
+
+typedef void (*rng_range_t) (void *arg, size_t first, size_t last);
+
+typedef struct
+{
+  rng_range_t fill;
+  void *arg;
+  size_t first;
+  size_t last;
+} rng_share_t;
+
+static void *rng_thread (void *arg)
+{
+  rng_share_t *share = (rng_share_t *) arg;
+
+  share->fill (share->arg, share->first, share->last);
+  return NULL;
+}
+
+/* fill n elements with n_threads threads, the calling thread doing the first range */
+
+static inline void rng_parallel (rng_range_t fill, void *arg, size_t n, int n_threads)
+{
+  rng_share_t *shares;
+  pthread_t *ids;
+  size_t n_grains;
+  int t;
+
+  n_grains = (n + RNG_GRAIN - 1u) / RNG_GRAIN;
+  if ((size_t) n_threads > n_grains)
+     n_threads = (int) n_grains;
+  if (n_threads <= 1)
+     { if (n > 0u)
+          fill (arg, 0u, n);
+       return;
+     }
+  shares = (rng_share_t *) malloc ((size_t) n_threads * sizeof (rng_share_t));
+  ids = (pthread_t *) malloc ((size_t) n_threads * sizeof (pthread_t));
+  for (t = 0; t < n_threads; t++)
+  { shares[t].fill = fill;
+    shares[t].arg = arg;
+    shares[t].first = n_grains * (size_t) t / (size_t) n_threads * RNG_GRAIN;
+    shares[t].last = (t == n_threads - 1) ? n : n_grains * (size_t) (t + 1) / (size_t) n_threads * RNG_GRAIN;
+    if (t > 0 && pthread_create (&ids[t], NULL, rng_thread, &shares[t]) != 0)
+    {
+      perror ("pthread_create");
+      exit (1);
+    }
+  }
+  fill (arg, shares[0].first, shares[0].last);
+  for (t = 1; t < n_threads; t++)
+    pthread_join (ids[t], NULL);
+  free (ids);
+  free (shares);
+}
+
+/* element i of data is number first_counter + i of the stream of seed */
+
+typedef struct
+{
+  unsigned int *data;
+  unsigned long long seed;
+  unsigned long long first_counter;
+} rng_u32_fill_t;
+
+static void rng_u32_range (void *arg, size_t first, size_t last)
+{
+  rng_u32_fill_t *job = (rng_u32_fill_t *) arg;
+  size_t i;
+
+  for (i = first; i < last; i++)
+    job->data[i] = counter_rng_u32 (job->seed, job->first_counter + (unsigned long long) i);
+}
+
+static inline void counter_rng_fill_u32 (unsigned int *data, size_t n, unsigned long long seed, unsigned long long first_counter,
+                                         int n_threads)
+{
+  rng_u32_fill_t job;
+
+  job.data = data;
+  job.seed = seed;
+  job.first_counter = first_counter;
+  rng_parallel (rng_u32_range, &job, n, n_threads);
+}
+
+#endif
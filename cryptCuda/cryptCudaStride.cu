@@ -6,12 +6,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "sector_tuning.h"
+#include "../common/counter_rng.h"
+#include "sector_layout.h"
 #include <cuda_runtime.h>
 
 /**
- *   program configuration
+ *   program configuration (defaults, the sector geometry can be given at run time)
  */
 
 #ifndef SECTOR_SIZE
@@ -27,6 +31,12 @@ static void modify_sector_cpu_kernel (unsigned int *sector_data, unsigned int se
                                       unsigned int sector_size);
 __global__ static void modify_sector_cuda_kernel (unsigned int * __restrict__ sector_data, unsigned int * __restrict__ sector_number,
                                                   unsigned int n_sectors, unsigned int sector_size);
+static void check_memory_size (size_t sector_data_size, size_t sector_number_size);
+static void init_host_data (unsigned int *host_sector_data, size_t sector_data_size, unsigned int *host_sector_number,
+                            size_t sector_number_size, unsigned long long seed);
+static void sweep_configurations (sector_config_t *config, int sweep_sector_sizes, const char *tuning_file, const char *device_name);
+static void check_layouts (const char *conversion, unsigned int *interleaved_data, unsigned int *sector_major_data, unsigned int n_sectors,
+                           unsigned int sector_size);
 static double get_delta_time(void);
 
 /**
@@ -39,6 +49,56 @@ int main (int argc, char **argv)
   if (sizeof (unsigned int) != (size_t) 4)
      return 1;                                             // it fails with prejudice if an integer does not have 4 bytes
 
+  /* the sector geometry and the launch geometry: built-in defaults, then the tuning file, then the command line
+     (0 means not given) */
+
+  sector_config_t config, given;
+  const char *tuning_file;
+  unsigned long long seed;
+  int opt, sweep;
+
+  config.sector_size = SECTOR_SIZE;
+  config.n_sectors = N_SECTORS;
+  config.block_dim_x = 1u;
+  config.block_dim_y = 1u;
+  config.grid_dim_y = 1u;
+  config.cpu_threads = 0;                                  // there is no threaded engine here
+  config.cpu_block_size = 0u;
+  memset (&given, 0, sizeof (given));
+  tuning_file = DEFAULT_TUNING_FILE;
+  seed = RNG_DEFAULT_SEED;
+  sweep = 0;
+  while ((opt = getopt (argc, argv, "s:n:x:y:Y:r:f:w")) != -1)
+    switch (opt)
+    { case 's': given.sector_size = (unsigned int) atoi (optarg);
+                break;
+      case 'n': given.n_sectors = (unsigned int) atoi (optarg);
+                break;
+      case 'x': given.block_dim_x = (unsigned int) atoi (optarg);
+                break;
+      case 'y': given.block_dim_y = (unsigned int) atoi (optarg);
+                break;
+      case 'Y': given.grid_dim_y = (unsigned int) atoi (optarg);
+                break;
+      case 'r': seed = strtoull (optarg, NULL, 0);
+                break;
+      case 'f': tuning_file = optarg;
+                break;
+      case 'w': sweep = 1;
+                break;
+      default:  fprintf (stderr, "usage: %s [-s sector_size] [-n n_sectors] [-x blockDimX] [-y blockDimY] [-Y gridDimY]"
+                                 " [-r seed] [-f tuning_file] [-w]\n", argv[0]);
+                exit (1);
+    }
+  if (given.sector_size != 0u)
+     config.sector_size = given.sector_size;
+  if (given.n_sectors != 0u)
+     config.n_sectors = given.n_sectors;
+  if (config.sector_size % 4u != 0u || config.sector_size == 0u || config.n_sectors == 0u)
+     { fprintf (stderr, "The sector size must be a positive multiple of 4 and the number of sectors positive\n");
+       exit (1);
+     }
+
   /* set up the device */
 
   int dev = 0;
@@ -49,6 +109,23 @@ int main (int argc, char **argv)
   printf("Using Device %d: %s\n", dev, deviceProp.name);
   CHECK (cudaSetDevice (dev));
 
+  /* a sweep tries several sector sizes (only the one given, if it was given) and times the launch geometries
+     for each one, keeping the fastest ones in the tuning file */
+
+  if (sweep)
+     { sweep_configurations (&config, given.sector_size == 0u, tuning_file, deviceProp.name);
+       CHECK (cudaDeviceReset ());
+       return 0;
+     }
+  if (load_tuning (tuning_file, "cryptCudaStride", deviceProp.name, &config))
+     printf ("Using the tuned configuration of %s\n", tuning_file);
+  if (given.block_dim_x != 0u)
+     config.block_dim_x = given.block_dim_x;
+  if (given.block_dim_y != 0u)
+     config.block_dim_y = given.block_dim_y;
+  if (given.grid_dim_y != 0u)
+     config.grid_dim_y = given.grid_dim_y;
+
   /* create memory areas in host and device memory where the disk sectors data and sector numbers will be stored */
 
   size_t sector_data_size;
@@ -56,12 +133,9 @@ int main (int argc, char **argv)
   unsigned int *host_sector_data, *host_sector_number;
   unsigned int *device_sector_data, *device_sector_number;
 
-  sector_data_size = (size_t) N_SECTORS * (size_t) SECTOR_SIZE;
-  sector_number_size = (size_t) N_SECTORS * sizeof (unsigned int);
-  if ((sector_data_size + sector_number_size) > (size_t) 1.3e9)
-     { fprintf (stderr,"The GeForce GTX 1660 Ti cannot handle more than 5GB of memory!\n");
-       exit (1);
-     }
+  sector_data_size = (size_t) config.n_sectors * (size_t) config.sector_size;
+  sector_number_size = (size_t) config.n_sectors * sizeof (unsigned int);
+  check_memory_size (sector_data_size, sector_number_size);
   printf ("Total sector data size: %lu\n", sector_data_size);
   printf ("Total sector numbers data size: %lu\n", sector_number_size);
 
@@ -73,11 +147,7 @@ int main (int argc, char **argv)
   /* initialize the host data */
 
   (void) get_delta_time ();
-  srand(0xCCE2021);
-  for (i = 0; i < (int) (sector_data_size / (int) sizeof(unsigned int)); i++)
-    host_sector_data[i] = 108584447u * (unsigned int) i; // "pseudo-random" data (faster than using the rand() function)
-  for(i = 0; i < (int) (sector_number_size / (int)sizeof(unsigned int)); i++)
-    host_sector_number[i] = (rand () & 0xFFFF) | ((rand () & 0xFFFF) << 16);
+  init_host_data (host_sector_data, sector_data_size, host_sector_number, sector_number_size, seed);
   printf ("The initialization of host data took %.3e seconds\n",get_delta_time ());
 
   /* copy the host data to the device memory */
@@ -89,24 +159,25 @@ int main (int argc, char **argv)
           (long) sector_data_size + (long) sector_number_size, get_delta_time ());
 
   /* run the computational kernel
-     as an example, N_SECTORS threads are launched where each thread deals with one sector */
+     as an example, n_sectors threads are launched where each thread deals with one sector */
 
   unsigned int gridDimX,gridDimY,gridDimZ,blockDimX,blockDimY,blockDimZ;
   int n_sectors, sector_size;
 
-  n_sectors = N_SECTORS;
-  sector_size = SECTOR_SIZE;
-  blockDimX = 1 << 0;                                             // optimize!
-  blockDimY = 1 << 0;                                             // optimize!
+  n_sectors = (int) config.n_sectors;
+  sector_size = (int) config.sector_size;
+  blockDimX = config.block_dim_x;
+  blockDimY = config.block_dim_y;
   blockDimZ = 1 << 0;                                             // do not change!
-  gridDimX = 1 << 21;                                             // optimize!
-  gridDimY = 1 << 0;                                              // optimize!
+  gridDimX = grid_dim_x (&config);
+  gridDimY = config.grid_dim_y;
   gridDimZ = 1 << 0;                                              // do not change!
 
   dim3 grid (gridDimX, gridDimY, gridDimZ);
   dim3 block (blockDimX, blockDimY, blockDimZ);
 
-  if ((gridDimX * gridDimY * gridDimZ * blockDimX * blockDimY * blockDimZ) != n_sectors)
+  if (blockDimX * blockDimY * blockDimZ > MAX_BLOCK_THREADS ||
+      (size_t) gridDimX * gridDimY * gridDimZ * blockDimX * blockDimY * blockDimZ < (size_t) n_sectors)
      { printf ("Wrong configuration!\n");
        return 1;
      }
@@ -135,20 +206,73 @@ int main (int argc, char **argv)
 
   CHECK (cudaDeviceReset ());
 
+  /* keep a copy of the original sector data for the other cpu kernels and the layout conversions */
+
+  unsigned int *cpu_sector_data, *sector_major_data;
+  int n_cores, n_threads;
+  double dt;
+
+  n_cores = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  cpu_sector_data = (unsigned int *) malloc (sector_data_size);
+  sector_major_data = (unsigned int *) malloc (sector_data_size);
+  memcpy (cpu_sector_data, host_sector_data, sector_data_size);
+
   /* compute the modified sector data on the CPU */
 
   (void) get_delta_time ();
-  for (i = 0; i < N_SECTORS; i++)
+  for (i = 0; i < n_sectors; i++)
     modify_sector_cpu_kernel (&host_sector_data[i], host_sector_number[i], n_sectors, sector_size);
   printf("The cpu kernel took %.3e seconds to run (single core)\n",get_delta_time ());
 
+  /* convert the original sector data to the sector-major layout of cryptCuda */
+
+  (void) get_delta_time ();
+  convert_layout (sector_major_data, cpu_sector_data, n_sectors, sector_size, 0, n_cores);
+  dt = get_delta_time ();
+  printf ("The conversion to the sector-major layout took %.3e seconds with %d thread%s (%.3f GB/s)\n", dt, n_cores,
+          (n_cores == 1) ? "" : "s", (double) sector_data_size / dt * 1.0e-9);
+  check_layouts ("conversion to the sector-major layout", cpu_sector_data, sector_major_data, n_sectors, sector_size);
+
+  /* compute it again with the interleaved cpu kernel (8 sectors per AVX2 register, if the cpu has it), with one thread and
+     then with one thread per cpu core, which must match the cpu kernel word for word; the sector data is modified by a xor,
+     so running it twice gives back the original data */
+
+  for (n_threads = 1; n_threads <= n_cores; n_threads = (n_threads == n_cores) ? n_cores + 1 : n_cores)
+  { (void) get_delta_time ();
+    modify_interleaved_sectors (cpu_sector_data, host_sector_number, n_sectors, sector_size, n_threads);
+    dt = get_delta_time ();
+    printf ("The interleaved cpu kernel took %.3e seconds to run with %d thread%s (%.3f GB/s)\n", dt, n_threads,
+            (n_threads == 1) ? "" : "s", (double) sector_data_size / dt * 1.0e-9);
+    for (size_t w = 0; w < sector_data_size / sizeof (unsigned int); w++)
+      if (cpu_sector_data[w] != host_sector_data[w])
+         { printf ("Mismatch of the interleaved cpu kernel in sector %zu, word %zu\n", w % (size_t) n_sectors,
+                   w / (size_t) n_sectors);
+           exit(1);
+         }
+    modify_interleaved_sectors (cpu_sector_data, host_sector_number, n_sectors, sector_size, n_threads);
+  }
+
+  /* convert the sector-major data back to the interleaved layout */
+
+  memset (cpu_sector_data, 0, sector_data_size);
+  (void) get_delta_time ();
+  convert_layout (cpu_sector_data, sector_major_data, n_sectors, sector_size, 1, n_cores);
+  dt = get_delta_time ();
+  printf ("The conversion to the interleaved layout took %.3e seconds with %d thread%s (%.3f GB/s)\n", dt, n_cores,
+          (n_cores == 1) ? "" : "s", (double) sector_data_size / dt * 1.0e-9);
+  check_layouts ("conversion to the interleaved layout", cpu_sector_data, sector_major_data, n_sectors, sector_size);
+  free (sector_major_data);
+  free (cpu_sector_data);
+
   /* compare results */
 
-  for(i = 0; i < (int) sector_data_size / (int) sizeof (unsigned int); i++)
-    if (host_sector_data[i] != modified_device_sector_data[i])
-       { int sector_words = sector_size / (int) sizeof (unsigned int);
+  size_t w;                                                // buffers may be larger than 2 GiB
+
+  for(w = 0; w < sector_data_size / sizeof (unsigned int); w++)
+    if (host_sector_data[w] != modified_device_sector_data[w])
+       { size_t sector_words = (size_t) sector_size / sizeof (unsigned int);
 
-         printf ("Mismatch in sector %d, word %d\n", i / sector_words, i % sector_words);
+         printf ("Mismatch in sector %zu, word %zu\n", w / sector_words, w % sector_words);
          exit(1);
        }
   printf ("All is well!\n");
@@ -226,6 +350,138 @@ __global__ static void modify_sector_cuda_kernel (unsigned int * __restrict__ se
   }
 }
 
+static void check_memory_size (size_t sector_data_size, size_t sector_number_size)
+{
+  if ((sector_data_size + sector_number_size) > (size_t) 1.3e9)
+     { fprintf (stderr,"The GeForce GTX 1660 Ti cannot handle more than 5GB of memory!\n");
+       exit (1);
+     }
+}
+
+/* the sector data is a "pseudo-random" sequence (faster than a real one) and the sector numbers are the counter-based
+   pseudo-random numbers of seed; both are filled by all the cores, the same seed giving the same data */
+
+static void fill_sector_data (void *arg, size_t first, size_t last)
+{
+  unsigned int *host_sector_data = (unsigned int *) arg;
+  size_t i;
+
+  for (i = first; i < last; i++)
+    host_sector_data[i] = 108584447u * (unsigned int) i;
+}
+
+static void init_host_data (unsigned int *host_sector_data, size_t sector_data_size, unsigned int *host_sector_number,
+                            size_t sector_number_size, unsigned long long seed)
+{
+  int n_cores = (int) sysconf (_SC_NPROCESSORS_ONLN);
+
+  rng_parallel (fill_sector_data, host_sector_data, sector_data_size / sizeof (unsigned int), n_cores);
+  counter_rng_fill_u32 (host_sector_number, sector_number_size / sizeof (unsigned int), seed, 0ull, n_cores);
+}
+
+/* the data a sweep times the kernels on */
+
+typedef struct
+{
+  unsigned int *host_sector_data, *host_sector_number;
+  unsigned int *device_sector_data, *device_sector_number;
+} sweep_data_t;
+
+/* best of SWEEP_REPETITIONS runs of the CUDA kernel with the launch geometry of config */
+
+static double time_cuda_kernel (void *context, const sector_config_t *config)
+{
+  sweep_data_t *data = (sweep_data_t *) context;
+  dim3 grid (grid_dim_x (config), config->grid_dim_y, 1);
+  dim3 block (config->block_dim_x, config->block_dim_y, 1);
+  double dt, best_dt;
+  int r;
+
+  best_dt = -1.0;
+  for (r = 0; r < SWEEP_REPETITIONS; r++)
+  { (void) get_delta_time ();
+    modify_sector_cuda_kernel <<<grid, block>>> (data->device_sector_data, data->device_sector_number, config->n_sectors,
+                                                 config->sector_size);
+    CHECK (cudaDeviceSynchronize ());
+    CHECK (cudaGetLastError ());
+    dt = get_delta_time ();
+    if (best_dt < 0.0 || dt < best_dt)
+       best_dt = dt;
+  }
+  return best_dt;
+}
+
+/* sweep the launch geometry for 512, 1024, 2048 and 4096 byte sectors (keeping the total sector data size), or only for the
+   sector size of config, saving the fastest one of each sector size in the tuning file */
+
+static void sweep_configurations (sector_config_t *config, int sweep_sector_sizes, const char *tuning_file, const char *device_name)
+{
+  static const unsigned int sector_sizes[] = { 512u, 1024u, 2048u, 4096u };
+  sector_config_t candidate, fastest_cuda;
+  size_t sector_data_size, sector_number_size, total_size;
+  double cuda_dt, cuda_rate, fastest_cuda_rate;
+  sweep_data_t data;
+  int s, n_sizes;
+
+  total_size = (size_t) config->n_sectors * (size_t) config->sector_size;
+  n_sizes = sweep_sector_sizes ? (int) (sizeof (sector_sizes) / sizeof (sector_sizes[0])) : 1;
+  fastest_cuda_rate = 0.0;
+  fastest_cuda = *config;
+  for (s = 0; s < n_sizes; s++)
+  { candidate = *config;
+    if (sweep_sector_sizes)
+       { candidate.sector_size = sector_sizes[s];
+         candidate.n_sectors = (unsigned int) (total_size / sector_sizes[s]);
+       }
+    sector_data_size = (size_t) candidate.n_sectors * (size_t) candidate.sector_size;
+    sector_number_size = (size_t) candidate.n_sectors * sizeof (unsigned int);
+    check_memory_size (sector_data_size, sector_number_size);
+    printf ("Sweeping %u sectors of %u bytes\n", candidate.n_sectors, candidate.sector_size);
+
+    data.host_sector_data = (unsigned int *) malloc (sector_data_size);
+    data.host_sector_number = (unsigned int *) malloc (sector_number_size);
+    CHECK (cudaMalloc ((void **) &data.device_sector_data, sector_data_size));
+    CHECK (cudaMalloc ((void **) &data.device_sector_number, sector_number_size));
+    init_host_data (data.host_sector_data, sector_data_size, data.host_sector_number, sector_number_size, RNG_DEFAULT_SEED);
+    CHECK (cudaMemcpy (data.device_sector_data, data.host_sector_data, sector_data_size, cudaMemcpyHostToDevice));
+    CHECK (cudaMemcpy (data.device_sector_number, data.host_sector_number, sector_number_size, cudaMemcpyHostToDevice));
+
+    cuda_dt = sweep_launch_geometry (&candidate, time_cuda_kernel, &data);
+    cuda_rate = (double) sector_data_size / cuda_dt * 1.0e-9;
+    printf ("The fastest CUDA kernel for %u byte sectors is <<<(%u,%u,1), (%u,%u,1)>>> (%.3f GB/s)\n", candidate.sector_size,
+            grid_dim_x (&candidate), candidate.grid_dim_y, candidate.block_dim_x, candidate.block_dim_y, cuda_rate);
+    save_tuning (tuning_file, "cryptCudaStride", device_name, &candidate);
+    if (cuda_rate > fastest_cuda_rate)
+       { fastest_cuda = candidate;
+         fastest_cuda_rate = cuda_rate;
+       }
+
+    CHECK (cudaFree (data.device_sector_data));
+    CHECK (cudaFree (data.device_sector_number));
+    free (data.host_sector_data);
+    free (data.host_sector_number);
+  }
+  printf ("Fastest CUDA configuration: -s %u -n %u -x %u -y %u -Y %u (%.3f GB/s)\n", fastest_cuda.sector_size, fastest_cuda.n_sectors,
+          fastest_cuda.block_dim_x, fastest_cuda.block_dim_y, fastest_cuda.grid_dim_y, fastest_cuda_rate);
+  printf ("The tuned configurations were saved in %s\n", tuning_file);
+}
+
+/* word i of sector s must be at i * n_sectors + s of the interleaved data and at s * n_words + i of the sector-major data */
+
+static void check_layouts (const char *conversion, unsigned int *interleaved_data, unsigned int *sector_major_data, unsigned int n_sectors,
+                           unsigned int sector_size)
+{
+  size_t s, i, n_words;
+
+  n_words = (size_t) sector_size / sizeof (unsigned int);
+  for (s = 0; s < n_sectors; s++)
+    for (i = 0; i < n_words; i++)
+      if (interleaved_data[i * n_sectors + s] != sector_major_data[s * n_words + i])
+         { printf ("Mismatch of the %s in sector %lu, word %lu\n", conversion, s, i);
+           exit(1);
+         }
+}
+
 static double get_delta_time(void)
 {
   static struct timespec t0,t1;
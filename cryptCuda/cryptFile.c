@@ -0,0 +1,529 @@
+/**
+ *   Streaming sector transform of a disk image
+ *
+ *   usage: cryptFile [-s first_sector] [-n n_sectors] [-S sector_size] [-b batch_MiB] [-t n_threads] [-c checkpoint_file]
+ *                    [-m] [-B] image [output]
+ *
+ *   The sectors of the image (a file or a block device) are modified in place, or written at the same offsets of the
+ *   output, with the cpu kernels of cryptCuda; the sector number of each sector is its offset in the image divided by
+ *   the sector size (modulo 2^32). Since the sector data is modified by a xor, running it twice gives back the image.
+ *
+ *   By default the image is read in large batches with O_DIRECT into aligned buffers, and reading, modifying (with
+ *   the threaded engine) and writing are pipelined: one batch is read while the previous one is being modified and
+ *   the one before it is being written. -B uses the page cache instead of O_DIRECT (it is also used, for the rest of
+ *   the run, whenever the kernel refuses an O_DIRECT transfer, e.g. for a last batch that is not block aligned),
+ *   and -m maps the image in memory and modifies it in place.
+ *
+ *   With an output, the bytes of the image outside of the sectors modified (those before and after the range given by
+ *   -s and -n, and a last partial sector) are copied to it unchanged, and the output is cut to the size of the image,
+ *   so that it is always a whole image.
+ *
+ *   With -c, every batch is flushed to the disk before the checkpoint file records the first sector not yet done, and
+ *   a run given a checkpoint file that exists resumes from there. A run that stops while a batch is being written may
+ *   leave that batch half done, and resuming would then modify its written part twice.
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sector_engine.h"
+
+/**
+ *   program configuration
+ */
+
+#define DEFAULT_SECTOR_SIZE  512
+#define DEFAULT_BATCH_SIZE   64                            // MiB
+#define DIRECT_ALIGNMENT     4096                          // alignment of the O_DIRECT buffers, offsets and lengths
+#define N_BUFFERS            3                             // one being read, one being modified and one being written
+
+/* state of a batch buffer, which goes around free -> read -> modified -> free */
+
+typedef enum
+{
+  BATCH_FREE,
+  BATCH_READ,
+  BATCH_MODIFIED
+} batch_state_t;
+
+typedef struct
+{
+  unsigned int *data;                                      // aligned buffer
+  batch_state_t state;
+  unsigned long long first_sector;                         // sector of the image the batch starts at
+  unsigned int n_sectors;                                  // number of sectors of the batch
+  int last;                                                // is it the last batch?
+} batch_t;
+
+typedef struct
+{
+  int in_fd;
+  int out_fd;                                              // the same as in_fd when modifying in place
+  unsigned int sector_size;
+  unsigned int batch_sectors;                              // number of sectors of a full batch
+  unsigned long long first_sector;                         // first sector to be modified
+  unsigned long long end_sector;                           // one past the last sector to be modified
+  const char *checkpoint_name;                             // NULL if there is no checkpoint file
+  batch_t batch[N_BUFFERS];
+  pthread_mutex_t lock;
+  pthread_cond_t changed;                                  // signaled whenever the state of a batch changes
+} pipeline_t;
+
+/* allusion to internal functions */
+
+static void *read_batches (void *arg);
+static void *write_batches (void *arg);
+static void wait_for_batch (pipeline_t *pipeline, batch_t *batch, batch_state_t state);
+static void set_batch_state (pipeline_t *pipeline, batch_t *batch, batch_state_t state);
+static void transfer (int fd, void *buffer, size_t n_bytes, off_t offset, int writing);
+static void copy_through (const char *in_name, const char *out_name, off_t from, off_t to, size_t buffer_size);
+static void fill_sector_numbers (unsigned int *sector_number, unsigned long long first_sector, unsigned int n_sectors);
+static unsigned long long read_checkpoint (const char *checkpoint_name, unsigned long long first_sector);
+static void write_checkpoint (const char *checkpoint_name, unsigned long long next_sector);
+static double get_delta_time(void);
+
+/**
+ *   main program
+ */
+
+int main (int argc, char **argv)
+{
+  unsigned long long first_sector, n_sectors, end_sector, image_sectors, range_first_sector;
+  unsigned int sector_size, batch_mib;
+  const char *checkpoint_name;
+  int opt, n_threads, use_mmap, use_direct;
+
+  first_sector = 0ull;
+  n_sectors = 0ull;                                        // 0 means up to the end of the image
+  sector_size = DEFAULT_SECTOR_SIZE;
+  batch_mib = DEFAULT_BATCH_SIZE;
+  n_threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  checkpoint_name = NULL;
+  use_mmap = 0;
+  use_direct = 1;
+  while ((opt = getopt (argc, argv, "s:n:S:b:t:c:mB")) != -1)
+    switch (opt)
+    { case 's': first_sector = strtoull (optarg, NULL, 0);
+                break;
+      case 'n': n_sectors = strtoull (optarg, NULL, 0);
+                break;
+      case 'S': sector_size = (unsigned int) atoi (optarg);
+                break;
+      case 'b': batch_mib = (unsigned int) atoi (optarg);
+                break;
+      case 't': n_threads = atoi (optarg);
+                break;
+      case 'c': checkpoint_name = optarg;
+                break;
+      case 'm': use_mmap = 1;
+                break;
+      case 'B': use_direct = 0;
+                break;
+      default:  fprintf (stderr, "usage: %s [-s first_sector] [-n n_sectors] [-S sector_size] [-b batch_MiB] [-t n_threads]"
+                                 " [-c checkpoint_file] [-m] [-B] image [output]\n", argv[0]);
+                exit (1);
+    }
+  if (optind >= argc || argc - optind > 2)
+     { fprintf (stderr, "%s: the image (and, optionally, the output) must be given\n", argv[0]);
+       exit (1);
+     }
+  if (sector_size == 0u || sector_size % 4u != 0u || batch_mib == 0u || n_threads < 1)
+     { fprintf (stderr, "%s: the sector size must be a positive multiple of 4, the batch size and number of threads positive\n", argv[0]);
+       exit (1);
+     }
+  if (use_mmap && argc - optind == 2)
+     { fprintf (stderr, "%s: the image can only be mapped in memory when it is modified in place\n", argv[0]);
+       exit (1);
+     }
+
+  /* open the image (and the output) */
+
+  pipeline_t pipeline;
+  off_t image_size;
+
+  pipeline.in_fd = open (argv[optind], ((argc - optind == 1) ? O_RDWR : O_RDONLY) | ((use_direct && !use_mmap) ? O_DIRECT : 0));
+  if (pipeline.in_fd < 0 && use_direct && errno == EINVAL)
+     pipeline.in_fd = open (argv[optind], (argc - optind == 1) ? O_RDWR : O_RDONLY);   // no O_DIRECT on this file system
+  if (pipeline.in_fd < 0)
+     { perror (argv[optind]);
+       exit (1);
+     }
+  pipeline.out_fd = pipeline.in_fd;
+  if (argc - optind == 2)
+     { pipeline.out_fd = open (argv[optind + 1], O_WRONLY | O_CREAT | (use_direct ? O_DIRECT : 0), 0644);
+       if (pipeline.out_fd < 0 && use_direct && errno == EINVAL)
+          pipeline.out_fd = open (argv[optind + 1], O_WRONLY | O_CREAT, 0644);
+       if (pipeline.out_fd < 0)
+          { perror (argv[optind + 1]);
+            exit (1);
+          }
+     }
+  if ((image_size = lseek (pipeline.in_fd, 0, SEEK_END)) < 0)
+     { perror ("lseek");
+       exit (1);
+     }
+
+  /* the range of sectors to be modified, resumed from the checkpoint file if there is one */
+
+  image_sectors = (unsigned long long) image_size / sector_size;
+  if ((unsigned long long) image_size % sector_size != 0ull)
+     printf ("The last %llu bytes of the image do not fill a sector and are left alone\n", (unsigned long long) image_size % sector_size);
+  end_sector = (n_sectors == 0ull || first_sector + n_sectors > image_sectors) ? image_sectors : first_sector + n_sectors;
+  if (first_sector > end_sector)
+     first_sector = end_sector;
+  range_first_sector = first_sector;                       // the sectors before it are never modified, even when resuming
+  if (checkpoint_name != NULL)
+     { unsigned long long next_sector = read_checkpoint (checkpoint_name, first_sector);
+
+       if (next_sector < first_sector || next_sector > end_sector)
+          { fprintf (stderr, "%s: the checkpoint (sector %llu) is outside of sectors %llu to %llu\n", checkpoint_name, next_sector,
+                     first_sector, end_sector);
+            exit (1);
+          }
+       if (next_sector != first_sector)
+          printf ("Resuming at sector %llu\n", next_sector);
+       first_sector = next_sector;
+     }
+  pipeline.sector_size = sector_size;
+  pipeline.first_sector = first_sector;
+  pipeline.end_sector = end_sector;
+  pipeline.checkpoint_name = checkpoint_name;
+  printf ("Modifying sectors %llu to %llu of %s (%llu bytes)\n", first_sector, end_sector, argv[optind],
+          (end_sector - first_sector) * sector_size);
+
+  /* batches hold a whole number of sectors and of O_DIRECT blocks */
+
+  size_t batch_size, unit;
+
+  for (unit = sector_size; unit % DIRECT_ALIGNMENT != 0u; unit += sector_size)
+    ;                                                      // least common multiple of the two
+  batch_size = ((size_t) batch_mib << 20) / unit * unit;
+  if (batch_size == 0u)
+     batch_size = unit;
+  pipeline.batch_sectors = (unsigned int) (batch_size / sector_size);
+
+  /* a separate output gets the rest of the image unchanged, so that it is a whole image */
+
+  if (pipeline.out_fd != pipeline.in_fd)
+     { struct stat out_stat;
+
+       if (fstat (pipeline.out_fd, &out_stat) != 0)
+          { perror ("fstat");
+            exit (1);
+          }
+       if (S_ISREG (out_stat.st_mode) && ftruncate (pipeline.out_fd, image_size) != 0)
+          { perror ("ftruncate");
+            exit (1);
+          }
+       copy_through (argv[optind], argv[optind + 1], 0, (off_t) (range_first_sector * sector_size), batch_size);
+       copy_through (argv[optind], argv[optind + 1], (off_t) (end_sector * sector_size), image_size, batch_size);
+     }
+
+  /* start the threaded engine */
+
+  sector_engine_t engine;
+  sector_kernel_t kernel;
+  unsigned int *sector_number;
+
+  kernel = fastest_sector_kernel ();
+  sector_engine_start (&engine, n_threads, sector_size, SECTOR_BLOCK_SIZE);
+  sector_number = (unsigned int *) malloc ((size_t) pipeline.batch_sectors * sizeof (unsigned int));
+  (void) get_delta_time ();
+
+  if (use_mmap)
+     { /* map the image and modify it one batch at a time, the kernel reading ahead on its own */
+
+       unsigned long long sector;
+       unsigned int n;
+       size_t page_size, map_offset, map_size, start, end;
+       char *map;
+
+       page_size = (size_t) sysconf (_SC_PAGESIZE);
+       map_offset = (size_t) (first_sector * sector_size) / page_size * page_size;
+       map_size = (size_t) (end_sector * sector_size) - map_offset;
+       map = NULL;
+       if (map_size > 0u)
+          { map = (char *) mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, pipeline.in_fd, (off_t) map_offset);
+            if (map == (char *) MAP_FAILED)
+               { perror ("mmap");
+                 exit (1);
+               }
+            (void) madvise (map, map_size, MADV_SEQUENTIAL);
+          }
+       for (sector = first_sector; sector < end_sector; sector += n)
+       { n = (end_sector - sector < pipeline.batch_sectors) ? (unsigned int) (end_sector - sector) : pipeline.batch_sectors;
+         fill_sector_numbers (sector_number, sector, n);
+         sector_engine_run (&engine, n_threads, kernel, (unsigned int *) (map + (size_t) (sector * sector_size) - map_offset),
+                            sector_number, n);
+         if (checkpoint_name != NULL)
+            { start = ((size_t) (sector * sector_size) - map_offset) / page_size * page_size;
+              end = (size_t) ((sector + n) * sector_size) - map_offset;
+              if (msync (map + start, end - start, MS_SYNC) != 0)
+                 { perror ("msync");
+                   exit (1);
+                 }
+              write_checkpoint (checkpoint_name, sector + n);
+            }
+       }
+       if (map != NULL && munmap (map, map_size) != 0)
+          { perror ("munmap");
+            exit (1);
+          }
+     }
+   else
+     { /* pipeline the batches through the reader thread, this thread and the writer thread */
+
+       pthread_t reader, writer;
+       batch_t *batch;
+       int k;
+
+       pthread_mutex_init (&pipeline.lock, NULL);
+       pthread_cond_init (&pipeline.changed, NULL);
+       for (k = 0; k < N_BUFFERS; k++)
+       { if (posix_memalign ((void **) &pipeline.batch[k].data, DIRECT_ALIGNMENT, batch_size) != 0)
+         {
+           fprintf (stderr, "Out of memory for the batch buffers\n");
+           exit (1);
+         }
+         pipeline.batch[k].state = BATCH_FREE;
+       }
+       if (pthread_create (&reader, NULL, read_batches, &pipeline) != 0 || pthread_create (&writer, NULL, write_batches, &pipeline) != 0)
+          { perror ("pthread_create");
+            exit (1);
+          }
+       for (k = 0; first_sector < end_sector; k = (k + 1) % N_BUFFERS)
+       { batch = &pipeline.batch[k];
+         wait_for_batch (&pipeline, batch, BATCH_READ);
+         fill_sector_numbers (sector_number, batch->first_sector, batch->n_sectors);
+         sector_engine_run (&engine, n_threads, kernel, batch->data, sector_number, batch->n_sectors);
+         set_batch_state (&pipeline, batch, BATCH_MODIFIED);
+         if (batch->last)
+            break;
+       }
+       pthread_join (reader, NULL);
+       pthread_join (writer, NULL);
+       for (k = 0; k < N_BUFFERS; k++)
+         free (pipeline.batch[k].data);
+       pthread_cond_destroy (&pipeline.changed);
+       pthread_mutex_destroy (&pipeline.lock);
+     }
+
+  if (fsync (pipeline.out_fd) != 0)                       // this also writes back the pages modified through the map
+     { perror ("fsync");
+       exit (1);
+     }
+
+  double dt = get_delta_time ();
+
+  if (pipeline.out_fd != pipeline.in_fd)
+     { off_t out_size = lseek (pipeline.out_fd, 0, SEEK_END);
+       struct stat out_stat;
+
+       if (out_size < 0 || fstat (pipeline.out_fd, &out_stat) != 0)
+          { perror (argv[optind + 1]);
+            exit (1);
+          }
+       if ((S_ISREG (out_stat.st_mode) && out_size != image_size) || out_size < image_size)
+          { fprintf (stderr, "%s: the output has %lld bytes instead of the %lld of the image\n", argv[optind + 1],
+                     (long long) out_size, (long long) image_size);
+            exit (1);
+          }
+     }
+
+  printf ("Modified %llu sectors (%llu bytes) in %.3e seconds (%.3f GB/s)\n", end_sector - first_sector,
+          (end_sector - first_sector) * sector_size, dt, (dt > 0.0) ? (double) ((end_sector - first_sector) * sector_size) / dt * 1.0e-9 : 0.0);
+
+  sector_engine_stop (&engine);
+  free (sector_number);
+  if (pipeline.out_fd != pipeline.in_fd)
+     close (pipeline.out_fd);
+  close (pipeline.in_fd);
+
+  return 0;
+}
+
+/* the reader thread: read the batches, in order, into the buffers as they become free */
+
+static void *read_batches (void *arg)
+{
+  pipeline_t *pipeline = (pipeline_t *) arg;
+  unsigned long long sector;
+  batch_t *batch;
+  int k;
+
+  for (sector = pipeline->first_sector, k = 0; sector < pipeline->end_sector; k = (k + 1) % N_BUFFERS)
+  { batch = &pipeline->batch[k];
+    wait_for_batch (pipeline, batch, BATCH_FREE);
+    batch->first_sector = sector;
+    batch->n_sectors = (pipeline->end_sector - sector < pipeline->batch_sectors) ? (unsigned int) (pipeline->end_sector - sector)
+                                                                                 : pipeline->batch_sectors;
+    transfer (pipeline->in_fd, batch->data, (size_t) batch->n_sectors * pipeline->sector_size, (off_t) (sector * pipeline->sector_size), 0);
+    sector += batch->n_sectors;
+    batch->last = (sector == pipeline->end_sector);
+    set_batch_state (pipeline, batch, BATCH_READ);
+  }
+  return NULL;
+}
+
+/* the writer thread: write the modified batches, in order, and record the progress in the checkpoint file */
+
+static void *write_batches (void *arg)
+{
+  pipeline_t *pipeline = (pipeline_t *) arg;
+  batch_t *batch;
+  int k;
+
+  for (k = 0; pipeline->first_sector < pipeline->end_sector; k = (k + 1) % N_BUFFERS)
+  { batch = &pipeline->batch[k];
+    wait_for_batch (pipeline, batch, BATCH_MODIFIED);
+    transfer (pipeline->out_fd, batch->data, (size_t) batch->n_sectors * pipeline->sector_size,
+              (off_t) (batch->first_sector * pipeline->sector_size), 1);
+    if (pipeline->checkpoint_name != NULL)
+       { if (fdatasync (pipeline->out_fd) != 0)
+            { perror ("fdatasync");
+              exit (1);
+            }
+         write_checkpoint (pipeline->checkpoint_name, batch->first_sector + batch->n_sectors);
+       }
+    if (batch->last)
+       break;
+    set_batch_state (pipeline, batch, BATCH_FREE);
+  }
+  return NULL;
+}
+
+static void wait_for_batch (pipeline_t *pipeline, batch_t *batch, batch_state_t state)
+{
+  pthread_mutex_lock (&pipeline->lock);
+  while (batch->state != state)
+    pthread_cond_wait (&pipeline->changed, &pipeline->lock);
+  pthread_mutex_unlock (&pipeline->lock);
+}
+
+static void set_batch_state (pipeline_t *pipeline, batch_t *batch, batch_state_t state)
+{
+  pthread_mutex_lock (&pipeline->lock);
+  batch->state = state;
+  pthread_cond_broadcast (&pipeline->changed);
+  pthread_mutex_unlock (&pipeline->lock);
+}
+
+/* read or write all of n_bytes, dropping O_DIRECT if the kernel refuses it (for instance, for an unaligned last batch) */
+
+static void transfer (int fd, void *buffer, size_t n_bytes, off_t offset, int writing)
+{
+  ssize_t done;
+  int flags;
+
+  while (n_bytes > 0u)
+  { done = writing ? pwrite (fd, buffer, n_bytes, offset) : pread (fd, buffer, n_bytes, offset);
+    if (done < 0 && errno == EINVAL && ((flags = fcntl (fd, F_GETFL)) & O_DIRECT) != 0)
+       { (void) fcntl (fd, F_SETFL, flags & ~O_DIRECT);
+         continue;
+       }
+    if (done < 0 && errno == EINTR)
+       continue;
+    if (done <= 0)
+       { if (done == 0)
+            fprintf (stderr, "The image ended before sector %llu\n", (unsigned long long) offset);
+          else
+            perror (writing ? "pwrite" : "pread");
+         exit (1);
+       }
+    buffer = (char *) buffer + done;
+    n_bytes -= (size_t) done;
+    offset += done;
+  }
+}
+
+/* copy bytes from to to of the image, unchanged, to the same offsets of the output, through descriptors of its own
+   without O_DIRECT: the copy is seldom aligned, and a refused transfer must not take O_DIRECT away from the pipeline */
+
+static void copy_through (const char *in_name, const char *out_name, off_t from, off_t to, size_t buffer_size)
+{
+  int in_fd, out_fd;
+  void *buffer;
+  size_t n;
+
+  if (from >= to)
+     return;
+  if ((in_fd = open (in_name, O_RDONLY)) < 0 || (out_fd = open (out_name, O_WRONLY)) < 0)
+     { perror ((in_fd < 0) ? in_name : out_name);
+       exit (1);
+     }
+  if ((buffer = malloc (buffer_size)) == NULL)
+     { fprintf (stderr, "Out of memory for the copy buffer\n");
+       exit (1);
+     }
+  for (; from < to; from += (off_t) n)
+  { n = ((size_t) (to - from) < buffer_size) ? (size_t) (to - from) : buffer_size;
+    transfer (in_fd, buffer, n, from, 0);
+    transfer (out_fd, buffer, n, from, 1);
+  }
+  free (buffer);
+  close (out_fd);                                          // the fsync of the output at the end also writes these back
+  close (in_fd);
+}
+
+static void fill_sector_numbers (unsigned int *sector_number, unsigned long long first_sector, unsigned int n_sectors)
+{
+  unsigned int i;
+
+  for (i = 0u; i < n_sectors; i++)
+    sector_number[i] = (unsigned int) (first_sector + i);  // the kernels take the sector number modulo 2^32
+}
+
+/* the checkpoint file holds the first sector not yet modified */
+
+static unsigned long long read_checkpoint (const char *checkpoint_name, unsigned long long first_sector)
+{
+  unsigned long long next_sector;
+  FILE *fp;
+
+  if ((fp = fopen (checkpoint_name, "r")) == NULL)
+     return first_sector;                                  // nothing was done yet
+  if (fscanf (fp, "%llu", &next_sector) != 1)
+     { fprintf (stderr, "%s: not a checkpoint file\n", checkpoint_name);
+       exit (1);
+     }
+  fclose (fp);
+  return next_sector;
+}
+
+static void write_checkpoint (const char *checkpoint_name, unsigned long long next_sector)
+{
+  char temporary_name[4096];
+  FILE *fp;
+
+  /* write a new file and rename it, so that the checkpoint file is always whole */
+
+  snprintf (temporary_name, sizeof (temporary_name), "%s.tmp", checkpoint_name);
+  if ((fp = fopen (temporary_name, "w")) == NULL || fprintf (fp, "%llu\n", next_sector) < 0 || fflush (fp) != 0 ||
+      fsync (fileno (fp)) != 0 || fclose (fp) != 0 || rename (temporary_name, checkpoint_name) != 0)
+     { perror (checkpoint_name);
+       exit (1);
+     }
+}
+
+static double get_delta_time(void)
+{
+  static struct timespec t0,t1;
+
+  t0 = t1;
+  if(clock_gettime(CLOCK_MONOTONIC,&t1) != 0)
+  {
+    perror("clock_gettime");
+    exit(1);
+  }
+  return (double)(t1.tv_sec - t0.tv_sec) + 1.0e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+}
@@ -0,0 +1,207 @@
+/**
+ *   Threaded sector engine
+ *
+ *   A pool of threads applies a cpu kernel to a range of sectors. The range is split in cache-sized blocks and
+ *   block b is always given to thread b % n_active, so when the data is first touched by the same threads (with
+ *   n_active equal to the size of the pool) each page lands on the NUMA node of the thread that later modifies it.
+ *   Threads are pinned to consecutive cpus (on Linux, when the system headers expose the affinity calls).
+ */
+
+#ifndef SECTOR_ENGINE_H
+#define SECTOR_ENGINE_H
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE                                       // cpu_set_t and pthread_setaffinity_np, for the pinning
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "sector_kernels.h"
+
+#ifndef SECTOR_BLOCK_SIZE
+# define SECTOR_BLOCK_SIZE  (1 << 18)                      // default bytes per block, about the size of a per-core L2 cache
+#endif
+
+/* what the threads of the pool are asked to do */
+
+typedef enum
+{
+  SECTOR_JOB_NONE,
+  SECTOR_JOB_COPY,                                         // copy the source data into the sector data
+  SECTOR_JOB_KERNEL,                                       // apply the kernel to the sector data
+  SECTOR_JOB_EXIT                                          // terminate
+} sector_job_t;
+
+typedef struct sector_engine
+{
+  int n_threads;                                           // number of threads of the pool
+  pthread_t *threads;
+  struct sector_worker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t job_posted;
+  pthread_cond_t job_done;
+  unsigned int generation;                                 // incremented for every job posted
+  int n_busy;                                              // number of threads still working on the current job
+
+  /* the current job */
+
+  sector_job_t job;
+  int n_active;                                            // threads 0 to n_active-1 take part in it
+  sector_kernel_t kernel;
+  unsigned int *sector_data;
+  unsigned int *source_data;
+  unsigned int *sector_number;
+  unsigned int n_sectors;
+  unsigned int sector_size;
+  unsigned int block_sectors;                              // number of sectors of a block
+} sector_engine_t;
+
+typedef struct sector_worker
+{
+  sector_engine_t *engine;
+  int id;
+} sector_worker_t;
+
+/* the blocks of a job given to one thread */
+
+static void sector_engine_work (sector_engine_t *engine, int id)
+{
+  unsigned int n_words, first, last, s;
+  size_t b;
+
+  n_words = engine->sector_size / 4u;
+  for (b = (size_t) id; b * engine->block_sectors < engine->n_sectors; b += (size_t) engine->n_active)
+  { first = (unsigned int) b * engine->block_sectors;
+    last = first + engine->block_sectors;
+    if (last > engine->n_sectors)
+       last = engine->n_sectors;
+    if (engine->job == SECTOR_JOB_COPY)
+       memcpy (&engine->sector_data[(size_t) first * n_words], &engine->source_data[(size_t) first * n_words],
+               (size_t) (last - first) * (size_t) engine->sector_size);
+     else
+       for (s = first; s < last; s++)
+         engine->kernel (&engine->sector_data[(size_t) s * n_words], engine->sector_number[s], engine->n_sectors, engine->sector_size);
+  }
+}
+
+static void *sector_engine_thread (void *arg)
+{
+  sector_worker_t *worker = (sector_worker_t *) arg;
+  sector_engine_t *engine = worker->engine;
+  unsigned int seen;
+  sector_job_t job;
+
+#if defined (__linux__) && defined (CPU_SET)               // not there when the includer got <sched.h> without _GNU_SOURCE
+  cpu_set_t cpus;                                          // pin the thread, so that first touch means something
+
+  CPU_ZERO (&cpus);
+  CPU_SET (worker->id % (int) sysconf (_SC_NPROCESSORS_ONLN), &cpus);
+  (void) pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus);
+#endif
+  seen = 0u;
+  pthread_mutex_lock (&engine->lock);
+  for (;;)
+  { while (engine->generation == seen)
+      pthread_cond_wait (&engine->job_posted, &engine->lock);
+    seen = engine->generation;
+    job = engine->job;
+    if (job == SECTOR_JOB_EXIT)
+       break;
+    pthread_mutex_unlock (&engine->lock);
+    if (worker->id < engine->n_active)
+       sector_engine_work (engine, worker->id);
+    pthread_mutex_lock (&engine->lock);
+    if (--engine->n_busy == 0)
+       pthread_cond_signal (&engine->job_done);
+  }
+  pthread_mutex_unlock (&engine->lock);
+  return NULL;
+}
+
+/* post a job and wait for every thread of the pool to finish it */
+
+static void sector_engine_post (sector_engine_t *engine, sector_job_t job, int n_active)
+{
+  pthread_mutex_lock (&engine->lock);
+  engine->job = job;
+  engine->n_active = (n_active < 1) ? 1 : (n_active > engine->n_threads) ? engine->n_threads : n_active;
+  engine->n_busy = engine->n_threads;
+  engine->generation++;
+  pthread_cond_broadcast (&engine->job_posted);
+  if (job != SECTOR_JOB_EXIT)
+     while (engine->n_busy > 0)
+       pthread_cond_wait (&engine->job_done, &engine->lock);
+  pthread_mutex_unlock (&engine->lock);
+}
+
+/* start a pool of n_threads threads, for sectors of sector_size bytes processed in blocks of about block_size bytes */
+
+static void sector_engine_start (sector_engine_t *engine, int n_threads, unsigned int sector_size, unsigned int block_size)
+{
+  int t;
+
+  engine->n_threads = (n_threads < 1) ? 1 : n_threads;
+  engine->threads = (pthread_t *) malloc ((size_t) engine->n_threads * sizeof (pthread_t));
+  engine->workers = (sector_worker_t *) malloc ((size_t) engine->n_threads * sizeof (sector_worker_t));
+  pthread_mutex_init (&engine->lock, NULL);
+  pthread_cond_init (&engine->job_posted, NULL);
+  pthread_cond_init (&engine->job_done, NULL);
+  engine->generation = 0u;
+  engine->n_busy = 0;
+  engine->job = SECTOR_JOB_NONE;
+  engine->sector_size = sector_size;
+  engine->block_sectors = (sector_size >= block_size) ? 1u : block_size / sector_size;
+  for (t = 0; t < engine->n_threads; t++)
+  { engine->workers[t].engine = engine;
+    engine->workers[t].id = t;
+    if (pthread_create (&engine->threads[t], NULL, sector_engine_thread, &engine->workers[t]) != 0)
+    {
+      perror ("pthread_create");
+      exit (1);
+    }
+  }
+}
+
+static void sector_engine_stop (sector_engine_t *engine)
+{
+  int t;
+
+  sector_engine_post (engine, SECTOR_JOB_EXIT, engine->n_threads);
+  for (t = 0; t < engine->n_threads; t++)
+    pthread_join (engine->threads[t], NULL);
+  pthread_cond_destroy (&engine->job_done);
+  pthread_cond_destroy (&engine->job_posted);
+  pthread_mutex_destroy (&engine->lock);
+  free (engine->workers);
+  free (engine->threads);
+}
+
+/* copy n_sectors sectors with every thread of the pool, each one first touching the blocks it will later modify */
+
+static inline void sector_engine_first_touch (sector_engine_t *engine, unsigned int *sector_data, unsigned int *source_data,
+                                              unsigned int n_sectors)
+{
+  engine->sector_data = sector_data;
+  engine->source_data = source_data;
+  engine->n_sectors = n_sectors;
+  sector_engine_post (engine, SECTOR_JOB_COPY, engine->n_threads);
+}
+
+/* apply a kernel to n_sectors sectors with the first n_active threads of the pool */
+
+static void sector_engine_run (sector_engine_t *engine, int n_active, sector_kernel_t kernel, unsigned int *sector_data,
+                               unsigned int *sector_number, unsigned int n_sectors)
+{
+  engine->kernel = kernel;
+  engine->sector_data = sector_data;
+  engine->sector_number = sector_number;
+  engine->n_sectors = n_sectors;
+  sector_engine_post (engine, SECTOR_JOB_KERNEL, n_active);
+}
+
+#endif
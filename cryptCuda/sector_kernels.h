@@ -0,0 +1,109 @@
+/**
+ *   Cpu kernels that modify the data of a sector
+ *
+ *   modify_sector_cpu_kernel is the scalar reference; modify_sector_avx2_kernel gives the same result bit for bit and is
+ *   only compiled on x86 (it must only be called when __builtin_cpu_supports ("avx2") says so).
+ */
+
+#ifndef SECTOR_KERNELS_H
+#define SECTOR_KERNELS_H
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_AVX2_KERNEL 1                                // the compiler can target AVX2, the cpu is checked at run time
+#endif
+
+/* a cpu kernel, with the same arguments as modify_sector_cpu_kernel */
+
+typedef void (*sector_kernel_t) (unsigned int *sector_data, unsigned int sector_number, unsigned int n_sectors,
+                                 unsigned int sector_size);
+
+static void modify_sector_cpu_kernel (unsigned int *sector_data, unsigned int sector_number, unsigned int n_sectors,
+                                      unsigned int sector_size)
+{
+  unsigned int x, i, a, c, n_words;
+
+  /* convert the sector size into number of 4-byte words (it is assumed that sizeof(unsigned int) = 4) */
+
+  n_words = sector_size / 4u;
+
+  /* initialize the linear congruencial pseudo-random number generator
+     (section 3.2.1.2 of The Art of Computer Programming presents the theory behind the restrictions on a and c) */
+
+  i = sector_number;                                       // get the sector number
+  a = 0xCCE00001u ^ ((i & 0x0F0F0F0Fu) << 2);              // a must be a multiple of 4 plus 1
+  c = 0x00CCE001u ^ ((i & 0xF0F0F0F0u) >> 3);              // c must be odd
+  x = 0xCCE02021u;                                         // initial state
+
+  /* modify the sector data */
+
+  for (i = 0u; i < n_words; i++)
+  { x = a * x + c;                                         // update the pseudo-random generator state
+    sector_data[i] ^= x;                                   // modify the sector data
+  }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__ ((target ("avx2")))
+static void modify_sector_avx2_kernel (unsigned int *sector_data, unsigned int sector_number, unsigned int n_sectors,
+                                       unsigned int sector_size)
+{
+  unsigned int x, i, k, a, c, n_words, a_k[8], c_k[8], lanes[8];
+  __m256i states, step_a, step_c, data;
+
+  /* convert the sector size into number of 4-byte words (it is assumed that sizeof(unsigned int) = 4) */
+
+  n_words = sector_size / 4u;
+
+  /* initialize the linear congruencial pseudo-random number generator exactly as modify_sector_cpu_kernel does */
+
+  i = sector_number;                                       // get the sector number
+  a = 0xCCE00001u ^ ((i & 0x0F0F0F0Fu) << 2);              // a must be a multiple of 4 plus 1
+  c = 0x00CCE001u ^ ((i & 0xF0F0F0F0u) >> 3);              // c must be odd
+  x = 0xCCE02021u;                                         // initial state
+
+  /* jump-ahead constants: k+1 steps of the generator take x to a_k[k] * x + c_k[k],
+     where a_k[k] = a^(k+1) and c_k[k] = c * (a^k + ... + a + 1), all modulo 2^32 */
+
+  a_k[0] = a;
+  c_k[0] = c;
+  for (k = 1u; k < 8u; k++)
+  { a_k[k] = a * a_k[k - 1u];
+    c_k[k] = a * c_k[k - 1u] + c;
+  }
+
+  /* lane k holds the state used for word k, every lane then jumps 8 steps ahead at once */
+
+  states = _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_loadu_si256 ((const __m256i *) a_k), _mm256_set1_epi32 ((int) x)),
+                             _mm256_loadu_si256 ((const __m256i *) c_k));
+  step_a = _mm256_set1_epi32 ((int) a_k[7]);
+  step_c = _mm256_set1_epi32 ((int) c_k[7]);
+
+  /* modify the sector data, 8 words at a time */
+
+  for (i = 0u; i + 8u <= n_words; i += 8u)
+  { data = _mm256_loadu_si256 ((const __m256i *) &sector_data[i]);
+    _mm256_storeu_si256 ((__m256i *) &sector_data[i], _mm256_xor_si256 (data, states));
+    states = _mm256_add_epi32 (_mm256_mullo_epi32 (states, step_a), step_c);
+  }
+
+  /* the last words of a sector whose size is not a multiple of 32 bytes */
+
+  _mm256_storeu_si256 ((__m256i *) lanes, states);
+  for (k = 0u; i < n_words; i++, k++)
+    sector_data[i] ^= lanes[k];
+}
+#endif
+
+/* the fastest cpu kernel the cpu can run */
+
+static sector_kernel_t fastest_sector_kernel (void)
+{
+#ifdef HAVE_AVX2_KERNEL
+  if (__builtin_cpu_supports ("avx2"))
+     return modify_sector_avx2_kernel;
+#endif
+  return modify_sector_cpu_kernel;
+}
+
+#endif
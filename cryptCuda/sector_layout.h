@@ -0,0 +1,235 @@
+/**
+ *   Sector data layouts
+ *
+ *   cryptCuda keeps the sectors one after the other (sector-major layout, word i of sector s at s * n_words + i) while
+ *   cryptCudaStride interleaves them (word i of sector s at i * n_sectors + s). The converters transpose one layout into
+ *   the other in square tiles that fit in the L1 cache, the threads splitting the sectors among them.
+ *
+ *   In the interleaved layout the same word of consecutive sectors sits in consecutive memory, so the interleaved cpu
+ *   kernel runs the pseudo-random generators of 8 sectors in the 8 lanes of an AVX2 register.
+ */
+
+#ifndef SECTOR_LAYOUT_H
+#define SECTOR_LAYOUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_AVX2_INTERLEAVED_KERNEL 1                    // the compiler can target AVX2, the cpu is checked at run time
+#endif
+
+#define LAYOUT_TILE        64                              // a tile has 64x64 words, 16 KiB
+#define LAYOUT_GROUP       16                              // sectors given to a thread come in groups of a cache line
+#define INTERLEAVED_CHUNK  512                             // sectors swept together by the interleaved kernel, a multiple of 8
+
+/* a task split among threads: thread id of n_threads does its share */
+
+typedef void (*layout_task_t) (void *arg, int id, int n_threads);
+
+typedef struct
+{
+  layout_task_t task;
+  void *arg;
+  int id;
+  int n_threads;
+} layout_thread_t;
+
+/* what a conversion or an interleaved kernel run works on */
+
+typedef struct
+{
+  unsigned int *sector_data;                               // destination of a conversion
+  const unsigned int *source_data;                         // source of a conversion
+  const unsigned int *sector_number;
+  unsigned int n_sectors;
+  unsigned int n_words;
+  int to_interleaved;                                      // direction of a conversion
+} layout_job_t;
+
+static void *layout_thread (void *arg)
+{
+  layout_thread_t *thread = (layout_thread_t *) arg;
+
+  thread->task (thread->arg, thread->id, thread->n_threads);
+  return NULL;
+}
+
+/* run a task with n_threads threads, the calling thread being thread 0 */
+
+static inline void run_layout_task (layout_task_t task, void *arg, int n_threads)
+{
+  layout_thread_t *threads;
+  pthread_t *ids;
+  int t;
+
+  if (n_threads < 1)
+     n_threads = 1;
+  threads = (layout_thread_t *) malloc ((size_t) n_threads * sizeof (layout_thread_t));
+  ids = (pthread_t *) malloc ((size_t) n_threads * sizeof (pthread_t));
+  for (t = 0; t < n_threads; t++)
+  { threads[t].task = task;
+    threads[t].arg = arg;
+    threads[t].id = t;
+    threads[t].n_threads = n_threads;
+    if (t > 0 && pthread_create (&ids[t], NULL, layout_thread, &threads[t]) != 0)
+    {
+      perror ("pthread_create");
+      exit (1);
+    }
+  }
+  task (arg, 0, n_threads);
+  for (t = 1; t < n_threads; t++)
+    pthread_join (ids[t], NULL);
+  free (ids);
+  free (threads);
+}
+
+/* the sectors [*first, *last) of thread id, whole groups of LAYOUT_GROUP sectors except for the last thread */
+
+static inline void layout_share (unsigned int n_sectors, int id, int n_threads, unsigned int *first, unsigned int *last)
+{
+  size_t n_groups = ((size_t) n_sectors + LAYOUT_GROUP - 1u) / LAYOUT_GROUP;
+
+  *first = (unsigned int) (n_groups * (size_t) id / (size_t) n_threads * LAYOUT_GROUP);
+  *last = (unsigned int) (n_groups * (size_t) (id + 1) / (size_t) n_threads * LAYOUT_GROUP);
+  if (*first > n_sectors)
+     *first = n_sectors;
+  if (*last > n_sectors)
+     *last = n_sectors;
+}
+
+static void convert_layout_task (void *arg, int id, int n_threads)
+{
+  layout_job_t *job = (layout_job_t *) arg;
+  unsigned int first, last, s0, w0, s, w, s_end, w_end;
+  size_t n_sectors = job->n_sectors, n_words = job->n_words;
+
+  layout_share (job->n_sectors, id, n_threads, &first, &last);
+  for (s0 = first; s0 < last; s0 += LAYOUT_TILE)
+  { s_end = (last - s0 < LAYOUT_TILE) ? last : s0 + LAYOUT_TILE;
+    for (w0 = 0u; w0 < job->n_words; w0 += LAYOUT_TILE)
+    { w_end = (job->n_words - w0 < LAYOUT_TILE) ? job->n_words : w0 + LAYOUT_TILE;
+      if (job->to_interleaved)
+         for (w = w0; w < w_end; w++)
+           for (s = s0; s < s_end; s++)
+             job->sector_data[w * n_sectors + s] = job->source_data[s * n_words + w];
+       else
+         for (s = s0; s < s_end; s++)
+           for (w = w0; w < w_end; w++)
+             job->sector_data[s * n_words + w] = job->source_data[w * n_sectors + s];
+    }
+  }
+}
+
+/* convert sector-major data into interleaved data (to_interleaved != 0) or the other way around, with n_threads threads */
+
+static inline void convert_layout (unsigned int *sector_data, const unsigned int *source_data, unsigned int n_sectors,
+                                   unsigned int sector_size, int to_interleaved, int n_threads)
+{
+  layout_job_t job;
+
+  job.sector_data = sector_data;
+  job.source_data = source_data;
+  job.sector_number = NULL;
+  job.n_sectors = n_sectors;
+  job.n_words = sector_size / 4u;
+  job.to_interleaved = to_interleaved;
+  run_layout_task (convert_layout_task, &job, n_threads);
+}
+
+/* the interleaved cpu kernel for sectors [first, last); the generator states of a chunk of sectors are kept in arrays and the
+   chunk is swept one word (one contiguous row) at a time, instead of walking a sector at a time down rows n_sectors words apart */
+
+static void modify_interleaved_cpu_kernel (unsigned int *sector_data, const unsigned int *sector_number, unsigned int first,
+                                           unsigned int last, unsigned int n_sectors, unsigned int n_words)
+{
+  unsigned int a[INTERLEAVED_CHUNK], c[INTERLEAVED_CHUNK], x[INTERLEAVED_CHUNK];
+  unsigned int i, k, s, m;
+  unsigned int *row;
+
+  for (s = first; s < last; s += m)
+  { m = (last - s < INTERLEAVED_CHUNK) ? last - s : INTERLEAVED_CHUNK;
+    for (k = 0u; k < m; k++)
+    { i = sector_number[s + k];                            // get the sector number
+      a[k] = 0xCCE00001u ^ ((i & 0x0F0F0F0Fu) << 2);       // a must be a multiple of 4 plus 1
+      c[k] = 0x00CCE001u ^ ((i & 0xF0F0F0F0u) >> 3);       // c must be odd
+      x[k] = 0xCCE02021u;                                  // initial state
+    }
+    for (i = 0u, row = &sector_data[s]; i < n_words; i++, row += n_sectors)
+      for (k = 0u; k < m; k++)
+      { x[k] = a[k] * x[k] + c[k];                         // update the pseudo-random generator state
+        row[k] ^= x[k];                                    // modify the sector data
+      }
+  }
+}
+
+#ifdef HAVE_AVX2_INTERLEAVED_KERNEL
+/* the same, with lane j of the k-th AVX2 register running the generator of sector 8k+j of the chunk */
+
+__attribute__ ((target ("avx2")))
+static void modify_interleaved_avx2_kernel (unsigned int *sector_data, const unsigned int *sector_number, unsigned int first,
+                                            unsigned int last, unsigned int n_sectors, unsigned int n_words)
+{
+  __m256i a[INTERLEAVED_CHUNK / 8], c[INTERLEAVED_CHUNK / 8], x[INTERLEAVED_CHUNK / 8];
+  __m256i numbers, low_mask, high_mask, a_base, c_base, x_base;
+  unsigned int i, k, s, m, n_vectors;
+  unsigned int *row;
+
+  low_mask = _mm256_set1_epi32 (0x0F0F0F0F);
+  high_mask = _mm256_set1_epi32 ((int) 0xF0F0F0F0u);
+  a_base = _mm256_set1_epi32 ((int) 0xCCE00001u);
+  c_base = _mm256_set1_epi32 (0x00CCE001);
+  x_base = _mm256_set1_epi32 ((int) 0xCCE02021u);
+  for (s = first; s + 8u <= last; s += m)
+  { m = (last - s < INTERLEAVED_CHUNK) ? (last - s) & ~7u : INTERLEAVED_CHUNK;
+    n_vectors = m / 8u;
+    for (k = 0u; k < n_vectors; k++)
+    { numbers = _mm256_loadu_si256 ((const __m256i *) &sector_number[s + 8u * k]);
+      a[k] = _mm256_xor_si256 (a_base, _mm256_slli_epi32 (_mm256_and_si256 (numbers, low_mask), 2));
+      c[k] = _mm256_xor_si256 (c_base, _mm256_srli_epi32 (_mm256_and_si256 (numbers, high_mask), 3));
+      x[k] = x_base;
+    }
+    for (i = 0u, row = &sector_data[s]; i < n_words; i++, row += n_sectors)
+      for (k = 0u; k < n_vectors; k++)
+      { x[k] = _mm256_add_epi32 (_mm256_mullo_epi32 (a[k], x[k]), c[k]);
+        _mm256_storeu_si256 ((__m256i *) &row[8u * k], _mm256_xor_si256 (_mm256_loadu_si256 ((const __m256i *) &row[8u * k]), x[k]));
+      }
+  }
+  modify_interleaved_cpu_kernel (sector_data, sector_number, s, last, n_sectors, n_words);
+}
+#endif
+
+static void modify_interleaved_task (void *arg, int id, int n_threads)
+{
+  layout_job_t *job = (layout_job_t *) arg;
+  unsigned int first, last;
+
+  layout_share (job->n_sectors, id, n_threads, &first, &last);
+#ifdef HAVE_AVX2_INTERLEAVED_KERNEL
+  if (__builtin_cpu_supports ("avx2"))
+     { modify_interleaved_avx2_kernel (job->sector_data, job->sector_number, first, last, job->n_sectors, job->n_words);
+       return;
+     }
+#endif
+  modify_interleaved_cpu_kernel (job->sector_data, job->sector_number, first, last, job->n_sectors, job->n_words);
+}
+
+/* modify interleaved sector data with n_threads threads, with AVX2 if the cpu has it */
+
+static inline void modify_interleaved_sectors (unsigned int *sector_data, const unsigned int *sector_number, unsigned int n_sectors,
+                                               unsigned int sector_size, int n_threads)
+{
+  layout_job_t job;
+
+  job.sector_data = sector_data;
+  job.source_data = NULL;
+  job.sector_number = sector_number;
+  job.n_sectors = n_sectors;
+  job.n_words = sector_size / 4u;
+  job.to_interleaved = 0;
+  run_layout_task (modify_interleaved_task, &job, n_threads);
+}
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ *   Runtime sector geometry and its tuning
+ *
+ *   The sector size, the number of sectors, the CUDA launch geometry and the threaded engine parameters of a run
+ *   are held in a sector_config_t. A sweep times the candidate launch geometries (and, on the cpu, numbers of threads
+ *   and block sizes) and the fastest ones are kept in a tuning file, one line per host, program, device, sector size
+ *   and number of sectors, so that later runs with the same sector geometry on the same host pick them up.
+ */
+
+#ifndef SECTOR_TUNING_H
+#define SECTOR_TUNING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_TUNING_FILE  "cryptCuda.tuning"
+#define MAX_BLOCK_THREADS    1024                          // most threads of a CUDA block
+#define SWEEP_REPETITIONS    2                             // an even number, so that a sweep leaves the data as it found it
+
+typedef struct
+{
+  unsigned int sector_size;                                // bytes per sector, a multiple of 4
+  unsigned int n_sectors;
+  unsigned int block_dim_x;                                // CUDA block (blockDimZ is always 1)
+  unsigned int block_dim_y;
+  unsigned int grid_dim_y;                                 // CUDA grid (gridDimX follows from the others, gridDimZ is always 1)
+  int cpu_threads;                                         // threads of the threaded engine
+  unsigned int cpu_block_size;                             // bytes per block of the threaded engine
+} sector_config_t;
+
+/* time (in seconds) of a run with a given configuration */
+
+typedef double (*sector_timer_t) (void *context, const sector_config_t *config);
+
+/* enough blocks along x for one thread per sector, the kernels ignoring the threads past the last sector */
+
+static inline unsigned int grid_dim_x (const sector_config_t *config)
+{
+  unsigned int per_column = config->block_dim_x * config->block_dim_y * config->grid_dim_y;
+
+  return (config->n_sectors + per_column - 1u) / per_column;
+}
+
+/* the device name, with no blanks, as it goes into the tuning file */
+
+static inline void tuning_device_name (char *name, size_t size, const char *device_name)
+{
+  size_t i;
+
+  snprintf (name, size, "%s", device_name);
+  for (i = 0u; name[i] != '\0'; i++)
+    if (name[i] == ' ' || name[i] == '\t')
+       name[i] = '_';
+}
+
+/* the key of a line of the tuning file: host, program, device, sector size and number of sectors */
+
+static inline void tuning_key (char *key, size_t size, const char *program, const char *device_name, const sector_config_t *config)
+{
+  char host[256], device[256];
+
+  if (gethostname (host, sizeof (host)) != 0)
+     strcpy (host, "unknown");
+  host[sizeof (host) - 1u] = '\0';
+  tuning_device_name (device, sizeof (device), device_name);
+  snprintf (key, size, "%s %s %s %u %u", host, program, device, config->sector_size, config->n_sectors);
+}
+
+/* fill the geometry of config from the tuning file, if it has a line for it; returns 1 if it did */
+
+static inline int load_tuning (const char *file_name, const char *program, const char *device_name, sector_config_t *config)
+{
+  char key[1024], line[1024];
+  size_t key_length;
+  unsigned int bx, by, gy, block_size;
+  int threads, found;
+  FILE *fp;
+
+  if ((fp = fopen (file_name, "r")) == NULL)
+     return 0;
+  tuning_key (key, sizeof (key), program, device_name, config);
+  key_length = strlen (key);
+  found = 0;
+  while (fgets (line, sizeof (line), fp) != NULL)
+    if (strncmp (line, key, key_length) == 0 && line[key_length] == ' ' &&
+        sscanf (&line[key_length], "%u %u %u %d %u", &bx, &by, &gy, &threads, &block_size) == 5)
+       { config->block_dim_x = bx;
+         config->block_dim_y = by;
+         config->grid_dim_y = gy;
+         config->cpu_threads = threads;
+         config->cpu_block_size = block_size;
+         found = 1;
+       }
+  fclose (fp);
+  return found;
+}
+
+/* replace (or add) the line of the tuning file for config */
+
+static inline void save_tuning (const char *file_name, const char *program, const char *device_name, const sector_config_t *config)
+{
+  char key[1024], line[1024], temporary_name[4096];
+  size_t key_length;
+  FILE *in, *out;
+
+  tuning_key (key, sizeof (key), program, device_name, config);
+  key_length = strlen (key);
+  snprintf (temporary_name, sizeof (temporary_name), "%s.tmp", file_name);
+  if ((out = fopen (temporary_name, "w")) == NULL)
+     { perror (temporary_name);
+       exit (1);
+     }
+  if ((in = fopen (file_name, "r")) != NULL)
+     { while (fgets (line, sizeof (line), in) != NULL)
+         if (strncmp (line, key, key_length) != 0 || line[key_length] != ' ')
+            fputs (line, out);
+       fclose (in);
+     }
+  fprintf (out, "%s %u %u %u %d %u\n", key, config->block_dim_x, config->block_dim_y, config->grid_dim_y, config->cpu_threads,
+           config->cpu_block_size);
+  if (fclose (out) != 0 || rename (temporary_name, file_name) != 0)
+     { perror (file_name);
+       exit (1);
+     }
+}
+
+/* try blocks of 32 up to MAX_BLOCK_THREADS threads in every shape, then a few grid heights for the fastest one */
+
+static inline double sweep_launch_geometry (sector_config_t *config, sector_timer_t time_launch, void *context)
+{
+  sector_config_t candidate, best;
+  unsigned int threads, bx, gy;
+  double dt, best_dt;
+
+  candidate = best = *config;
+  best_dt = -1.0;
+  candidate.grid_dim_y = 1u;
+  for (threads = 32u; threads <= MAX_BLOCK_THREADS; threads <<= 1)
+    for (bx = 1u; bx <= threads; bx <<= 1)
+    { candidate.block_dim_x = bx;
+      candidate.block_dim_y = threads / bx;
+      dt = time_launch (context, &candidate);
+      printf ("  <<<(%u,%u,1), (%u,%u,1)>>> %.3e seconds\n", grid_dim_x (&candidate), candidate.grid_dim_y, candidate.block_dim_x,
+              candidate.block_dim_y, dt);
+      if (best_dt < 0.0 || dt < best_dt)
+         { best = candidate;
+           best_dt = dt;
+         }
+    }
+  candidate = best;
+  for (gy = 2u; gy <= 64u; gy <<= 2)
+  { candidate.grid_dim_y = gy;
+    dt = time_launch (context, &candidate);
+    printf ("  <<<(%u,%u,1), (%u,%u,1)>>> %.3e seconds\n", grid_dim_x (&candidate), candidate.grid_dim_y, candidate.block_dim_x,
+            candidate.block_dim_y, dt);
+    if (dt < best_dt)
+       { best = candidate;
+         best_dt = dt;
+       }
+  }
+  config->block_dim_x = best.block_dim_x;
+  config->block_dim_y = best.block_dim_y;
+  config->grid_dim_y = best.grid_dim_y;
+  return best_dt;
+}
+
+/* try 1, 2, 4, ... and max_threads threads with blocks of 64 KiB up to 16 MiB */
+
+static inline double sweep_cpu_engine (sector_config_t *config, int max_threads, sector_timer_t time_engine, void *context)
+{
+  sector_config_t candidate, best;
+  unsigned int block_size;
+  double dt, best_dt;
+  int threads;
+
+  candidate = best = *config;
+  best_dt = -1.0;
+  for (block_size = 1u << 16; block_size <= (1u << 24); block_size <<= 2)
+    for (threads = 1; threads <= max_threads; threads = (threads < max_threads && 2 * threads > max_threads) ? max_threads : 2 * threads)
+    { candidate.cpu_block_size = block_size;
+      candidate.cpu_threads = threads;
+      dt = time_engine (context, &candidate);
+      printf ("  %d thread%s, blocks of %u KiB %.3e seconds\n", threads, (threads == 1) ? "" : "s", block_size >> 10, dt);
+      if (best_dt < 0.0 || dt < best_dt)
+         { best = candidate;
+           best_dt = dt;
+         }
+    }
+  config->cpu_threads = best.cpu_threads;
+  config->cpu_block_size = best.cpu_block_size;
+  return best_dt;
+}
+
+#endif
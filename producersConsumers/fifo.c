@@ -11,7 +11,9 @@
  *
  *  Definition of the operations carried out by the producers / consumers:
  *     \li putVal
- *     \li getVal.
+ *     \li getVal
+ *     \li putVals
+ *     \li getVals.
  *
  *  \author António Rui Borges - March 2019
  */
@@ -24,6 +26,7 @@
 #include <errno.h>
 
 #include "probConst.h"
+#include "latency.h"
 
 /** \brief producer threads return status array */
 extern int statusProd[N];
@@ -89,6 +92,7 @@ void putVal (unsigned int prodId, unsigned int val)
        pthread_exit (&statusProd[prodId]);
      }
   pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
 
   while (full)                                                           /* wait if the data transfer region is full */
   { if ((statusProd[prodId] = pthread_cond_wait (&fifoFull, &accessCR)) != 0)
@@ -99,6 +103,9 @@ void putVal (unsigned int prodId, unsigned int val)
        }
   }
 
+  LATENCY_STAMP (waited);
+  LATENCY_BETWEEN (LATENCY_ENQUEUE_WAIT, entered, waited);
+
   mem[ii] = val;                                                                          /* store value in the FIFO */
   ii = (ii + 1) % K;
   full = (ii == ri);
@@ -111,6 +118,7 @@ void putVal (unsigned int prodId, unsigned int val)
        pthread_exit (&statusProd[prodId]);
      }
 
+  LATENCY_SINCE (LATENCY_HOLD, waited);
   if ((statusProd[prodId] = pthread_mutex_unlock (&accessCR)) != 0)                                  /* exit monitor */
      { errno = statusProd[prodId];                                                            /* save error in errno */
        perror ("error on exiting monitor(CF)");
@@ -140,6 +148,7 @@ unsigned int getVal (unsigned int consId)
        pthread_exit (&statusCons[consId]);
      }
   pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
 
   while ((ii == ri) && !full)                                           /* wait if the data transfer region is empty */
   { if ((statusCons[consId] = pthread_cond_wait (&fifoEmpty, &accessCR)) != 0)
@@ -150,6 +159,9 @@ unsigned int getVal (unsigned int consId)
        }
   }
 
+  LATENCY_STAMP (waited);
+  LATENCY_BETWEEN (LATENCY_DEQUEUE_WAIT, entered, waited);
+
   val = mem[ri];                                                                   /* retrieve a  value from the FIFO */
   ri = (ri + 1) % K;
   full = false;
@@ -162,6 +174,7 @@ unsigned int getVal (unsigned int consId)
        pthread_exit (&statusCons[consId]);
      }
 
+  LATENCY_SINCE (LATENCY_HOLD, waited);
   if ((statusCons[consId] = pthread_mutex_unlock (&accessCR)) != 0)                                   /* exit monitor */
      { errno = statusCons[consId];                                                             /* save error in errno */
        perror ("error on exiting monitor(CF)");
@@ -171,3 +184,136 @@ unsigned int getVal (unsigned int consId)
 
   return val;
 }
+
+/**
+ *  \brief Store several values in the data transfer region.
+ *
+ *  Operation carried out by the producers.
+ *  It waits until there is room for at least one value and stores as many of them as there is room for, all at once.
+ *
+ *  \param prodId producer identification
+ *  \param vals values to be stored
+ *  \param n number of values to be stored
+ *
+ *  \return number of values stored, from the first one on (at least one, if n is not 0)
+ */
+
+unsigned int putVals (unsigned int prodId, const unsigned int *vals, unsigned int n)
+{
+  unsigned int stored;                                                                     /* number of values stored */
+
+  if (n == 0)
+     return 0;
+
+  if ((statusProd[prodId] = pthread_mutex_lock (&accessCR)) != 0)                                   /* enter monitor */
+     { errno = statusProd[prodId];                                                            /* save error in errno */
+       perror ("error on entering monitor(CF)");
+       statusProd[prodId] = EXIT_FAILURE;
+       pthread_exit (&statusProd[prodId]);
+     }
+  pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
+
+  while (full)                                                           /* wait if the data transfer region is full */
+  { if ((statusProd[prodId] = pthread_cond_wait (&fifoFull, &accessCR)) != 0)
+       { errno = statusProd[prodId];                                                          /* save error in errno */
+         perror ("error on waiting in fifoFull");
+         statusProd[prodId] = EXIT_FAILURE;
+         pthread_exit (&statusProd[prodId]);
+       }
+  }
+
+  LATENCY_STAMP (waited);
+  LATENCY_BETWEEN (LATENCY_ENQUEUE_WAIT, entered, waited);
+
+  for (stored = 0; (stored < n) && !full; stored++)                     /* store as many values as there is room for */
+  { mem[ii] = vals[stored];
+    ii = (ii + 1) % K;
+    full = (ii == ri);
+  }
+
+  if ((statusProd[prodId] = ((stored == 1) ? pthread_cond_signal (&fifoEmpty)         /* let the consumers know that */
+                                           : pthread_cond_broadcast (&fifoEmpty))) != 0)       /* values were stored */
+     { errno = statusProd[prodId];                                                             /* save error in errno */
+       perror ("error on signaling in fifoEmpty");
+       statusProd[prodId] = EXIT_FAILURE;
+       pthread_exit (&statusProd[prodId]);
+     }
+
+  LATENCY_SINCE (LATENCY_HOLD, waited);
+  if ((statusProd[prodId] = pthread_mutex_unlock (&accessCR)) != 0)                                  /* exit monitor */
+     { errno = statusProd[prodId];                                                            /* save error in errno */
+       perror ("error on exiting monitor(CF)");
+       statusProd[prodId] = EXIT_FAILURE;
+       pthread_exit (&statusProd[prodId]);
+     }
+
+  return stored;
+}
+
+/**
+ *  \brief Get several values from the data transfer region.
+ *
+ *  Operation carried out by the consumers.
+ *  It waits until there is at least one value and retrieves as many of them as there are, up to max, all at once.
+ *
+ *  \param consId consumer identification
+ *  \param vals array where the retrieved values are stored
+ *  \param max most values to be retrieved
+ *
+ *  \return number of values retrieved (at least one, if max is not 0)
+ */
+
+unsigned int getVals (unsigned int consId, unsigned int *vals, unsigned int max)
+{
+  unsigned int retrieved;                                                               /* number of values retrieved */
+
+  if (max == 0)
+     return 0;
+
+  if ((statusCons[consId] = pthread_mutex_lock (&accessCR)) != 0)                                   /* enter monitor */
+     { errno = statusCons[consId];                                                            /* save error in errno */
+       perror ("error on entering monitor(CF)");
+       statusCons[consId] = EXIT_FAILURE;
+       pthread_exit (&statusCons[consId]);
+     }
+  pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
+
+  while ((ii == ri) && !full)                                           /* wait if the data transfer region is empty */
+  { if ((statusCons[consId] = pthread_cond_wait (&fifoEmpty, &accessCR)) != 0)
+       { errno = statusCons[consId];                                                          /* save error in errno */
+         perror ("error on waiting in fifoEmpty");
+         statusCons[consId] = EXIT_FAILURE;
+         pthread_exit (&statusCons[consId]);
+       }
+  }
+
+  LATENCY_STAMP (waited);
+  LATENCY_BETWEEN (LATENCY_DEQUEUE_WAIT, entered, waited);
+
+  retrieved = 0;                                                  /* retrieve as many values as there are, up to max */
+  do
+  { vals[retrieved++] = mem[ri];
+    ri = (ri + 1) % K;
+  } while ((retrieved < max) && (ri != ii));
+  full = false;
+
+  if ((statusCons[consId] = ((retrieved == 1) ? pthread_cond_signal (&fifoFull)       /* let the producers know that */
+                                              : pthread_cond_broadcast (&fifoFull))) != 0)  /* values were retrieved */
+     { errno = statusCons[consId];                                                             /* save error in errno */
+       perror ("error on signaling in fifoFull");
+       statusCons[consId] = EXIT_FAILURE;
+       pthread_exit (&statusCons[consId]);
+     }
+
+  LATENCY_SINCE (LATENCY_HOLD, waited);
+  if ((statusCons[consId] = pthread_mutex_unlock (&accessCR)) != 0)                                   /* exit monitor */
+     { errno = statusCons[consId];                                                             /* save error in errno */
+       perror ("error on exiting monitor(CF)");
+       statusCons[consId] = EXIT_FAILURE;
+       pthread_exit (&statusCons[consId]);
+     }
+
+  return retrieved;
+}
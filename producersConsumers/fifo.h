@@ -11,7 +11,9 @@
  *
  *  Definition of the operations carried out by the producers / consumers:
  *     \li putVal
- *     \li getVal.
+ *     \li getVal
+ *     \li putVals
+ *     \li getVals.
  *
  *  \author António Rui Borges - March 2019
  */
@@ -42,4 +44,34 @@ extern void putVal (unsigned int prodId, unsigned int val);
 
 extern unsigned int getVal (unsigned int consId);
 
+/**
+ *  \brief Store several values in the data transfer region.
+ *
+ *  Operation carried out by the producers.
+ *  It waits until there is room for at least one value and stores as many of them as there is room for, all at once.
+ *
+ *  \param prodId producer identification
+ *  \param vals values to be stored
+ *  \param n number of values to be stored
+ *
+ *  \return number of values stored, from the first one on (at least one, if n is not 0)
+ */
+
+extern unsigned int putVals (unsigned int prodId, const unsigned int *vals, unsigned int n);
+
+/**
+ *  \brief Get several values from the data transfer region.
+ *
+ *  Operation carried out by the consumers.
+ *  It waits until there is at least one value and retrieves as many of them as there are, up to max, all at once.
+ *
+ *  \param consId consumer identification
+ *  \param vals array where the retrieved values are stored
+ *  \param max most values to be retrieved
+ *
+ *  \return number of values retrieved (at least one, if max is not 0)
+ */
+
+extern unsigned int getVals (unsigned int consId, unsigned int *vals, unsigned int max);
+
 #endif /* FIFO_H */
@@ -0,0 +1,273 @@
+/**
+ *  \file fifoBench.c (implementation file)
+ *
+ *  \brief Problem name: Producers / Consumers.
+ *
+ *  Benchmark of the data transfer region.
+ *  For n = 1, 2, 4, ... N, n producers and n consumers exchange values as fast as they can, one at a time with putVal
+ *  and getVal or in batches with putVals and getVals; the number of values transferred per second and the median and
+ *  99th percentile of the time taken by a call (one call in LAT_SAMPLE is timed) are reported, and the values consumed
+ *  are checked against the ones produced.
+ *
+ *  Linked with fifo.c it measures the monitor, with fifoLockFree.c the lock-free ring; fifoBench.sh builds and runs
+ *  both for several values of K.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "probConst.h"
+#include "fifo.h"
+
+/** \brief name of the implementation of the data transfer region */
+#ifndef FIFO_NAME
+#define  FIFO_NAME   "fifo"
+#endif
+
+/** \brief default number of values stored by each producer */
+#define  ITEMS       100000
+
+/** \brief one call in LAT_SAMPLE is timed */
+#define  LAT_SAMPLE  16
+
+/** \brief default batch size compared with the single value operations */
+#define  BATCH       16
+
+/** \brief most batch sizes of a run */
+#define  MAX_BATCHES 16
+
+/** \brief producer threads return status array */
+int statusProd[N];
+
+/** \brief consumer threads return status array */
+int statusCons[N];
+
+/** \brief state of a producer or consumer thread */
+typedef struct
+{ unsigned int id;                                                                                      /* thread id */
+  unsigned int items;                                                                /* number of values to transfer */
+  unsigned int batch;                                                   /* most values per call, 1 for putVal / getVal */
+  unsigned long long sum;                                                              /* sum of the values consumed */
+  double *lat;                                                                     /* sampled call times, in seconds */
+  unsigned int nLat;                                                                 /* number of sampled call times */
+} WORKER;
+
+/** \brief synchronization point for the start of a run */
+static pthread_barrier_t start;
+
+/**
+ *  \brief Current time, in seconds.
+ */
+
+static double now (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + 1.0e-9 * (double) t.tv_nsec;
+}
+
+/**
+ *  \brief Producer life cycle: store its values as fast as it can.
+ *
+ *  \param par pointer to the producer state
+ */
+
+static void *producer (void *par)
+{
+  WORKER *w = (WORKER *) par;
+  unsigned int *vals = (unsigned int *) malloc (w->batch * sizeof (unsigned int));
+  unsigned int i, j, n, calls;
+  double t0;
+
+  pthread_barrier_wait (&start);
+  for (i = calls = 0; i < w->items; i += n, calls++)
+  { t0 = (calls % LAT_SAMPLE == 0) ? now () : 0.0;
+    if (w->batch == 1)
+       { putVal (w->id, w->id * w->items + i);
+         n = 1;
+       }
+       else { n = (w->items - i < w->batch) ? w->items - i : w->batch;
+              for (j = 0; j < n; j++)
+                vals[j] = w->id * w->items + i + j;
+              n = putVals (w->id, vals, n);
+            }
+    if (calls % LAT_SAMPLE == 0)
+       w->lat[w->nLat++] = now () - t0;
+  }
+  free (vals);
+  statusProd[w->id] = EXIT_SUCCESS;
+  return &statusProd[w->id];
+}
+
+/**
+ *  \brief Consumer life cycle: retrieve its share of the values as fast as it can.
+ *
+ *  \param par pointer to the consumer state
+ */
+
+static void *consumer (void *par)
+{
+  WORKER *w = (WORKER *) par;
+  unsigned int *vals = (unsigned int *) malloc (w->batch * sizeof (unsigned int));
+  unsigned int i, j, n, calls;
+  double t0;
+
+  pthread_barrier_wait (&start);
+  for (i = calls = 0; i < w->items; i += n, calls++)
+  { t0 = (calls % LAT_SAMPLE == 0) ? now () : 0.0;
+    if (w->batch == 1)
+       { w->sum += getVal (w->id);
+         n = 1;
+       }
+       else { n = getVals (w->id, vals, (w->items - i < w->batch) ? w->items - i : w->batch);
+              for (j = 0; j < n; j++)
+                w->sum += vals[j];
+            }
+    if (calls % LAT_SAMPLE == 0)
+       w->lat[w->nLat++] = now () - t0;
+  }
+  free (vals);
+  statusCons[w->id] = EXIT_SUCCESS;
+  return &statusCons[w->id];
+}
+
+static int compareDouble (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ *  \brief Merge the sampled call times of n threads and get two of their percentiles.
+ *
+ *  \param w thread states
+ *  \param n number of threads
+ *  \param p50 set to the median, in nanoseconds
+ *  \param p99 set to the 99th percentile, in nanoseconds
+ */
+
+static void percentiles (WORKER *w, unsigned int n, double *p50, double *p99)
+{
+  unsigned int i, total;
+  double *all;
+
+  for (i = total = 0; i < n; i++)
+    total += w[i].nLat;
+  all = (double *) malloc ((total + 1) * sizeof (double));
+  for (i = total = 0; i < n; i++)
+  { memcpy (&all[total], w[i].lat, w[i].nLat * sizeof (double));
+    total += w[i].nLat;
+  }
+  qsort (all, total, sizeof (double), compareDouble);
+  *p50 = (total == 0) ? 0.0 : 1.0e9 * all[total / 2];
+  *p99 = (total == 0) ? 0.0 : 1.0e9 * all[(unsigned int) (0.99 * (total - 1))];
+  free (all);
+}
+
+/**
+ *  \brief One run with n producers and n consumers.
+ *
+ *  \param n number of producers and of consumers
+ *  \param items number of values stored by each producer
+ *  \param batch most values per call, 1 for putVal / getVal
+ *
+ *  \return EXIT_SUCCESS if every value produced was consumed, EXIT_FAILURE otherwise
+ */
+
+static int run (unsigned int n, unsigned int items, unsigned int batch)
+{
+  pthread_t tIdProd[N], tIdCons[N];
+  WORKER prod[N], cons[N];
+  unsigned long long sum, expected;
+  double t0, dt, putP50, putP99, getP50, getP99;
+  unsigned int i;
+  int *status_p, status = EXIT_SUCCESS;
+
+  pthread_barrier_init (&start, NULL, 2 * n + 1);
+  for (i = 0; i < n; i++)
+  { prod[i].id = cons[i].id = i;
+    prod[i].items = cons[i].items = items;
+    prod[i].batch = cons[i].batch = batch;
+    prod[i].sum = cons[i].sum = 0;
+    prod[i].nLat = cons[i].nLat = 0;
+    prod[i].lat = (double *) malloc ((items / LAT_SAMPLE + 1) * sizeof (double));
+    cons[i].lat = (double *) malloc ((items / LAT_SAMPLE + 1) * sizeof (double));
+    if ((pthread_create (&tIdProd[i], NULL, producer, &prod[i]) != 0) ||
+        (pthread_create (&tIdCons[i], NULL, consumer, &cons[i]) != 0))
+       { perror ("error on creating thread");
+         exit (EXIT_FAILURE);
+       }
+  }
+  pthread_barrier_wait (&start);
+  t0 = now ();
+  for (i = 0; i < n; i++)
+  { if ((pthread_join (tIdProd[i], (void *) &status_p) != 0) || (*status_p != EXIT_SUCCESS) ||
+        (pthread_join (tIdCons[i], (void *) &status_p) != 0) || (*status_p != EXIT_SUCCESS))
+       { perror ("error on waiting for thread");
+         exit (EXIT_FAILURE);
+       }
+  }
+  dt = now () - t0;
+  pthread_barrier_destroy (&start);
+
+  for (i = 0, sum = 0; i < n; i++)
+    sum += cons[i].sum;
+  expected = (unsigned long long) n * items;
+  expected = expected * (expected - 1) / 2;
+  if (sum != expected)
+     { fprintf (stderr, "%s: the values consumed are not the ones produced\n", FIFO_NAME);
+       status = EXIT_FAILURE;
+     }
+  percentiles (prod, n, &putP50, &putP99);
+  percentiles (cons, n, &getP50, &getP99);
+  printf ("%-9s %6d %4u %6u %14.0f %10.0f %10.0f %10.0f %10.0f\n", FIFO_NAME, K, n, batch, (double) n * items / dt, putP50,
+          putP99, getP50, getP99);
+  for (i = 0; i < n; i++)
+  { free (prod[i].lat);
+    free (cons[i].lat);
+  }
+  return status;
+}
+
+/**
+ *  \brief Main thread.
+ *
+ *  Runs the benchmark for n = 1, 2, 4, ... N producers and consumers, with each batch size given (1 and BATCH by
+ *  default).
+ *  usage: fifoBench [values per producer [batch size ...]] | -h  (-h prints the header of the table only)
+ */
+
+int main (int argc, char *argv[])
+{
+  unsigned int items = ITEMS, batches[MAX_BATCHES] = { 1, BATCH }, nBatches = 2, n, b;
+  int status = EXIT_SUCCESS;
+
+  if ((argc > 1) && (strcmp (argv[1], "-h") == 0))
+     { printf ("%-9s %6s %4s %6s %14s %10s %10s %10s %10s\n", "fifo", "K", "N", "batch", "values/s", "put p50", "put p99",
+               "get p50", "get p99");
+       printf ("%-9s %6s %4s %6s %14s %10s %10s %10s %10s\n", "", "", "", "", "", "(ns)", "(ns)", "(ns)", "(ns)");
+       return EXIT_SUCCESS;
+     }
+  if ((argc > 1) && ((items = (unsigned int) atoi (argv[1])) == 0))
+     { fprintf (stderr, "usage: %s [values per producer [batch size ...]] | -h\n", argv[0]);
+       return EXIT_FAILURE;
+     }
+  if (argc > 2)
+     for (nBatches = 0; (nBatches < MAX_BATCHES) && ((int) nBatches + 2 < argc); nBatches++)
+       if ((batches[nBatches] = (unsigned int) atoi (argv[nBatches + 2])) == 0)
+          { fprintf (stderr, "usage: %s [values per producer [batch size ...]] | -h\n", argv[0]);
+            return EXIT_FAILURE;
+          }
+
+  for (b = 0; b < nBatches; b++)
+    for (n = 1; n <= N; n = (n < N && 2 * n > N) ? N : 2 * n)
+      if (run (n, items, batches[b]) != EXIT_SUCCESS)
+         status = EXIT_FAILURE;
+
+  return status;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Benchmark of the data transfer region: builds fifoBench with the monitor (fifo.c) and with the lock-free ring
+# (fifoLockFree.c) for each capacity K and runs both for 1, 2, 4, ... N producers / consumers, moving the values one at
+# a time and in batches of BATCH (16 by default).
+#
+# usage: [BATCH=b] fifoBench.sh [N [values per producer [K ...]]]
+#
+
+cd "$(dirname "$0")" || exit 1
+N=${1:-16}
+ITEMS=${2:-100000}
+[ $# -gt 2 ] && shift 2 && KS="$*" || KS="2 16 256 4096"
+BIN=$(mktemp -d) || exit 1
+trap 'rm -rf "$BIN"' EXIT
+
+STATUS=0
+cc -O2 -Wall -o "$BIN/header" fifoBench.c fifo.c -lpthread && "$BIN/header" -h || exit 1
+for K in $KS
+do
+  for FIFO in fifo fifoLockFree
+  do
+    NAME=$([ $FIFO = fifo ] && echo monitor || echo lockfree)
+    cc -O2 -Wall -DN="$N" -DK="$K" -DFIFO_NAME="\"$NAME\"" -o "$BIN/$NAME" fifoBench.c $FIFO.c -lpthread || exit 1
+    "$BIN/$NAME" "$ITEMS" 1 "${BATCH:-16}" || STATUS=1
+  done
+done
+exit $STATUS
@@ -0,0 +1,441 @@
+/**
+ *  \file fifoLockFree.c (implementation file)
+ *
+ *  \brief Problem name: Producers / Consumers.
+ *
+ *  Lock-free synchronization.
+ *  The data transfer region is a bounded ring shared by many producers and many consumers. Every slot carries a
+ *  sequence number which tells whether it is free for the producer of a given position or holds the value of that
+ *  position for its consumer, and producers and consumers claim positions by a compare-and-swap of the insertion and
+ *  retrieval counters.
+ *  A producer finding the region full (a consumer finding it empty) spins for a while, the number of tries adapting to
+ *  how often spinning was enough, and then blocks in a futex until a consumer (a producer) lets it know that a value
+ *  has been retrieved (stored).
+ *
+ *  It is a replacement of the monitor of fifo.c with the same interface: link the program with fifoLockFree.c instead.
+ *
+ *  Values are stored and retrieved in batches, putVal and getVal being batches of one value; the positions of a batch
+ *  are claimed by a single compare-and-swap.
+ *
+ *  Definition of the operations carried out by the producers / consumers:
+ *     \li putVal
+ *     \li getVal
+ *     \li putVals
+ *     \li getVals.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "probConst.h"
+#include "latency.h"
+
+/** \brief size of a cache line, the counters of the producers and of the consumers are kept in different ones */
+#define  CACHE_LINE      64
+
+/** \brief least number of tries spent spinning before blocking */
+#define  SPIN_MIN        16
+
+/** \brief most number of tries spent spinning before blocking */
+#define  SPIN_MAX      4096
+
+/** \brief producer threads return status array */
+extern int statusProd[N];
+
+/** \brief consumer threads return status array */
+extern int statusCons[N];
+
+/** \brief storage slot: position p may store in it when seq == 2 p and retrieve from it when seq == 2 p + 1, the
+ *  states of successive positions being kept apart even with a single slot (K = 1) */
+typedef struct
+{ _Atomic unsigned long long seq;                                                                 /* sequence number */
+  unsigned int val;                                                                                  /* stored value */
+} SLOT;
+
+/** \brief side of the data transfer region (producers or consumers) */
+typedef struct
+{ _Alignas (CACHE_LINE) _Atomic unsigned long long pos;                   /* next position to be claimed by the side */
+  _Atomic unsigned int event;                                        /* futex, changed whenever the side is signaled */
+  _Atomic unsigned int waiting;                                             /* number of threads of the side blocked */
+} SIDE;
+
+/** \brief storage region */
+static SLOT mem[K];
+
+/** \brief insertion side */
+static SIDE prodSide;
+
+/** \brief retrieval side */
+static SIDE consSide;
+
+/** \brief flag which warrants that the data transfer region is initialized exactly once */
+static pthread_once_t init = PTHREAD_ONCE_INIT;
+
+/** \brief number of tries the calling thread spins before blocking */
+static __thread unsigned int spinLimit = SPIN_MIN;
+
+/**
+ *  \brief Initialization of the data transfer region.
+ *
+ *  Internal operation.
+ */
+
+static void initialization (void)
+{
+  unsigned int i;                                                                               /* counting variable */
+
+  for (i = 0; i < K; i++)                                           /* slot i is free for the producer of position i */
+    atomic_store_explicit (&mem[i].seq, 2ull * i, memory_order_relaxed);
+  atomic_store_explicit (&prodSide.pos, 0, memory_order_relaxed);                          /* FIFO is in empty state */
+  atomic_store_explicit (&consSide.pos, 0, memory_order_relaxed);
+}
+
+/**
+ *  \brief Hint the processor that the calling thread is spinning.
+ *
+ *  Internal operation.
+ */
+
+static inline void cpuRelax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause ();
+#else
+  atomic_signal_fence (memory_order_seq_cst);
+#endif
+}
+
+/**
+ *  \brief Try to store several values in the data transfer region.
+ *
+ *  Internal operation. The positions of all the values stored are claimed at once, as many consecutive ones as there
+ *  are free slots for.
+ *
+ *  \param vals values to be stored
+ *  \param n number of values to be stored (at least one)
+ *
+ *  \return number of values stored, 0 if the data transfer region is full
+ */
+
+static unsigned int tryPutVals (const unsigned int *vals, unsigned int n)
+{
+  unsigned long long pos = atomic_load_explicit (&prodSide.pos, memory_order_relaxed);     /* first claimed position */
+  unsigned int m, j;                                            /* number of positions claimed and counting variable */
+  SLOT *slot;                                                                                    /* slot of position */
+  long long dif;                                                        /* how far ahead of the position the slot is */
+
+  for (;;)
+  { slot = &mem[pos % K];
+    dif = (long long) (atomic_load_explicit (&slot->seq, memory_order_acquire) - 2 * pos);
+    if (dif == 0)                                                    /* the slot is free: try to claim the positions */
+       { for (m = 1; (m < n) && (m < K) &&
+                     (atomic_load_explicit (&mem[(pos + m) % K].seq, memory_order_acquire) == 2 * (pos + m)); m++)
+           ;
+         if (atomic_compare_exchange_weak_explicit (&prodSide.pos, &pos, pos + m, memory_order_relaxed,
+                                                    memory_order_relaxed))
+            break;
+       }
+       else if (dif < 0)                               /* the slot still holds the value stored one lap before: full */
+               return 0;
+               else pos = atomic_load_explicit (&prodSide.pos, memory_order_relaxed);     /* another producer got it */
+  }
+
+  for (j = 0; j < m; j++)
+  { slot = &mem[(pos + j) % K];
+    slot->val = vals[j];                                                                  /* store value in the FIFO */
+    atomic_store_explicit (&slot->seq, 2 * (pos + j) + 1, memory_order_release);     /* hand it over to its consumer */
+  }
+  return m;
+}
+
+/**
+ *  \brief Try to get several values from the data transfer region.
+ *
+ *  Internal operation. The positions of all the values retrieved are claimed at once, as many consecutive ones as
+ *  there are values in, up to max.
+ *
+ *  \param vals array where the retrieved values are stored
+ *  \param max most values to be retrieved (at least one)
+ *
+ *  \return number of values retrieved, 0 if the data transfer region is empty
+ */
+
+static unsigned int tryGetVals (unsigned int *vals, unsigned int max)
+{
+  unsigned long long pos = atomic_load_explicit (&consSide.pos, memory_order_relaxed);     /* first claimed position */
+  unsigned int m, j;                                            /* number of positions claimed and counting variable */
+  SLOT *slot;                                                                                    /* slot of position */
+  long long dif;                                              /* how far ahead of the filled position the slot is */
+
+  for (;;)
+  { slot = &mem[pos % K];
+    dif = (long long) (atomic_load_explicit (&slot->seq, memory_order_acquire) - (2 * pos + 1));
+    if (dif == 0)                                                  /* the slot is filled: try to claim the positions */
+       { for (m = 1; (m < max) && (m < K) &&
+                     (atomic_load_explicit (&mem[(pos + m) % K].seq, memory_order_acquire) == 2 * (pos + m) + 1); m++)
+           ;
+         if (atomic_compare_exchange_weak_explicit (&consSide.pos, &pos, pos + m, memory_order_relaxed,
+                                                    memory_order_relaxed))
+            break;
+       }
+       else if (dif < 0)                                        /* the value of the position is not there yet: empty */
+               return 0;
+               else pos = atomic_load_explicit (&consSide.pos, memory_order_relaxed);     /* another consumer got it */
+  }
+
+  for (j = 0; j < m; j++)
+  { slot = &mem[(pos + j) % K];
+    vals[j] = slot->val;                                                           /* retrieve a value from the FIFO */
+    atomic_store_explicit (&slot->seq, 2 * (pos + j + K), memory_order_release);            /* free it one lap ahead */
+  }
+  return m;
+}
+
+/**
+ *  \brief Register the calling thread as about to block on a side.
+ *
+ *  Internal operation. The operation must be retried before blocking, a thread signaling the side after that is
+ *  bound to see the registration. A registration is withdrawn by the thread signaling the side, never by the thread
+ *  itself: one left behind by a thread which did not block costs a spurious wake up, one withdrawn by the thread
+ *  itself after another thread blocked would cost a lost one.
+ *
+ *  \param side side to block on
+ *
+ *  \return value of the futex to block on
+ */
+
+static unsigned int enterWait (SIDE *side)
+{
+  unsigned int event = atomic_load_explicit (&side->event, memory_order_seq_cst);
+
+  atomic_fetch_add_explicit (&side->waiting, 1, memory_order_seq_cst);
+  atomic_thread_fence (memory_order_seq_cst);
+  return event;
+}
+
+/**
+ *  \brief Block on a side until it is signaled.
+ *
+ *  Internal operation.
+ *
+ *  \param side side to block on
+ *  \param event value of the futex returned by enterWait
+ *
+ *  \return 0 on success, an error number otherwise
+ */
+
+static int waitSide (SIDE *side, unsigned int event)
+{
+  int status = 0;                                                                                /* execution status */
+
+  if ((syscall (SYS_futex, &side->event, FUTEX_WAIT_PRIVATE, event, NULL, NULL, 0) == -1) && (errno != EAGAIN) &&
+      (errno != EINTR))
+     status = errno;
+  return status;
+}
+
+/**
+ *  \brief Wake up to n threads blocked on a side, if there are any.
+ *
+ *  Internal operation. The registrations of the threads are withdrawn here, so that the threads signaling the side
+ *  before they get to run do not wake them up again.
+ *
+ *  \param side side to be signaled
+ *  \param n most threads to wake up (the number of values stored or retrieved)
+ *
+ *  \return 0 on success, an error number otherwise
+ */
+
+static int signalSide (SIDE *side, unsigned int n)
+{
+  unsigned int waiting;                                                           /* number of threads registered */
+  unsigned int woken;                                                              /* number of threads woken up */
+
+  atomic_thread_fence (memory_order_seq_cst);                          /* order the hand over before the check below */
+  waiting = atomic_load_explicit (&side->waiting, memory_order_relaxed);
+  do
+  { if (waiting == 0)
+       return 0;
+    woken = (waiting < n) ? waiting : n;
+  } while (!atomic_compare_exchange_weak_explicit (&side->waiting, &waiting, waiting - woken, memory_order_relaxed,
+                                                   memory_order_relaxed));
+  atomic_fetch_add_explicit (&side->event, 1, memory_order_seq_cst);
+  if (syscall (SYS_futex, &side->event, FUTEX_WAKE_PRIVATE, woken, NULL, NULL, 0) == -1)
+     return errno;
+  return 0;
+}
+
+/**
+ *  \brief Adapt the number of tries spent spinning.
+ *
+ *  Internal operation. Spinning longer pays off when it was enough the last time, blocking earlier otherwise.
+ *
+ *  \param spinning true if spinning was enough
+ */
+
+static inline void adaptSpin (bool spinning)
+{
+  if (spinning)
+     { if (spinLimit < SPIN_MAX)
+          spinLimit *= 2;
+     }
+     else if (spinLimit > SPIN_MIN)
+             spinLimit /= 2;
+}
+
+/**
+ *  \brief Store several values in the data transfer region.
+ *
+ *  Operation carried out by the producers.
+ *  It waits until there is room for at least one value and stores as many of them as there is room for, all at once.
+ *
+ *  \param prodId producer identification
+ *  \param vals values to be stored
+ *  \param n number of values to be stored
+ *
+ *  \return number of values stored, from the first one on (at least one, if n is not 0)
+ */
+
+unsigned int putVals (unsigned int prodId, const unsigned int *vals, unsigned int n)
+{
+  unsigned int stored;                                                                    /* number of values stored */
+  unsigned int spin;                                                                            /* counting variable */
+  unsigned int event;                                                                          /* value of the futex */
+  bool done;                                                                                  /* spinning was enough */
+
+  if (n == 0)
+     return 0;
+  pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
+
+  if ((stored = tryPutVals (vals, n)) == 0)                              /* wait if the data transfer region is full */
+     { for (spin = 0; (spin < spinLimit) && ((stored = tryPutVals (vals, n)) == 0); spin++)
+         cpuRelax ();
+       done = (spin < spinLimit);
+       adaptSpin (done);
+       if (!done)
+          for (;;)
+          { event = enterWait (&prodSide);
+            if ((stored = tryPutVals (vals, n)) != 0)
+               break;
+            if ((statusProd[prodId] = waitSide (&prodSide, event)) != 0)
+               { errno = statusProd[prodId];                                                  /* save error in errno */
+                 perror ("error on waiting in fifoFull");
+                 statusProd[prodId] = EXIT_FAILURE;
+                 pthread_exit (&statusProd[prodId]);
+               }
+            if ((stored = tryPutVals (vals, n)) != 0)
+               break;
+          }
+     }
+
+  LATENCY_SINCE (LATENCY_ENQUEUE_WAIT, entered);                         /* the wait includes the store, there being */
+                                                                                               /* no monitor to hold */
+  if ((statusProd[prodId] = signalSide (&consSide, stored)) != 0)              /* let the consumers know that values */
+                                                                                                 /* have been stored */
+     { errno = statusProd[prodId];                                                            /* save error in errno */
+       perror ("error on signaling in fifoEmpty");
+       statusProd[prodId] = EXIT_FAILURE;
+       pthread_exit (&statusProd[prodId]);
+     }
+
+  return stored;
+}
+
+/**
+ *  \brief Get several values from the data transfer region.
+ *
+ *  Operation carried out by the consumers.
+ *  It waits until there is at least one value and retrieves as many of them as there are, up to max, all at once.
+ *
+ *  \param consId consumer identification
+ *  \param vals array where the retrieved values are stored
+ *  \param max most values to be retrieved
+ *
+ *  \return number of values retrieved (at least one, if max is not 0)
+ */
+
+unsigned int getVals (unsigned int consId, unsigned int *vals, unsigned int max)
+{
+  unsigned int retrieved;                                                              /* number of values retrieved */
+  unsigned int spin;                                                                            /* counting variable */
+  unsigned int event;                                                                          /* value of the futex */
+  bool done;                                                                                  /* spinning was enough */
+
+  if (max == 0)
+     return 0;
+  pthread_once (&init, initialization);                                              /* internal data initialization */
+  LATENCY_STAMP (entered);
+
+  if ((retrieved = tryGetVals (vals, max)) == 0)                        /* wait if the data transfer region is empty */
+     { for (spin = 0; (spin < spinLimit) && ((retrieved = tryGetVals (vals, max)) == 0); spin++)
+         cpuRelax ();
+       done = (spin < spinLimit);
+       adaptSpin (done);
+       if (!done)
+          for (;;)
+          { event = enterWait (&consSide);
+            if ((retrieved = tryGetVals (vals, max)) != 0)
+               break;
+            if ((statusCons[consId] = waitSide (&consSide, event)) != 0)
+               { errno = statusCons[consId];                                                  /* save error in errno */
+                 perror ("error on waiting in fifoEmpty");
+                 statusCons[consId] = EXIT_FAILURE;
+                 pthread_exit (&statusCons[consId]);
+               }
+            if ((retrieved = tryGetVals (vals, max)) != 0)
+               break;
+          }
+     }
+
+  LATENCY_SINCE (LATENCY_DEQUEUE_WAIT, entered);                     /* the wait includes the retrieval, there being */
+                                                                                               /* no monitor to hold */
+  if ((statusCons[consId] = signalSide (&prodSide, retrieved)) != 0)           /* let the producers know that values */
+                                                                                              /* have been retrieved */
+     { errno = statusCons[consId];                                                            /* save error in errno */
+       perror ("error on signaling in fifoFull");
+       statusCons[consId] = EXIT_FAILURE;
+       pthread_exit (&statusCons[consId]);
+     }
+
+  return retrieved;
+}
+
+/**
+ *  \brief Store a value in the data transfer region.
+ *
+ *  Operation carried out by the producers.
+ *
+ *  \param prodId producer identification
+ *  \param val value to be stored
+ */
+
+void putVal (unsigned int prodId, unsigned int val)
+{
+  putVals (prodId, &val, 1);
+}
+
+/**
+ *  \brief Get a value from the data transfer region.
+ *
+ *  Operation carried out by the consumers.
+ *
+ *  \param consId consumer identification
+ *
+ *  \return value
+ */
+
+unsigned int getVal (unsigned int consId)
+{
+  unsigned int val;                                                                               /* retrieved value */
+
+  getVals (consId, &val, 1);
+  return val;
+}
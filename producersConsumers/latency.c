@@ -0,0 +1,227 @@
+/**
+ *  \file latency.c (implementation file)
+ *
+ *  \brief Problem name: Producers / Consumers.
+ *
+ *  Latency histograms of the data transfer region: how long the producers wait for it not to be full, how long the
+ *  consumers wait for it not to be empty and how long the monitor is held, the waits left out.
+ *
+ *  Definition of the operations:
+ *     \li latencyClock
+ *     \li recordLatency
+ *     \li printLatency.
+ */
+
+#ifdef LATENCY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "latency.h"
+
+/** \brief bits of the linear part of a bucket, 2^LATENCY_SUB_BITS buckets per power of two */
+#define  LATENCY_SUB_BITS      5
+
+/** \brief number of linear buckets per power of two */
+#define  LATENCY_SUB_BUCKETS   (1 << LATENCY_SUB_BITS)
+
+/** \brief number of buckets, enough for any latency up to 2^63 ns */
+#define  LATENCY_BUCKETS       (LATENCY_SUB_BUCKETS * (64 - LATENCY_SUB_BITS))
+
+/** \brief histograms of a thread */
+typedef struct histograms
+{ long long counts[LATENCY_KINDS][LATENCY_BUCKETS];                  /* number of latencies in each bucket, per kind */
+  long long max[LATENCY_KINDS];                                                /* largest latency recorded, per kind */
+  long long sum[LATENCY_KINDS];                                           /* sum of the latencies recorded, per kind */
+  struct histograms *next;                                /* histograms of the thread which recorded before this one */
+} HISTOGRAMS;
+
+/** \brief names of the kinds of latency, as printed */
+static const char *kindNames[LATENCY_KINDS] = { "enqueue wait", "dequeue wait", "monitor hold" };
+
+/** \brief histograms of the calling thread, NULL until it records */
+static __thread HISTOGRAMS *own;
+
+/** \brief histograms of all threads */
+static HISTOGRAMS *all;
+
+/** \brief locking flag which warrants mutual exclusion while accessing the list of histograms */
+static pthread_mutex_t allAccess = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ *  \brief Get the histograms of the calling thread, allocating them the first time.
+ *
+ *  Internal operation.
+ *
+ *  \return histograms of the calling thread
+ */
+
+static HISTOGRAMS *ownHistograms (void)
+{
+  if (own == NULL)
+     { if ((own = (HISTOGRAMS *) calloc (1, sizeof (HISTOGRAMS))) == NULL)
+          { perror ("error on allocating latency histograms");
+            exit (EXIT_FAILURE);
+          }
+       pthread_mutex_lock (&allAccess);
+       own->next = all;
+       all = own;
+       pthread_mutex_unlock (&allAccess);
+     }
+  return own;
+}
+
+/**
+ *  \brief Get the bucket of a latency.
+ *
+ *  Internal operation. Latencies below 2 * LATENCY_SUB_BUCKETS have a bucket each, the ones above share buckets
+ *  1 / LATENCY_SUB_BUCKETS of their power of two wide.
+ *
+ *  \param value latency
+ *
+ *  \return index of the bucket
+ */
+
+static int bucketOf (long long value)
+{
+  unsigned long long v = (value < 0) ? 0 : (unsigned long long) value;
+  int shift;                                                                      /* bits below the linear part of v */
+
+  if (v < 2 * LATENCY_SUB_BUCKETS)
+     return (int) v;
+  shift = 63 - __builtin_clzll (v) - LATENCY_SUB_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + (int) (v >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/**
+ *  \brief Get the largest latency of a bucket.
+ *
+ *  Internal operation.
+ *
+ *  \param bucket index of the bucket
+ *
+ *  \return largest latency falling into it
+ */
+
+static long long bucketTop (int bucket)
+{
+  int shift;                                                             /* bits below the linear part of the bucket */
+
+  if (bucket < 2 * LATENCY_SUB_BUCKETS)
+     return bucket;
+  shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return ((long long) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+/**
+ *  \brief Get a percentile of a merged histogram.
+ *
+ *  Internal operation.
+ *
+ *  \param counts number of latencies in each bucket
+ *  \param total number of latencies
+ *  \param max largest latency
+ *  \param percentile percentile wanted, from 0 to 100
+ *
+ *  \return largest latency of the bucket the percentile falls into
+ */
+
+static long long valueAt (const long long *counts, long long total, long long max, double percentile)
+{
+  long long wanted = (long long) (percentile / 100.0 * total + 0.5),                       /* rank of the percentile */
+            seen = 0;                                                     /* number of latencies in the buckets seen */
+  int b;                                                                                        /* counting variable */
+
+  if (wanted < 1)
+     wanted = 1;
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    if ((seen += counts[b]) >= wanted)
+       return (bucketTop (b) < max) ? bucketTop (b) : max;
+  return max;
+}
+
+/**
+ *  \brief Get the current time.
+ *
+ *  \return nanoseconds since an arbitrary origin
+ */
+
+long long latencyClock (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/**
+ *  \brief Record a latency in the histogram of the calling thread.
+ *
+ *  \param kind what was measured
+ *  \param nanoseconds latency
+ */
+
+void recordLatency (LATENCY_KIND kind, long long nanoseconds)
+{
+  HISTOGRAMS *h = ownHistograms ();
+
+  h->counts[kind][bucketOf (nanoseconds)] += 1;
+  h->sum[kind] += nanoseconds;
+  if (nanoseconds > h->max[kind])
+     h->max[kind] = nanoseconds;
+}
+
+/**
+ *  \brief Merge the histograms of all threads and print their percentiles.
+ *
+ *  It must be called once every thread has stopped recording.
+ */
+
+void printLatency (void)
+{
+  static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+  static long long counts[LATENCY_BUCKETS];                                                      /* merged histogram */
+  long long total, sum, max;
+  HISTOGRAMS *h;
+  int k, b, p;                                                                                 /* counting variables */
+
+  pthread_mutex_lock (&allAccess);
+
+  printf ("\n%-14s %10s %12s %12s %12s %12s %12s %12s\n", "Latency (ns)", "count", "mean", "p50", "p90", "p99",
+          "p99.9", "max");
+  for (k = 0; k < LATENCY_KINDS; k++)
+  { memset (counts, 0, sizeof (counts));
+    total = sum = max = 0;
+    for (h = all; h != NULL; h = h->next)
+    { for (b = 0; b < LATENCY_BUCKETS; b++)
+      { counts[b] += h->counts[k][b];
+        total += h->counts[k][b];
+      }
+      sum += h->sum[k];
+      if (h->max[k] > max)
+         max = h->max[k];
+    }
+    if (total == 0)                                               /* not measured by this implementation of the FIFO */
+       { printf ("%-14s %10s   nothing recorded\n", kindNames[k], "0");
+         continue;
+       }
+    printf ("%-14s %10lld %12.0f", kindNames[k], total, (double) sum / total);
+    for (p = 0; p < (int) (sizeof (percentiles) / sizeof (percentiles[0])); p++)
+      printf (" %12lld", valueAt (counts, total, max, percentiles[p]));
+    printf (" %12lld\n", max);
+  }
+
+  own = NULL;
+  while (all != NULL)
+  { h = all->next;
+    free (all);
+    all = h;
+  }
+
+  pthread_mutex_unlock (&allAccess);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ *  \file latency.h (interface file)
+ *
+ *  \brief Problem name: Producers / Consumers.
+ *
+ *  Latency histograms of the data transfer region: how long the producers wait for it not to be full, how long the
+ *  consumers wait for it not to be empty and how long the monitor is held, the waits left out.
+ *
+ *  Only compiled in with -DLATENCY, otherwise every macro expands to nothing.
+ *  Each thread records into histograms of its own, allocated the first time it records, with buckets growing
+ *  logarithmically and split linearly in LATENCY_SUB_BUCKETS (HDR style, about 3% of precision from a nanosecond up).
+ *  The histograms of all threads are merged and printed as percentiles at the end of the simulation.
+ *  The lock-free FIFO has no monitor: its waits include the store or the retrieval and it records no hold.
+ *
+ *  Definition of the operations:
+ *     \li latencyClock
+ *     \li recordLatency
+ *     \li printLatency.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#ifdef LATENCY
+
+/** \brief what is measured */
+typedef enum
+{ LATENCY_ENQUEUE_WAIT,                                              /* time a producer waits while the FIFO is full */
+  LATENCY_DEQUEUE_WAIT,                                             /* time a consumer waits while the FIFO is empty */
+  LATENCY_HOLD,                                                  /* time the monitor is held, not counting the waits */
+  LATENCY_KINDS
+} LATENCY_KIND;
+
+/**
+ *  \brief Get the current time.
+ *
+ *  \return nanoseconds since an arbitrary origin
+ */
+
+extern long long latencyClock (void);
+
+/**
+ *  \brief Record a latency in the histogram of the calling thread.
+ *
+ *  \param kind what was measured
+ *  \param nanoseconds latency
+ */
+
+extern void recordLatency (LATENCY_KIND kind, long long nanoseconds);
+
+/**
+ *  \brief Merge the histograms of all threads and print their percentiles.
+ *
+ *  It must be called once every thread has stopped recording.
+ */
+
+extern void printLatency (void);
+
+#define  LATENCY_STAMP(name)              long long name = latencyClock ()
+#define  LATENCY_BETWEEN(kind, from, to)  recordLatency (kind, (to) - (from))
+#define  LATENCY_SINCE(kind, from)        recordLatency (kind, latencyClock () - (from))
+#define  LATENCY_REPORT()                 printLatency ()
+
+#else
+
+#define  LATENCY_STAMP(name)
+#define  LATENCY_BETWEEN(kind, from, to)
+#define  LATENCY_SINCE(kind, from)
+#define  LATENCY_REPORT()
+
+#endif
+
+#endif                                                                                                  /* LATENCY_H */
@@ -14,13 +14,22 @@
 /* Generic parameters */
 
 /** \brief number of producers / consumers */
+#ifndef N
 #define  N           10
+#endif
 
 /** \brief data transfer region nominal capacity (in number of values that can be stored) */
+#ifndef K
 #define  K            2
+#endif
 
 /** \brief number of iterations of the life cycle */
 #define  M           10
 
+/** \brief most values stored / retrieved at once */
+#ifndef B
+#define  B            4
+#endif
+
 
 #endif /* PROBCONST_H_ */
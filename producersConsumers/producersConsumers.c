@@ -22,6 +22,7 @@
 
 #include "probConst.h"
 #include "fifo.h"
+#include "latency.h"
 
 /** \brief producer threads return status array */
 int statusProd[N];
@@ -97,6 +98,7 @@ int main (void)
   }
   t1 = ((double) clock ()) / CLOCKS_PER_SEC;
   printf ("\nElapsed time = %.6f s\n", t1 - t0);
+  LATENCY_REPORT ();                                                /* print the latency percentiles, if compiled in */
 
   exit (EXIT_SUCCESS);
 }
@@ -112,12 +114,16 @@ int main (void)
 static void *producer (void *par)
 {
   unsigned int id = *((unsigned int *) par),                                                          /* producer id */
-               val;                                                                                /* produced value */
+               vals[B],                                                                  /* batch of produced values */
+               n,                                                                   /* number of values in the batch */
+               stored;                                                       /* number of values of the batch stored */
   int i;                                                                                        /* counting variable */
 
-  for (i = 0; i < M; i++)
-  { val = 1000 * id + i;                                                                          /* produce a value */
-    putVal (id, val);                                                                               /* store a value */
+  for (i = 0; i < M; i += n)
+  { for (n = 0; (n < B) && (i + n < M); n++)
+      vals[n] = 1000 * id + i + n;                                                      /* produce a batch of values */
+    for (stored = 0; stored < n; )
+      stored += putVals (id, &vals[stored], n - stored);                     /* store them, as room is made for them */
     usleep((unsigned int) floor (40.0 * random () / RAND_MAX + 1.5));                           /* do something else */
   }
 
@@ -136,14 +142,17 @@ static void *producer (void *par)
 static void *consumer (void *par)
 {
   unsigned int id = *((unsigned int *) par),                                                          /* consumer id */
-               val;                                                                                /* produced value */
+               vals[B],                                                                 /* batch of retrieved values */
+               n,                                                                   /* number of values in the batch */
+               j;                                                                               /* counting variable */
   int i;                                                                                        /* counting variable */
 
-  for (i = 0; i < M; i++)
+  for (i = 0; i < M; i += n)
   { usleep((unsigned int) floor (40.0 * random () / RAND_MAX + 1.5));                           /* do something else */
-    val = getVal (id);                                                                           /* retrieve a value */
-    printf ("The value %u was produced by the thread P%u and consumed by the thread C%u.\n",      /* consume a value */
-            val % 1000, val / 1000, id);
+    n = getVals (id, vals, (M - i < B) ? M - i : B);                 /* retrieve the values there are, up to a batch */
+    for (j = 0; j < n; j++)
+      printf ("The value %u was produced by the thread P%u and consumed by the thread C%u.\n",    /* consume a value */
+              vals[j] % 1000, vals[j] / 1000, id);
   }
 
   statusCons[id] = EXIT_SUCCESS;